@@ -7,6 +7,7 @@
 # Test REST interface
 #
 
+from test_framework.mininode import CBlock
 from test_framework.test_framework import BitcoinTestFramework
 from test_framework.util import assert_equal, assert_greater_than, \
     start_nodes, connect_nodes_bi
@@ -243,6 +244,16 @@ class RESTTest (BitcoinTestFramework):
         response_hex_str = response_hex.read()
         assert_equal(encode(response_str, "hex_codec")[0:354], response_hex_str[0:354])
 
+        # the raw block is the serialized block, as getblock returns it
+        block_hex = self.nodes[0].getblock(bb_hash, 0)
+        assert_equal(encode(response_str, "hex_codec").decode('ascii'), block_hex)
+        assert_equal(response_hex_str.decode('ascii'), block_hex + "\n")
+        raw_block = CBlock()
+        raw_block.deserialize(BytesIO(response_str))
+        raw_block.rehash()
+        assert_equal(raw_block.hash, bb_hash)
+        assert_equal(raw_block.serialize(), response_str)
+
         # compare with hex block header
         response_header_hex = http_get_call(url.hostname, url.port, '/rest/headers/1/'+bb_hash+self.FORMAT_SEPARATOR+"hex", True)
         assert_equal(response_header_hex.status, 200)
@@ -0,0 +1,113 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockfilecache.h"
+
+#include <algorithm>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap((void*)pbegin, nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CMappedFile::Map(const fs::path& path)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (p == MAP_FAILED)
+        return nullptr;
+    return std::make_shared<const CMappedFile>((const char*)p, (size_t)st.st_size);
+#else
+    // Block files are read through stdio on Windows
+    return nullptr;
+#endif
+}
+
+void CMappedFile::WillNeed(size_t nPos, size_t nLen) const
+{
+#ifndef WIN32
+    if (nPos >= nSize)
+        return;
+    nLen = std::min(nLen, nSize - nPos);
+    // madvise needs a page-aligned address
+    static const size_t nPageSize = sysconf(_SC_PAGESIZE);
+    size_t nAligned = nPos - nPos % nPageSize;
+    madvise((void*)(pbegin + nAligned), nLen + (nPos - nAligned), MADV_WILLNEED);
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CBlockFileCache::Get(const fs::path& path, size_t nPos, size_t nSize)
+{
+    if (nMaxFiles == 0)
+        return nullptr;
+
+    LOCK(cs);
+    auto it = mapFiles.find(path);
+    if (it == mapFiles.end() || nPos + nSize > it->second.file->size()) {
+        // Either the file isn't mapped, or it has grown since it was
+        std::shared_ptr<const CMappedFile> file = CMappedFile::Map(path);
+        if (!file || nPos + nSize > file->size())
+            return nullptr;
+        if (it == mapFiles.end()) {
+            if (mapFiles.size() >= nMaxFiles) {
+                auto lru = std::min_element(mapFiles.begin(), mapFiles.end(),
+                    [](const std::pair<const fs::path, CEntry>& a, const std::pair<const fs::path, CEntry>& b) {
+                        return a.second.nLastUsed < b.second.nLastUsed;
+                    });
+                mapFiles.erase(lru);
+            }
+            it = mapFiles.emplace(path, CEntry()).first;
+        }
+        it->second.file = file;
+    }
+
+    CEntry& entry = it->second;
+    entry.nLastUsed = ++nUseCounter;
+
+    // Read ahead of reads that follow on from the previous one, topping up
+    // the read-ahead range once half of it has been consumed.
+    bool fSequential = nPos >= entry.nLastReadEnd && nPos - entry.nLastReadEnd <= BLOCK_FILE_READAHEAD;
+    size_t nReadEnd = nPos + nSize;
+    if (fSequential && nReadEnd + BLOCK_FILE_READAHEAD / 2 > entry.nReadAheadEnd) {
+        size_t nFrom = std::max(nPos, entry.nReadAheadEnd);
+        entry.nReadAheadEnd = nReadEnd + BLOCK_FILE_READAHEAD;
+        entry.file->WillNeed(nFrom, entry.nReadAheadEnd - nFrom);
+    } else if (!fSequential) {
+        entry.nReadAheadEnd = 0;
+    }
+    entry.nLastReadEnd = nReadEnd;
+
+    return entry.file;
+}
+
+void CBlockFileCache::Erase(const fs::path& path)
+{
+    LOCK(cs);
+    mapFiles.erase(path);
+}
+
+size_t CBlockFileCache::Size() const
+{
+    LOCK(cs);
+    return mapFiles.size();
+}
@@ -0,0 +1,140 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKFILECACHE_H
+#define ZCASH_BLOCKFILECACHE_H
+
+#include "fs.h"
+#include "serialize.h"
+#include "sync.h"
+
+#include <ios>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+
+/** Number of block and undo files that are kept mapped into memory. */
+static const size_t MAX_MAPPED_BLOCK_FILES = 8;
+/** How far ahead of a sequential scan of a block file the OS is asked to read. */
+static const size_t BLOCK_FILE_READAHEAD = 16 * 1024 * 1024;
+
+/** A block or undo file, mapped read-only into memory. */
+class CMappedFile
+{
+private:
+    const char* pbegin;
+    size_t nSize;
+
+public:
+    CMappedFile(const char* pbeginIn, size_t nSizeIn) : pbegin(pbeginIn), nSize(nSizeIn) {}
+    ~CMappedFile();
+
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+
+    /** Maps the file at path, as far as its current size. Returns null on failure. */
+    static std::shared_ptr<const CMappedFile> Map(const fs::path& path);
+
+    const char* begin() const { return pbegin; }
+    size_t size() const { return nSize; }
+
+    /** Asks the OS to start reading [nPos, nPos + nLen) of the file into memory. */
+    void WillNeed(size_t nPos, size_t nLen) const;
+};
+
+/** Deserializes from a range of a mapped file. */
+class CMappedFileReader
+{
+private:
+    std::shared_ptr<const CMappedFile> file;
+    size_t nReadPos;
+    size_t nEnd;
+    const int nType;
+    const int nVersion;
+
+public:
+    CMappedFileReader(std::shared_ptr<const CMappedFile> fileIn, size_t nBegin, size_t nEndIn, int nTypeIn, int nVersionIn) :
+        file(std::move(fileIn)), nReadPos(nBegin), nEnd(nEndIn), nType(nTypeIn), nVersion(nVersionIn)
+    {
+        if (nEnd < nReadPos || nEnd > file->size())
+            throw std::ios_base::failure("CMappedFileReader: range is outside of the file");
+    }
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
+    //! The bytes that have not been read yet
+    const char* data() const { return file->begin() + nReadPos; }
+    size_t size() const { return nEnd - nReadPos; }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > nEnd - nReadPos)
+            throw std::ios_base::failure("CMappedFileReader::read(): end of data");
+        memcpy(pch, file->begin() + nReadPos, nSize);
+        nReadPos += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > nEnd - nReadPos)
+            throw std::ios_base::failure("CMappedFileReader::ignore(): end of data");
+        nReadPos += nSize;
+    }
+
+    template<typename T>
+    CMappedFileReader& operator>>(T&& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
+/**
+ * Keeps the most recently read block and undo files mapped into memory, so
+ * that reading a block does not open the file, seek and copy it through a
+ * stdio buffer. When a read of a file starts at or just after the end of the
+ * previous one, the OS is asked to read ahead of it, which gives sequential
+ * scans (rescans, VerifyDB, reindex) streaming throughput.
+ *
+ * Files are mapped as far as their size when they are first read, and are
+ * mapped again when a read goes past that. Files that are truncated or
+ * deleted must be passed to Erase().
+ */
+class CBlockFileCache
+{
+private:
+    struct CEntry {
+        std::shared_ptr<const CMappedFile> file;
+        uint64_t nLastUsed = 0;
+        //! End of the previous read of the file
+        size_t nLastReadEnd = 0;
+        //! End of the range that the OS was last asked to read ahead
+        size_t nReadAheadEnd = 0;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<fs::path, CEntry> mapFiles;
+    uint64_t nUseCounter = 0;
+    const size_t nMaxFiles;
+
+public:
+    explicit CBlockFileCache(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn) {}
+
+    /**
+     * Returns a mapping of the file at path that covers [nPos, nPos + nSize),
+     * or null if the file can't be mapped or is too short.
+     */
+    std::shared_ptr<const CMappedFile> Get(const fs::path& path, size_t nPos, size_t nSize);
+
+    /** Unmaps the file at path, once the readers that are using it are done. */
+    void Erase(const fs::path& path);
+
+    /** Returns the number of files that are mapped. */
+    size_t Size() const;
+};
+
+#endif // ZCASH_BLOCKFILECACHE_H
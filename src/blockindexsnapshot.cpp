@@ -0,0 +1,174 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockindexsnapshot.h"
+
+#include "arith_uint256.h"
+#include "blockfilecache.h"
+#include "chain.h"
+#include "clientversion.h"
+#include "crypto/sha256.h"
+#include "streams.h"
+#include "util.h"
+
+#include <unordered_map>
+
+CBlockIndexSnapshotRecord::CBlockIndexSnapshotRecord(const CBlockIndex& index, int32_t nPrevIn) :
+    hash(index.GetBlockHash()),
+    nPrev(nPrevIn),
+    nHeight(index.nHeight),
+    nFile(index.nFile),
+    nDataPos(index.nDataPos),
+    nUndoPos(index.nUndoPos),
+    nStatus(index.nStatus),
+    nTx(index.nTx),
+    nCachedBranchId(index.nCachedBranchId),
+    hashSproutAnchor(index.hashSproutAnchor),
+    nSproutValue(index.nSproutValue),
+    nSaplingValue(index.nSaplingValue),
+    hashFinalSaplingRoot(index.hashFinalSaplingRoot),
+    hashChainHistoryRoot(index.hashChainHistoryRoot),
+    nVersion(index.nVersion),
+    hashMerkleRoot(index.hashMerkleRoot),
+    hashLightClientRoot(index.hashLightClientRoot),
+    nTime(index.nTime),
+    nBits(index.nBits),
+    nNonce(index.nNonce),
+    nChainWork(ArithToUint256(index.nChainWork)),
+    nChainTx(index.nChainTx),
+    nChainSproutValue(index.nChainSproutValue),
+    nChainSaplingValue(index.nChainSaplingValue)
+{
+}
+
+void CBlockIndexSnapshotRecord::ToIndex(CBlockIndex& index) const
+{
+    index.nHeight              = nHeight;
+    index.nFile                = nFile;
+    index.nDataPos             = nDataPos;
+    index.nUndoPos             = nUndoPos;
+    index.nStatus              = nStatus;
+    index.nTx                  = nTx;
+    index.nCachedBranchId      = nCachedBranchId;
+    index.hashSproutAnchor     = hashSproutAnchor;
+    index.nSproutValue         = nSproutValue;
+    index.nSaplingValue        = nSaplingValue;
+    index.hashFinalSaplingRoot = hashFinalSaplingRoot;
+    index.hashChainHistoryRoot = hashChainHistoryRoot;
+    index.nVersion             = nVersion;
+    index.hashMerkleRoot       = hashMerkleRoot;
+    index.hashLightClientRoot  = hashLightClientRoot;
+    index.nTime                = nTime;
+    index.nBits                = nBits;
+    index.nNonce               = nNonce;
+    index.nChainWork           = UintToArith256(nChainWork);
+    index.nChainTx             = nChainTx;
+    index.nChainSproutValue    = nChainSproutValue;
+    index.nChainSaplingValue   = nChainSaplingValue;
+}
+
+bool WriteBlockIndexSnapshotFile(
+    const fs::path& path,
+    const uint256& id,
+    const CBlockIndexSnapshotDBState& dbState,
+    const std::vector<const CBlockIndex*>& vIndex)
+{
+    fs::path pathTmp = path;
+    pathTmp += ".new";
+    CAutoFile fileout(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s: failed to open %s", __func__, pathTmp.string());
+
+    CBlockIndexSnapshotHeader header;
+    header.id = id;
+    header.dbState = dbState;
+    header.nRecords = vIndex.size();
+
+    std::unordered_map<const CBlockIndex*, int32_t> mapPos;
+    mapPos.reserve(vIndex.size());
+    CSHA256 hasher;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    try {
+        // The header is written again once the checksum is known
+        fileout << header;
+        for (const CBlockIndex* pindex : vIndex) {
+            int32_t nPrev = -1;
+            if (pindex->pprev) {
+                auto it = mapPos.find(pindex->pprev);
+                if (it == mapPos.end())
+                    return error("%s: %s comes before its parent", __func__, pindex->GetBlockHash().ToString());
+                nPrev = it->second;
+            }
+            mapPos.emplace(pindex, mapPos.size());
+
+            ss.clear();
+            ss << CBlockIndexSnapshotRecord(*pindex, nPrev);
+            hasher.Write((const unsigned char*)&ss[0], ss.size());
+            fileout.write(&ss[0], ss.size());
+        }
+        hasher.Finalize(header.checksum.begin());
+
+        if (fseek(fileout.Get(), 0, SEEK_SET) != 0)
+            return error("%s: failed to seek in %s", __func__, pathTmp.string());
+        fileout << header;
+    } catch (const std::exception& e) {
+        return error("%s: failed to write %s: %s", __func__, pathTmp.string(), e.what());
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, path))
+        return error("%s: failed to rename %s", __func__, pathTmp.string());
+    return true;
+}
+
+bool ReadBlockIndexSnapshotFile(
+    const fs::path& path,
+    const uint256& id,
+    const CBlockIndexSnapshotDBState& dbState,
+    std::function<CBlockIndex*(const uint256&)> insertBlockIndex,
+    std::vector<CBlockIndex*>& vIndex)
+{
+    std::shared_ptr<const CMappedFile> file = CMappedFile::Map(path);
+    if (!file)
+        return error("%s: failed to map %s", __func__, path.string());
+
+    try {
+        CMappedFileReader reader(file, 0, file->size(), SER_DISK, CLIENT_VERSION);
+        CBlockIndexSnapshotHeader header;
+        reader >> header;
+        if (header.nMagic != BLOCK_INDEX_SNAPSHOT_MAGIC || header.nVersion != BLOCK_INDEX_SNAPSHOT_VERSION)
+            return error("%s: %s is not a block index snapshot", __func__, path.string());
+        if (header.id != id)
+            return error("%s: %s does not match the block index database", __func__, path.string());
+        if (header.dbState != dbState)
+            return error("%s: %s was written against another state of the block database", __func__, path.string());
+
+        size_t nRecordSize = ::GetSerializeSize(CBlockIndexSnapshotRecord(), SER_DISK, CLIENT_VERSION);
+        if (reader.size() != header.nRecords * nRecordSize)
+            return error("%s: %s has the wrong size", __func__, path.string());
+
+        uint256 checksum;
+        CSHA256().Write((const unsigned char*)reader.data(), reader.size()).Finalize(checksum.begin());
+        if (checksum != header.checksum)
+            return error("%s: %s is corrupt", __func__, path.string());
+
+        vIndex.reserve(header.nRecords);
+        for (uint64_t i = 0; i < header.nRecords; i++) {
+            CBlockIndexSnapshotRecord record;
+            reader >> record;
+            if (record.nPrev < -1 || record.nPrev >= (int64_t)i)
+                return error("%s: %s has an invalid parent", __func__, record.hash.ToString());
+            CBlockIndex* pindexNew = insertBlockIndex(record.hash);
+            record.ToIndex(*pindexNew);
+            pindexNew->pprev = record.nPrev < 0 ? nullptr : vIndex[record.nPrev];
+            if (pindexNew->pprev && pindexNew->nHeight != pindexNew->pprev->nHeight + 1)
+                return error("%s: %s has an invalid height", __func__, record.hash.ToString());
+            vIndex.push_back(pindexNew);
+        }
+    } catch (const std::exception& e) {
+        return error("%s: failed to read %s: %s", __func__, path.string(), e.what());
+    }
+    return true;
+}
@@ -0,0 +1,204 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKINDEXSNAPSHOT_H
+#define ZCASH_BLOCKINDEXSNAPSHOT_H
+
+#include "amount.h"
+#include "fs.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <functional>
+#include <optional>
+#include <stdint.h>
+#include <vector>
+
+class CBlockIndex;
+
+static const uint32_t BLOCK_INDEX_SNAPSHOT_MAGIC = 0x78646e69; // "indx"
+static const uint32_t BLOCK_INDEX_SNAPSHOT_VERSION = 1;
+
+/**
+ * The state of the coins and block tree databases that a snapshot was written
+ * against. Another binary that changes the block index without knowing about
+ * the snapshot also changes this, so the snapshot is then not loaded.
+ */
+struct CBlockIndexSnapshotDBState
+{
+    //! Best block of the coins database
+    uint256 hashBestBlock;
+    int32_t nLastBlockFile = 0;
+    //! Used sizes of the last block and undo files
+    uint32_t nLastBlockFileSize = 0;
+    uint32_t nLastUndoFileSize = 0;
+
+    friend bool operator==(const CBlockIndexSnapshotDBState& a, const CBlockIndexSnapshotDBState& b)
+    {
+        return a.hashBestBlock == b.hashBestBlock &&
+               a.nLastBlockFile == b.nLastBlockFile &&
+               a.nLastBlockFileSize == b.nLastBlockFileSize &&
+               a.nLastUndoFileSize == b.nLastUndoFileSize;
+    }
+    friend bool operator!=(const CBlockIndexSnapshotDBState& a, const CBlockIndexSnapshotDBState& b)
+    {
+        return !(a == b);
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBestBlock);
+        READWRITE(nLastBlockFile);
+        READWRITE(nLastBlockFileSize);
+        READWRITE(nLastUndoFileSize);
+    }
+};
+
+/** The header at the start of a block index snapshot. */
+struct CBlockIndexSnapshotHeader
+{
+    uint32_t nMagic = BLOCK_INDEX_SNAPSHOT_MAGIC;
+    uint32_t nVersion = BLOCK_INDEX_SNAPSHOT_VERSION;
+    //! Random id of the snapshot, which is also stored in the block tree
+    //! database for as long as the snapshot matches it.
+    uint256 id;
+    CBlockIndexSnapshotDBState dbState;
+    uint64_t nRecords = 0;
+    //! SHA-256 of the records that follow the header
+    uint256 checksum;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nMagic);
+        READWRITE(nVersion);
+        READWRITE(id);
+        READWRITE(dbState);
+        READWRITE(nRecords);
+        READWRITE(checksum);
+    }
+};
+
+/**
+ * A block index entry, as stored in a snapshot. Records have a fixed size,
+ * refer to their parent by its position in the snapshot, and hold the chain
+ * totals that are otherwise recomputed from the whole index at startup. The
+ * Equihash solution is left in the block tree database.
+ */
+struct CBlockIndexSnapshotRecord
+{
+    uint256 hash;
+    //! Position of the parent's record, or -1 for the genesis block
+    int32_t nPrev = -1;
+
+    int32_t nHeight = 0;
+    int32_t nFile = 0;
+    uint32_t nDataPos = 0;
+    uint32_t nUndoPos = 0;
+    uint32_t nStatus = 0;
+    uint32_t nTx = 0;
+    std::optional<uint32_t> nCachedBranchId;
+    uint256 hashSproutAnchor;
+    std::optional<CAmount> nSproutValue;
+    CAmount nSaplingValue = 0;
+    uint256 hashFinalSaplingRoot;
+    uint256 hashChainHistoryRoot;
+
+    int32_t nVersion = 0;
+    uint256 hashMerkleRoot;
+    uint256 hashLightClientRoot;
+    uint32_t nTime = 0;
+    uint32_t nBits = 0;
+    uint256 nNonce;
+
+    uint256 nChainWork;
+    uint32_t nChainTx = 0;
+    std::optional<CAmount> nChainSproutValue;
+    std::optional<CAmount> nChainSaplingValue;
+
+    CBlockIndexSnapshotRecord() {}
+    CBlockIndexSnapshotRecord(const CBlockIndex& index, int32_t nPrevIn);
+
+    /** Copies the record into index, except for its hash and parent. */
+    void ToIndex(CBlockIndex& index) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(nPrev);
+        READWRITE(nHeight);
+        READWRITE(nFile);
+        READWRITE(nDataPos);
+        READWRITE(nUndoPos);
+        READWRITE(nStatus);
+        READWRITE(nTx);
+        ReadWriteOptional(s, ser_action, nCachedBranchId);
+        READWRITE(hashSproutAnchor);
+        ReadWriteOptional(s, ser_action, nSproutValue);
+        READWRITE(nSaplingValue);
+        READWRITE(hashFinalSaplingRoot);
+        READWRITE(hashChainHistoryRoot);
+        READWRITE(nVersion);
+        READWRITE(hashMerkleRoot);
+        READWRITE(hashLightClientRoot);
+        READWRITE(nTime);
+        READWRITE(nBits);
+        READWRITE(nNonce);
+        READWRITE(nChainWork);
+        READWRITE(nChainTx);
+        ReadWriteOptional(s, ser_action, nChainSproutValue);
+        ReadWriteOptional(s, ser_action, nChainSaplingValue);
+    }
+
+private:
+    //! Optionals are stored as a flag and a value, so that records keep a fixed size
+    template <typename Stream, typename T>
+    static void ReadWriteOptional(Stream& s, CSerActionSerialize ser_action, const std::optional<T>& value)
+    {
+        ::Serialize(s, (bool)value);
+        ::Serialize(s, value ? *value : T());
+    }
+
+    template <typename Stream, typename T>
+    static void ReadWriteOptional(Stream& s, CSerActionUnserialize ser_action, std::optional<T>& value)
+    {
+        bool fHave;
+        T v;
+        ::Unserialize(s, fHave);
+        ::Unserialize(s, v);
+        value = fHave ? std::optional<T>(v) : std::nullopt;
+    }
+};
+
+/**
+ * Writes the entries of vIndex to a snapshot at path. Every entry's parent
+ * must come before it in vIndex. The file is written next to path and
+ * renamed over it once it has been synced.
+ */
+bool WriteBlockIndexSnapshotFile(
+    const fs::path& path,
+    const uint256& id,
+    const CBlockIndexSnapshotDBState& dbState,
+    const std::vector<const CBlockIndex*>& vIndex);
+
+/**
+ * Reads the snapshot at path, if it has the given id and database state and
+ * its checksum matches. Each record is copied into the entry that insertBlockIndex
+ * returns for its hash, which is appended to vIndex, so that vIndex ends up
+ * in the order of the snapshot. Returns false if the snapshot is missing or
+ * doesn't match, in which case some entries may already have been inserted.
+ */
+bool ReadBlockIndexSnapshotFile(
+    const fs::path& path,
+    const uint256& id,
+    const CBlockIndexSnapshotDBState& dbState,
+    std::function<CBlockIndex*(const uint256&)> insertBlockIndex,
+    std::vector<CBlockIndex*>& vIndex);
+
+#endif // ZCASH_BLOCKINDEXSNAPSHOT_H
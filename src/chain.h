@@ -12,6 +12,7 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <functional>
 #include <optional>
 #include <vector>
 
@@ -278,8 +279,15 @@ public:
     unsigned int nTime;
     unsigned int nBits;
     uint256 nNonce;
+
+protected:
+    //! The Equihash solution, while it is held in memory. Solutions take up
+    //! most of the size of a header, and are rarely needed once the header has
+    //! been accepted, so they are trimmed once the entry has been written to
+    //! the block tree database, and read back from there by GetSolution().
     std::vector<unsigned char> nSolution;
 
+public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
@@ -350,19 +358,25 @@ public:
         return ret;
     }
 
-    CBlockHeader GetBlockHeader() const
+    //! Returns the block header, reading the solution from the block tree
+    //! database if it has been trimmed. Requires cs_main; defined in main.cpp.
+    CBlockHeader GetBlockHeader() const;
+
+    //! Returns the Equihash solution, reading it from the block tree database
+    //! if it has been trimmed. Requires cs_main; defined in main.cpp.
+    std::vector<unsigned char> GetSolution() const;
+
+    //! Whether the Equihash solution is held in memory.
+    bool HasSolution() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        if (pprev)
-            block.hashPrevBlock = pprev->GetBlockHash();
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.hashLightClientRoot = hashLightClientRoot;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
-        return block;
+        return !nSolution.empty();
+    }
+
+    //! Frees the Equihash solution. This must only be done once the entry has
+    //! been written to the block tree database.
+    void TrimSolution()
+    {
+        std::vector<unsigned char>().swap(nSolution);
     }
 
     uint256 GetBlockHash() const
@@ -446,8 +460,15 @@ public:
         hashPrev = uint256();
     }
 
-    explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
+    /**
+     * getSolution is called to fetch the Equihash solution if it has been
+     * trimmed from pindex.
+     */
+    CDiskBlockIndex(const CBlockIndex* pindex, std::function<std::vector<unsigned char>()> getSolution) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        if (!HasSolution()) {
+            nSolution = getSolution();
+        }
     }
 
     ADD_SERIALIZE_METHODS;
@@ -533,6 +554,12 @@ public:
         return block.GetHash();
     }
 
+    //! The Equihash solution that was read from or will be written to disk
+    const std::vector<unsigned char>& GetDiskSolution() const
+    {
+        return nSolution;
+    }
+
 
     std::string ToString() const
     {
@@ -679,10 +679,20 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
 CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid) {
     assert(!hasModifier);
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    size_t cachedCoinUsage = ret.second ? 0 : ret.first->second.coins.DynamicMemoryUsage();
+    if (!ret.second && !(ret.first->second.flags & CCoinsCacheEntry::FRESH)) {
+        // The parent view may still have outputs of the entry being replaced,
+        // so it is not fresh; make sure that those outputs get erased if the
+        // new entry doesn't have them.
+        for (unsigned int i = 0; i < ret.first->second.coins.vout.size(); i++) {
+            ret.first->second.MarkOutputDirty(i);
+        }
+    } else {
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    }
     ret.first->second.coins.Clear();
-    ret.first->second.flags = CCoinsCacheEntry::FRESH;
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, 0);
+    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
 const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
@@ -694,6 +704,10 @@ const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
     }
 }
 
+bool CCoinsViewCache::HaveCoinsInCache(const uint256 &txid) const {
+    return cacheCoins.count(txid) != 0;
+}
+
 bool CCoinsViewCache::HaveCoins(const uint256 &txid) const {
     CCoinsMap::const_iterator it = FetchCoins(txid);
     // We're using vtx.empty() instead of IsPruned here for performance reasons,
@@ -847,6 +861,21 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
+                    if (!(itUs->second.flags & CCoinsCacheEntry::FRESH)) {
+                        // Track which outputs differ from the grandparent. A
+                        // fresh child entry replaces all of ours.
+                        if (it->second.flags & CCoinsCacheEntry::FRESH) {
+                            size_t nOutputs = std::max(itUs->second.coins.vout.size(), it->second.coins.vout.size());
+                            for (unsigned int i = 0; i < nOutputs; i++) {
+                                itUs->second.MarkOutputDirty(i);
+                            }
+                        }
+                        for (unsigned int i = 0; i < it->second.dirtyOutputs.size(); i++) {
+                            if (it->second.dirtyOutputs[i]) {
+                                itUs->second.MarkOutputDirty(i);
+                            }
+                        }
+                    }
                     cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
                     cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
@@ -1027,6 +1056,13 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight) const
 CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
+    if (!(it->second.flags & CCoinsCacheEntry::FRESH)) {
+        const std::vector<CTxOut>& vout = it->second.coins.vout;
+        availableBefore.resize(vout.size());
+        for (unsigned int i = 0; i < vout.size(); i++) {
+            availableBefore[i] = !vout[i].IsNull();
+        }
+    }
 }
 
 CCoinsModifier::~CCoinsModifier()
@@ -1034,6 +1070,19 @@ CCoinsModifier::~CCoinsModifier()
     assert(cache.hasModifier);
     cache.hasModifier = false;
     it->second.coins.Cleanup();
+    if (!(it->second.flags & CCoinsCacheEntry::FRESH)) {
+        // Remember which outputs were spent or restored, so that only those
+        // need to be written to the parent view.
+        const std::vector<CTxOut>& vout = it->second.coins.vout;
+        size_t nOutputs = std::max(availableBefore.size(), vout.size());
+        for (unsigned int i = 0; i < nOutputs; i++) {
+            bool fAvailable = i < vout.size() && !vout[i].IsNull();
+            bool fWasAvailable = i < availableBefore.size() && availableBefore[i];
+            if (fAvailable != fWasAvailable) {
+                it->second.MarkOutputDirty(i);
+            }
+        }
+    }
     cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
@@ -1042,3 +1091,120 @@ CCoinsModifier::~CCoinsModifier()
         cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
     }
 }
+
+CCoinsViewSharedCache::CCoinsViewSharedCache(CCoinsView *baseIn) : cache(baseIn), nBestHeight(-1) { }
+
+bool CCoinsViewSharedCache::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.GetSproutAnchorAt(rt, tree);
+}
+
+bool CCoinsViewSharedCache::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.GetSaplingAnchorAt(rt, tree);
+}
+
+bool CCoinsViewSharedCache::GetNullifier(const uint256 &nullifier, ShieldedType type) const {
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.GetNullifier(nullifier, type);
+}
+
+bool CCoinsViewSharedCache::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_cache);
+        if (cache.HaveCoinsInCache(txid)) {
+            return cache.GetCoins(txid, coins);
+        }
+    }
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.GetCoins(txid, coins);
+}
+
+bool CCoinsViewSharedCache::HaveCoins(const uint256 &txid) const {
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_cache);
+        if (cache.HaveCoinsInCache(txid)) {
+            return cache.HaveCoins(txid);
+        }
+    }
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.HaveCoins(txid);
+}
+
+uint256 CCoinsViewSharedCache::GetBestBlock() const {
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.GetBestBlock();
+}
+
+uint256 CCoinsViewSharedCache::GetBestAnchor(ShieldedType type) const {
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.GetBestAnchor(type);
+}
+
+HistoryIndex CCoinsViewSharedCache::GetHistoryLength(uint32_t epochId) const {
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.GetHistoryLength(epochId);
+}
+
+HistoryNode CCoinsViewSharedCache::GetHistoryAt(uint32_t epochId, HistoryIndex index) const {
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.GetHistoryAt(epochId, index);
+}
+
+uint256 CCoinsViewSharedCache::GetHistoryRoot(uint32_t epochId) const {
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.GetHistoryRoot(epochId);
+}
+
+bool CCoinsViewSharedCache::BatchWrite(CCoinsMap &mapCoins,
+                                       const uint256 &hashBlockIn,
+                                       const uint256 &hashSproutAnchorIn,
+                                       const uint256 &hashSaplingAnchorIn,
+                                       CAnchorsSproutMap &mapSproutAnchors,
+                                       CAnchorsSaplingMap &mapSaplingAnchors,
+                                       CNullifiersMap &mapSproutNullifiers,
+                                       CNullifiersMap &mapSaplingNullifiers,
+                                       CHistoryCacheMap &historyCacheMapIn) {
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    if (hashBlockIn != hashHeightBlock) {
+        nBestHeight = -1;
+    }
+    return cache.BatchWrite(mapCoins, hashBlockIn, hashSproutAnchorIn, hashSaplingAnchorIn,
+                            mapSproutAnchors, mapSaplingAnchors,
+                            mapSproutNullifiers, mapSaplingNullifiers, historyCacheMapIn);
+}
+
+bool CCoinsViewSharedCache::GetStats(CCoinsStats &stats) const {
+    boost::shared_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.GetStats(stats);
+}
+
+void CCoinsViewSharedCache::SetBestBlockHeight(const uint256 &hashBlockIn, int nHeight) {
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    assert(hashBlockIn == cache.GetBestBlock());
+    hashHeightBlock = hashBlockIn;
+    nBestHeight = nHeight;
+}
+
+std::pair<uint256, int> CCoinsViewSharedCache::GetBestBlockHeight() const {
+    boost::shared_lock<boost::shared_mutex> lock(cs_cache);
+    if (nBestHeight < 0) {
+        return std::make_pair(uint256(), -1);
+    }
+    return std::make_pair(hashHeightBlock, nBestHeight);
+}
+
+bool CCoinsViewSharedCache::Flush() {
+    boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.Flush();
+}
+
+unsigned int CCoinsViewSharedCache::GetCacheSize() const {
+    boost::shared_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.GetCacheSize();
+}
+
+size_t CCoinsViewSharedCache::DynamicMemoryUsage() const {
+    boost::shared_lock<boost::shared_mutex> lock(cs_cache);
+    return cache.DynamicMemoryUsage();
+}
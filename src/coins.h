@@ -16,6 +16,7 @@
 #include <assert.h>
 #include <stdint.h>
 
+#include <boost/thread/shared_mutex.hpp>
 #include <boost/unordered_map.hpp>
 #include "zcash/History.hpp"
 #include "zcash/IncrementalMerkleTree.hpp"
@@ -272,7 +273,19 @@ struct CCoinsCacheEntry
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
+    //! Indices of the outputs whose availability may differ from the parent
+    //! view; only tracked for entries that are not FRESH. Outputs are never
+    //! modified in place, only spent or restored, so this is enough for the
+    //! parent to know which of its outputs are stale.
+    std::vector<bool> dirtyOutputs;
+
     CCoinsCacheEntry() : coins(), flags(0) {}
+
+    void MarkOutputDirty(unsigned int n) {
+        if (dirtyOutputs.size() <= n)
+            dirtyOutputs.resize(n + 1);
+        dirtyOutputs[n] = true;
+    }
 };
 
 struct CAnchorsSproutCacheEntry
@@ -439,6 +452,7 @@ private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
     size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    std::vector<bool> availableBefore; // Which outputs were available before modification (if not FRESH)
     CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
@@ -531,6 +545,9 @@ public:
      */
     const CCoins* AccessCoins(const uint256 &txid) const;
 
+    //! Check whether the CCoins for the given txid are already loaded into this cache
+    bool HaveCoinsInCache(const uint256 &txid) const;
+
     /**
      * Return a modifiable reference to a CCoins. If no entry with the given
      * txid exists, a new one is created. Simultaneous modifications are not
@@ -631,4 +648,70 @@ private:
     HistoryCache& SelectHistoryCache(uint32_t epochId) const;
 };
 
+/**
+ * CCoinsViewCache that can be read from several threads at once, used for the
+ * cache of the chain tip (pcoinsTip) so that readers do not need cs_main.
+ *
+ * Lookups of coins that are already in the cache share a lock, which is only
+ * taken exclusively to load entries from the base view or to write to the
+ * cache. A block is validated in a child cache that is written here once it has
+ * been connected, so lookups proceed while blocks are being validated, and see
+ * the state as of the previous block until then.
+ */
+class CCoinsViewSharedCache : public CCoinsView
+{
+private:
+    mutable boost::shared_mutex cs_cache;
+    CCoinsViewCache cache;
+
+    //! The best block whose height was last set, and its height (-1 if the
+    //! best block has changed since)
+    uint256 hashHeightBlock;
+    int nBestHeight;
+
+public:
+    CCoinsViewSharedCache(CCoinsView *baseIn);
+
+    bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
+    bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    uint256 GetBestAnchor(ShieldedType type) const;
+    HistoryIndex GetHistoryLength(uint32_t epochId) const;
+    HistoryNode GetHistoryAt(uint32_t epochId, HistoryIndex index) const;
+    uint256 GetHistoryRoot(uint32_t epochId) const;
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    CAnchorsSproutMap &mapSproutAnchors,
+                    CAnchorsSaplingMap &mapSaplingAnchors,
+                    CNullifiersMap &mapSproutNullifiers,
+                    CNullifiersMap &mapSaplingNullifiers,
+                    CHistoryCacheMap &historyCacheMap);
+    bool GetStats(CCoinsStats &stats) const;
+
+    //! Record the height of the best block, after writing a block to the cache
+    void SetBestBlockHeight(const uint256 &hashBlock, int nHeight);
+
+    /**
+     * Return the best block, and its height if that was recorded with
+     * SetBestBlockHeight (or -1 otherwise). Readers that do not hold cs_main
+     * can compare the results from before and after a series of lookups to
+     * check that the lookups saw the same block.
+     */
+    std::pair<uint256, int> GetBestBlockHeight() const;
+
+    //! Push the modifications applied to this cache to its base
+    bool Flush();
+
+    //! Calculate the size of the cache (in number of transactions)
+    unsigned int GetCacheSize() const;
+
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+};
+
 #endif // BITCOIN_COINS_H
@@ -103,8 +103,17 @@ typedef int32_t ssize_t;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+// poll() is broken on Windows and macOS, so they keep using select()
+#if defined(HAVE_POLL_H) && !defined(WIN32) && !defined(__APPLE__)
+#define USE_POLL
+#endif
+// epoll, where there is one, goes ahead of poll()
+#if defined(USE_POLL) && defined(HAVE_SYS_EPOLL_H)
+#define USE_EPOLL
+#endif
+
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_POLL)
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -0,0 +1,202 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+#define BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+
+// Double-SHA256 of several 64-byte inputs at once, with one input in each
+// lane of a vector of 32-bit words.
+//
+// This is only to be included by the translation units of the multi-way
+// backends, which are each compiled with the flags of their instruction set.
+// Everything here has internal linkage, so that no code built with those flags
+// can end up being called on a CPU that lacks them.
+
+#include <stdint.h>
+#include <string.h>
+
+namespace {
+namespace sha256_multiway {
+
+template<typename V> inline V Ch(V x, V y, V z) { return z ^ (x & (y ^ z)); }
+template<typename V> inline V Maj(V x, V y, V z) { return (x & y) | (z & (x | y)); }
+template<typename V> inline V Sigma0(V x) { return (x >> 2 | x << 30) ^ (x >> 13 | x << 19) ^ (x >> 22 | x << 10); }
+template<typename V> inline V Sigma1(V x) { return (x >> 6 | x << 26) ^ (x >> 11 | x << 21) ^ (x >> 25 | x << 7); }
+template<typename V> inline V sigma0(V x) { return (x >> 7 | x << 25) ^ (x >> 18 | x << 14) ^ (x >> 3); }
+template<typename V> inline V sigma1(V x) { return (x >> 17 | x << 15) ^ (x >> 19 | x << 13) ^ (x >> 10); }
+
+/** The number of lanes in a vector. */
+template<typename V> constexpr int Lanes() { return sizeof(V) / sizeof(uint32_t); }
+
+/** A vector with every lane set to x. */
+template<typename V> inline V Broadcast(uint32_t x) { return V{} + x; }
+
+/** One round of SHA-256. */
+template<typename V>
+inline void Round(V a, V b, V c, V& d, V e, V f, V g, V& h, uint32_t k, V w)
+{
+    V t1 = h + Sigma1(e) + Ch(e, f, g) + k + w;
+    V t2 = Sigma0(a) + Maj(a, b, c);
+    d += t1;
+    h = t1 + t2;
+}
+
+template<typename V>
+inline void Initialize(V* s)
+{
+    s[0] = Broadcast<V>(0x6a09e667ul);
+    s[1] = Broadcast<V>(0xbb67ae85ul);
+    s[2] = Broadcast<V>(0x3c6ef372ul);
+    s[3] = Broadcast<V>(0xa54ff53aul);
+    s[4] = Broadcast<V>(0x510e527ful);
+    s[5] = Broadcast<V>(0x9b05688cul);
+    s[6] = Broadcast<V>(0x1f83d9abul);
+    s[7] = Broadcast<V>(0x5be0cd19ul);
+}
+
+/** Perform one SHA-256 transformation in every lane, on the message words w. */
+template<typename V>
+inline void Transform(V* s, const V* w)
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    V w0 = w[0], w1 = w[1], w2 = w[2], w3 = w[3], w4 = w[4], w5 = w[5], w6 = w[6], w7 = w[7];
+    V w8 = w[8], w9 = w[9], w10 = w[10], w11 = w[11], w12 = w[12], w13 = w[13], w14 = w[14], w15 = w[15];
+
+    Round(a, b, c, d, e, f, g, h, 0x428a2f98, w0);
+    Round(h, a, b, c, d, e, f, g, 0x71374491, w1);
+    Round(g, h, a, b, c, d, e, f, 0xb5c0fbcf, w2);
+    Round(f, g, h, a, b, c, d, e, 0xe9b5dba5, w3);
+    Round(e, f, g, h, a, b, c, d, 0x3956c25b, w4);
+    Round(d, e, f, g, h, a, b, c, 0x59f111f1, w5);
+    Round(c, d, e, f, g, h, a, b, 0x923f82a4, w6);
+    Round(b, c, d, e, f, g, h, a, 0xab1c5ed5, w7);
+    Round(a, b, c, d, e, f, g, h, 0xd807aa98, w8);
+    Round(h, a, b, c, d, e, f, g, 0x12835b01, w9);
+    Round(g, h, a, b, c, d, e, f, 0x243185be, w10);
+    Round(f, g, h, a, b, c, d, e, 0x550c7dc3, w11);
+    Round(e, f, g, h, a, b, c, d, 0x72be5d74, w12);
+    Round(d, e, f, g, h, a, b, c, 0x80deb1fe, w13);
+    Round(c, d, e, f, g, h, a, b, 0x9bdc06a7, w14);
+    Round(b, c, d, e, f, g, h, a, 0xc19bf174, w15);
+
+    Round(a, b, c, d, e, f, g, h, 0xe49b69c1, w0 += sigma1(w14) + w9 + sigma0(w1));
+    Round(h, a, b, c, d, e, f, g, 0xefbe4786, w1 += sigma1(w15) + w10 + sigma0(w2));
+    Round(g, h, a, b, c, d, e, f, 0x0fc19dc6, w2 += sigma1(w0) + w11 + sigma0(w3));
+    Round(f, g, h, a, b, c, d, e, 0x240ca1cc, w3 += sigma1(w1) + w12 + sigma0(w4));
+    Round(e, f, g, h, a, b, c, d, 0x2de92c6f, w4 += sigma1(w2) + w13 + sigma0(w5));
+    Round(d, e, f, g, h, a, b, c, 0x4a7484aa, w5 += sigma1(w3) + w14 + sigma0(w6));
+    Round(c, d, e, f, g, h, a, b, 0x5cb0a9dc, w6 += sigma1(w4) + w15 + sigma0(w7));
+    Round(b, c, d, e, f, g, h, a, 0x76f988da, w7 += sigma1(w5) + w0 + sigma0(w8));
+    Round(a, b, c, d, e, f, g, h, 0x983e5152, w8 += sigma1(w6) + w1 + sigma0(w9));
+    Round(h, a, b, c, d, e, f, g, 0xa831c66d, w9 += sigma1(w7) + w2 + sigma0(w10));
+    Round(g, h, a, b, c, d, e, f, 0xb00327c8, w10 += sigma1(w8) + w3 + sigma0(w11));
+    Round(f, g, h, a, b, c, d, e, 0xbf597fc7, w11 += sigma1(w9) + w4 + sigma0(w12));
+    Round(e, f, g, h, a, b, c, d, 0xc6e00bf3, w12 += sigma1(w10) + w5 + sigma0(w13));
+    Round(d, e, f, g, h, a, b, c, 0xd5a79147, w13 += sigma1(w11) + w6 + sigma0(w14));
+    Round(c, d, e, f, g, h, a, b, 0x06ca6351, w14 += sigma1(w12) + w7 + sigma0(w15));
+    Round(b, c, d, e, f, g, h, a, 0x14292967, w15 += sigma1(w13) + w8 + sigma0(w0));
+
+    Round(a, b, c, d, e, f, g, h, 0x27b70a85, w0 += sigma1(w14) + w9 + sigma0(w1));
+    Round(h, a, b, c, d, e, f, g, 0x2e1b2138, w1 += sigma1(w15) + w10 + sigma0(w2));
+    Round(g, h, a, b, c, d, e, f, 0x4d2c6dfc, w2 += sigma1(w0) + w11 + sigma0(w3));
+    Round(f, g, h, a, b, c, d, e, 0x53380d13, w3 += sigma1(w1) + w12 + sigma0(w4));
+    Round(e, f, g, h, a, b, c, d, 0x650a7354, w4 += sigma1(w2) + w13 + sigma0(w5));
+    Round(d, e, f, g, h, a, b, c, 0x766a0abb, w5 += sigma1(w3) + w14 + sigma0(w6));
+    Round(c, d, e, f, g, h, a, b, 0x81c2c92e, w6 += sigma1(w4) + w15 + sigma0(w7));
+    Round(b, c, d, e, f, g, h, a, 0x92722c85, w7 += sigma1(w5) + w0 + sigma0(w8));
+    Round(a, b, c, d, e, f, g, h, 0xa2bfe8a1, w8 += sigma1(w6) + w1 + sigma0(w9));
+    Round(h, a, b, c, d, e, f, g, 0xa81a664b, w9 += sigma1(w7) + w2 + sigma0(w10));
+    Round(g, h, a, b, c, d, e, f, 0xc24b8b70, w10 += sigma1(w8) + w3 + sigma0(w11));
+    Round(f, g, h, a, b, c, d, e, 0xc76c51a3, w11 += sigma1(w9) + w4 + sigma0(w12));
+    Round(e, f, g, h, a, b, c, d, 0xd192e819, w12 += sigma1(w10) + w5 + sigma0(w13));
+    Round(d, e, f, g, h, a, b, c, 0xd6990624, w13 += sigma1(w11) + w6 + sigma0(w14));
+    Round(c, d, e, f, g, h, a, b, 0xf40e3585, w14 += sigma1(w12) + w7 + sigma0(w15));
+    Round(b, c, d, e, f, g, h, a, 0x106aa070, w15 += sigma1(w13) + w8 + sigma0(w0));
+
+    Round(a, b, c, d, e, f, g, h, 0x19a4c116, w0 += sigma1(w14) + w9 + sigma0(w1));
+    Round(h, a, b, c, d, e, f, g, 0x1e376c08, w1 += sigma1(w15) + w10 + sigma0(w2));
+    Round(g, h, a, b, c, d, e, f, 0x2748774c, w2 += sigma1(w0) + w11 + sigma0(w3));
+    Round(f, g, h, a, b, c, d, e, 0x34b0bcb5, w3 += sigma1(w1) + w12 + sigma0(w4));
+    Round(e, f, g, h, a, b, c, d, 0x391c0cb3, w4 += sigma1(w2) + w13 + sigma0(w5));
+    Round(d, e, f, g, h, a, b, c, 0x4ed8aa4a, w5 += sigma1(w3) + w14 + sigma0(w6));
+    Round(c, d, e, f, g, h, a, b, 0x5b9cca4f, w6 += sigma1(w4) + w15 + sigma0(w7));
+    Round(b, c, d, e, f, g, h, a, 0x682e6ff3, w7 += sigma1(w5) + w0 + sigma0(w8));
+    Round(a, b, c, d, e, f, g, h, 0x748f82ee, w8 += sigma1(w6) + w1 + sigma0(w9));
+    Round(h, a, b, c, d, e, f, g, 0x78a5636f, w9 += sigma1(w7) + w2 + sigma0(w10));
+    Round(g, h, a, b, c, d, e, f, 0x84c87814, w10 += sigma1(w8) + w3 + sigma0(w11));
+    Round(f, g, h, a, b, c, d, e, 0x8cc70208, w11 += sigma1(w9) + w4 + sigma0(w12));
+    Round(e, f, g, h, a, b, c, d, 0x90befffa, w12 += sigma1(w10) + w5 + sigma0(w13));
+    Round(d, e, f, g, h, a, b, c, 0xa4506ceb, w13 += sigma1(w11) + w6 + sigma0(w14));
+    Round(c, d, e, f, g, h, a, b, 0xbef9a3f7, w14 + sigma1(w12) + w7 + sigma0(w15));
+    Round(b, c, d, e, f, g, h, a, 0xc67178f2, w15 + sigma1(w13) + w8 + sigma0(w0));
+
+    s[0] += a;
+    s[1] += b;
+    s[2] += c;
+    s[3] += d;
+    s[4] += e;
+    s[5] += f;
+    s[6] += g;
+    s[7] += h;
+}
+
+inline uint32_t ReadBE32(const unsigned char* ptr)
+{
+    uint32_t x;
+    memcpy(&x, ptr, 4);
+    return __builtin_bswap32(x);
+}
+
+inline void WriteBE32(unsigned char* ptr, uint32_t x)
+{
+    x = __builtin_bswap32(x);
+    memcpy(ptr, &x, 4);
+}
+
+/** Compute the double-SHA256 of Lanes<V>() consecutive 64-byte inputs. */
+template<typename V>
+inline void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    V s[8], w[16];
+
+    // The inputs, transposed so that each lane holds the words of one input
+    for (int i = 0; i < 16; i++) {
+        for (int j = 0; j < Lanes<V>(); j++) {
+            w[i][j] = ReadBE32(in + 64 * j + 4 * i);
+        }
+    }
+    Initialize(s);
+    Transform(s, w);
+
+    // The padding of a 64-byte message
+    w[0] = Broadcast<V>(0x80000000ul);
+    for (int i = 1; i < 15; i++) {
+        w[i] = V{};
+    }
+    w[15] = Broadcast<V>(512);
+    Transform(s, w);
+
+    // The first hash, padded to a block of its own
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+    }
+    w[8] = Broadcast<V>(0x80000000ul);
+    for (int i = 9; i < 15; i++) {
+        w[i] = V{};
+    }
+    w[15] = Broadcast<V>(256);
+    Initialize(s);
+    Transform(s, w);
+
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < Lanes<V>(); j++) {
+            WriteBE32(out + 32 * j + 4 * i, s[i][j]);
+        }
+    }
+}
+
+} // namespace sha256_multiway
+} // namespace
+
+#endif // BITCOIN_CRYPTO_SHA256_MULTIWAY_H
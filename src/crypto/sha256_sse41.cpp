@@ -0,0 +1,19 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifdef ENABLE_SSE41
+
+#include "crypto/sha256_multiway.h"
+
+namespace sha256d64_sse41 {
+
+void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    typedef uint32_t v4u32 __attribute__((vector_size(16)));
+    sha256_multiway::TransformD64<v4u32>(out, in);
+}
+
+}
+
+#endif
@@ -1,6 +1,9 @@
+#include "crypto/sha256.h"
 #include "gmock/gmock.h"
 #include "key.h"
+#include "proof_verifier.h"
 #include "pubkey.h"
+#include "script/sigcache.h"
 #include "util.h"
 
 #include "librustzcash.h"
@@ -17,7 +20,10 @@ ECCryptoClosure instance_of_eccryptoclosure;
 
 int main(int argc, char **argv) {
   assert(sodium_init() != -1);
+  SHA256AutoDetect();
   ECC_Start();
+  InitSignatureCache();
+  InitProofValidityCache();
 
   fs::path sapling_spend = ZC_GetParamsDir() / "sapling-spend.params";
   fs::path sapling_output = ZC_GetParamsDir() / "sapling-output.params";
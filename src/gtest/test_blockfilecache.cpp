@@ -0,0 +1,99 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include <gtest/gtest.h>
+
+#include "blockfilecache.h"
+#include "clientversion.h"
+#include "fs.h"
+#include "streams.h"
+#include "tinyformat.h"
+
+#include <fstream>
+
+#ifndef WIN32
+
+static void AppendToFile(const fs::path& path, const std::vector<char>& data)
+{
+    std::ofstream file(path.string(), std::ios::binary | std::ios::app);
+    file.write(data.data(), data.size());
+}
+
+TEST(BlockFileCache, ReadThroughMapping) {
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+    fs::path path = dir / "blk00000.dat";
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << uint32_t(7) << std::string("block");
+    AppendToFile(path, std::vector<char>(ss.begin(), ss.end()));
+
+    CBlockFileCache cache(2);
+    auto file = cache.Get(path, 0, ss.size());
+    ASSERT_NE(file, nullptr);
+    EXPECT_EQ(file->size(), ss.size());
+
+    CMappedFileReader reader(file, 0, file->size(), SER_DISK, CLIENT_VERSION);
+    uint32_t n;
+    std::string str;
+    reader >> n >> str;
+    EXPECT_EQ(n, 7);
+    EXPECT_EQ(str, "block");
+    EXPECT_EQ(reader.size(), 0);
+    EXPECT_THROW(reader >> n, std::ios_base::failure);
+
+    // A read past the end of the file fails
+    EXPECT_EQ(cache.Get(path, 0, ss.size() + 1), nullptr);
+
+    // Once the file has grown, it is mapped again
+    AppendToFile(path, std::vector<char>(100, 'x'));
+    auto grown = cache.Get(path, ss.size(), 100);
+    ASSERT_NE(grown, nullptr);
+    EXPECT_EQ(grown->size(), ss.size() + 100);
+    EXPECT_EQ(grown->begin()[ss.size()], 'x');
+
+    // Readers of the old mapping are unaffected
+    EXPECT_EQ(std::string(file->begin() + file->size() - 5, 5), "block");
+
+    fs::remove_all(dir);
+}
+
+TEST(BlockFileCache, EvictsLeastRecentlyUsed) {
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+
+    std::vector<fs::path> paths;
+    for (int i = 0; i < 3; i++) {
+        paths.push_back(dir / strprintf("blk%05u.dat", i));
+        AppendToFile(paths.back(), std::vector<char>(16, 'a' + i));
+    }
+
+    CBlockFileCache cache(2);
+    auto file0 = cache.Get(paths[0], 0, 16);
+    ASSERT_NE(file0, nullptr);
+    ASSERT_NE(cache.Get(paths[1], 0, 16), nullptr);
+    ASSERT_NE(cache.Get(paths[0], 0, 16), nullptr);
+    EXPECT_EQ(cache.Size(), 2);
+
+    // Mapping a third file unmaps the second, which was used least recently
+    ASSERT_NE(cache.Get(paths[2], 0, 16), nullptr);
+    EXPECT_EQ(cache.Size(), 2);
+    EXPECT_EQ(cache.Get(paths[0], 0, 16), file0);
+
+    cache.Erase(paths[0]);
+    cache.Erase(paths[2]);
+    EXPECT_EQ(cache.Size(), 0);
+
+    // A missing file can't be mapped
+    fs::remove(paths[1]);
+    EXPECT_EQ(cache.Get(paths[1], 0, 16), nullptr);
+    EXPECT_EQ(cache.Size(), 0);
+
+    // Mappings outlive their removal from the cache
+    EXPECT_EQ(file0->begin()[0], 'a');
+
+    fs::remove_all(dir);
+}
+
+#endif
@@ -0,0 +1,157 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include <gtest/gtest.h>
+
+#include "arith_uint256.h"
+#include "blockindexsnapshot.h"
+#include "chain.h"
+#include "fs.h"
+#include "random.h"
+
+#include <fstream>
+#include <map>
+#include <memory>
+
+#ifndef WIN32
+
+namespace {
+
+/** A block index built from scratch, in the way LoadBlockIndexGuts fills one in. */
+class CTestBlockIndex
+{
+public:
+    std::map<uint256, std::unique_ptr<CBlockIndex>> mapIndex;
+
+    CBlockIndex* Insert(const uint256& hash)
+    {
+        auto it = mapIndex.find(hash);
+        if (it == mapIndex.end()) {
+            it = mapIndex.emplace(hash, std::unique_ptr<CBlockIndex>(new CBlockIndex())).first;
+            it->second->phashBlock = &it->first;
+        }
+        return it->second.get();
+    }
+};
+
+}
+
+TEST(BlockIndexSnapshot, RoundTrip) {
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+    fs::path path = dir / "index.snapshot";
+
+    CTestBlockIndex written;
+    std::vector<const CBlockIndex*> vWritten;
+    CBlockIndex* pprev = nullptr;
+    CBlockIndex* pforkPoint = nullptr;
+    for (int i = 0; i < 5; i++) {
+        CBlockIndex* pindex = written.Insert(GetRandHash());
+        pindex->pprev = pprev;
+        pindex->nHeight = i;
+        pindex->nFile = 1;
+        pindex->nDataPos = 1000 * i;
+        pindex->nStatus = BLOCK_VALID_SCRIPTS | BLOCK_HAVE_DATA;
+        pindex->nTx = 2;
+        pindex->nChainTx = 2 * (i + 1);
+        pindex->nChainWork = arith_uint256(i + 1);
+        pindex->nSaplingValue = -i;
+        pindex->nChainSaplingValue = -i;
+        if (i >= 3)
+            pindex->nSproutValue = 7;
+        pindex->nCachedBranchId = 0x76b809bb;
+        pindex->hashLightClientRoot = GetRandHash();
+        pindex->nNonce = GetRandHash();
+        pindex->nTime = 1477641360 + i;
+        vWritten.push_back(pindex);
+        if (i == 1)
+            pforkPoint = pindex;
+        pprev = pindex;
+    }
+    // A fork, written after entries above its height
+    CBlockIndex* pfork = written.Insert(GetRandHash());
+    pfork->pprev = pforkPoint;
+    pfork->nHeight = 2;
+    vWritten.push_back(pfork);
+
+    uint256 id = GetRandHash();
+    CBlockIndexSnapshotDBState dbState;
+    dbState.hashBestBlock = vWritten[4]->GetBlockHash();
+    dbState.nLastBlockFile = 1;
+    dbState.nLastBlockFileSize = 5000;
+    dbState.nLastUndoFileSize = 300;
+    ASSERT_TRUE(WriteBlockIndexSnapshotFile(path, id, dbState, vWritten));
+
+    CTestBlockIndex read;
+    std::vector<CBlockIndex*> vRead;
+    auto insert = [&](const uint256& hash) { return read.Insert(hash); };
+    ASSERT_TRUE(ReadBlockIndexSnapshotFile(path, id, dbState, insert, vRead));
+    ASSERT_EQ(vRead.size(), vWritten.size());
+    for (size_t i = 0; i < vRead.size(); i++) {
+        const CBlockIndex* a = vWritten[i];
+        const CBlockIndex* b = vRead[i];
+        EXPECT_EQ(a->GetBlockHash(), b->GetBlockHash());
+        EXPECT_EQ(a->pprev ? a->pprev->GetBlockHash() : uint256(), b->pprev ? b->pprev->GetBlockHash() : uint256());
+        EXPECT_EQ(a->nHeight, b->nHeight);
+        EXPECT_EQ(a->nDataPos, b->nDataPos);
+        EXPECT_EQ(a->nStatus, b->nStatus);
+        EXPECT_EQ(a->nChainTx, b->nChainTx);
+        EXPECT_EQ(a->nChainWork, b->nChainWork);
+        EXPECT_EQ(a->nSproutValue, b->nSproutValue);
+        EXPECT_EQ(a->nChainSproutValue, b->nChainSproutValue);
+        EXPECT_EQ(a->nSaplingValue, b->nSaplingValue);
+        EXPECT_EQ(a->nChainSaplingValue, b->nChainSaplingValue);
+        EXPECT_EQ(a->nCachedBranchId, b->nCachedBranchId);
+        EXPECT_EQ(a->GetBlockTime(), b->GetBlockTime());
+        EXPECT_EQ(a->hashLightClientRoot, b->hashLightClientRoot);
+        EXPECT_EQ(a->nNonce, b->nNonce);
+        EXPECT_FALSE(b->HasSolution());
+    }
+
+    // A snapshot with another id is not loaded
+    CTestBlockIndex other;
+    std::vector<CBlockIndex*> vOther;
+    auto insertOther = [&](const uint256& hash) { return other.Insert(hash); };
+    EXPECT_FALSE(ReadBlockIndexSnapshotFile(path, GetRandHash(), dbState, insertOther, vOther));
+    EXPECT_TRUE(other.mapIndex.empty());
+
+    // Nor is one written against another state of the databases
+    CBlockIndexSnapshotDBState otherState = dbState;
+    otherState.hashBestBlock = vWritten[3]->GetBlockHash();
+    EXPECT_FALSE(ReadBlockIndexSnapshotFile(path, id, otherState, insertOther, vOther));
+    otherState = dbState;
+    otherState.nLastBlockFileSize += 1000;
+    EXPECT_FALSE(ReadBlockIndexSnapshotFile(path, id, otherState, insertOther, vOther));
+    EXPECT_TRUE(other.mapIndex.empty());
+
+    // Nor is a corrupt one
+    {
+        std::fstream file(path.string(), std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(-1, std::ios::end);
+        file.put('x');
+    }
+    EXPECT_FALSE(ReadBlockIndexSnapshotFile(path, id, dbState, insertOther, vOther));
+    EXPECT_TRUE(other.mapIndex.empty());
+
+    fs::remove_all(dir);
+}
+
+TEST(BlockIndexSnapshot, ParentsComeFirst) {
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+    fs::path path = dir / "index.snapshot";
+
+    CTestBlockIndex index;
+    CBlockIndex* pgenesis = index.Insert(GetRandHash());
+    CBlockIndex* pchild = index.Insert(GetRandHash());
+    pchild->pprev = pgenesis;
+    pchild->nHeight = 1;
+
+    EXPECT_FALSE(WriteBlockIndexSnapshotFile(path, GetRandHash(), CBlockIndexSnapshotDBState(), {pchild, pgenesis}));
+    EXPECT_FALSE(fs::exists(path));
+
+    fs::remove_all(dir);
+}
+
+#endif
@@ -4,6 +4,8 @@
 #include "consensus/validation.h"
 #include "main.h"
 #include "proof_verifier.h"
+#include "random.h"
+#include "transaction_builder.h"
 #include "utiltest.h"
 #include "zcash/Proof.hpp"
 
@@ -69,6 +71,31 @@ TEST(CheckBlock, BlockSproutRejectsBadVersion) {
 }
 
 
+// Test that a block that has passed CheckBlock is not checked again, other
+// than its proofs.
+TEST(CheckBlock, SkipsRepeatedChecks) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    CBlock block = Params().GenesisBlock();
+    auto verifier = ProofVerifier::Disabled();
+    CValidationState state;
+
+    // Blocks are only marked as checked when their proof of work and merkle
+    // root have been checked.
+    EXPECT_TRUE(CheckBlock(block, state, Params(), verifier, false, false, true));
+    EXPECT_FALSE(block.fChecked);
+    EXPECT_TRUE(CheckBlock(block, state, Params(), verifier, true, true, true));
+    EXPECT_TRUE(block.fChecked);
+
+    block.hashMerkleRoot = uint256();
+    EXPECT_TRUE(CheckBlock(block, state, Params(), verifier, true, true, true));
+
+    block.fChecked = false;
+    EXPECT_FALSE(CheckBlock(block, state, Params(), verifier, true, true, true));
+    EXPECT_FALSE(block.fChecked);
+}
+
+
 class ContextualCheckBlockTest : public ::testing::Test {
 protected:
     void SetUp() override {
@@ -381,3 +408,76 @@ TEST_F(ContextualCheckBlockTest, BlockBlossomRulesRejectOtherTx) {
         ExpectInvalidBlockFromTx(CTransaction(mtx), 100, "bad-sapling-tx-version-group-id");
     }
 }
+
+
+// Test that Sapling transactions spread across several batches, which are
+// validated in parallel on the script check queue, are accepted, and that a
+// block in which one batch fails is rejected with the same reason as when
+// its transactions are checked one at a time.
+TEST_F(ContextualCheckBlockTest, SaplingBatchesRejectWithTransactionReason) {
+    SelectParams(CBaseChainParams::REGTEST);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, 1);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, 1);
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    CMutableTransaction mtxCoinbase = GetFirstBlockCoinbaseTx();
+    mtxCoinbase.fOverwintered = true;
+    mtxCoinbase.nVersion = SAPLING_TX_VERSION;
+    mtxCoinbase.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+
+    // Transactions from a transparent input to a Sapling address
+    CBasicKeyStore keyStore;
+    CKey tsk = AddTestCKeyToKeyStore(keyStore);
+    auto scriptPubKey = GetScriptForDestination(tsk.GetPubKey().GetID());
+    auto sk = GetTestMasterSaplingSpendingKey();
+    auto fvk = sk.expsk.full_viewing_key();
+    std::vector<CTransaction> saplingTxs;
+    for (int i = 0; i < 4; i++) {
+        auto builder = TransactionBuilder(consensusParams, 1, &keyStore);
+        builder.SetFee(0);
+        builder.AddTransparentInput(COutPoint(GetRandHash(), 0), scriptPubKey, 10);
+        builder.AddSaplingOutput(fvk.ovk, sk.DefaultAddress(), 10, {});
+        saplingTxs.push_back(builder.Build().GetTxOrThrow());
+    }
+
+    // Give the third transaction the binding signature of the fourth. It is
+    // well-formed, so it is queued, and only fails when its batch is
+    // validated.
+    CMutableTransaction mtxBad(saplingTxs[2]);
+    mtxBad.bindingSig = saplingTxs[3].bindingSig;
+    CTransaction badTx(mtxBad);
+
+    CBlock validBlock;
+    validBlock.vtx.push_back(CTransaction(mtxCoinbase));
+    validBlock.vtx.insert(validBlock.vtx.end(), saplingTxs.begin(), saplingTxs.end());
+    CBlock invalidBlock = validBlock;
+    invalidBlock.vtx[3] = badTx;
+
+    CBlockIndex indexPrev {Params().GenesisBlock()};
+    std::string reason = "bad-txns-sapling-binding-signature-invalid";
+
+    {
+        MockCValidationState state;
+        EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, reason, false)).Times(1);
+        EXPECT_FALSE(ContextualCheckTransaction(badTx, state, Params(), 1, true));
+    }
+
+    int nPrevScriptCheckThreads = nScriptCheckThreads;
+    for (int nThreads : {0, 2, 3}) {
+        SCOPED_TRACE(nThreads);
+        nScriptCheckThreads = nThreads;
+        {
+            MockCValidationState state;
+            EXPECT_CALL(state, DoS(::testing::_, ::testing::_, ::testing::_, ::testing::_, ::testing::_)).Times(0);
+            EXPECT_TRUE(ContextualCheckBlock(validBlock, state, Params(), &indexPrev, true));
+        }
+        {
+            // The failed batch falls back to checking each transaction,
+            // which finds the invalid one.
+            MockCValidationState state;
+            EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, reason, false)).Times(1);
+            EXPECT_FALSE(ContextualCheckBlock(invalidBlock, state, Params(), &indexPrev, true));
+        }
+    }
+    nScriptCheckThreads = nPrevScriptCheckThreads;
+}
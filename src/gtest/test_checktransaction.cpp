@@ -1338,3 +1338,37 @@ TEST(ChecktransactionTests, CanopyAcceptsZeroVPubOld) {
     RegtestDeactivateCanopy();
 
 }
+
+TEST(ChecktransactionTests, ProofValidityCache) {
+    auto saplingBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId;
+    auto canopyBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_CANOPY].nBranchId;
+
+    // The empty Groth16 proofs of this transaction don't verify
+    CMutableTransaction mtx = GetValidTransaction(saplingBranchId);
+    CTransaction tx(mtx);
+
+    CValidationState state;
+    auto verifier = ProofVerifier::Cached(saplingBranchId);
+    EXPECT_FALSE(verifier.IsCached(tx));
+    EXPECT_FALSE(CheckTransaction(tx, state, verifier));
+
+    // Once the transaction is in the cache, its proofs are skipped, but only
+    // for the branch under which it was verified
+    ProofValidityCacheAdd(tx.GetHash(), saplingBranchId);
+    EXPECT_TRUE(ProofValidityCacheContains(tx.GetHash(), saplingBranchId));
+    EXPECT_FALSE(ProofValidityCacheContains(tx.GetHash(), canopyBranchId));
+
+    CValidationState state2;
+    EXPECT_TRUE(verifier.IsCached(tx));
+    EXPECT_TRUE(CheckTransaction(tx, state2, verifier));
+
+    CValidationState state3;
+    auto otherVerifier = ProofVerifier::Cached(canopyBranchId);
+    EXPECT_FALSE(CheckTransaction(tx, state3, otherVerifier));
+
+    // Strict verifiers never consult the cache
+    CValidationState state4;
+    auto strictVerifier = ProofVerifier::Strict();
+    EXPECT_FALSE(strictVerifier.IsCached(tx));
+    EXPECT_FALSE(CheckTransaction(tx, state4, strictVerifier));
+}
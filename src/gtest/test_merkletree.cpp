@@ -285,3 +285,90 @@ TEST(merkletree, testZeroElements) {
         ASSERT_TRUE(newTree.root() == oldroot);
     }
 }
+
+template<typename T>
+std::vector<unsigned char> serialized(const T& t) {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << t;
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
+TEST(merkletree, WitnessUpdater) {
+    // Fill a testing tree in batches of various sizes, witnessing some of the
+    // commitments, and check that the witnesses are the same as those built
+    // by appending every commitment to every witness.
+    for (size_t batchSize : {1, 2, 3, 5, 7, 16}) {
+        for (int every : {1, 3, 4}) {
+            SproutTestingMerkleTree tree, expectedTree;
+            std::vector<SproutTestingWitness> witnesses, expectedWitnesses;
+
+            for (int start = 0; start < 16; start += batchSize) {
+                SproutTestingWitnessUpdater updater(tree);
+                for (auto& witness : witnesses) {
+                    updater.track(witness);
+                }
+
+                std::vector<uint64_t> requested;
+                for (int i = start; i < std::min(16, start + (int) batchSize); i++) {
+                    uint256 cm;
+                    cm.begin()[0] = i + 1;
+                    uint64_t position = updater.append(cm);
+                    ASSERT_EQ(i, position);
+
+                    expectedTree.append(cm);
+                    for (auto& witness : expectedWitnesses) {
+                        witness.append(cm);
+                    }
+                    if (i % every == 0) {
+                        updater.witness(position);
+                        requested.push_back(position);
+                        expectedWitnesses.push_back(expectedTree.witness());
+                    }
+                }
+
+                auto newWitnesses = updater.apply();
+                ASSERT_EQ(requested.size(), newWitnesses.size());
+                for (uint64_t position : requested) {
+                    witnesses.push_back(newWitnesses.at(position));
+                }
+
+                ASSERT_TRUE(tree == expectedTree);
+                ASSERT_EQ(expectedWitnesses.size(), witnesses.size());
+                for (size_t i = 0; i < witnesses.size(); i++) {
+                    EXPECT_EQ(expectedWitnesses[i].root(), witnesses[i].root());
+                    EXPECT_EQ(serialized(expectedWitnesses[i].path()), serialized(witnesses[i].path()));
+                    EXPECT_EQ(serialized(expectedWitnesses[i]), serialized(witnesses[i]));
+                }
+            }
+        }
+    }
+}
+
+TEST(merkletree, WitnessUpdaterAppendsToStaleWitness) {
+    SproutTestingMerkleTree tree;
+    uint256 cm;
+    tree.append(cm);
+    auto stale = tree.witness();
+    for (int i = 0; i < 3; i++) {
+        tree.append(cm);
+    }
+    auto current = tree.witness();
+
+    // The stale witness is missing the last three commitments, so it gets
+    // the new commitment appended as it would without the updater, and does
+    // not prevent the current witness from being updated.
+    auto expectedStale = stale;
+    expectedStale.append(cm);
+    auto expectedCurrent = current;
+    expectedCurrent.append(cm);
+
+    SproutTestingWitnessUpdater updater(tree);
+    updater.track(stale);
+    updater.track(current);
+    updater.append(cm);
+    ASSERT_NO_THROW(updater.apply());
+
+    EXPECT_EQ(serialized(expectedStale), serialized(stale));
+    EXPECT_EQ(serialized(expectedCurrent), serialized(current));
+    EXPECT_EQ(tree.root(), current.root());
+}
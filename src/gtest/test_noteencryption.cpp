@@ -181,6 +181,78 @@ TEST(NoteEncryption, NotePlaintext)
     }
 }
 
+TEST(NoteEncryption, SaplingKeyAgreementBatch)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    auto params = RegtestActivateSapling();
+
+    using namespace libzcash;
+    auto xsk = SaplingSpendingKey(uint256()).expanded_spending_key();
+    auto ivk = xsk.full_viewing_key().in_viewing_key();
+    SaplingPaymentAddress addr = *ivk.address({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+
+    std::array<unsigned char, ZC_MEMO_SIZE> memo = {};
+    SaplingNote note(addr, 39393, Zip212Enabled::BeforeZip212);
+    uint256 cmu = note.cmu().value();
+    auto enc = SaplingNotePlaintext(note, memo).encrypt(addr.pk_d).value();
+    auto ct = enc.first;
+    auto epk = enc.second.get_epk();
+
+    // A second note, to a different ivk
+    auto xsk2 = SaplingSpendingKey(uint256S("1")).expanded_spending_key();
+    auto ivk2 = xsk2.full_viewing_key().in_viewing_key();
+    SaplingPaymentAddress addr2 = *ivk2.address({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+    auto epk2 = SaplingNotePlaintext(SaplingNote(addr2, 5, Zip212Enabled::BeforeZip212), memo)
+        .encrypt(addr2.pk_d).value().second.get_epk();
+
+    // Not a valid scalar
+    uint256 badIvk;
+    memset(badIvk.begin(), 0xff, 32);
+
+    std::vector<uint256> epks {epk, epk2};
+    std::vector<uint256> ivks {ivk2, badIvk, ivk};
+    auto dhsecrets = SaplingKeyAgreementBatch(epks, ivks);
+    ASSERT_EQ(6, dhsecrets.size());
+
+    // Every valid entry matches the unbatched key agreement.
+    for (size_t i = 0; i < epks.size(); i++) {
+        for (size_t j = 0; j < ivks.size(); j++) {
+            uint256 expected;
+            bool valid = librustzcash_sapling_ka_agree(epks[i].begin(), ivks[j].begin(), expected.begin());
+            ASSERT_EQ(valid, (bool) dhsecrets[i * ivks.size() + j]);
+            if (valid) {
+                EXPECT_EQ(expected, *dhsecrets[i * ivks.size() + j]);
+            }
+        }
+    }
+    EXPECT_FALSE(dhsecrets[1]);
+
+    // The note only decrypts with the shared secret for its own ivk.
+    EXPECT_FALSE(SaplingNotePlaintext::decrypt_with_shared_secret(
+        params, 1, ct, ivk2, epk, cmu, *dhsecrets[0]));
+    auto pt = SaplingNotePlaintext::decrypt_with_shared_secret(
+        params, 1, ct, ivk, epk, cmu, *dhsecrets[2]);
+    ASSERT_TRUE(pt);
+    EXPECT_EQ(note.value(), pt->value());
+    EXPECT_TRUE(pt->d == note.d);
+
+    // The leading bytes of the ciphertext are enough to find the note.
+    SaplingCompactCiphertext compact;
+    std::copy(ct.begin(), ct.begin() + compact.size(), compact.begin());
+    EXPECT_FALSE(SaplingNotePlaintext::decrypt_compact_with_shared_secret(
+        params, 1, compact, ivk2, epk, cmu, *dhsecrets[0]));
+    auto compactPt = SaplingNotePlaintext::decrypt_compact_with_shared_secret(
+        params, 1, compact, ivk, epk, cmu, *dhsecrets[2]);
+    ASSERT_TRUE(compactPt);
+    EXPECT_EQ(note.value(), compactPt->value());
+    EXPECT_TRUE(compactPt->d == note.d);
+    EXPECT_EQ(pt->rcm(), compactPt->rcm());
+
+    EXPECT_TRUE(SaplingKeyAgreementBatch({}, ivks).empty());
+
+    RegtestDeactivateSapling();
+}
+
 TEST(NoteEncryption, RejectsInvalidNoteZip212Enabled)
 {
     SelectParams(CBaseChainParams::REGTEST);
@@ -0,0 +1,192 @@
+// Copyright (c) 2026 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include <gtest/gtest.h>
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "consensus/consensus.h"
+#include "crypto/common.h"
+#include "fs.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+#include "version.h"
+
+class ReadBlockTest : public ::testing::Test {
+protected:
+    fs::path pathTemp;
+
+    void SetUp() override {
+        SelectParams(CBaseChainParams::MAIN);
+        pathTemp = fs::temp_directory_path() / fs::unique_path();
+        fs::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
+    }
+
+    void TearDown() override {
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        fs::remove_all(pathTemp);
+    }
+
+    // Writes the block record at nPos in block file 0, and returns the
+    // position of the block data.
+    CDiskBlockPos WriteBlock(const CBlock& block, unsigned int nPos) {
+        CDiskBlockPos pos(0, nPos);
+        EXPECT_TRUE(WriteBlockToDisk(block, pos, Params().MessageStart()));
+        return pos;
+    }
+
+    // Returns the end of the block record whose data starts at pos.
+    static unsigned int EndOf(const CBlock& block, const CDiskBlockPos& pos) {
+        return pos.nPos + ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    }
+};
+
+// The index entry for a block that has reached the given validity level,
+// stored at pos
+static CBlockIndex IndexEntry(const uint256& hash, const CDiskBlockPos& pos, unsigned int nValidity)
+{
+    CBlockIndex index;
+    index.phashBlock = &hash;
+    index.nFile = pos.nFile;
+    index.nDataPos = pos.nPos;
+    index.nStatus = BLOCK_HAVE_DATA | nValidity;
+    return index;
+}
+
+// A block that fails the Equihash solution and proof of work checks
+static CBlock UnsolvedBlock()
+{
+    CBlock block = Params().GenesisBlock();
+    block.nNonce = ArithToUint256(UintToArith256(block.nNonce) + 1);
+    return block;
+}
+
+TEST_F(ReadBlockTest, SkipsHeaderCheckForValidTreeEntry) {
+    CBlock unsolved = UnsolvedBlock();
+    CDiskBlockPos pos = WriteBlock(unsolved, 0);
+    uint256 hash = unsolved.GetHash();
+
+    // Read by position, the header is checked
+    CBlock block;
+    EXPECT_FALSE(ReadBlockFromDisk(block, pos, Params().GetConsensus()));
+
+    // Read through an index entry that has reached BLOCK_VALID_TREE, its
+    // header was checked when it was accepted
+    CBlockIndex index = IndexEntry(hash, pos, BLOCK_VALID_TREE);
+    EXPECT_TRUE(ReadBlockFromDisk(block, &index, Params().GetConsensus()));
+    EXPECT_EQ(block.GetHash(), hash);
+}
+
+TEST_F(ReadBlockTest, ChecksHeaderBelowValidTree) {
+    CBlock solved = Params().GenesisBlock();
+    CBlock unsolved = UnsolvedBlock();
+    CDiskBlockPos posSolved = WriteBlock(solved, 0);
+    CDiskBlockPos posUnsolved = WriteBlock(unsolved, EndOf(solved, posSolved));
+    uint256 hashSolved = solved.GetHash();
+    uint256 hashUnsolved = unsolved.GetHash();
+
+    CBlock block;
+    CBlockIndex indexSolved = IndexEntry(hashSolved, posSolved, BLOCK_VALID_HEADER);
+    EXPECT_TRUE(ReadBlockFromDisk(block, &indexSolved, Params().GetConsensus()));
+    EXPECT_EQ(block.GetHash(), hashSolved);
+
+    CBlockIndex indexUnsolved = IndexEntry(hashUnsolved, posUnsolved, BLOCK_VALID_HEADER);
+    EXPECT_FALSE(ReadBlockFromDisk(block, &indexUnsolved, Params().GetConsensus()));
+
+    // An entry that has failed validation is below BLOCK_VALID_TREE too
+    indexUnsolved = IndexEntry(hashUnsolved, posUnsolved, BLOCK_VALID_TREE);
+    indexUnsolved.nStatus |= BLOCK_FAILED_VALID;
+    EXPECT_FALSE(ReadBlockFromDisk(block, &indexUnsolved, Params().GetConsensus()));
+}
+
+TEST_F(ReadBlockTest, RejectsBlockNotMatchingIndex) {
+    CBlock solved = Params().GenesisBlock();
+    CBlock unsolved = UnsolvedBlock();
+    CDiskBlockPos posSolved = WriteBlock(solved, 0);
+    CDiskBlockPos posUnsolved = WriteBlock(unsolved, EndOf(solved, posSolved));
+    uint256 hashSolved = solved.GetHash();
+    uint256 hashUnsolved = unsolved.GetHash();
+
+    // Each entry points at the other block
+    CBlock block;
+    CBlockIndex indexSolved = IndexEntry(hashSolved, posUnsolved, BLOCK_VALID_TREE);
+    EXPECT_FALSE(ReadBlockFromDisk(block, &indexSolved, Params().GetConsensus()));
+    CBlockIndex indexUnsolved = IndexEntry(hashUnsolved, posSolved, BLOCK_VALID_TREE);
+    EXPECT_FALSE(ReadBlockFromDisk(block, &indexUnsolved, Params().GetConsensus()));
+}
+
+TEST_F(ReadBlockTest, ReadsRawBlockAsSerialized) {
+    CBlock solved = Params().GenesisBlock();
+    CBlock unsolved = UnsolvedBlock();
+    CDiskBlockPos posSolved = WriteBlock(solved, 0);
+    CDiskBlockPos posUnsolved = WriteBlock(unsolved, EndOf(solved, posSolved));
+    uint256 hashSolved = solved.GetHash();
+    uint256 hashUnsolved = unsolved.GetHash();
+
+    // The raw block is exactly the serialized block, without the record
+    // header or the blocks around it
+    std::vector<uint8_t> vBlock;
+    CBlockIndex indexSolved = IndexEntry(hashSolved, posSolved, BLOCK_VALID_HEADER);
+    EXPECT_TRUE(ReadRawBlockFromDisk(vBlock, &indexSolved, Params().MessageStart(), Params().GetConsensus()));
+    CDataStream ssSolved(SER_NETWORK, PROTOCOL_VERSION);
+    ssSolved << solved;
+    EXPECT_EQ(vBlock, std::vector<uint8_t>(ssSolved.begin(), ssSolved.end()));
+
+    CBlockIndex indexUnsolved = IndexEntry(hashUnsolved, posUnsolved, BLOCK_VALID_TREE);
+    EXPECT_TRUE(ReadRawBlockFromDisk(vBlock, &indexUnsolved, Params().MessageStart(), Params().GetConsensus()));
+    CDataStream ssUnsolved(SER_NETWORK, PROTOCOL_VERSION);
+    ssUnsolved << unsolved;
+    EXPECT_EQ(vBlock, std::vector<uint8_t>(ssUnsolved.begin(), ssUnsolved.end()));
+}
+
+TEST_F(ReadBlockTest, RejectsRawBlockNotMatchingIndex) {
+    CBlock solved = Params().GenesisBlock();
+    CBlock unsolved = UnsolvedBlock();
+    CDiskBlockPos posSolved = WriteBlock(solved, 0);
+    CDiskBlockPos posUnsolved = WriteBlock(unsolved, EndOf(solved, posSolved));
+    CDiskBlockPos posCorrupt = WriteBlock(solved, EndOf(unsolved, posUnsolved));
+    uint256 hashSolved = solved.GetHash();
+    uint256 hashUnsolved = unsolved.GetHash();
+
+    // Give the last record a size prefix that is larger than any block
+    {
+        FILE* file = fsbridge::fopen(GetBlockPosFilename(posCorrupt, "blk"), "rb+");
+        ASSERT_TRUE(file != nullptr);
+        unsigned char nSize[4];
+        WriteLE32(nSize, MAX_BLOCK_SIZE + 1);
+        ASSERT_EQ(fseek(file, posCorrupt.nPos - sizeof(nSize), SEEK_SET), 0);
+        ASSERT_EQ(fwrite(nSize, sizeof(nSize), 1, file), 1u);
+        fclose(file);
+    }
+
+    std::vector<uint8_t> vBlock;
+    auto ReadRaw = [&](const uint256& hash, const CDiskBlockPos& pos, unsigned int nValidity) {
+        CBlockIndex index = IndexEntry(hash, pos, nValidity);
+        bool fRead = ReadRawBlockFromDisk(vBlock, &index, Params().MessageStart(), Params().GetConsensus());
+        EXPECT_TRUE(fRead || vBlock.empty());
+        return fRead;
+    };
+
+    // The entry points at another block
+    EXPECT_FALSE(ReadRaw(hashSolved, posUnsolved, BLOCK_VALID_TREE));
+    EXPECT_FALSE(ReadRaw(hashUnsolved, posSolved, BLOCK_VALID_TREE));
+
+    // The entry points into the middle of a record, so the message start
+    // and size prefix before it are not those of a block
+    CDiskBlockPos posInside(posSolved.nFile, posSolved.nPos + 1);
+    EXPECT_FALSE(ReadRaw(hashSolved, posInside, BLOCK_VALID_TREE));
+
+    // The size prefix of the record is invalid
+    EXPECT_FALSE(ReadRaw(hashSolved, posCorrupt, BLOCK_VALID_TREE));
+
+    // The header doesn't pass the checks that an entry below
+    // BLOCK_VALID_TREE still needs
+    EXPECT_FALSE(ReadRaw(hashUnsolved, posUnsolved, BLOCK_VALID_HEADER));
+    EXPECT_TRUE(ReadRaw(hashUnsolved, posUnsolved, BLOCK_VALID_TREE));
+}
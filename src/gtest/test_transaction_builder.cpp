@@ -149,6 +149,57 @@ TEST(TransactionBuilder, SaplingToSapling) {
     RegtestDeactivateSapling();
 }
 
+TEST(TransactionBuilder, SaplingBatchVerification) {
+    auto consensusParams = RegtestActivateSapling();
+
+    auto sk = libzcash::SaplingSpendingKey::random();
+    auto expsk = sk.expanded_spending_key();
+    auto fvk = sk.full_viewing_key();
+    auto pa = sk.default_address();
+
+    auto buildTx = [&]() {
+        auto testNote = GetTestSaplingNote(pa, 40000);
+        auto builder = TransactionBuilder(consensusParams, 2);
+        builder.AddSaplingSpend(expsk, testNote.note, testNote.tree.root(), testNote.tree.witness());
+        builder.AddSaplingOutput(fvk.ovk, pa, 25000, {});
+        return builder.Build().GetTxOrThrow();
+    };
+    auto tx1 = buildTx();
+    auto tx2 = buildTx();
+
+    // Valid transactions pass as a batch
+    {
+        SaplingBatchVerifier batch;
+        CValidationState state;
+        EXPECT_TRUE(ContextualCheckTransaction(tx1, state, Params(), 3, true, IsInitialBlockDownload, &batch));
+        EXPECT_TRUE(ContextualCheckTransaction(tx2, state, Params(), 3, true, IsInitialBlockDownload, &batch));
+        EXPECT_TRUE(batch.Validate());
+    }
+
+    // A well-formed but invalid binding signature is only caught by the batch
+    CMutableTransaction mtx(tx1);
+    mtx.bindingSig = tx2.bindingSig;
+    CTransaction badTx(mtx);
+    {
+        SaplingBatchVerifier batch;
+        CValidationState state;
+        EXPECT_TRUE(ContextualCheckTransaction(tx2, state, Params(), 3, true, IsInitialBlockDownload, &batch));
+        EXPECT_TRUE(ContextualCheckTransaction(badTx, state, Params(), 3, true, IsInitialBlockDownload, &batch));
+        EXPECT_FALSE(batch.Validate());
+
+        // The batch is emptied by validation
+        EXPECT_TRUE(batch.Validate());
+    }
+
+    // Checking individually identifies the invalid transaction
+    CValidationState state;
+    EXPECT_FALSE(ContextualCheckTransaction(badTx, state, Params(), 3, true));
+    EXPECT_EQ(state.GetRejectReason(), "bad-txns-sapling-binding-signature-invalid");
+
+    // Revert to default
+    RegtestDeactivateSapling();
+}
+
 TEST(TransactionBuilder, SaplingToSprout) {
     auto consensusParams = RegtestActivateSapling();
 
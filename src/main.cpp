@@ -9,6 +9,8 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockfilecache.h"
+#include "blockindexsnapshot.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -26,6 +28,7 @@
 #include "policy/policy.h"
 #include "pow.h"
 #include "reverse_iterator.h"
+#include "script/sigcache.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "undo.h"
@@ -38,7 +41,10 @@
 
 #include <algorithm>
 #include <atomic>
+#include <future>
+#include <list>
 #include <sstream>
+#include <thread>
 #include <variant>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -71,6 +77,7 @@ int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fTxIndex = false;
+bool fShieldedIndex = false;
 bool fAddressIndex = false;     // insightexplorer || lightwalletd
 bool fSpentIndex = false;       // insightexplorer
 bool fTimestampIndex = false;   // insightexplorer
@@ -79,6 +86,7 @@ bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fBlockIndexSnapshot = DEFAULT_BLOCK_INDEX_SNAPSHOT;
 bool fIBDSkipTxVerification = DEFAULT_IBD_SKIP_TX_VERIFICATION;
 bool fCoinbaseEnforcedShieldingEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
@@ -260,6 +268,9 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** Whether mapBlockIndex holds the whole block index, rather than part of a failed load. */
+    bool fBlockIndexLoaded = false;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -608,7 +619,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
     return chain.Genesis();
 }
 
-CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewSharedCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -799,7 +810,8 @@ bool ContextualCheckTransaction(
         const CChainParams& chainparams,
         const int nHeight,
         const bool isMined,
-        bool (*isInitBlockDownload)(const Consensus::Params&))
+        bool (*isInitBlockDownload)(const Consensus::Params&),
+        SaplingBatchVerifier* saplingBatch)
 {
     const int DOS_LEVEL_BLOCK = 100;
     // DoS level set to 10 to be more forgiving.
@@ -1056,7 +1068,7 @@ bool ContextualCheckTransaction(
 
     if (!tx.vJoinSplit.empty())
     {
-        if (!ed25519_verify(&tx.joinSplitPubKey, &tx.joinSplitSig, dataToBeSigned.begin(), 32)) {
+        if (!CachingJoinSplitSigVerify(tx.joinSplitPubKey, tx.joinSplitSig, dataToBeSigned, !isMined)) {
             // Check whether the failure was caused by an outdated consensus
             // branch ID; if so, inform the node that they need to upgrade. We
             // only check the previous epoch's branch ID, on the assumption that
@@ -1078,24 +1090,32 @@ bool ContextualCheckTransaction(
         }
     }
 
-    if (!tx.vShieldedSpend.empty() ||
-        !tx.vShieldedOutput.empty())
+    // Proofs and signatures that were verified when the transaction was
+    // accepted to the mempool, under the same consensus rules, are not
+    // verified again.
+    if ((!tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) &&
+        !(isMined && ProofValidityCacheContains(tx.GetHash(), consensusBranchId)))
     {
-        auto ctx = librustzcash_sapling_verification_ctx_init();
+        // When batching, proofs and signatures are only queued here, and are
+        // verified for the whole block by ContextualCheckBlock.
+        auto ctx = saplingBatch ? nullptr : librustzcash_sapling_verification_ctx_init();
 
         for (const SpendDescription &spend : tx.vShieldedSpend) {
-            if (!librustzcash_sapling_check_spend(
-                ctx,
-                spend.cv.begin(),
-                spend.anchor.begin(),
-                spend.nullifier.begin(),
-                spend.rk.begin(),
-                spend.zkproof.begin(),
-                spend.spendAuthSig.begin(),
-                dataToBeSigned.begin()
-            ))
+            bool validSpend = saplingBatch ?
+                saplingBatch->QueueSpend(spend, dataToBeSigned) :
+                librustzcash_sapling_check_spend(
+                    ctx,
+                    spend.cv.begin(),
+                    spend.anchor.begin(),
+                    spend.nullifier.begin(),
+                    spend.rk.begin(),
+                    spend.zkproof.begin(),
+                    spend.spendAuthSig.begin(),
+                    dataToBeSigned.begin()
+                );
+            if (!validSpend)
             {
-                librustzcash_sapling_verification_ctx_free(ctx);
+                if (ctx) librustzcash_sapling_verification_ctx_free(ctx);
                 return state.DoS(
                     dosLevelPotentiallyRelaxing,
                     error("ContextualCheckTransaction(): Sapling spend description invalid"),
@@ -1104,15 +1124,18 @@ bool ContextualCheckTransaction(
         }
 
         for (const OutputDescription &output : tx.vShieldedOutput) {
-            if (!librustzcash_sapling_check_output(
-                ctx,
-                output.cv.begin(),
-                output.cmu.begin(),
-                output.ephemeralKey.begin(),
-                output.zkproof.begin()
-            ))
+            bool validOutput = saplingBatch ?
+                saplingBatch->QueueOutput(output) :
+                librustzcash_sapling_check_output(
+                    ctx,
+                    output.cv.begin(),
+                    output.cmu.begin(),
+                    output.ephemeralKey.begin(),
+                    output.zkproof.begin()
+                );
+            if (!validOutput)
             {
-                librustzcash_sapling_verification_ctx_free(ctx);
+                if (ctx) librustzcash_sapling_verification_ctx_free(ctx);
                 // This should be a non-contextual check, but we check it here
                 // as we need to pass over the outputs anyway in order to then
                 // call librustzcash_sapling_final_check().
@@ -1121,21 +1144,24 @@ bool ContextualCheckTransaction(
             }
         }
 
-        if (!librustzcash_sapling_final_check(
-            ctx,
-            tx.valueBalance,
-            tx.bindingSig.begin(),
-            dataToBeSigned.begin()
-        ))
+        bool validBindingSig = saplingBatch ?
+            saplingBatch->QueueBindingSig(tx, dataToBeSigned) :
+            librustzcash_sapling_final_check(
+                ctx,
+                tx.valueBalance,
+                tx.bindingSig.begin(),
+                dataToBeSigned.begin()
+            );
+        if (!validBindingSig)
         {
-            librustzcash_sapling_verification_ctx_free(ctx);
+            if (ctx) librustzcash_sapling_verification_ctx_free(ctx);
             return state.DoS(
                 dosLevelPotentiallyRelaxing,
                 error("ContextualCheckTransaction(): Sapling binding signature invalid"),
                 REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
         }
 
-        librustzcash_sapling_verification_ctx_free(ctx);
+        if (ctx) librustzcash_sapling_verification_ctx_free(ctx);
     }
     return true;
 }
@@ -1153,10 +1179,12 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state,
         return false;
     } else {
         // Ensure that zk-SNARKs verify
-        for (const JSDescription &joinsplit : tx.vJoinSplit) {
-            if (!verifier.VerifySprout(joinsplit, tx.joinSplitPubKey)) {
-                return state.DoS(100, error("CheckTransaction(): joinsplit does not verify"),
-                                    REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+        if (!tx.vJoinSplit.empty() && !verifier.IsCached(tx)) {
+            for (const JSDescription &joinsplit : tx.vJoinSplit) {
+                if (!verifier.VerifySprout(joinsplit, tx.joinSplitPubKey)) {
+                    return state.DoS(100, error("CheckTransaction(): joinsplit does not verify"),
+                                        REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+                }
             }
         }
 
@@ -1652,6 +1680,20 @@ bool AcceptToMemoryPool(
             return state.Error("AcceptToMemoryPool: " + errmsg);
         }
 
+        // Calculate in-mempool ancestors, up to a limit. The set is kept for
+        // addUnchecked; cs_main stops the mempool from changing in between.
+        CTxMemPool::setEntries setAncestors;
+        {
+            LOCK(pool.cs);
+            size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+            size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+            std::string errString;
+            if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitDescendants, errString)) {
+                return state.DoS(0, error("AcceptToMemoryPool: %s %s", hash.ToString(), errString),
+                                 REJECT_NONSTANDARD, "too-long-mempool-chain");
+            }
+        }
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
@@ -1674,12 +1716,18 @@ bool AcceptToMemoryPool(
             return error("AcceptToMemoryPool: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
 
+        // The transaction's proofs and signatures have all been verified, so
+        // they needn't be verified again when it is mined.
+        if (!tx.vJoinSplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+            ProofValidityCacheAdd(hash, consensusBranchId);
+        }
+
         {
             // We lock to prevent other threads from accessing the mempool between adding and evicting
             LOCK(pool.cs);
 
             // Store transaction in memory
-            pool.addUnchecked(hash, entry, !IsInitialBlockDownload(chainparams.GetConsensus()));
+            pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload(chainparams.GetConsensus()));
 
             // Add memory address index
             if (fAddressIndex) {
@@ -1800,10 +1848,9 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::P
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
             int nHeight = -1;
             {
-                CCoinsViewCache &view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
+                CCoins coins;
+                if (pcoinsTip->GetCoins(hash, coins))
+                    nHeight = coins.nHeight;
             }
             if (nHeight > 0)
                 pindexSlow = chainActive[nHeight];
@@ -1831,6 +1878,97 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::P
 // CBlock and CBlockIndex
 //
 
+/** The block and undo files that were read most recently, kept mapped. */
+static CBlockFileCache blockFileCache(MAX_MAPPED_BLOCK_FILES);
+
+/**
+ * The Equihash solutions that were most recently read back from the block
+ * tree database, most recent first. Most reads are of headers near the tip,
+ * which are sent to peers, so this only needs to hold a few getheaders
+ * responses' worth.
+ */
+static CCriticalSection cs_solutionCache;
+static std::list<std::pair<uint256, std::vector<unsigned char>>> listSolutionCache;
+static std::map<uint256, decltype(listSolutionCache)::iterator> mapSolutionCache;
+
+std::vector<unsigned char> CBlockIndex::GetSolution() const
+{
+    // FlushStateToDisk trims solutions under cs_main
+    AssertLockHeld(cs_main);
+    if (HasSolution())
+        return nSolution;
+
+    uint256 hash = GetBlockHash();
+    LOCK(cs_solutionCache);
+    auto it = mapSolutionCache.find(hash);
+    if (it != mapSolutionCache.end()) {
+        listSolutionCache.splice(listSolutionCache.begin(), listSolutionCache, it->second);
+        return it->second->second;
+    }
+
+    CDiskBlockIndex dbindex;
+    if (!pblocktree || !pblocktree->ReadDiskBlockIndex(hash, dbindex)) {
+        LogPrintf("%s: Failed to read block index entry %s\n", __func__, hash.ToString());
+        throw std::runtime_error("Failed to read block index entry");
+    }
+    listSolutionCache.emplace_front(hash, dbindex.GetDiskSolution());
+    mapSolutionCache[hash] = listSolutionCache.begin();
+    if (listSolutionCache.size() > SOLUTION_CACHE_SIZE) {
+        mapSolutionCache.erase(listSolutionCache.back().first);
+        listSolutionCache.pop_back();
+    }
+    return listSolutionCache.front().second;
+}
+
+CBlockHeader CBlockIndex::GetBlockHeader() const
+{
+    AssertLockHeld(cs_main);
+    CBlockHeader block;
+    block.nVersion       = nVersion;
+    if (pprev)
+        block.hashPrevBlock = pprev->GetBlockHash();
+    block.hashMerkleRoot = hashMerkleRoot;
+    block.hashLightClientRoot = hashLightClientRoot;
+    block.nTime          = nTime;
+    block.nBits          = nBits;
+    block.nNonce         = nNonce;
+    block.nSolution      = GetSolution();
+    return block;
+}
+
+/**
+ * Returns a reader over the record at pos in a block or undo file, followed
+ * by nTrailing bytes, from the block file cache. The size of the record is
+ * the one that was written just before it. If pchMessageStart is given, the
+ * message start written before the size must match it. Returns nothing if
+ * the file can't be mapped or the message start doesn't match, in which case
+ * it should be read through stdio.
+ */
+static std::optional<CMappedFileReader> MapDiskRecord(const CDiskBlockPos& pos, const char* prefix, size_t nTrailing,
+                                                      const unsigned char* pchMessageStart = nullptr)
+{
+    size_t nHeaderSize = (pchMessageStart ? MESSAGE_START_SIZE : 0) + sizeof(unsigned int);
+    if (pos.IsNull() || pos.nPos < nHeaderSize)
+        return std::nullopt;
+
+    fs::path path = GetBlockPosFilename(pos, prefix);
+    size_t nHeaderPos = pos.nPos - nHeaderSize;
+    size_t nSizePos = pos.nPos - sizeof(unsigned int);
+    std::shared_ptr<const CMappedFile> file = blockFileCache.Get(path, nHeaderPos, nHeaderSize);
+    if (!file)
+        return std::nullopt;
+    if (pchMessageStart && memcmp(file->begin() + nHeaderPos, pchMessageStart, MESSAGE_START_SIZE))
+        return std::nullopt;
+    unsigned int nSize = ReadLE32((const unsigned char*)file->begin() + nSizePos);
+    size_t nEnd = (size_t)pos.nPos + nSize + nTrailing;
+    if (nEnd > file->size()) {
+        file = blockFileCache.Get(path, pos.nPos, nSize + nTrailing);
+        if (!file)
+            return std::nullopt;
+    }
+    return CMappedFileReader(file, pos.nPos, nEnd, SER_DISK, CLIENT_VERSION);
+}
+
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
@@ -1852,34 +1990,49 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckHeader)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-
     // Read block
+    std::optional<CMappedFileReader> mapped = MapDiskRecord(pos, "blk", 0);
     try {
-        filein >> block;
+        if (mapped) {
+            *mapped >> block;
+        } else {
+            // Open history file to read
+            CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+            filein >> block;
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
     // Check the header
-    if (!(CheckEquihashSolution(&block, consensusParams) &&
+    if (fCheckHeader &&
+        !(CheckEquihashSolution(&block, consensusParams) &&
           CheckProofOfWork(block.GetHash(), block.nBits, consensusParams)))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    return ReadBlockFromDisk(block, pos, consensusParams, true);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    // The header of a block that has reached BLOCK_VALID_TREE had its
+    // Equihash solution and proof of work checked when it was accepted. The
+    // block hash commits to the whole header, so checking that the block read
+    // from disk has the hash in the index is enough to trust its header.
+    bool fCheckHeader = !pindex->IsValid(BLOCK_VALID_TREE);
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams, fCheckHeader))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1887,6 +2040,85 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+/** Checks the header of a block read by ReadRawBlockFromDisk against its index entry. */
+static bool CheckRawBlockHeader(const CBlockHeader& header, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+    if (header.GetHash() != pindex->GetBlockHash())
+        return error("ReadRawBlockFromDisk: GetHash() doesn't match index for %s at %s",
+                pindex->ToString(), pindex->GetBlockPos().ToString());
+    if (!pindex->IsValid(BLOCK_VALID_TREE) &&
+        !(CheckEquihashSolution(&header, consensusParams) &&
+          CheckProofOfWork(header.GetHash(), header.nBits, consensusParams)))
+        return error("ReadRawBlockFromDisk: Errors in block header at %s", pindex->GetBlockPos().ToString());
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart, const Consensus::Params& consensusParams)
+{
+    block.clear();
+
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    // A record whose magic doesn't match is left to the stdio path, which
+    // reports it
+    std::optional<CMappedFileReader> mapped = MapDiskRecord(pos, "blk", 0, messageStart);
+    if (mapped) {
+        try {
+            // Check the header in the same way as ReadBlockFromDisk does,
+            // without deserializing the transactions
+            const char* pbegin = mapped->data();
+            size_t nSize = mapped->size();
+            if (nSize > MAX_BLOCK_SIZE)
+                return error("ReadRawBlockFromDisk: Invalid block size %u for %s at %s", nSize, pindex->ToString(), pos.ToString());
+            CBlockHeader header;
+            *mapped >> header;
+            if (!CheckRawBlockHeader(header, pindex, consensusParams))
+                return false;
+            block.assign(pbegin, pbegin + nSize);
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+        return true;
+    }
+
+    // The block is preceded in its file by the message start and its size
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("ReadRawBlockFromDisk: Invalid block position %s", pos.ToString());
+    CDiskBlockPos hpos(pos.nFile, pos.nPos - MESSAGE_START_SIZE - sizeof(unsigned int));
+
+    // Open history file to read
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadRawBlockFromDisk: OpenBlockFile failed for %s", hpos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blkStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blkStart) >> nSize;
+        if (memcmp(blkStart, messageStart, MESSAGE_START_SIZE))
+            return error("ReadRawBlockFromDisk: Block magic mismatch for %s at %s", pindex->ToString(), pos.ToString());
+        if (nSize > MAX_BLOCK_SIZE)
+            return error("ReadRawBlockFromDisk: Invalid block size %u for %s at %s", nSize, pindex->ToString(), pos.ToString());
+
+        CBlockHeader header;
+        filein >> header;
+        if (!CheckRawBlockHeader(header, pindex, consensusParams))
+            return false;
+
+        // Read the whole block again from its start, as it is stored
+        if (fseek(filein.Get(), pos.nPos, SEEK_SET))
+            return error("ReadRawBlockFromDisk: fseek failed for %s", pos.ToString());
+        block.resize(nSize);
+        filein.read((char*)block.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        block.clear();
+        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     CAmount nSubsidy = 12.5 * COIN;
@@ -2180,6 +2412,20 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CSproutProofCheck::operator()() {
+    auto verifier = ProofVerifier::Strict();
+    for (const JSDescription &joinsplit : ptx->vJoinSplit) {
+        if (!verifier.VerifySprout(joinsplit, ptx->joinSplitPubKey)) {
+            return ::error("CSproutProofCheck(): %s joinsplit does not verify", ptx->GetHash().ToString());
+        }
+    }
+    return true;
+}
+
+bool CSaplingBatchCheck::operator()() {
+    return batch->Validate();
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -2377,16 +2623,21 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenBlockFile failed", __func__);
-
     // Read block
     uint256 hashChecksum;
+    std::optional<CMappedFileReader> mapped = MapDiskRecord(pos, "rev", sizeof(hashChecksum));
     try {
-        filein >> blockundo;
-        filein >> hashChecksum;
+        if (mapped) {
+            *mapped >> blockundo;
+            *mapped >> hashChecksum;
+        } else {
+            // Open history file to read
+            CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("%s: OpenBlockFile failed", __func__);
+            filein >> blockundo;
+            filein >> hashChecksum;
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s", __func__, e.what());
@@ -2620,6 +2871,12 @@ void static FlushBlockFile(bool fFinalize = false)
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
+    if (fFinalize) {
+        // The files are mapped up to their preallocated size
+        blockFileCache.Erase(GetBlockPosFilename(posOld, "blk"));
+        blockFileCache.Erase(GetBlockPosFilename(posOld, "rev"));
+    }
+
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
@@ -2639,7 +2896,7 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CValidationCheck> scriptcheckqueue(128);
 
 void ThreadScriptCheck() {
     RenameThread("zcash-scriptch");
@@ -2679,8 +2936,18 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         fExpensiveChecks = false;
     }
 
-    // proof verification is expensive, disable if possible
-    auto verifier = fExpensiveChecks ? ProofVerifier::Strict() : ProofVerifier::Disabled();
+    // If there are script check threads, JoinSplit proofs are verified on the
+    // check queue alongside the scripts below, instead of inline in CheckBlock.
+    bool fParallelProofs = fExpensiveChecks && nScriptCheckThreads;
+    std::vector<const CTransaction*> vSproutProofTxs;
+
+    // Grab the consensus branch ID for this block and its parent
+    auto consensusBranchId = CurrentEpochBranchId(pindex->nHeight, chainparams.GetConsensus());
+    auto prevConsensusBranchId = CurrentEpochBranchId(pindex->nHeight - 1, chainparams.GetConsensus());
+
+    // proof verification is expensive, disable if possible, and skip the
+    // proofs that were verified when their transaction entered the mempool
+    auto verifier = fExpensiveChecks && !fParallelProofs ? ProofVerifier::Cached(consensusBranchId) : ProofVerifier::Disabled();
 
     // If in initial block download, and this block is an ancestor of a checkpoint,
     // and -ibdskiptxverification is set, disable all transaction checks.
@@ -2752,7 +3019,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckQueueControl<CValidationCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -2787,10 +3054,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     SaplingMerkleTree sapling_tree;
     assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
 
-    // Grab the consensus branch ID for this block and its parent
-    auto consensusBranchId = CurrentEpochBranchId(pindex->nHeight, chainparams.GetConsensus());
-    auto prevConsensusBranchId = CurrentEpochBranchId(pindex->nHeight - 1, chainparams.GetConsensus());
-
     size_t total_sapling_tx = 0;
 
     std::vector<PrecomputedTransactionData> txdata;
@@ -2868,17 +3131,29 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
         txdata.emplace_back(tx);
 
+        std::vector<CValidationCheck> vChecks;
+
+        if (fParallelProofs && fCheckTransactions && !tx.vJoinSplit.empty() &&
+            !ProofValidityCacheContains(tx.GetHash(), consensusBranchId)) {
+            vChecks.push_back(CSproutProofCheck(tx));
+            vSproutProofTxs.push_back(&tx);
+        }
+
         if (!tx.IsCoinBase())
         {
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
 
-            std::vector<CScriptCheck> vChecks;
+            std::vector<CScriptCheck> vScriptChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, fCacheResults, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
+            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, fCacheResults, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vScriptChecks : NULL))
                 return false;
-            control.Add(vChecks);
+            for (CScriptCheck& check : vScriptChecks) {
+                vChecks.push_back(std::move(check));
+            }
         }
 
+        control.Add(vChecks);
+
         // insightexplorer
         // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2656
         if (fAddressIndex) {
@@ -3001,8 +3276,20 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                block.vtx[0].GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
-    if (!control.Wait())
+    if (!control.Wait()) {
+        // The queue doesn't say which check failed. If it was a JoinSplit
+        // proof, find it so that the reject reason is the same as when the
+        // proofs are verified by CheckBlock.
+        auto sproutVerifier = ProofVerifier::Strict();
+        for (const CTransaction* ptx : vSproutProofTxs) {
+            for (const JSDescription& joinsplit : ptx->vJoinSplit) {
+                if (!sproutVerifier.VerifySprout(joinsplit, ptx->joinSplitPubKey))
+                    return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                                     REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+            }
+        }
         return state.DoS(100, false);
+    }
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
 
@@ -3043,6 +3330,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    if (fShieldedIndex)
+        if (!pblocktree->WriteShieldedIndex(pindex->GetBlockHash(), CCompactBlock(block)))
+            return AbortNode(state, "Failed to write shielded index");
+
     // START insightexplorer
     if (fAddressIndex) {
         if (!pblocktree->WriteAddressIndex(addressIndex)) {
@@ -3087,7 +3378,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
-    GetMainSignals().UpdatedTransaction(hashPrevBestCoinBase);
+    CallFunctionInValidationInterfaceQueue([hash = hashPrevBestCoinBase] {
+        GetMainSignals().UpdatedTransaction(hash);
+    });
     hashPrevBestCoinBase = block.vtx[0].GetHash();
 
     int64_t nTime4 = GetTimeMicros(); nTimeCallbacks += nTime4 - nTime3;
@@ -3165,14 +3458,22 @@ bool static FlushStateToDisk(
                 it = setDirtyFileInfo.erase(it);
             }
             std::vector<const CBlockIndex*> vBlocks;
+            std::vector<CBlockIndex*> vWritten;
             vBlocks.reserve(setDirtyBlockIndex.size());
+            vWritten.reserve(setDirtyBlockIndex.size());
             for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
                 vBlocks.push_back(*it);
+                vWritten.push_back(*it);
                 it = setDirtyBlockIndex.erase(it);
             }
             if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                 return AbortNode(state, "Files to write to block index database");
             }
+            // The solutions of the entries that were written can now be read
+            // back from the database when they are needed.
+            for (CBlockIndex* pindex : vWritten) {
+                pindex->TrimSolution();
+            }
         }
         // Finally remove any pruned files
         if (fFlushForPrune)
@@ -3263,6 +3564,7 @@ bool static DisconnectTip(CValidationState &state, const CChainParams& chainpara
         if (DisconnectBlock(block, state, pindexDelete, view, chainparams, true) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
+        pcoinsTip->SetBestBlockHeight(pindexDelete->pprev->GetBlockHash(), pindexDelete->pprev->nHeight);
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     uint256 sproutAnchorAfterDisconnect = pcoinsTip->GetBestAnchor(SPROUT);
@@ -3337,6 +3639,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
+        pcoinsTip->SetBestBlockHeight(pindexNew->GetBlockHash(), pindexNew->nHeight);
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -3593,6 +3896,10 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
     do {
         boost::this_thread::interruption_point();
 
+        // Reindexing, importing and reconsiderblock can connect many blocks
+        // here without going through ProcessNewBlock.
+        LimitValidationInterfaceQueue();
+
         bool fInitialDownload;
         {
             LOCK(cs_main);
@@ -3625,8 +3932,10 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
                     if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
                         pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
             }
-            // Notify external listeners about the new tip.
-            GetMainSignals().UpdatedBlockTip(pindexNewTip);
+            // Notify external listeners about the new tip, off this thread.
+            CallFunctionInValidationInterfaceQueue([pindexNewTip] {
+                GetMainSignals().UpdatedBlockTip(pindexNewTip);
+            });
         }
     } while(pindexMostWork != chainActive.Tip());
     CheckBlockIndex(chainparams.GetConsensus());
@@ -4006,6 +4315,22 @@ bool CheckBlock(const CBlock& block,
 {
     // These are checks that are independent of context.
 
+    // If this block has already passed the checks below (for example on a
+    // -reindex worker thread, or in AcceptBlock), only the proofs are left.
+    if (block.fChecked) {
+        if (!fCheckTransactions) return true;
+        for (const CTransaction& tx : block.vtx) {
+            if (tx.vJoinSplit.empty() || verifier.IsCached(tx))
+                continue;
+            for (const JSDescription& joinsplit : tx.vJoinSplit) {
+                if (!verifier.VerifySprout(joinsplit, tx.joinSplitPubKey))
+                    return state.DoS(100, error("CheckBlock(): joinsplit does not verify"),
+                                     REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+            }
+        }
+        return true;
+    }
+
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
     if (!CheckBlockHeader(block, state, chainparams, fCheckPOW))
@@ -4062,6 +4387,9 @@ bool CheckBlock(const CBlock& block,
         return state.DoS(100, error("CheckBlock(): out-of-bounds SigOpCount"),
                          REJECT_INVALID, "bad-blk-sigops", true);
 
+    if (fCheckPOW && fCheckMerkleRoot)
+        block.fChecked = true;
+
     return true;
 }
 
@@ -4140,11 +4468,26 @@ bool ContextualCheckBlock(
     const Consensus::Params& consensusParams = chainparams.GetConsensus();
 
     if (fCheckTransactions) {
+        // Sapling proofs and signatures for the whole block are verified in
+        // batches once every transaction has passed its other contextual
+        // checks. With script check threads, transactions are spread across
+        // one batch per thread and the batches are validated in parallel.
+        size_t nSaplingBatches = std::max(1, nScriptCheckThreads);
+        std::vector<std::shared_ptr<SaplingBatchVerifier>> saplingBatches;
+        for (size_t i = 0; i < nSaplingBatches; i++) {
+            saplingBatches.push_back(std::make_shared<SaplingBatchVerifier>());
+        }
+        size_t nSaplingTx = 0;
+
         // Check that all transactions are finalized
         for (const CTransaction& tx : block.vtx) {
+            auto saplingBatch = saplingBatches[nSaplingTx % nSaplingBatches].get();
+            if (!(tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())) {
+                nSaplingTx++;
+            }
 
             // Check transaction contextually against consensus rules at block height
-            if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, true)) {
+            if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, true, IsInitialBlockDownload, saplingBatch)) {
                 return false; // Failure reason has been set in validation state object
             }
 
@@ -4157,6 +4500,31 @@ bool ContextualCheckBlock(
                                  REJECT_INVALID, "bad-txns-nonfinal");
             }
         }
+
+        bool fSaplingValid = true;
+        if (nSaplingTx > 1 && nSaplingBatches > 1) {
+            CCheckQueueControl<CValidationCheck> control(&scriptcheckqueue);
+            std::vector<CValidationCheck> vChecks;
+            for (auto& saplingBatch : saplingBatches) {
+                vChecks.push_back(CSaplingBatchCheck(saplingBatch));
+            }
+            control.Add(vChecks);
+            fSaplingValid = control.Wait();
+        } else {
+            fSaplingValid = saplingBatches[0]->Validate();
+        }
+
+        if (!fSaplingValid) {
+            // At least one transaction has an invalid Sapling proof or
+            // signature. Check them one at a time to find out which one, so
+            // that the failure reason is the same as without batching.
+            LogPrintf("%s: Sapling batch validation failed, checking transactions individually\n", __func__);
+            for (const CTransaction& tx : block.vtx) {
+                if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, true)) {
+                    return false; // Failure reason has been set in validation state object
+                }
+            }
+        }
     }
 
     // Enforce BIP 34 rule that the coinbase starts with serialized block height.
@@ -4341,6 +4709,9 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, c
     auto span = TracingSpan("info", "main", "ProcessNewBlock");
     auto spanGuard = span.Enter();
 
+    // Don't get too far ahead of the listeners to the validation interface.
+    LimitValidationInterfaceQueue();
+
     {
         LOCK(cs_main);
         bool fRequested = MarkBlockAsReceived(pblock->GetHash()) | fForceProcessing;
@@ -4444,6 +4815,8 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileCache.Erase(GetBlockPosFilename(pos, "blk"));
+        blockFileCache.Erase(GetBlockPosFilename(pos, "rev"));
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4565,75 +4938,176 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
-bool static LoadBlockIndexDB(const CChainParams& chainparams)
+static fs::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
+
+/** Reads the state of the databases that a block index snapshot is tied to. */
+static CBlockIndexSnapshotDBState GetBlockIndexSnapshotDBState()
 {
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, chainparams))
+    CBlockIndexSnapshotDBState dbState;
+    dbState.hashBestBlock = pcoinsTip->GetBestBlock();
+    int nFile = 0;
+    pblocktree->ReadLastBlockFile(nFile);
+    CBlockFileInfo info;
+    pblocktree->ReadBlockFileInfo(nFile, info);
+    dbState.nLastBlockFile = nFile;
+    dbState.nLastBlockFileSize = info.nSize;
+    dbState.nLastUndoFileSize = info.nUndoSize;
+    return dbState;
+}
+
+bool WriteBlockIndexSnapshot()
+{
+    AssertLockHeld(cs_main);
+    if (!fBlockIndexSnapshot || fExperimentalDeveloperSetPoolSizeZero || !fBlockIndexLoaded)
         return false;
+    // The snapshot must not hold anything that the database doesn't
+    if (!setDirtyBlockIndex.empty() || !setDirtyFileInfo.empty())
+        return error("%s: the block index has not been flushed", __func__);
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    int64_t nStart = GetTimeMillis();
+    vector<pair<int, const CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
-    }
+        vSortedByHeight.push_back(make_pair(item.second->nHeight, item.second));
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
-    {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        // We can link the chain of blocks for which we've received transactions at some point.
-        // Pruned nodes may have deleted the block.
-        if (pindex->nTx > 0) {
-            if (pindex->pprev) {
-                if (pindex->pprev->nChainTx) {
-                    pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
-                    if (pindex->pprev->nChainSproutValue && pindex->nSproutValue) {
-                        pindex->nChainSproutValue = *pindex->pprev->nChainSproutValue + *pindex->nSproutValue;
-                    } else {
-                        pindex->nChainSproutValue = std::nullopt;
-                    }
-                    if (pindex->pprev->nChainSaplingValue) {
-                        pindex->nChainSaplingValue = *pindex->pprev->nChainSaplingValue + pindex->nSaplingValue;
-                    } else {
-                        pindex->nChainSaplingValue = std::nullopt;
-                    }
+    std::vector<const CBlockIndex*> vIndex;
+    vIndex.reserve(vSortedByHeight.size());
+    for (const std::pair<int, const CBlockIndex*>& item : vSortedByHeight)
+        vIndex.push_back(item.second);
+
+    uint256 id = GetRandHash();
+    if (!WriteBlockIndexSnapshotFile(GetBlockIndexSnapshotPath(), id, GetBlockIndexSnapshotDBState(), vIndex))
+        return false;
+    if (!pblocktree->WriteBlockIndexSnapshotId(id))
+        return error("%s: failed to write the snapshot id", __func__);
+    LogPrintf("%s: wrote %u entries in %dms\n", __func__, vIndex.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/**
+ * Computes the chain totals and branch ID of a block index entry that has
+ * been loaded from the database, from those of its parent.
+ */
+static void LinkBlockIndexEntry(CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+    // We can link the chain of blocks for which we've received transactions at some point.
+    // Pruned nodes may have deleted the block.
+    if (pindex->nTx > 0) {
+        if (pindex->pprev) {
+            if (pindex->pprev->nChainTx) {
+                pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+                if (pindex->pprev->nChainSproutValue && pindex->nSproutValue) {
+                    pindex->nChainSproutValue = *pindex->pprev->nChainSproutValue + *pindex->nSproutValue;
                 } else {
-                    pindex->nChainTx = 0;
                     pindex->nChainSproutValue = std::nullopt;
+                }
+                if (pindex->pprev->nChainSaplingValue) {
+                    pindex->nChainSaplingValue = *pindex->pprev->nChainSaplingValue + pindex->nSaplingValue;
+                } else {
                     pindex->nChainSaplingValue = std::nullopt;
-                    mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
                 }
             } else {
-                pindex->nChainTx = pindex->nTx;
-                pindex->nChainSproutValue = pindex->nSproutValue;
-                pindex->nChainSaplingValue = pindex->nSaplingValue;
+                pindex->nChainTx = 0;
+                pindex->nChainSproutValue = std::nullopt;
+                pindex->nChainSaplingValue = std::nullopt;
+                mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
             }
+        } else {
+            pindex->nChainTx = pindex->nTx;
+            pindex->nChainSproutValue = pindex->nSproutValue;
+            pindex->nChainSaplingValue = pindex->nSaplingValue;
+        }
+
+        // Fall back to hardcoded Sprout value pool balance
+        FallbackSproutValuePoolBalance(pindex, chainparams);
+
+        // If developer option -developersetpoolsizezero has been enabled,
+        // override and set the in-memory size of shielded pools to zero.  An unshielding transaction
+        // can then be used to trigger and test the handling of turnstile violations.
+        if (fExperimentalDeveloperSetPoolSizeZero) {
+            pindex->nChainSproutValue = 0;
+            pindex->nChainSaplingValue = 0;
+        }
+    }
+    // Construct in-memory chain of branch IDs.
+    // Relies on invariant: a block that does not activate a network upgrade
+    // will always be valid under the same consensus rules as its parent.
+    // Genesis block has a branch ID of zero by definition, but has no
+    // validity status because it is side-loaded into a fresh chain.
+    // Activation blocks will have branch IDs set (read from disk).
+    if (pindex->pprev) {
+        if (pindex->IsValid(BLOCK_VALID_CONSENSUS) && !pindex->nCachedBranchId) {
+            pindex->nCachedBranchId = pindex->pprev->nCachedBranchId;
+        }
+    } else {
+        pindex->nCachedBranchId = SPROUT_BRANCH_ID;
+    }
+}
 
-            // Fall back to hardcoded Sprout value pool balance
-            FallbackSproutValuePoolBalance(pindex, chainparams);
+/**
+ * Loads the block index from the snapshot written at the last shutdown, if
+ * it still matches the block tree and coins databases. Fills vSortedByHeight with the
+ * entries in height order.
+ */
+static bool LoadBlockIndexSnapshot(vector<CBlockIndex*>& vSortedByHeight)
+{
+    uint256 id;
+    if (!pblocktree->ReadBlockIndexSnapshotId(id))
+        return false;
 
-            // If developer option -developersetpoolsizezero has been enabled,
-            // override and set the in-memory size of shielded pools to zero.  An unshielding transaction
-            // can then be used to trigger and test the handling of turnstile violations.
-            if (fExperimentalDeveloperSetPoolSizeZero) {
-                pindex->nChainSproutValue = 0;
-                pindex->nChainSaplingValue = 0;
-            }
+    int64_t nStart = GetTimeMillis();
+    if (!ReadBlockIndexSnapshotFile(GetBlockIndexSnapshotPath(), id, GetBlockIndexSnapshotDBState(), InsertBlockIndex, vSortedByHeight) ||
+        vSortedByHeight.size() != mapBlockIndex.size()) {
+        // Start again from the database
+        for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
+            delete item.second;
+        mapBlockIndex.clear();
+        vSortedByHeight.clear();
+        return false;
+    }
+    LogPrintf("%s: loaded %u entries in %dms\n", __func__, vSortedByHeight.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool static LoadBlockIndexDB(const CChainParams& chainparams)
+{
+    vector<CBlockIndex*> vSortedByHeight;
+    bool fFromSnapshot = fBlockIndexSnapshot && !fExperimentalDeveloperSetPoolSizeZero &&
+        LoadBlockIndexSnapshot(vSortedByHeight);
+    // Any snapshot stops matching the database once the block index is next
+    // written, so it is only ever loaded once.
+    if (!pblocktree->EraseBlockIndexSnapshotId())
+        return error("%s: failed to erase the block index snapshot id", __func__);
+
+    if (!fFromSnapshot) {
+        if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, chainparams))
+            return false;
+
+        vector<pair<int, CBlockIndex*> > vHeightPairs;
+        vHeightPairs.reserve(mapBlockIndex.size());
+        for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            vHeightPairs.push_back(make_pair(pindex->nHeight, pindex));
         }
-        // Construct in-memory chain of branch IDs.
-        // Relies on invariant: a block that does not activate a network upgrade
-        // will always be valid under the same consensus rules as its parent.
-        // Genesis block has a branch ID of zero by definition, but has no
-        // validity status because it is side-loaded into a fresh chain.
-        // Activation blocks will have branch IDs set (read from disk).
-        if (pindex->pprev) {
-            if (pindex->IsValid(BLOCK_VALID_CONSENSUS) && !pindex->nCachedBranchId) {
-                pindex->nCachedBranchId = pindex->pprev->nCachedBranchId;
-            }
+        sort(vHeightPairs.begin(), vHeightPairs.end());
+        vSortedByHeight.reserve(vHeightPairs.size());
+        for (const std::pair<int, CBlockIndex*>& item : vHeightPairs)
+            vSortedByHeight.push_back(item.second);
+    }
+
+    for (CBlockIndex* pindex : vSortedByHeight)
+    {
+        if (fFromSnapshot) {
+            // The chain totals and branch IDs were saved in the snapshot
+            if (pindex->nTx > 0 && pindex->pprev && !pindex->pprev->nChainTx)
+                mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
         } else {
-            pindex->nCachedBranchId = SPROUT_BRANCH_ID;
+            LinkBlockIndexEntry(pindex, chainparams);
         }
         if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
             setBlockIndexCandidates.insert(pindex);
@@ -4730,6 +5204,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    pcoinsTip->SetBestBlockHeight(it->second->GetBlockHash(), it->second->nHeight);
     // Set hashFinalSproutRoot for the end of best chain
     it->second->hashFinalSproutRoot = pcoinsTip->GetBestAnchor(SPROUT);
 
@@ -5037,6 +5512,7 @@ void UnloadBlockIndex()
     }
     mapBlockIndex.clear();
     fHavePruned = false;
+    fBlockIndexLoaded = false;
 }
 
 bool LoadBlockIndex()
@@ -5044,6 +5520,7 @@ bool LoadBlockIndex()
     // Load block index from databases
     if (!fReindex && !LoadBlockIndexDB(Params()))
         return false;
+    fBlockIndexLoaded = true;
     return true;
 }
 
@@ -5103,100 +5580,194 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
+namespace {
+
+/** A block found by LoadExternalBlockFile, with where it was found. */
+struct ImportBlock
+{
+    //! Position of the block in the file, and of the end of the block
+    uint64_t nBlockPos;
+    uint64_t nEnd;
+    CBlock block;
+};
+
+/**
+ * Reads the blocks of a batch of about IMPORT_BATCH_SIZE bytes from blkdat,
+ * starting the search for the next block at nRewind. fEnd is set once no
+ * further block can be found. The blocks are then checked with CheckBlock on
+ * GetNumCores() threads; the blocks that pass have fChecked set, so that
+ * connecting them does not repeat those checks.
+ */
+std::vector<ImportBlock> ReadImportBatch(CBufferedFile& blkdat, uint64_t& nRewind, bool& fEnd, const CChainParams& chainparams)
+{
+    std::vector<ImportBlock> vBlocks;
+    size_t nBatchSize = 0;
+    while (nBatchSize < IMPORT_BATCH_SIZE && !blkdat.eof()) {
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            fEnd = true;
+            break;
+        }
+        try {
+            // read block
+            ImportBlock ib;
+            ib.nBlockPos = blkdat.GetPos();
+            blkdat.SetLimit(ib.nBlockPos + nSize);
+            blkdat.SetPos(ib.nBlockPos);
+            blkdat >> ib.block;
+            // resume where the block actually ends, which may be before
+            // nBlockPos + nSize
+            nRewind = ib.nEnd = blkdat.GetPos();
+            nBatchSize += nSize;
+            vBlocks.push_back(std::move(ib));
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+    if (blkdat.eof())
+        fEnd = true;
+
+    std::atomic<size_t> nNext(0);
+    auto checkBlocks = [&]() {
+        for (size_t i = nNext++; i < vBlocks.size(); i = nNext++) {
+            try {
+                // A block that fails is left for ProcessNewBlock to reject
+                CValidationState state;
+                auto verifier = ProofVerifier::Disabled();
+                CheckBlock(vBlocks[i].block, state, chainparams, verifier, true, true, true);
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Error checking block - %s\n", __func__, e.what());
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < GetNumCores() && (size_t)i < vBlocks.size(); i++) {
+        threads.emplace_back(checkBlocks);
+    }
+    checkBlocks();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    return vBlocks;
+}
+
+} // anon namespace
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
     static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
+#if defined(__linux__)
+    // The file is read from start to end, so let the OS read ahead further
+    posix_fadvise(fileno(fileIn), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
     int nLoaded = 0;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
+        bool fEnd = false;
         size_t initialSize = nSizeReindexed;
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
 
+        // Each batch of blocks is read, deserialized and checked on other
+        // threads while the previous batch is connected here, in file order.
+        auto readNextBatch = [&]() {
+            return std::async(std::launch::async, [&]() {
+                return ReadImportBatch(blkdat, nRewind, fEnd, chainparams);
+            });
+        };
+        std::future<std::vector<ImportBlock>> nextBatch = readNextBatch();
+        bool fAbort = false;
+        // A batch that reaches the end of the file may still hold blocks, in
+        // which case no further read is started and nextBatch is left invalid.
+        while (!fAbort && nextBatch.valid()) {
+            std::vector<ImportBlock> vBlocks = nextBatch.get();
+            if (vBlocks.empty())
+                break;
+            if (!fEnd)
+                nextBatch = readNextBatch();
             if (fReindex)
-               nSizeReindexed = initialSize + nRewind;
+                nSizeReindexRead = initialSize + vBlocks.back().nEnd;
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
+            for (ImportBlock& ib : vBlocks) {
+                boost::this_thread::interruption_point();
+
+                if (fReindex)
+                    nSizeReindexed = initialSize + ib.nEnd;
                 if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
+                    dbp->nPos = ib.nBlockPos;
+                const CBlock& block = ib.block;
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, chainparams, NULL, &block, true, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+                try {
+                    // detect out of order blocks, and store them for later
+                    uint256 hash = block.GetHash();
+                    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                                block.hashPrevBlock.ToString());
+                        if (dbp)
+                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                        continue;
+                    }
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        if (ReadBlockFromDisk(block, range.first->second, chainparams.GetConsensus()))
-                        {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, chainparams, NULL, &block, true, &(range.first->second)))
+                    // process in case the block isn't known yet
+                    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                        CValidationState state;
+                        if (ProcessNewBlock(state, chainparams, NULL, &block, true, dbp))
+                            nLoaded++;
+                        if (state.IsError()) {
+                            fAbort = true;
+                            break;
+                        }
+                    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+                        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                    }
+
+                    // Recursively process earlier encountered successors of this block
+                    deque<uint256> queue;
+                    queue.push_back(hash);
+                    while (!queue.empty()) {
+                        uint256 head = queue.front();
+                        queue.pop_front();
+                        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                        while (range.first != range.second) {
+                            CBlock child;
+                            if (ReadBlockFromDisk(child, range.first->second, chainparams.GetConsensus()))
                             {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
+                                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, child.GetHash().ToString(),
+                                        head.ToString());
+                                CValidationState dummy;
+                                if (ProcessNewBlock(dummy, chainparams, NULL, &child, true, &(range.first->second)))
+                                {
+                                    nLoaded++;
+                                    queue.push_back(child.GetHash());
+                                }
                             }
+                            range.first = mapBlocksUnknownParent.erase(range.first);
                         }
-                        range.first = mapBlocksUnknownParent.erase(range.first);
                     }
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
     } catch (const std::runtime_error& e) {
@@ -5490,13 +6061,20 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    {
+                        // The block is sent as it is stored, without being
+                        // deserialized and serialized again
+                        std::vector<uint8_t> vBlock;
+                        if (!ReadRawBlockFromDisk(vBlock, (*mi).second, Params().MessageStart(), consensusParams))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("block", CFlatData(vBlock));
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
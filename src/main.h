@@ -31,15 +31,18 @@
 #include "addressindex.h"
 #include "spentindex.h"
 #include "timestampindex.h"
+#include "shieldedindex.h"
 
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <optional>
 #include <set>
 #include <stdint.h>
 #include <string>
 #include <utility>
+#include <variant>
 #include <vector>
 
 #include <boost/unordered_map.hpp>
@@ -70,6 +73,10 @@ static const CAmount HIGH_TX_FEE_PER_KB = 0.01 * COIN;
 static const CAmount HIGH_MAX_TX_FEE = 100 * HIGH_TX_FEE_PER_KB;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -txexpirydelta, in number of blocks */
 static const unsigned int DEFAULT_PRE_BLOSSOM_TX_EXPIRY_DELTA = 20;
 static const unsigned int DEFAULT_POST_BLOSSOM_TX_EXPIRY_DELTA = DEFAULT_PRE_BLOSSOM_TX_EXPIRY_DELTA * Consensus::BLOSSOM_POW_TARGET_SPACING_RATIO;
@@ -81,6 +88,8 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Size of the batches of blocks that are read and checked ahead of being connected by -reindex and -loadblock */
+static const unsigned int IMPORT_BATCH_SIZE = 0x1000000; // 16 MiB
 
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
@@ -93,6 +102,8 @@ static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 160;
+/** Number of Equihash solutions read back from the block tree database that are cached. */
+static const size_t SOLUTION_CACHE_SIZE = 2 * MAX_HEADERS_RESULTS;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
@@ -117,6 +128,8 @@ static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_IBD_SKIP_TX_VERIFICATION = false;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_BLOCK_INDEX_SNAPSHOT = false;
+static const bool DEFAULT_SHIELDEDINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 /** Default for -nurejectoldversions */
@@ -150,6 +163,11 @@ extern std::atomic_bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
 
+// Maintain a compact record of each connected block for wallet rescans. Unlike
+// the indices above this can be switched on at any time: blocks connected while
+// it was off just have no record.
+extern bool fShieldedIndex;
+
 // The following flags enable specific indices (DB tables), but are not exposed as
 // separate command-line options; instead they are enabled by experimental feature "-insightexplorer"
 
@@ -167,6 +185,7 @@ extern bool fTimestampIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+extern bool fBlockIndexSnapshot;
 extern bool fIBDSkipTxVerification;
 // TODO: remove this flag by structuring our code such that
 // it is unneeded for testing
@@ -297,6 +316,12 @@ void Misbehaving(NodeId nodeid, int howmuch);
 void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
+/**
+ * Write the block index to a snapshot that the next start can load instead
+ * of the block index database. Must be called after the block index has
+ * been flushed, and before anything else writes to it.
+ */
+bool WriteBlockIndexSnapshot();
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(
@@ -343,10 +368,15 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
                            const Consensus::Params& consensusParams, uint32_t consensusBranchId,
                            std::vector<CScriptCheck> *pvChecks = NULL);
 
-/** Check a transaction contextually against a set of consensus rules */
+/**
+ * Check a transaction contextually against a set of consensus rules. If
+ * saplingBatch is not NULL, Sapling proofs and signatures are queued onto it
+ * instead of being verified inline.
+ */
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState &state,
                                 const CChainParams& chainparams, int nHeight, bool isMined,
-                                bool (*isInitBlockDownload)(const Consensus::Params&) = IsInitialBlockDownload);
+                                bool (*isInitBlockDownload)(const Consensus::Params&) = IsInitialBlockDownload,
+                                SaplingBatchVerifier* saplingBatch = NULL);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -435,6 +465,71 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the verification of a transaction's JoinSplit proofs
+ * Note that this stores a reference to the transaction
+ */
+class CSproutProofCheck
+{
+private:
+    const CTransaction *ptx;
+
+public:
+    CSproutProofCheck(): ptx(NULL) {}
+    CSproutProofCheck(const CTransaction& txIn): ptx(&txIn) {}
+
+    bool operator()();
+
+    void swap(CSproutProofCheck &check) {
+        std::swap(ptx, check.ptx);
+    }
+};
+
+/**
+ * Closure representing the validation of a batch of Sapling proofs and
+ * signatures, covering one or more transactions
+ */
+class CSaplingBatchCheck
+{
+private:
+    std::shared_ptr<SaplingBatchVerifier> batch;
+
+public:
+    CSaplingBatchCheck() {}
+    CSaplingBatchCheck(std::shared_ptr<SaplingBatchVerifier> batchIn): batch(batchIn) {}
+
+    bool operator()();
+
+    void swap(CSaplingBatchCheck &check) {
+        batch.swap(check.batch);
+    }
+};
+
+/**
+ * A unit of work for the script check queue, so that shielded proofs are
+ * verified by the same -par worker threads as, and concurrently with,
+ * transparent scripts.
+ */
+class CValidationCheck
+{
+private:
+    std::variant<CScriptCheck, CSproutProofCheck, CSaplingBatchCheck> check;
+
+public:
+    CValidationCheck() {}
+    CValidationCheck(CScriptCheck&& checkIn): check(std::move(checkIn)) {}
+    CValidationCheck(CSproutProofCheck&& checkIn): check(std::move(checkIn)) {}
+    CValidationCheck(CSaplingBatchCheck&& checkIn): check(std::move(checkIn)) {}
+
+    bool operator()() {
+        return std::visit([](auto& c) { return c(); }, check);
+    }
+
+    void swap(CValidationCheck &other) {
+        check.swap(other.check);
+    }
+};
+
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool GetAddressIndex(const uint160& addressHash, int type,
         std::vector<CAddressIndexDbEntry> &addressIndex,
@@ -447,7 +542,25 @@ bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
+/**
+ * Reads the block at pos without cs_main. The Equihash solution and proof of
+ * work are only checked if fCheckHeader is set. It may only be unset if the
+ * caller checks that the block has the hash of an index entry that had
+ * reached BLOCK_VALID_TREE.
+ */
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckHeader);
+/**
+ * Reads the block of pindex from disk. The header of a block that has reached
+ * BLOCK_VALID_TREE is trusted once its hash matches the index, without
+ * checking its Equihash solution again.
+ */
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Reads the serialized block of pindex from disk into block, exactly as it is
+ * stored, so that it can be sent on without deserializing it. The header is
+ * checked as ReadBlockFromDisk does; the transactions are not parsed.
+ */
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart, const Consensus::Params& consensusParams);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -517,8 +630,11 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
-/** Global variable that points to the active CCoinsView (protected by cs_main) */
-extern CCoinsViewCache *pcoinsTip;
+/**
+ * Global variable that points to the active CCoinsView. It is written to under
+ * cs_main, but may be read without it.
+ */
+extern CCoinsViewSharedCache *pcoinsTip;
 
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
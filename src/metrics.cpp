@@ -83,6 +83,7 @@ static AtomicCounter minedBlocks;
 AtomicTimer miningTimer;
 std::atomic<size_t> nSizeReindexed(0);   // valid only during reindex
 std::atomic<size_t> nFullSizeToReindex(1);   // valid only during reindex
+std::atomic<size_t> nSizeReindexRead(0);   // valid only during reindex
 
 static boost::synchronized_value<std::list<uint256>> trackedBlocks;
 
@@ -336,7 +337,8 @@ int printStats(MetricsStats stats, bool isScreen, bool mining)
             int downloadPercent = nSizeReindexed * 100 / nFullSizeToReindex;
             std::cout << "      " << _("Reindexing blocks") << " | "
                 << DisplaySize(nSizeReindexed) << " / " << DisplaySize(nFullSizeToReindex)
-                << " (" << downloadPercent << "%, " << stats.height << " " << _("blocks") << ")" << std::endl;
+                << " (" << downloadPercent << "%, " << stats.height << " " << _("blocks") << ", "
+                << DisplaySize(nSizeReindexRead > nSizeReindexed ? nSizeReindexRead - nSizeReindexed : 0) << " " << _("checked ahead") << ")" << std::endl;
         } else {
             int nHeaders = stats.currentHeadersHeight;
             if (nHeaders < 0)
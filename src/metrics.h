@@ -70,6 +70,7 @@ extern AtomicCounter solutionTargetChecks;
 extern AtomicTimer miningTimer;
 extern std::atomic<size_t> nSizeReindexed; // valid only during reindex
 extern std::atomic<size_t> nFullSizeToReindex; // valid only during reindex
+extern std::atomic<size_t> nSizeReindexRead; // valid only during reindex
 
 void TrackMinedBlock(uint256 hash);
 
@@ -36,8 +36,9 @@
 
 #include <librustzcash.h>
 
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 #ifdef ENABLE_MINING
 #include <functional>
 #endif
@@ -50,56 +51,9 @@ using namespace std;
 // BitcoinMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
-};
-
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
-{
-    bool byFee;
-
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
-
-    bool operator()(const TxPriority& a, const TxPriority& b)
-    {
-        if (byFee)
-        {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        }
-        else
-        {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
-    }
-};
-
 void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     auto medianTimePast = pindexPrev->GetMedianTimePast();
@@ -305,293 +259,681 @@ CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, C
         return mtx;
 }
 
-CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddress& minerAddress, const std::optional<CMutableTransaction>& next_cb_mtx)
-{
-    // Create new block
-    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if(!pblocktemplate.get())
-        return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+namespace {
 
-    // -regtest only: allow overriding block.nVersion with
-    // -blockversion=N to test forking scenarios
-    if (chainparams.MineBlocksOnDemand())
-        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+/**
+ * A mempool entry whose package (the entry and the in-mempool ancestors it
+ * needs) has been changed by some of those ancestors already going into
+ * the block, so that its ancestor state in the mempool no longer applies.
+ */
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+    }
 
-    // Add dummy coinbase tx as first transaction
-    pblock->vtx.push_back(CTransaction());
-    pblocktemplate->vTxFees.push_back(-1); // updated at end
-    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+};
 
-    // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
-    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+struct modifiedentry_iter
+{
+    typedef CTxMemPool::txiter result_type;
+    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
+    {
+        return entry.iter;
+    }
+};
 
-    // How much of the block should be dedicated to high-priority transactions,
-    // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
-    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
+// This matches the ordering of CompareTxMemPoolEntryByAncestorFee
+class CompareModifiedEntry
+{
+public:
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2) {
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        }
+        return f1 > f2;
+    }
+};
 
-    // Minimum block size you want to create; block will be filled with free transactions
-    // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
-    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CTxMemPool::CompareIteratorByHash
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::nth_index<1>::type::iterator modtxscoreiter;
+
+// Ancestors go into the block before their descendants
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
 
-    // Collect memory pool transactions into the block
+/**
+ * The transactions selected for the last block template, along with the
+ * state of the block with them applied. Between blocks the mempool mostly
+ * grows, so the next template on the same tip only has to consider the
+ * transactions that arrived since, and can reuse the selection outright
+ * when none did. Protected by cs_main.
+ */
+struct CBlockAssembly
+{
+    // What the selection was made against
+    const CChainParams* pchainparams = nullptr;
+    const CCoinsView* pcoinsBase = nullptr;
+    uint256 hashPrevBlock;
+    int nHeight = -1;
+    unsigned int nBlockMaxSize = 0;
+    unsigned int nBlockPrioritySize = 0;
+    unsigned int nBlockMinSize = 0;
+    uint64_t nEntrySequence = 0;     //!< Last mempool entry considered
+    uint64_t nRemovalSequence = 0;
+
+    // The selection so far. The mempool iterators in inBlock stay valid
+    // for as long as nRemovalSequence is current.
+    std::unique_ptr<CCoinsViewCache> view;
+    std::vector<CTransaction> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    CTxMemPool::setEntries inBlock;
+    uint64_t nBlockSize = 0;
+    int nBlockSigOps = 0;
     CAmount nFees = 0;
+    bool fSortedByFee = false;
+
+    // We want to track the value pool, but if the miner gets
+    // invoked on an old block before the hardcoded fallback
+    // is active we don't want to trip up any assertions. So,
+    // we only adhere to the turnstile (as a miner) if we
+    // actually have all of the information necessary to do
+    // so.
+    CAmount sproutValue = 0;
+    CAmount saplingValue = 0;
+    bool monitoring_pool_balances = true;
+
+    bool IsCurrent(const CChainParams& chainparams, const CBlockIndex* pindexPrev,
+                   unsigned int nMaxSize, unsigned int nPrioritySize, unsigned int nMinSize) const
+    {
+        return view && pchainparams == &chainparams && pcoinsBase == pcoinsTip &&
+            hashPrevBlock == pindexPrev->GetBlockHash() && nHeight == pindexPrev->nHeight + 1 &&
+            nBlockMaxSize == nMaxSize && nBlockPrioritySize == nPrioritySize && nBlockMinSize == nMinSize &&
+            nRemovalSequence == mempool.GetRemovalSequence();
+    }
 
+    void Reset(const CChainParams& chainparams, const CBlockIndex* pindexPrev,
+               unsigned int nMaxSize, unsigned int nPrioritySize, unsigned int nMinSize)
     {
-        LOCK2(cs_main, mempool.cs);
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        const int nHeight = pindexPrev->nHeight + 1;
-        uint32_t consensusBranchId = CurrentEpochBranchId(nHeight, chainparams.GetConsensus());
-        pblock->nTime = GetTime();
-        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
-        CCoinsViewCache view(pcoinsTip);
+        pchainparams = &chainparams;
+        pcoinsBase = pcoinsTip;
+        hashPrevBlock = pindexPrev->GetBlockHash();
+        nHeight = pindexPrev->nHeight + 1;
+        nBlockMaxSize = nMaxSize;
+        nBlockPrioritySize = nPrioritySize;
+        nBlockMinSize = nMinSize;
+        nEntrySequence = 0;
+        nRemovalSequence = mempool.GetRemovalSequence();
+
+        view.reset(new CCoinsViewCache(pcoinsTip));
+        vtx.clear();
+        vTxFees.clear();
+        vTxSigOps.clear();
+        inBlock.clear();
+        nBlockSize = 1000;
+        nBlockSigOps = 100;
+        nFees = 0;
+        fSortedByFee = (nBlockPrioritySize <= 0);
+
+        sproutValue = 0;
+        saplingValue = 0;
+        monitoring_pool_balances = true;
+        if (chainparams.ZIP209Enabled()) {
+            if (pindexPrev->nChainSproutValue) {
+                sproutValue = *pindexPrev->nChainSproutValue;
+            } else {
+                monitoring_pool_balances = false;
+            }
+            if (pindexPrev->nChainSaplingValue) {
+                saplingValue = *pindexPrev->nChainSaplingValue;
+            } else {
+                monitoring_pool_balances = false;
+            }
+        }
+    }
 
-        SaplingMerkleTree sapling_tree;
-        assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
+    void AddToBlock(CTxMemPool::txiter iter, CAmount nTxFees, unsigned int nTxSigOps)
+    {
+        vtx.push_back(iter->GetTx());
+        vTxFees.push_back(nTxFees);
+        vTxSigOps.push_back(nTxSigOps);
+        nBlockSize += iter->GetTxSize();
+        nBlockSigOps += nTxSigOps;
+        nFees += nTxFees;
+        inBlock.insert(iter);
+    }
+};
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
+CBlockAssembly blockAssembly;
 
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
+enum class TxCheckResult { OK, SIGOPS_LIMIT, INVALID };
 
-        // If we're given a coinbase tx, it's been precomputed, its fees are zero,
-        // so we can't include any mempool transactions; this will be an empty block.
-        if (!next_cb_mtx) {
-            for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-                mi != mempool.mapTx.end(); ++mi)
-            {
-                const CTransaction& tx = mi->GetTx();
+/**
+ * Check that tx can go in the block on top of view, with nBlockSigOps
+ * sigops already in it, and apply it to view and the value pools.
+ */
+TxCheckResult CheckAndApplyTransaction(const CBlockAssembly& assembly, const CTransaction& tx, CCoinsViewCache& view,
+                                       unsigned int nBlockSigOps, CAmount& sproutValue, CAmount& saplingValue,
+                                       CAmount& nTxFees, unsigned int& nTxSigOps)
+{
+    const CChainParams& chainparams = *assembly.pchainparams;
+    uint32_t consensusBranchId = CurrentEpochBranchId(assembly.nHeight, chainparams.GetConsensus());
 
-                int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                        ? nMedianTimePast
-                                        : pblock->GetBlockTime();
+    if (!view.HaveInputs(tx))
+        return TxCheckResult::INVALID;
 
-                if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight))
-                    continue;
+    nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
 
-                COrphan* porphan = NULL;
-                double dPriority = 0;
-                CAmount nTotalIn = 0;
-                bool fMissingInputs = false;
-                for (const CTxIn& txin : tx.vin)
-                {
-                    // Read prev transaction
-                    if (!view.HaveCoins(txin.prevout.hash))
-                    {
-                        // This should never happen; all transactions in the memory
-                        // pool should connect to either transactions in the chain
-                        // or other transactions in the memory pool.
-                        if (!mempool.mapTx.count(txin.prevout.hash))
-                        {
-                            LogPrintf("ERROR: mempool transaction missing input\n");
-                            if (fDebug) assert("mempool transaction missing input" == 0);
-                            fMissingInputs = true;
-                            if (porphan)
-                                vOrphan.pop_back();
-                            break;
-                        }
+    // Legacy limits on sigOps:
+    nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, view);
+    if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return TxCheckResult::SIGOPS_LIMIT;
 
-                        // Has to wait for dependencies
-                        if (!porphan)
-                        {
-                            // Use list for automatic deletion
-                            vOrphan.push_back(COrphan(&tx));
-                            porphan = &vOrphan.back();
-                        }
-                        mapDependers[txin.prevout.hash].push_back(porphan);
-                        porphan->setDependsOn.insert(txin.prevout.hash);
-                        nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                        continue;
-                    }
-                    const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                    assert(coins);
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    CValidationState state;
+    PrecomputedTransactionData txdata(tx);
+    if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, chainparams.GetConsensus(), consensusBranchId))
+        return TxCheckResult::INVALID;
 
-                    CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                    nTotalIn += nValueIn;
+    if (chainparams.ZIP209Enabled() && assembly.monitoring_pool_balances) {
+        // Does this transaction lead to a turnstile violation?
 
-                    int nConf = nHeight - coins->nHeight;
+        CAmount sproutValueDummy = sproutValue;
+        CAmount saplingValueDummy = saplingValue;
 
-                    dPriority += (double)nValueIn * nConf;
-                }
-                nTotalIn += tx.GetShieldedValueIn();
+        saplingValueDummy += -tx.valueBalance;
 
-                if (fMissingInputs) continue;
+        for (auto js : tx.vJoinSplit) {
+            sproutValueDummy += js.vpub_old;
+            sproutValueDummy -= js.vpub_new;
+        }
 
-                // Priority is sum(valuein * age) / modified_txsize
-                unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-                dPriority = tx.ComputePriority(dPriority, nTxSize);
+        if (sproutValueDummy < 0) {
+            LogPrintf("CreateNewBlock(): tx %s appears to violate Sprout turnstile\n", tx.GetHash().ToString());
+            return TxCheckResult::INVALID;
+        }
+        if (saplingValueDummy < 0) {
+            LogPrintf("CreateNewBlock(): tx %s appears to violate Sapling turnstile\n", tx.GetHash().ToString());
+            return TxCheckResult::INVALID;
+        }
 
-                uint256 hash = tx.GetHash();
-                mempool.ApplyDeltas(hash, dPriority, nTotalIn);
+        sproutValue = sproutValueDummy;
+        saplingValue = saplingValueDummy;
+    }
 
-                CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
+    UpdateCoins(tx, view, assembly.nHeight);
+    return TxCheckResult::OK;
+}
 
-                if (porphan)
-                {
-                    porphan->dPriority = dPriority;
-                    porphan->feeRate = feeRate;
-                }
-                else
-                    vecPriority.push_back(TxPriority(dPriority, feeRate, &(mi->GetTx())));
-            }
+bool IsStillDependent(const CBlockAssembly& assembly, CTxMemPool::txiter iter)
+{
+    for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(iter)) {
+        if (!assembly.inBlock.count(parent))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Fill the part of the block set aside for high-priority transactions,
+ * regardless of the fees they pay, until the first transaction that
+ * doesn't qualify. Returns false when extending an earlier selection and
+ * a candidate doesn't fit, as AddMempoolTransactions does.
+ */
+bool AddPriorityTxs(CBlockAssembly& assembly, const std::vector<CTxMemPool::txiter>& vCandidates,
+                    int64_t nLockTimeCutoff, bool fExtending)
+{
+    typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+    auto comparer = [](const TxCoinAgePriority& a, const TxCoinAgePriority& b) {
+        if (a.first == b.first)
+            return CompareTxMemPoolEntryByFee()(*(b.second), *(a.second));
+        return a.first < b.first;
+    };
+
+    const int nHeight = assembly.nHeight;
+    CCoinsViewCache& view = *assembly.view;
+    bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
+
+    // Priority is sum(valuein * age) / modified_txsize, over the inputs
+    // that are already confirmed
+    std::vector<TxCoinAgePriority> vecPriority;
+    vecPriority.reserve(vCandidates.size());
+    for (CTxMemPool::txiter iter : vCandidates) {
+        const CTransaction& tx = iter->GetTx();
+        if (assembly.inBlock.count(iter) || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight))
+            continue;
+
+        double dPriority = 0;
+        for (const CTxIn& txin : tx.vin) {
+            const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+            if (coins && coins->IsAvailable(txin.prevout.n))
+                dPriority += (double)coins->vout[txin.prevout.n].nValue * (nHeight - coins->nHeight);
         }
+        dPriority = tx.ComputePriority(dPriority, iter->GetTxSize());
+        CAmount dummy = 0;
+        mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, iter));
+    }
+    std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        // We want to track the value pool, but if the miner gets
-        // invoked on an old block before the hardcoded fallback
-        // is active we don't want to trip up any assertions. So,
-        // we only adhere to the turnstile (as a miner) if we
-        // actually have all of the information necessary to do
-        // so.
-        CAmount sproutValue = 0;
-        CAmount saplingValue = 0;
-        bool monitoring_pool_balances = true;
-        if (chainparams.ZIP209Enabled()) {
-            if (pindexPrev->nChainSproutValue) {
-                sproutValue = *pindexPrev->nChainSproutValue;
-            } else {
-                monitoring_pool_balances = false;
-            }
-            if (pindexPrev->nChainSaplingValue) {
-                saplingValue = *pindexPrev->nChainSaplingValue;
-            } else {
-                monitoring_pool_balances = false;
-            }
+    // Transactions waiting for their mempool parents to go in first
+    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+
+    while (!vecPriority.empty()) {
+        // Take highest priority transaction off the priority queue:
+        double dPriority = vecPriority.front().first;
+        CTxMemPool::txiter iter = vecPriority.front().second;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        vecPriority.pop_back();
+
+        if (IsStillDependent(assembly, iter)) {
+            waitPriMap.insert(std::make_pair(iter, dPriority));
+            continue;
         }
 
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
+        // Size limits
+        unsigned int nTxSize = iter->GetTxSize();
+        if (assembly.nBlockSize + nTxSize >= assembly.nBlockMaxSize) {
+            if (fExtending)
+                return false;
+            continue;
+        }
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+        // Prioritise by fee once past the priority size or we run out of high-priority
+        // transactions:
+        if ((assembly.nBlockSize + nTxSize >= assembly.nBlockPrioritySize) || !AllowFree(dPriority)) {
+            assembly.fSortedByFee = true;
+            return true;
+        }
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
+        const CTransaction& tx = iter->GetTx();
+        CAmount nTxFees;
+        unsigned int nTxSigOps;
+        TxCheckResult result = CheckAndApplyTransaction(assembly, tx, view, assembly.nBlockSigOps,
+                                                        assembly.sproutValue, assembly.saplingValue,
+                                                        nTxFees, nTxSigOps);
+        if (result == TxCheckResult::SIGOPS_LIMIT && fExtending)
+            return false;
+        if (result != TxCheckResult::OK)
+            continue;
 
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+        assembly.AddToBlock(iter, nTxFees, nTxSigOps);
 
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
+        if (fPrintPriority)
+        {
+            LogPrintf("priority %.1f fee %s txid %s\n",
+                dPriority, CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
+        }
 
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        // Add transactions that depend on this one to the priority queue
+        for (CTxMemPool::txiter child : mempool.GetMemPoolChildren(iter)) {
+            auto wpiter = waitPriMap.find(child);
+            if (wpiter != waitPriMap.end() && !IsStillDependent(assembly, child)) {
+                vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                waitPriMap.erase(wpiter);
             }
+        }
+    }
 
-            if (!view.HaveInputs(tx))
-                continue;
+    return true;
+}
 
-            CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
+/**
+ * The package state of iter with the ancestors that are already in the
+ * block taken out.
+ */
+CTxMemPoolModifiedEntry GetPackageEntry(const CBlockAssembly& assembly, CTxMemPool::txiter iter)
+{
+    CTxMemPoolModifiedEntry modEntry(iter);
+    if (iter->GetCountWithAncestors() > 1) {
+        const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        CTxMemPool::setEntries ancestors;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, dummy, false);
+        for (CTxMemPool::txiter ancestor : ancestors) {
+            if (assembly.inBlock.count(ancestor)) {
+                modEntry.nSizeWithAncestors -= ancestor->GetTxSize();
+                modEntry.nModFeesWithAncestors -= ancestor->GetModifiedFee();
+            }
+        }
+    }
+    return modEntry;
+}
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+/** Recompute the package state of the descendants of transactions just added to the block. */
+void UpdatePackagesForAdded(const CBlockAssembly& assembly, const CTxMemPool::setEntries& alreadyAdded,
+                            indexed_modified_transaction_set& mapModifiedTx)
+{
+    CTxMemPool::setEntries descendants;
+    for (CTxMemPool::txiter it : alreadyAdded) {
+        mempool.CalculateDescendants(it, descendants);
+    }
+    for (CTxMemPool::txiter desc : descendants) {
+        if (assembly.inBlock.count(desc))
+            continue;
+        mapModifiedTx.erase(desc);
+        mapModifiedTx.insert(GetPackageEntry(assembly, desc));
+    }
+}
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            PrecomputedTransactionData txdata(tx);
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, chainparams.GetConsensus(), consensusBranchId))
+/**
+ * Add transactions to the block by the fee rate of their packages, so that
+ * a transaction paying a high fee can bring its low-fee ancestors in with
+ * it. Based on Bitcoin Core's addPackageTxs.
+ */
+bool AddPackageTxs(CBlockAssembly& assembly, const std::vector<CTxMemPool::txiter>& vCandidates,
+                   int64_t nLockTimeCutoff, bool fExtending)
+{
+    const int nHeight = assembly.nHeight;
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
+
+    // Packages with ancestors that are already in the block, and so are
+    // out of order in vCandidates
+    indexed_modified_transaction_set mapModifiedTx;
+    // Packages that can't go in this block
+    CTxMemPool::setEntries failedTx;
+
+    if (!assembly.inBlock.empty()) {
+        for (CTxMemPool::txiter iter : vCandidates) {
+            if (iter->GetCountWithAncestors() == 1 || assembly.inBlock.count(iter))
                 continue;
+            CTxMemPoolModifiedEntry modEntry = GetPackageEntry(assembly, iter);
+            if (modEntry.nSizeWithAncestors != iter->GetSizeWithAncestors())
+                mapModifiedTx.insert(modEntry);
+        }
+    }
 
-            if (chainparams.ZIP209Enabled() && monitoring_pool_balances) {
-                // Does this transaction lead to a turnstile violation?
+    auto mi = vCandidates.begin();
+    while (mi != vCandidates.end() || !mapModifiedTx.empty())
+    {
+        // Skip entries that are already in the block, have failed, or
+        // are better represented by their entry in mapModifiedTx
+        if (mi != vCandidates.end() &&
+            (mapModifiedTx.count(*mi) || assembly.inBlock.count(*mi) || failedTx.count(*mi))) {
+            ++mi;
+            continue;
+        }
 
-                CAmount sproutValueDummy = sproutValue;
-                CAmount saplingValueDummy = saplingValue;
+        // Now that mi is not stale, determine which transaction to evaluate:
+        // the next entry from vCandidates, or the best from mapModifiedTx?
+        bool fUsingModified = false;
+        CTxMemPool::txiter iter;
+        modtxscoreiter modit = mapModifiedTx.get<1>().begin();
+        if (mi == vCandidates.end()) {
+            // We're out of entries in vCandidates; use the entry from mapModifiedTx
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            iter = *mi;
+            if (modit != mapModifiedTx.get<1>().end() &&
+                CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                // The best entry in mapModifiedTx has higher score
+                // than the one from vCandidates.
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                ++mi;
+            }
+        }
 
-                saplingValueDummy += -tx.valueBalance;
+        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+        // contain anything that is inBlock.
+        assert(!assembly.inBlock.count(iter));
 
-                for (auto js : tx.vJoinSplit) {
-                    sproutValueDummy += js.vpub_old;
-                    sproutValueDummy -= js.vpub_new;
-                }
+        uint64_t packageSize = iter->GetSizeWithAncestors();
+        CAmount packageFees = iter->GetModFeesWithAncestors();
+        if (fUsingModified) {
+            packageSize = modit->nSizeWithAncestors;
+            packageFees = modit->nModFeesWithAncestors;
+        }
 
-                if (sproutValueDummy < 0) {
-                    LogPrintf("CreateNewBlock(): tx %s appears to violate Sprout turnstile\n", tx.GetHash().ToString());
-                    continue;
-                }
-                if (saplingValueDummy < 0) {
-                    LogPrintf("CreateNewBlock(): tx %s appears to violate Sapling turnstile\n", tx.GetHash().ToString());
-                    continue;
-                }
+        // Everything else we might consider has a lower fee rate, so once
+        // we're past the minimum block size we're done.
+        if (assembly.nBlockSize + packageSize >= assembly.nBlockMinSize &&
+            CFeeRate(packageFees, packageSize) < ::minRelayTxFee) {
+            return true;
+        }
+
+        bool fFits = assembly.nBlockSize + packageSize < assembly.nBlockMaxSize;
+
+        CTxMemPool::setEntries ancestors;
+        if (fFits) {
+            std::string dummy;
+            mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, dummy, false);
+            for (auto it = ancestors.begin(); it != ancestors.end(); ) {
+                if (assembly.inBlock.count(*it))
+                    it = ancestors.erase(it);
+                else
+                    ++it;
+            }
+            ancestors.insert(iter);
+        }
 
-                sproutValue = sproutValueDummy;
-                saplingValue = saplingValueDummy;
+        // Sort the package so that ancestors go in first, and check it
+        // against a scratch view so that it goes in whole or not at all
+        std::vector<CTxMemPool::txiter> sortedEntries(ancestors.begin(), ancestors.end());
+        std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+        CCoinsViewCache viewPackage(assembly.view.get());
+        CAmount sproutValue = assembly.sproutValue;
+        CAmount saplingValue = assembly.saplingValue;
+        unsigned int nPackageSigOps = 0;
+        std::vector<std::pair<CAmount, unsigned int>> vFeesAndSigOps;
+        bool fValid = true;
+        for (CTxMemPool::txiter it : sortedEntries) {
+            const CTransaction& tx = it->GetTx();
+            if (!IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight)) {
+                fValid = false;
+                break;
             }
+            CAmount nTxFees;
+            unsigned int nTxSigOps;
+            TxCheckResult result = CheckAndApplyTransaction(assembly, tx, viewPackage,
+                                                            assembly.nBlockSigOps + nPackageSigOps,
+                                                            sproutValue, saplingValue, nTxFees, nTxSigOps);
+            if (result != TxCheckResult::OK) {
+                fFits = fFits && result != TxCheckResult::SIGOPS_LIMIT;
+                fValid = false;
+                break;
+            }
+            nPackageSigOps += nTxSigOps;
+            vFeesAndSigOps.push_back(std::make_pair(nTxFees, nTxSigOps));
+        }
 
-            UpdateCoins(tx, view, nHeight);
+        if (!fFits && fExtending)
+            return false;
+        if (!fFits || !fValid) {
+            if (fUsingModified) {
+                // Since we always look at the best entry in mapModifiedTx,
+                // we must erase failed entries so that we can consider the
+                // next best entry on the next loop iteration
+                mapModifiedTx.get<1>().erase(modit);
+            }
+            failedTx.insert(iter);
+            continue;
+        }
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+        // The package goes in
+        viewPackage.Flush();
+        assembly.sproutValue = sproutValue;
+        assembly.saplingValue = saplingValue;
+        for (size_t i = 0; i < sortedEntries.size(); i++) {
+            CTxMemPool::txiter it = sortedEntries[i];
+            assembly.AddToBlock(it, vFeesAndSigOps[i].first, vFeesAndSigOps[i].second);
+            mapModifiedTx.erase(it);
 
             if (fPrintPriority)
             {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
+                LogPrintf("fee %s package fee %s txid %s\n",
+                    CFeeRate(it->GetModifiedFee(), it->GetTxSize()).ToString(),
+                    CFeeRate(packageFees, packageSize).ToString(),
+                    it->GetTx().GetHash().ToString());
             }
+        }
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
-            {
-                for (COrphan* porphan : mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
+        // Update transactions that depend on each of these
+        UpdatePackagesForAdded(assembly, ancestors, mapModifiedTx);
+    }
+
+    return true;
+}
+
+/**
+ * Add the given mempool entries, sorted by ancestor fee rate, to the block
+ * being assembled: first by priority, into the space set aside for that,
+ * then by the fee rate of their packages. When extending an earlier
+ * selection, returns false as soon as a candidate doesn't fit, because a
+ * selection made from scratch could have preferred it to something
+ * already in the block.
+ */
+bool AddMempoolTransactions(CBlockAssembly& assembly, const std::vector<CTxMemPool::txiter>& vCandidates,
+                            int64_t nLockTimeCutoff, bool fExtending)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    if (!assembly.fSortedByFee && !AddPriorityTxs(assembly, vCandidates, nLockTimeCutoff, fExtending))
+        return false;
+    return AddPackageTxs(assembly, vCandidates, nLockTimeCutoff, fExtending);
+}
+
+/**
+ * Bring the block assembly up to date with the mempool, extending the
+ * selection made for the previous template where it can.
+ */
+void UpdateBlockAssembly(const CChainParams& chainparams, const CBlockIndex* pindexPrev, int64_t nLockTimeCutoff,
+                         unsigned int nBlockMaxSize, unsigned int nBlockPrioritySize, unsigned int nBlockMinSize)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    CBlockAssembly& assembly = blockAssembly;
+    std::vector<CTxMemPool::txiter> vCandidates;
+    if (assembly.IsCurrent(chainparams, pindexPrev, nBlockMaxSize, nBlockPrioritySize, nBlockMinSize)) {
+        uint64_t nEntrySequence = mempool.GetEntrySequence();
+        if (nEntrySequence == assembly.nEntrySequence)
+            return;
+
+        const auto& byArrival = mempool.mapTx.get<2>();
+        for (auto mi = byArrival.upper_bound(assembly.nEntrySequence); mi != byArrival.end(); ++mi)
+            vCandidates.push_back(mempool.mapTx.project<0>(mi));
+        std::sort(vCandidates.begin(), vCandidates.end(),
+                  [](const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) {
+                      return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+                  });
+        assembly.nEntrySequence = nEntrySequence;
+        if (AddMempoolTransactions(assembly, vCandidates, nLockTimeCutoff, true))
+            return;
+
+        LogPrint("bench", "CreateNewBlock(): block is full, selecting transactions from scratch\n");
+        vCandidates.clear();
+    }
+
+    assembly.Reset(chainparams, pindexPrev, nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
+    assembly.nEntrySequence = mempool.GetEntrySequence();
+    vCandidates.reserve(mempool.mapTx.size());
+    const auto& byAncestorFee = mempool.mapTx.get<3>();
+    for (auto mi = byAncestorFee.begin(); mi != byAncestorFee.end(); ++mi)
+        vCandidates.push_back(mempool.mapTx.project<0>(mi));
+    AddMempoolTransactions(assembly, vCandidates, nLockTimeCutoff, false);
+}
+
+}
+
+CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddress& minerAddress, const std::optional<CMutableTransaction>& next_cb_mtx)
+{
+    // Create new block
+    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    if(!pblocktemplate.get())
+        return NULL;
+    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+
+    // -regtest only: allow overriding block.nVersion with
+    // -blockversion=N to test forking scenarios
+    if (chainparams.MineBlocksOnDemand())
+        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+
+    // Add dummy coinbase tx as first transaction
+    pblock->vtx.push_back(CTransaction());
+    pblocktemplate->vTxFees.push_back(-1); // updated at end
+    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+
+    // Largest block you're willing to create:
+    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
+    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+
+    // How much of the block should be dedicated to high-priority transactions,
+    // included regardless of the fees they pay
+    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
+    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
+
+    // Minimum block size you want to create; block will be filled with free transactions
+    // until there are no more or the block reaches this size:
+    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+
+    // Collect memory pool transactions into the block
+    CAmount nFees = 0;
+
+    {
+        LOCK2(cs_main, mempool.cs);
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        const int nHeight = pindexPrev->nHeight + 1;
+        pblock->nTime = GetTime();
+        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
+
+        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                                ? nMedianTimePast
+                                : pblock->GetBlockTime();
+
+        // If we're given a coinbase tx, it's been precomputed, its fees are zero,
+        // so we can't include any mempool transactions; this will be an empty block.
+        uint64_t nBlockSize = 1000;
+        if (!next_cb_mtx) {
+            UpdateBlockAssembly(chainparams, pindexPrev, nLockTimeCutoff,
+                                nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
+            pblock->vtx.insert(pblock->vtx.end(), blockAssembly.vtx.begin(), blockAssembly.vtx.end());
+            pblocktemplate->vTxFees.insert(pblocktemplate->vTxFees.end(), blockAssembly.vTxFees.begin(), blockAssembly.vTxFees.end());
+            pblocktemplate->vTxSigOps.insert(pblocktemplate->vTxSigOps.end(), blockAssembly.vTxSigOps.begin(), blockAssembly.vTxSigOps.end());
+            nBlockSize = blockAssembly.nBlockSize;
+            nFees = blockAssembly.nFees;
         }
 
-        nLastBlockTx = nBlockTx;
+        nLastBlockTx = pblock->vtx.size() - 1;
         nLastBlockSize = nBlockSize;
         LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
 
@@ -603,13 +945,6 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
         }
         pblocktemplate->vTxFees[0] = -nFees;
 
-        // Update the Sapling commitment tree.
-        for (const CTransaction& tx : pblock->vtx) {
-            for (const OutputDescription& odesc : tx.vShieldedOutput) {
-                sapling_tree.append(odesc.cmu);
-            }
-        }
-
         // Randomise nonce
         arith_uint256 nonce = UintToArith256(GetRandHash());
         // Clear the top and bottom 16 bits (for local use as thread flags and counters)
@@ -624,8 +959,16 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
         if (IsActivationHeight(nHeight, chainparams.GetConsensus(), Consensus::UPGRADE_HEARTWOOD)) {
             pblock->hashLightClientRoot.SetNull();
         } else if (chainparams.GetConsensus().NetworkUpgradeActive(nHeight, Consensus::UPGRADE_HEARTWOOD)) {
-            pblock->hashLightClientRoot = view.GetHistoryRoot(prevConsensusBranchId);
+            pblock->hashLightClientRoot = pcoinsTip->GetHistoryRoot(prevConsensusBranchId);
         } else {
+            // Update the Sapling commitment tree.
+            SaplingMerkleTree sapling_tree;
+            assert(pcoinsTip->GetSaplingAnchorAt(pcoinsTip->GetBestAnchor(SAPLING), sapling_tree));
+            for (const CTransaction& tx : pblock->vtx) {
+                for (const OutputDescription& odesc : tx.vShieldedOutput) {
+                    sapling_tree.append(odesc.cmu);
+                }
+            }
             pblock->hashLightClientRoot = sapling_tree.root();
         }
         UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
@@ -633,9 +976,14 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
         pblock->nSolution.clear();
         pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
 
+        // The coinbase is rebuilt for every template, so even a reused
+        // selection is checked again.
         CValidationState state;
-        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false))
+        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false)) {
+            // Don't let a later template reuse the selection
+            blockAssembly.view.reset();
             throw std::runtime_error(std::string("CreateNewBlock(): TestBlockValidity failed: ") + state.GetRejectReason());
+        }
     }
 
     return pblocktemplate.release();
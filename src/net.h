@@ -255,6 +255,8 @@ public:
     // socket
     uint64_t nServices;
     SOCKET hSocket;
+    //! hSocket as registered for socket events, only used by the socket handler thread
+    SOCKET hSocketEvents;
     CDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
@@ -26,6 +26,12 @@
 #endif
 #include <fcntl.h>
 #endif
+#ifdef USE_POLL
+#include <poll.h>
+#endif
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
@@ -235,6 +241,26 @@ struct timeval MillisToTimeval(int64_t nTimeout)
     return timeout;
 }
 
+/**
+ * Wait up to nTimeout milliseconds for hSocket to be ready to receive, or
+ * to send if fSend. Returns as select() does.
+ */
+static int WaitForSocket(SOCKET hSocket, bool fSend, int64_t nTimeout)
+{
+#ifdef USE_POLL
+    struct pollfd pollfd = {};
+    pollfd.fd = hSocket;
+    pollfd.events = fSend ? POLLOUT : POLLIN;
+    return poll(&pollfd, 1, nTimeout);
+#else
+    struct timeval timeout = MillisToTimeval(nTimeout);
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(hSocket, &fdset);
+    return select(hSocket + 1, fSend ? NULL : &fdset, fSend ? &fdset : NULL, NULL, &timeout);
+#endif
+}
+
 /**
  * Read bytes from socket. This will either read the full number of bytes requested
  * or return False on error or timeout.
@@ -272,11 +298,7 @@ bool static InterruptibleRecv(uint8_t* data, size_t len, int timeout, SOCKET& hS
                 if (!IsSelectableSocket(hSocket)) {
                     return false;
                 }
-                struct timeval tval = MillisToTimeval(std::min(endTime - curTime, maxWait));
-                fd_set fdset;
-                FD_ZERO(&fdset);
-                FD_SET(hSocket, &fdset);
-                int nRet = select(hSocket + 1, &fdset, NULL, NULL, &tval);
+                int nRet = WaitForSocket(hSocket, false, std::min(endTime - curTime, maxWait));
                 if (nRet == SOCKET_ERROR) {
                     return false;
                 }
@@ -470,11 +492,7 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
         // WSAEINVAL is here because some legacy version of winsock uses it
         if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL)
         {
-            struct timeval timeout = MillisToTimeval(nTimeout);
-            fd_set fdset;
-            FD_ZERO(&fdset);
-            FD_SET(hSocket, &fdset);
-            int nRet = select(hSocket + 1, NULL, &fdset, NULL, &timeout);
+            int nRet = WaitForSocket(hSocket, true, nTimeout);
             if (nRet == 0)
             {
                 LogPrint("net", "connection to %s timeout\n", addrConnect.ToString());
@@ -1470,3 +1488,217 @@ bool SetSocketNonBlocking(SOCKET& hSocket, bool fNonBlocking)
 
     return true;
 }
+
+CSocketEvents::Mode CSocketEvents::BestMode()
+{
+#if defined(USE_EPOLL)
+    return EPOLL;
+#elif defined(USE_POLL)
+    return POLL;
+#else
+    return SELECT;
+#endif
+}
+
+CSocketEvents::CSocketEvents(Mode modeIn) : mode(modeIn), epollfd(-1)
+{
+#ifdef USE_EPOLL
+    if (mode == EPOLL) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            LogPrintf("epoll_create1() failed, falling back to poll(): %s\n", NetworkErrorString(errno));
+            mode = POLL;
+        }
+    }
+#else
+    if (mode == EPOLL)
+        mode = POLL;
+#endif
+#ifndef USE_POLL
+    if (mode == POLL)
+        mode = SELECT;
+#endif
+}
+
+CSocketEvents::~CSocketEvents()
+{
+#ifdef USE_EPOLL
+    if (epollfd != -1)
+        close(epollfd);
+#endif
+}
+
+std::string CSocketEvents::GetModeName() const
+{
+    switch (mode) {
+    case EPOLL:
+        return "epoll";
+    case POLL:
+        return "poll";
+    default:
+        return "select";
+    }
+}
+
+#ifdef USE_EPOLL
+static uint32_t ToEpollEvents(uint8_t nEvents)
+{
+    return ((nEvents & CSocketEvents::RECV) ? EPOLLIN : 0) |
+           ((nEvents & CSocketEvents::SEND) ? EPOLLOUT : 0);
+}
+#endif
+
+void CSocketEvents::Set(SOCKET hSocket, uint8_t nEvents)
+{
+    std::map<SOCKET, uint8_t>::iterator it = mapEvents.find(hSocket);
+    if (it != mapEvents.end() && it->second == nEvents)
+        return;
+
+#ifdef USE_EPOLL
+    if (mode == EPOLL) {
+        struct epoll_event event = {};
+        event.events = ToEpollEvents(nEvents);
+        event.data.fd = hSocket;
+        int op = it == mapEvents.end() ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        if (epoll_ctl(epollfd, op, hSocket, &event) != 0) {
+            // The descriptor may have been closed, and reused for a socket
+            // that the kernel does or doesn't know about yet
+            if (errno == ENOENT || errno == EEXIST) {
+                op = errno == ENOENT ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+                if (epoll_ctl(epollfd, op, hSocket, &event) == 0) {
+                    mapEvents[hSocket] = nEvents;
+                    return;
+                }
+            }
+            LogPrint("net", "epoll_ctl() for socket %d failed: %s\n", hSocket, NetworkErrorString(errno));
+            if (it != mapEvents.end())
+                mapEvents.erase(it);
+            return;
+        }
+    }
+#endif
+
+    mapEvents[hSocket] = nEvents;
+}
+
+void CSocketEvents::Remove(SOCKET hSocket)
+{
+    std::map<SOCKET, uint8_t>::iterator it = mapEvents.find(hSocket);
+    if (it == mapEvents.end())
+        return;
+#ifdef USE_EPOLL
+    // Fails harmlessly if the socket has already been closed, as that took
+    // it out of the epoll set
+    if (mode == EPOLL)
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, hSocket, NULL);
+#endif
+    mapEvents.erase(it);
+}
+
+void CSocketEvents::Wait(int64_t nTimeout, std::vector<std::pair<SOCKET, uint8_t>>& vReady)
+{
+#ifdef USE_EPOLL
+    if (mode == EPOLL) {
+        std::vector<struct epoll_event> vEvents(std::max<size_t>(mapEvents.size(), 1));
+        int nReady = epoll_wait(epollfd, vEvents.data(), vEvents.size(), nTimeout);
+        if (nReady == -1) {
+            if (errno != EINTR) {
+                LogPrintf("socket epoll_wait() error %s\n", NetworkErrorString(errno));
+                // Don't spin if the error persists
+                MilliSleep(nTimeout);
+            }
+            return;
+        }
+        for (int i = 0; i < nReady; i++) {
+            SOCKET hSocket = vEvents[i].data.fd;
+            uint32_t events = vEvents[i].events;
+            uint8_t nEvents = ((events & EPOLLIN) ? RECV : 0) |
+                              ((events & EPOLLOUT) ? SEND : 0) |
+                              ((events & (EPOLLERR | EPOLLHUP)) ? ERR : 0);
+            vReady.push_back(std::make_pair(hSocket, nEvents));
+        }
+        return;
+    }
+#endif
+
+#ifdef USE_POLL
+    if (mode == POLL) {
+        std::vector<struct pollfd> vPollFds;
+        vPollFds.reserve(mapEvents.size());
+        for (const std::pair<SOCKET, uint8_t>& item : mapEvents) {
+            struct pollfd pollfd = {};
+            pollfd.fd = item.first;
+            pollfd.events = ((item.second & RECV) ? POLLIN : 0) |
+                            ((item.second & SEND) ? POLLOUT : 0);
+            vPollFds.push_back(pollfd);
+        }
+        int nReady = poll(vPollFds.data(), vPollFds.size(), nTimeout);
+        if (nReady == SOCKET_ERROR) {
+            if (errno != EINTR) {
+                LogPrintf("socket poll error %s\n", NetworkErrorString(errno));
+                // Don't spin if the error persists
+                MilliSleep(nTimeout);
+            }
+            return;
+        }
+        for (const struct pollfd& pollfd : vPollFds) {
+            if (pollfd.revents == 0)
+                continue;
+            uint8_t nEvents = ((pollfd.revents & POLLIN) ? RECV : 0) |
+                              ((pollfd.revents & POLLOUT) ? SEND : 0) |
+                              ((pollfd.revents & (POLLERR | POLLHUP | POLLNVAL)) ? ERR : 0);
+            vReady.push_back(std::make_pair((SOCKET)pollfd.fd, nEvents));
+        }
+        return;
+    }
+#endif
+
+    struct timeval timeout = MillisToTimeval(nTimeout);
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+    for (const std::pair<SOCKET, uint8_t>& item : mapEvents) {
+#ifndef WIN32
+        if (item.first >= FD_SETSIZE)
+            continue;
+#endif
+        FD_SET(item.first, &fdsetError);
+        if (item.second & RECV)
+            FD_SET(item.first, &fdsetRecv);
+        if (item.second & SEND)
+            FD_SET(item.first, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, item.first);
+        have_fds = true;
+    }
+
+    if (!have_fds) {
+        MilliSleep(nTimeout);
+        return;
+    }
+
+    int nSelect = select(hSocketMax + 1, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nSelect == SOCKET_ERROR) {
+        // Have every socket tried, so that the one in error is found
+        LogPrintf("socket select error %s\n", NetworkErrorString(WSAGetLastError()));
+        for (const std::pair<SOCKET, uint8_t>& item : mapEvents)
+            vReady.push_back(std::make_pair(item.first, RECV));
+        MilliSleep(nTimeout);
+        return;
+    }
+    for (const std::pair<SOCKET, uint8_t>& item : mapEvents) {
+#ifndef WIN32
+        if (item.first >= FD_SETSIZE)
+            continue;
+#endif
+        uint8_t nEvents = (FD_ISSET(item.first, &fdsetRecv) ? RECV : 0) |
+                          (FD_ISSET(item.first, &fdsetSend) ? SEND : 0) |
+                          (FD_ISSET(item.first, &fdsetError) ? ERR : 0);
+        if (nEvents)
+            vReady.push_back(std::make_pair(item.first, nEvents));
+    }
+}
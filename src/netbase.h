@@ -12,6 +12,7 @@
 #include "compat.h"
 #include "serialize.h"
 
+#include <map>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -222,4 +223,57 @@ bool SetSocketNonBlocking(SOCKET& hSocket, bool fNonBlocking);
  */
 struct timeval MillisToTimeval(int64_t nTimeout);
 
+/**
+ * Waits for sockets to be ready to receive or send. With epoll (on Linux)
+ * each socket is registered with the kernel once, and only touched again
+ * when what it is waited on for changes, so that a wait costs time in the
+ * number of ready sockets rather than the number of sockets. poll() is the
+ * fallback, and select() is used where poll() isn't reliable. Not
+ * thread-safe.
+ */
+class CSocketEvents
+{
+public:
+    enum Mode {
+        SELECT,
+        POLL,
+        EPOLL,
+    };
+
+    static constexpr uint8_t RECV = 0x1;
+    static constexpr uint8_t SEND = 0x2;
+    static constexpr uint8_t ERR = 0x4; //!< Reported whatever a socket is waited on for
+
+    /** The best mode this platform has. */
+    static Mode BestMode();
+
+    /** Use mode, or the next best one if it isn't available. */
+    explicit CSocketEvents(Mode mode = BestMode());
+    ~CSocketEvents();
+
+    CSocketEvents(const CSocketEvents&) = delete;
+    CSocketEvents& operator=(const CSocketEvents&) = delete;
+
+    Mode GetMode() const { return mode; }
+    std::string GetModeName() const;
+
+    /** Wait on hSocket for the events in nEvents, which may be none. */
+    void Set(SOCKET hSocket, uint8_t nEvents);
+    /**
+     * Stop waiting on hSocket. If it has already been closed, this must
+     * come before a new socket that reuses its descriptor is Set().
+     */
+    void Remove(SOCKET hSocket);
+    /**
+     * Wait up to nTimeout milliseconds for any socket to be ready, and add
+     * each ready socket to vReady, with the events it is ready for.
+     */
+    void Wait(int64_t nTimeout, std::vector<std::pair<SOCKET, uint8_t>>& vReady);
+
+private:
+    Mode mode;
+    std::map<SOCKET, uint8_t> mapEvents;
+    int epollfd;
+};
+
 #endif // BITCOIN_NETBASE_H
@@ -85,6 +85,9 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    //! Set once CheckBlock has passed all of its checks, other than proof
+    //! verification, so that they aren't repeated for this object.
+    mutable bool fChecked;
 
     CBlock()
     {
@@ -110,6 +113,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         vMerkleTree.clear();
+        fChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
@@ -4,12 +4,90 @@
 
 #include <proof_verifier.h>
 
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+#include <cuckoocache.h>
+#include <random.h>
+#include <script/sigcache.h>
+#include <util.h>
 #include <zcash/JoinSplit.hpp>
 
+#include <shared_mutex>
 #include <variant>
 
 #include <librustzcash.h>
 
+namespace {
+
+class CProofValidityCache
+{
+private:
+    //! Entries are SHA256(nonce || txid || consensus branch ID)
+    uint256 nonce;
+    CuckooCache::cache<uint256, SignatureCacheHasher> setValid;
+    std::shared_mutex cs_proofcache;
+
+public:
+    CProofValidityCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    uint256 ComputeEntry(const uint256& txid, uint32_t consensusBranchId)
+    {
+        uint256 entry;
+        unsigned char branchId[4];
+        WriteLE32(branchId, consensusBranchId);
+        CSHA256().Write(nonce.begin(), 32).Write(txid.begin(), 32).Write(branchId, 4).Finalize(entry.begin());
+        return entry;
+    }
+
+    bool Get(const uint256& entry)
+    {
+        std::shared_lock<std::shared_mutex> lock(cs_proofcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(const uint256& entry)
+    {
+        std::unique_lock<std::shared_mutex> lock(cs_proofcache);
+        setValid.insert(entry);
+    }
+
+    uint32_t setup_bytes(size_t n)
+    {
+        return setValid.setup_bytes(n);
+    }
+};
+
+CProofValidityCache proofValidityCache;
+std::atomic<bool> fProofValidityCacheReady(false);
+
+}
+
+void InitProofValidityCache()
+{
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxproofcachesize", DEFAULT_MAX_PROOF_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = proofValidityCache.setup_bytes(nMaxCacheSize);
+    fProofValidityCacheReady = true;
+    LogPrintf("Using %zu MiB out of %zu requested for proof validity cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
+}
+
+bool ProofValidityCacheContains(const uint256& txid, uint32_t consensusBranchId)
+{
+    if (!fProofValidityCacheReady)
+        return false;
+    return proofValidityCache.Get(proofValidityCache.ComputeEntry(txid, consensusBranchId));
+}
+
+void ProofValidityCacheAdd(const uint256& txid, uint32_t consensusBranchId)
+{
+    if (!fProofValidityCacheReady)
+        return;
+    proofValidityCache.Set(proofValidityCache.ComputeEntry(txid, consensusBranchId));
+}
+
 class SproutProofVerifier
 {
     ProofVerifier& verifier;
@@ -58,6 +136,14 @@ ProofVerifier ProofVerifier::Disabled() {
     return ProofVerifier(false);
 }
 
+ProofVerifier ProofVerifier::Cached(uint32_t consensusBranchId) {
+    return ProofVerifier(true, consensusBranchId);
+}
+
+bool ProofVerifier::IsCached(const CTransaction& tx) const {
+    return cachedBranchId && ProofValidityCacheContains(tx.GetHash(), *cachedBranchId);
+}
+
 bool ProofVerifier::VerifySprout(
     const JSDescription& jsdesc,
     const Ed25519VerificationKey& joinSplitPubKey
@@ -69,3 +155,57 @@ bool ProofVerifier::VerifySprout(
     auto pv = SproutProofVerifier(*this, joinSplitPubKey, jsdesc);
     return std::visit(pv, jsdesc.proof);
 }
+
+SaplingBatchVerifier::SaplingBatchVerifier()
+{
+    ctx = librustzcash_sapling_batch_validation_ctx_init();
+}
+
+SaplingBatchVerifier::~SaplingBatchVerifier()
+{
+    librustzcash_sapling_batch_validation_ctx_free(ctx);
+}
+
+bool SaplingBatchVerifier::QueueSpend(
+    const SpendDescription& spend,
+    const uint256& dataToBeSigned
+) {
+    return librustzcash_sapling_batch_check_spend(
+        ctx,
+        spend.cv.begin(),
+        spend.anchor.begin(),
+        spend.nullifier.begin(),
+        spend.rk.begin(),
+        spend.zkproof.begin(),
+        spend.spendAuthSig.begin(),
+        dataToBeSigned.begin()
+    );
+}
+
+bool SaplingBatchVerifier::QueueOutput(const OutputDescription& output)
+{
+    return librustzcash_sapling_batch_check_output(
+        ctx,
+        output.cv.begin(),
+        output.cmu.begin(),
+        output.ephemeralKey.begin(),
+        output.zkproof.begin()
+    );
+}
+
+bool SaplingBatchVerifier::QueueBindingSig(
+    const CTransaction& tx,
+    const uint256& dataToBeSigned
+) {
+    return librustzcash_sapling_batch_final_check(
+        ctx,
+        tx.valueBalance,
+        tx.bindingSig.begin(),
+        dataToBeSigned.begin()
+    );
+}
+
+bool SaplingBatchVerifier::Validate()
+{
+    return librustzcash_sapling_batch_validate(ctx);
+}
@@ -10,11 +10,29 @@
 
 #include <rust/ed25519/types.h>
 
+#include <optional>
+
+/** Default for -maxproofcachesize, in MiB: room for over 60000 transactions */
+static const unsigned int DEFAULT_MAX_PROOF_CACHE_SIZE = 2;
+
+// Remembers the transactions whose Sprout and Sapling proofs and signatures
+// have been verified on acceptance to the mempool, so that they need not be
+// verified again when the transactions are mined. Entries are keyed by txid,
+// which commits to the proofs and signatures, and by the consensus branch ID
+// that the Sapling signatures were checked against.
+void InitProofValidityCache();
+bool ProofValidityCacheContains(const uint256& txid, uint32_t consensusBranchId);
+void ProofValidityCacheAdd(const uint256& txid, uint32_t consensusBranchId);
+
 class ProofVerifier {
 private:
     bool perform_verification;
+    //! If set, transactions in the proof validity cache for this branch are
+    //! not verified again
+    std::optional<uint32_t> cachedBranchId;
 
-    ProofVerifier(bool perform_verification) : perform_verification(perform_verification) { }
+    ProofVerifier(bool perform_verification, std::optional<uint32_t> cachedBranchId = std::nullopt) :
+        perform_verification(perform_verification), cachedBranchId(cachedBranchId) { }
 
 public:
     // ProofVerifier should never be copied
@@ -32,6 +50,15 @@ public:
     // such as during reindexing.
     static ProofVerifier Disabled();
 
+    // Creates a verification context that verifies all proofs, except those
+    // of transactions that were verified on acceptance to the mempool under
+    // the given consensus branch.
+    static ProofVerifier Cached(uint32_t consensusBranchId);
+
+    // Returns true if the proofs of tx need not be verified, because they
+    // are in the proof validity cache.
+    bool IsCached(const CTransaction& tx) const;
+
     // Verifies that the JoinSplit proof is correct.
     bool VerifySprout(
         const JSDescription& jsdesc,
@@ -39,4 +66,36 @@ public:
     );
 };
 
+// Accumulates the Sapling proofs and signatures of many transactions (usually
+// every transaction in a block) so that they can be checked together: Groth16
+// proofs with a single multi-pairing per circuit, and RedJubjub signatures with
+// a single multiscalar multiplication. Encoding errors are still detected as
+// each description is queued.
+class SaplingBatchVerifier {
+private:
+    void* ctx;
+
+public:
+    SaplingBatchVerifier();
+    ~SaplingBatchVerifier();
+
+    // SaplingBatchVerifier should never be copied
+    SaplingBatchVerifier(const SaplingBatchVerifier&) = delete;
+    SaplingBatchVerifier& operator=(const SaplingBatchVerifier&) = delete;
+
+    // Queues a Spend description of the transaction currently being added.
+    bool QueueSpend(const SpendDescription& spend, const uint256& dataToBeSigned);
+
+    // Queues an Output description of the transaction currently being added.
+    bool QueueOutput(const OutputDescription& output);
+
+    // Queues the binding signature, completing the current transaction.
+    bool QueueBindingSig(const CTransaction& tx, const uint256& dataToBeSigned);
+
+    // Verifies everything queued so far, and empties the queue. On failure,
+    // the caller must check the transactions individually to find out which
+    // one is invalid.
+    bool Validate();
+};
+
 #endif // ZCASH_PROOF_VERIFIER_H
@@ -194,6 +194,56 @@ extern "C" {
     /// `librustzcash_sapling_verification_ctx_init`.
     void librustzcash_sapling_verification_ctx_free(void *);
 
+    /// Creates a Sapling batch validation context, which defers
+    /// proof and signature checks for many transactions so that
+    /// they can be validated together. Please free this when
+    /// you're done.
+    void * librustzcash_sapling_batch_validation_ctx_init();
+
+    /// Checks the encoding of a Sapling Spend description and
+    /// queues its proof and spendAuthSig for batch validation,
+    /// accumulating the value commitment into the context.
+    bool librustzcash_sapling_batch_check_spend(
+        void *ctx,
+        const unsigned char *cv,
+        const unsigned char *anchor,
+        const unsigned char *nullifier,
+        const unsigned char *rk,
+        const unsigned char *zkproof,
+        const unsigned char *spendAuthSig,
+        const unsigned char *sighashValue
+    );
+
+    /// Checks the encoding of a Sapling Output description and
+    /// queues its proof for batch validation, accumulating the
+    /// value commitment into the context.
+    bool librustzcash_sapling_batch_check_output(
+        void *ctx,
+        const unsigned char *cv,
+        const unsigned char *cm,
+        const unsigned char *ephemeralKey,
+        const unsigned char *zkproof
+    );
+
+    /// Completes a transaction in the batch given valueBalance,
+    /// queueing its binding signature for batch validation.
+    bool librustzcash_sapling_batch_final_check(
+        void *ctx,
+        int64_t valueBalance,
+        const unsigned char *bindingSig,
+        const unsigned char *sighashValue
+    );
+
+    /// Validates every proof and signature queued in the context,
+    /// and empties it. If this returns false, at least one queued
+    /// transaction is invalid and must be found by checking each
+    /// transaction individually.
+    bool librustzcash_sapling_batch_validate(void *ctx);
+
+    /// Frees a Sapling batch validation context returned from
+    /// `librustzcash_sapling_batch_validation_ctx_init`.
+    void librustzcash_sapling_batch_validation_ctx_free(void *);
+
     /// Compute a Sapling nullifier.
     ///
     /// The `diversifier` parameter must be 11 bytes in length.
@@ -236,6 +286,24 @@ extern "C" {
         unsigned char *result
     );
 
+    /// Compute [ivk] [8] epk for every pair of
+    /// the `epks_len` 32-byte points in `epks`
+    /// and the `ivks_len` 32-byte scalars in
+    /// `ivks`, decompressing each point only
+    /// once. The result for epks[i] and ivks[j]
+    /// is written to the 32-byte buffer at
+    /// index i * ivks_len + j of `results`, and
+    /// the same index of `valid` is set to
+    /// whether both encodings were valid.
+    void librustzcash_sapling_ka_agree_batch(
+        const unsigned char *epks,
+        size_t epks_len,
+        const unsigned char *ivks,
+        size_t ivks_len,
+        unsigned char *results,
+        bool *valid
+    );
+
     /// Compute g_d = GH(diversifier) and returns
     /// false if the diversifier is invalid.
     /// Computes [esk] g_d and writes the result
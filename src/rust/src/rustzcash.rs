@@ -63,6 +63,8 @@ use zcash_history::{Entry as MMREntry, NodeData as MMRNodeData, Tree as MMRTree}
 
 mod blake2b;
 mod ed25519;
+mod sapling_batch;
+mod sapling_ka;
 mod tracing_ffi;
 
 #[cfg(test)]
@@ -0,0 +1,415 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+//! Batch validation of Sapling proofs and signatures.
+//!
+//! The per-transaction [`SaplingVerificationContext`] checks each Groth16
+//! proof with its own pairing product and each RedJubjub signature with its
+//! own scalar multiplications. This context instead defers those checks, so
+//! that every proof and signature in a block can be validated together:
+//!
+//! - all Groth16 proofs for a circuit are combined, with random weights, into
+//!   a single multi-Miller loop and a single final exponentiation;
+//! - all RedJubjub signatures are combined, with random weights, into a single
+//!   linear combination that must equal the identity.
+//!
+//! Structural checks (point and scalar encodings, small-order checks) are still
+//! performed eagerly, so that they can be reported against the transaction that
+//! failed them.
+//!
+//! [`SaplingVerificationContext`]: zcash_proofs::sapling::SaplingVerificationContext
+
+use bellman::{
+    gadgets::multipack,
+    groth16::{Proof, VerifyingKey},
+};
+use bls12_381::{Bls12, G1Affine, G1Projective, G2Prepared, Gt};
+use group::{ff::Field, Group, GroupEncoding};
+use libc::c_uchar;
+use rand_core::OsRng;
+use zcash_primitives::{
+    constants::{SPENDING_KEY_GENERATOR, VALUE_COMMITMENT_RANDOMNESS_GENERATOR},
+    transaction::components::Amount,
+    util::hash_to_scalar,
+};
+use zcash_proofs::sapling::compute_value_balance;
+
+use crate::{de_ct, GROTH_PROOF_SIZE, SAPLING_OUTPUT_PARAMS, SAPLING_SPEND_PARAMS};
+
+/// A Groth16 proof together with the public inputs it is checked against.
+struct ProofItem {
+    proof: Proof<Bls12>,
+    inputs: Vec<bls12_381::Scalar>,
+}
+
+/// A decoded RedJubjub signature and the challenge it was made over.
+struct SignatureItem {
+    vk: jubjub::ExtendedPoint,
+    r: jubjub::ExtendedPoint,
+    s: jubjub::Fr,
+    c: jubjub::Fr,
+}
+
+impl SignatureItem {
+    /// Decodes a RedJubjub signature over `vk || sighash`, as used for both
+    /// spendAuthSig and bindingSig. Returns `None` if the encoding of `R` or
+    /// `S` is invalid.
+    fn new(vk: jubjub::ExtendedPoint, sig: &[u8; 64], sighash: &[u8; 32]) -> Option<Self> {
+        let mut rbar = [0u8; 32];
+        let mut sbar = [0u8; 32];
+        rbar.copy_from_slice(&sig[0..32]);
+        sbar.copy_from_slice(&sig[32..64]);
+
+        let r = de_ct(jubjub::ExtendedPoint::from_bytes(&rbar))?;
+        let s = de_ct(jubjub::Fr::from_bytes(&sbar))?;
+
+        let mut data_to_be_signed = [0u8; 64];
+        data_to_be_signed[0..32].copy_from_slice(&vk.to_bytes());
+        data_to_be_signed[32..64].copy_from_slice(&sighash[..]);
+        let c = hash_to_scalar(b"Zcash_RedJubjubH", &rbar[..], &data_to_be_signed[..]);
+
+        Some(SignatureItem { vk, r, s, c })
+    }
+}
+
+/// Accumulates the Sapling proofs and signatures of many transactions.
+pub struct SaplingBatchValidationContext {
+    spend_proofs: Vec<ProofItem>,
+    output_proofs: Vec<ProofItem>,
+    spend_auth_sigs: Vec<SignatureItem>,
+    binding_sigs: Vec<SignatureItem>,
+    /// The sum of value commitments for the transaction currently being added.
+    cv_sum: jubjub::ExtendedPoint,
+}
+
+impl SaplingBatchValidationContext {
+    fn new() -> Self {
+        SaplingBatchValidationContext {
+            spend_proofs: vec![],
+            output_proofs: vec![],
+            spend_auth_sigs: vec![],
+            binding_sigs: vec![],
+            cv_sum: jubjub::ExtendedPoint::identity(),
+        }
+    }
+
+    fn validate(&mut self) -> bool {
+        let spend_proofs = std::mem::take(&mut self.spend_proofs);
+        let output_proofs = std::mem::take(&mut self.output_proofs);
+        let spend_auth_sigs = std::mem::take(&mut self.spend_auth_sigs);
+        let binding_sigs = std::mem::take(&mut self.binding_sigs);
+        self.cv_sum = jubjub::ExtendedPoint::identity();
+
+        let spend_vk = &unsafe { SAPLING_SPEND_PARAMS.as_ref() }
+            .expect("parameters should have been initialized")
+            .vk;
+        let output_vk = &unsafe { SAPLING_OUTPUT_PARAMS.as_ref() }
+            .expect("parameters should have been initialized")
+            .vk;
+
+        batch_verify_signatures(&spend_auth_sigs, &binding_sigs)
+            && batch_verify_proofs(spend_vk, &spend_proofs)
+            && batch_verify_proofs(output_vk, &output_proofs)
+    }
+}
+
+/// Returns the affine coordinates of a Jubjub point as circuit inputs.
+fn point_inputs(p: &jubjub::ExtendedPoint) -> [bls12_381::Scalar; 2] {
+    let affine = jubjub::AffinePoint::from(*p);
+    [affine.get_u(), affine.get_v()]
+}
+
+/// Checks a set of Groth16 proofs for the same circuit.
+///
+/// For random weights r_i, this checks that
+///
+/// ```text
+/// ∏ e(r_i A_i, B_i) · e(-(Σ r_i) α, β) · e(-Σ r_i L_i, γ) · e(-Σ r_i C_i, δ) = 1
+/// ```
+///
+/// where L_i is the linear combination of the verifying key's IC with the
+/// public inputs of proof i. Σ r_i L_i is computed from the weighted sums of
+/// each public input, so the IC bases are only multiplied once per input.
+fn batch_verify_proofs(vk: &VerifyingKey<Bls12>, items: &[ProofItem]) -> bool {
+    if items.is_empty() {
+        return true;
+    }
+
+    let mut rng = OsRng;
+
+    let mut r_sum = bls12_381::Scalar::zero();
+    let mut input_sums = vec![bls12_381::Scalar::zero(); vk.ic.len() - 1];
+    let mut c_sum = G1Projective::identity();
+    let mut weighted_a = Vec::with_capacity(items.len());
+
+    for item in items {
+        assert_eq!(item.inputs.len() + 1, vk.ic.len());
+
+        let r = bls12_381::Scalar::random(&mut rng);
+        r_sum += r;
+        for (sum, input) in input_sums.iter_mut().zip(item.inputs.iter()) {
+            *sum += r * input;
+        }
+        c_sum += item.proof.c * r;
+        weighted_a.push(item.proof.a * r);
+    }
+
+    let mut ic_sum = vk.ic[0] * r_sum;
+    for (base, sum) in vk.ic[1..].iter().zip(input_sums.iter()) {
+        ic_sum += base * sum;
+    }
+
+    // Normalize all of the G1 points at once to share the inversion.
+    let mut g1_projective = weighted_a;
+    g1_projective.push(-(vk.alpha_g1 * r_sum));
+    g1_projective.push(-ic_sum);
+    g1_projective.push(-c_sum);
+    let mut g1_affine = vec![G1Affine::identity(); g1_projective.len()];
+    G1Projective::batch_normalize(&g1_projective, &mut g1_affine);
+
+    let mut g2_prepared: Vec<G2Prepared> = items
+        .iter()
+        .map(|item| G2Prepared::from(item.proof.b))
+        .collect();
+    g2_prepared.push(G2Prepared::from(vk.beta_g2));
+    g2_prepared.push(G2Prepared::from(vk.gamma_g2));
+    g2_prepared.push(G2Prepared::from(vk.delta_g2));
+
+    let terms: Vec<(&G1Affine, &G2Prepared)> = g1_affine.iter().zip(g2_prepared.iter()).collect();
+
+    bls12_381::multi_miller_loop(&terms).final_exponentiation() == Gt::identity()
+}
+
+/// Checks a set of spendAuthSig and bindingSig signatures.
+///
+/// For random weights z_i, this checks that
+///
+/// ```text
+/// [8] (Σ z_i (R_i + [c_i] vk_i) - [Σ z_i S_i] G) = O
+/// ```
+///
+/// where G is the spend authorization or value commitment randomness generator
+/// as appropriate.
+fn batch_verify_signatures(spend_auth_sigs: &[SignatureItem], binding_sigs: &[SignatureItem]) -> bool {
+    let mut rng = OsRng;
+    let mut acc = jubjub::ExtendedPoint::identity();
+
+    let mut accumulate = |items: &[SignatureItem]| {
+        let mut s_sum = jubjub::Fr::zero();
+        for item in items {
+            let z = jubjub::Fr::random(&mut rng);
+            acc += item.r * z;
+            acc += item.vk * (z * item.c);
+            s_sum += z * item.s;
+        }
+        s_sum
+    };
+
+    let spend_auth_s = accumulate(spend_auth_sigs);
+    let binding_s = accumulate(binding_sigs);
+
+    acc -= jubjub::ExtendedPoint::from(SPENDING_KEY_GENERATOR) * spend_auth_s;
+    acc -= jubjub::ExtendedPoint::from(VALUE_COMMITMENT_RANDOMNESS_GENERATOR) * binding_s;
+
+    acc.mul_by_cofactor().is_identity().into()
+}
+
+/// Creates a Sapling batch validation context. Please free this when you're
+/// done.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_validation_ctx_init(
+) -> *mut SaplingBatchValidationContext {
+    let ctx = Box::new(SaplingBatchValidationContext::new());
+
+    Box::into_raw(ctx)
+}
+
+/// Frees a Sapling batch validation context returned from
+/// [`librustzcash_sapling_batch_validation_ctx_init`].
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_validation_ctx_free(
+    ctx: *mut SaplingBatchValidationContext,
+) {
+    drop(unsafe { Box::from_raw(ctx) });
+}
+
+/// Checks the encoding of a Sapling Spend description, and queues its proof and
+/// spendAuthSig for batch validation. The value commitment is accumulated into
+/// the current transaction.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_check_spend(
+    ctx: *mut SaplingBatchValidationContext,
+    cv: *const [c_uchar; 32],
+    anchor: *const [c_uchar; 32],
+    nullifier: *const [c_uchar; 32],
+    rk: *const [c_uchar; 32],
+    zkproof: *const [c_uchar; GROTH_PROOF_SIZE],
+    spend_auth_sig: *const [c_uchar; 64],
+    sighash_value: *const [c_uchar; 32],
+) -> bool {
+    let ctx = unsafe { &mut *ctx };
+
+    // Deserialize the value commitment
+    let cv = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*cv })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    // Deserialize the anchor, which should be an element
+    // of Fr.
+    let anchor = match de_ct(bls12_381::Scalar::from_bytes(unsafe { &*anchor })) {
+        Some(a) => a,
+        None => return false,
+    };
+
+    // Deserialize rk
+    let rk = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*rk })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    if (cv.is_small_order() | rk.is_small_order()).into() {
+        return false;
+    }
+
+    // Deserialize the signature
+    let spend_auth_sig =
+        match SignatureItem::new(rk, unsafe { &*spend_auth_sig }, unsafe { &*sighash_value }) {
+            Some(sig) => sig,
+            None => return false,
+        };
+
+    // Deserialize the proof
+    let zkproof = match Proof::read(&(unsafe { &*zkproof })[..]) {
+        Ok(p) => p,
+        Err(_) => return false,
+    };
+
+    // Construct public input for circuit
+    let mut inputs = Vec::with_capacity(7);
+    inputs.extend_from_slice(&point_inputs(&rk));
+    inputs.extend_from_slice(&point_inputs(&cv));
+    inputs.push(anchor);
+    {
+        let nullifier = multipack::bytes_to_bits_le(&(unsafe { &*nullifier })[..]);
+        let nullifier = multipack::compute_multipacking(&nullifier);
+        assert_eq!(nullifier.len(), 2);
+        inputs.extend_from_slice(&nullifier);
+    }
+
+    ctx.cv_sum += cv;
+    ctx.spend_auth_sigs.push(spend_auth_sig);
+    ctx.spend_proofs.push(ProofItem {
+        proof: zkproof,
+        inputs,
+    });
+
+    true
+}
+
+/// Checks the encoding of a Sapling Output description, and queues its proof
+/// for batch validation. The value commitment is accumulated into the current
+/// transaction.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_check_output(
+    ctx: *mut SaplingBatchValidationContext,
+    cv: *const [c_uchar; 32],
+    cm: *const [c_uchar; 32],
+    epk: *const [c_uchar; 32],
+    zkproof: *const [c_uchar; GROTH_PROOF_SIZE],
+) -> bool {
+    let ctx = unsafe { &mut *ctx };
+
+    // Deserialize the value commitment
+    let cv = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*cv })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    // Deserialize the commitment, which should be an element
+    // of Fr.
+    let cm = match de_ct(bls12_381::Scalar::from_bytes(unsafe { &*cm })) {
+        Some(a) => a,
+        None => return false,
+    };
+
+    // Deserialize the ephemeral key
+    let epk = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*epk })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    if (cv.is_small_order() | epk.is_small_order()).into() {
+        return false;
+    }
+
+    // Deserialize the proof
+    let zkproof = match Proof::read(&(unsafe { &*zkproof })[..]) {
+        Ok(p) => p,
+        Err(_) => return false,
+    };
+
+    // Construct public input for circuit
+    let mut inputs = Vec::with_capacity(5);
+    inputs.extend_from_slice(&point_inputs(&cv));
+    inputs.extend_from_slice(&point_inputs(&epk));
+    inputs.push(cm);
+
+    ctx.cv_sum -= cv;
+    ctx.output_proofs.push(ProofItem {
+        proof: zkproof,
+        inputs,
+    });
+
+    true
+}
+
+/// Finishes the current transaction: derives its binding verification key from
+/// the accumulated value commitments and valueBalance, and queues its binding
+/// signature for batch validation.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_final_check(
+    ctx: *mut SaplingBatchValidationContext,
+    value_balance: i64,
+    binding_sig: *const [c_uchar; 64],
+    sighash_value: *const [c_uchar; 32],
+) -> bool {
+    let ctx = unsafe { &mut *ctx };
+
+    // Whatever happens, the next transaction starts from an empty sum.
+    let cv_sum = std::mem::replace(&mut ctx.cv_sum, jubjub::ExtendedPoint::identity());
+
+    let value_balance = match Amount::from_i64(value_balance) {
+        Ok(vb) => vb,
+        Err(()) => return false,
+    };
+
+    let value_balance = match compute_value_balance(value_balance) {
+        Some(a) => a,
+        None => return false,
+    };
+
+    let bvk = cv_sum - value_balance;
+
+    let binding_sig =
+        match SignatureItem::new(bvk, unsafe { &*binding_sig }, unsafe { &*sighash_value }) {
+            Some(sig) => sig,
+            None => return false,
+        };
+
+    ctx.binding_sigs.push(binding_sig);
+
+    true
+}
+
+/// Validates every proof and signature queued in the context since it was
+/// created or last validated, and empties the queue. Returns false if any of
+/// them is invalid; the caller must then check transactions individually to
+/// find out which one.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_validate(
+    ctx: *mut SaplingBatchValidationContext,
+) -> bool {
+    unsafe { &mut *ctx }.validate()
+}
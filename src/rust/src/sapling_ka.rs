@@ -0,0 +1,141 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+//! Batched Sapling key agreement for trial decryption.
+//!
+//! Trial-decrypting N outputs with M incoming viewing keys needs the N * M
+//! shared secrets \[ivk\] \[8\] epk. Computing them one at a time with
+//! [`sapling_ka_agree`] decompresses each epk M times, clears its cofactor M
+//! times, and normalizes every result with its own field inversion. Here each
+//! epk is instead decompressed and multiplied by the cofactor once, and turned
+//! into a table of small multiples that is shared by every ivk; each ivk is
+//! split into 4-bit windows once; and each row of results is normalized with a
+//! single batch inversion. Table entries are selected in constant time, so
+//! that the memory access pattern does not depend on the ivk.
+//!
+//! [`sapling_ka_agree`]: zcash_primitives::note_encryption::sapling_ka_agree
+
+use group::Curve;
+use libc::{c_uchar, size_t};
+use std::slice;
+use subtle::{ConditionallySelectable, ConstantTimeEq};
+
+use crate::de_ct;
+
+/// Width in bits of the windows that scalars are split into.
+const WINDOW_BITS: usize = 4;
+
+/// Number of windows in a Jubjub scalar, which is less than 2^252.
+const WINDOWS: usize = 252 / WINDOW_BITS;
+
+/// The multiples \[0\] P ... \[15\] P of a point P.
+struct WindowTable([jubjub::ExtendedNielsPoint; 1 << WINDOW_BITS]);
+
+impl WindowTable {
+    fn new(p: jubjub::ExtendedPoint) -> Self {
+        let mut table = [jubjub::ExtendedPoint::identity().to_niels(); 1 << WINDOW_BITS];
+        let mut acc = jubjub::ExtendedPoint::identity();
+        for entry in table.iter_mut().skip(1) {
+            acc = acc + p.to_niels();
+            *entry = acc.to_niels();
+        }
+        WindowTable(table)
+    }
+
+    /// Computes \[k\] P from the windows of k, most significant first.
+    fn mul(&self, windows: &[u8; WINDOWS]) -> jubjub::ExtendedPoint {
+        let mut acc = jubjub::ExtendedPoint::identity();
+        for &w in windows.iter() {
+            for _ in 0..WINDOW_BITS {
+                acc = acc.double();
+            }
+            acc = acc + self.select(w);
+        }
+        acc
+    }
+
+    /// Returns \[w\] P, reading every entry so that the access pattern is
+    /// independent of w.
+    fn select(&self, w: u8) -> jubjub::ExtendedNielsPoint {
+        let mut ret = self.0[0];
+        for (i, entry) in self.0.iter().enumerate().skip(1) {
+            ret.conditional_assign(entry, (i as u8).ct_eq(&w));
+        }
+        ret
+    }
+}
+
+/// Splits a scalar into 4-bit windows, most significant first.
+fn scalar_windows(k: &jubjub::Fr) -> [u8; WINDOWS] {
+    let bytes = k.to_bytes();
+    let mut windows = [0u8; WINDOWS];
+    for (i, w) in windows.iter_mut().enumerate() {
+        let nibble = WINDOWS - 1 - i;
+        *w = (bytes[nibble / 2] >> ((nibble % 2) * 4)) & 0x0f;
+    }
+    windows
+}
+
+/// Computes the key agreement \[ivk\] \[8\] epk for every pair of the
+/// `epks_len` points in `epks` and the `ivks_len` scalars in `ivks`.
+///
+/// The result for `epks[i]` and `ivks[j]` is written to
+/// `results[i * ivks_len + j]`, and `valid[i * ivks_len + j]` is set to
+/// whether `epks[i]` and `ivks[j]` were both valid encodings. Results for
+/// invalid pairs are left untouched.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_ka_agree_batch(
+    epks: *const [c_uchar; 32],
+    epks_len: size_t,
+    ivks: *const [c_uchar; 32],
+    ivks_len: size_t,
+    results: *mut [c_uchar; 32],
+    valid: *mut bool,
+) {
+    if epks_len == 0 || ivks_len == 0 {
+        return;
+    }
+
+    let epks = unsafe { slice::from_raw_parts(epks, epks_len) };
+    let ivks = unsafe { slice::from_raw_parts(ivks, ivks_len) };
+    let results = unsafe { slice::from_raw_parts_mut(results, epks_len * ivks_len) };
+    let valid = unsafe { slice::from_raw_parts_mut(valid, epks_len * ivks_len) };
+
+    let ivks: Vec<Option<[u8; WINDOWS]>> = ivks
+        .iter()
+        .map(|ivk| de_ct(jubjub::Fr::from_bytes(ivk)).map(|ivk| scalar_windows(&ivk)))
+        .collect();
+
+    let mut points = Vec::with_capacity(ivks.len());
+    let mut affine = vec![jubjub::AffinePoint::identity(); ivks.len()];
+    for (i, epk) in epks.iter().enumerate() {
+        let row = i * ivks_len..(i + 1) * ivks_len;
+
+        let epk = match de_ct(jubjub::ExtendedPoint::from_bytes(epk)) {
+            Some(epk) => epk,
+            None => {
+                valid[row].iter_mut().for_each(|v| *v = false);
+                continue;
+            }
+        };
+
+        // [ivk] [8] epk = [8] [ivk] epk, so the cofactor only needs to be
+        // cleared once for each epk.
+        let table = WindowTable::new(epk.mul_by_cofactor());
+
+        points.clear();
+        points.extend(ivks.iter().map(|ivk| match ivk {
+            Some(windows) => table.mul(windows),
+            None => jubjub::ExtendedPoint::identity(),
+        }));
+        jubjub::ExtendedPoint::batch_normalize(&points, &mut affine);
+
+        for (j, p) in affine.iter().enumerate() {
+            valid[row.start + j] = ivks[j].is_some();
+            if ivks[j].is_some() {
+                results[row.start + j] = p.to_bytes();
+            }
+        }
+    }
+}
@@ -4,7 +4,7 @@ use zcash_primitives::primitives::{Diversifier, ViewingKey};
 
 use crate::{
     librustzcash_sapling_generate_r, librustzcash_sapling_ka_agree,
-    librustzcash_sapling_ka_derivepublic,
+    librustzcash_sapling_ka_derivepublic, sapling_ka::librustzcash_sapling_ka_agree_batch,
 };
 
 #[test]
@@ -69,3 +69,45 @@ fn test_key_agreement() {
     assert!(!shared_secret_sender.iter().all(|&v| v == 0));
     assert_eq!(shared_secret_sender, shared_secret_recipient);
 }
+
+#[test]
+fn test_key_agreement_batch() {
+    let mut rng = OsRng;
+
+    let mut epks: Vec<[u8; 32]> = (0..5)
+        .map(|_| jubjub::ExtendedPoint::random(&mut rng).to_bytes())
+        .collect();
+    let mut ivks: Vec<[u8; 32]> = (0..7)
+        .map(|_| {
+            let mut ivk = [0u8; 32];
+            librustzcash_sapling_generate_r(&mut ivk);
+            ivk
+        })
+        .collect();
+
+    // Non-canonical encodings
+    epks[2] = [0xff; 32];
+    ivks[4] = [0xff; 32];
+
+    let mut results = vec![[0u8; 32]; epks.len() * ivks.len()];
+    let mut valid = vec![true; epks.len() * ivks.len()];
+    librustzcash_sapling_ka_agree_batch(
+        epks.as_ptr(),
+        epks.len(),
+        ivks.as_ptr(),
+        ivks.len(),
+        results.as_mut_ptr(),
+        valid.as_mut_ptr(),
+    );
+
+    for (i, epk) in epks.iter().enumerate() {
+        for (j, ivk) in ivks.iter().enumerate() {
+            let mut expected = [0u8; 32];
+            let expected_valid = librustzcash_sapling_ka_agree(epk, ivk, &mut expected);
+            assert_eq!(valid[i * ivks.len() + j], expected_valid);
+            if expected_valid {
+                assert_eq!(results[i * ivks.len() + j], expected);
+            }
+        }
+    }
+}
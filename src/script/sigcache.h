@@ -8,14 +8,39 @@
 
 #include "script/interpreter.h"
 
+#include <string.h>
 #include <vector>
 
-// DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
+#include <rust/ed25519/types.h>
+
+// DoS prevention: limit cache size to 40MB (over 1300000 entries).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+// Maximum sig cache size allowed
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
 class CPubKey;
 
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation.
+ *
+ * This may exhibit platform endian dependent behavior but because these are
+ * nonced hashes (random) and this state is only ever used locally it is safe.
+ * All that matters is local consistency.
+ */
+class SignatureCacheHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select < 8, "SignatureCacheHasher only has 8 hashes available.");
+        uint32_t u;
+        memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -27,4 +52,13 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/**
+ * Verifies the Ed25519 signature over the JoinSplits of a transaction,
+ * consulting the signature cache first. Valid signatures are added to the
+ * cache if store is set.
+ */
+bool CachingJoinSplitSigVerify(const Ed25519VerificationKey& pubkey, const Ed25519Signature& sig, const uint256& dataToBeSigned, bool store);
+
+void InitSignatureCache();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
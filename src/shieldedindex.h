@@ -0,0 +1,112 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_SHIELDEDINDEX_H
+#define ZCASH_SHIELDEDINDEX_H
+
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "serialize.h"
+#include "uint256.h"
+#include "zcash/NoteEncryption.hpp"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+/**
+ * The parts of a Sapling output that are needed to trial-decrypt it: the
+ * leading bytes of its note ciphertext hold everything but the memo.
+ */
+struct CCompactSaplingOutput {
+    uint256 cmu;
+    uint256 epk;
+    libzcash::SaplingCompactCiphertext encCiphertext;
+
+    CCompactSaplingOutput() {}
+
+    explicit CCompactSaplingOutput(const OutputDescription& output) : cmu(output.cmu), epk(output.ephemeralKey) {
+        std::copy(output.encCiphertext.begin(), output.encCiphertext.begin() + encCiphertext.size(), encCiphertext.begin());
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(cmu);
+        READWRITE(epk);
+        READWRITE(encCiphertext);
+    }
+};
+
+/**
+ * The parts of a transaction that a wallet rescan looks at, without the
+ * proofs and signatures.
+ */
+struct CCompactTx {
+    uint256 hash;
+    std::vector<COutPoint> vPrevouts;
+    std::vector<CTxOut> vout;
+    std::vector<uint256> vSproutNullifiers;
+    //! The note commitments of each JoinSplit, whose ciphertexts are not kept
+    std::vector<std::array<uint256, ZC_NUM_JS_OUTPUTS>> vSproutCommitments;
+    std::vector<uint256> vSaplingNullifiers;
+    std::vector<CCompactSaplingOutput> vSaplingOutputs;
+
+    CCompactTx() {}
+
+    explicit CCompactTx(const CTransaction& tx) : hash(tx.GetHash()), vout(tx.vout) {
+        for (const CTxIn& txin : tx.vin) {
+            vPrevouts.push_back(txin.prevout);
+        }
+        for (const JSDescription& jsdesc : tx.vJoinSplit) {
+            vSproutNullifiers.insert(vSproutNullifiers.end(), jsdesc.nullifiers.begin(), jsdesc.nullifiers.end());
+            vSproutCommitments.push_back(jsdesc.commitments);
+        }
+        for (const SpendDescription& spend : tx.vShieldedSpend) {
+            vSaplingNullifiers.push_back(spend.nullifier);
+        }
+        for (const OutputDescription& output : tx.vShieldedOutput) {
+            vSaplingOutputs.emplace_back(output);
+        }
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(vPrevouts);
+        READWRITE(vout);
+        READWRITE(vSproutNullifiers);
+        READWRITE(vSproutCommitments);
+        READWRITE(vSaplingNullifiers);
+        READWRITE(vSaplingOutputs);
+    }
+};
+
+/**
+ * The record kept by the shielded index (-shieldedindex) for each block,
+ * which lets a wallet rescan skip reading the blocks that hold nothing for it.
+ */
+struct CCompactBlock {
+    std::vector<CCompactTx> vtx;
+
+    CCompactBlock() {}
+
+    explicit CCompactBlock(const CBlock& block) {
+        for (const CTransaction& tx : block.vtx) {
+            vtx.emplace_back(tx);
+        }
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vtx);
+    }
+};
+
+#endif // ZCASH_SHIELDEDINDEX_H
@@ -10,6 +10,7 @@
 #include "test/test_bitcoin.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "txdb.h"
 #include "undo.h"
 #include "primitives/transaction.h"
 #include "pubkey.h"
@@ -19,6 +20,7 @@
 #include <map>
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 #include "zcash/IncrementalMerkleTree.hpp"
 
 namespace
@@ -1094,4 +1096,210 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_AUTO_TEST_CASE(shared_cache_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewSharedCache shared(&base);
+
+    // Write some coins and a best block to the shared cache from a child.
+    std::vector<uint256> txids;
+    uint256 hashBlock1 = GetRandHash();
+    {
+        CCoinsViewCache child(&shared);
+        for (int i = 0; i < 100; i++) {
+            uint256 txid = GetRandHash();
+            CCoinsModifier coins = child.ModifyCoins(txid);
+            coins->vout.resize(1);
+            coins->vout[0].nValue = i + 1;
+            coins->nHeight = 1;
+            txids.push_back(txid);
+        }
+        child.SetBestBlock(hashBlock1);
+        BOOST_CHECK(child.Flush());
+    }
+    BOOST_CHECK(shared.GetBestBlock() == hashBlock1);
+    BOOST_CHECK(shared.GetBestBlockHeight().second == -1);
+    shared.SetBestBlockHeight(hashBlock1, 1);
+    BOOST_CHECK(shared.GetBestBlockHeight() == std::make_pair(hashBlock1, 1));
+
+    // Read the coins from several threads at once, while another child spends
+    // half of them.
+    std::atomic<int> nFound(0);
+    boost::thread_group readers;
+    for (int t = 0; t < 4; t++) {
+        readers.create_thread([&]() {
+            for (const uint256& txid : txids) {
+                CCoins coins;
+                if (shared.GetCoins(txid, coins) && shared.HaveCoins(txid)) {
+                    nFound++;
+                }
+            }
+        });
+    }
+    uint256 hashBlock2 = GetRandHash();
+    {
+        CCoinsViewCache child(&shared);
+        for (size_t i = 0; i < txids.size(); i += 2) {
+            child.ModifyCoins(txids[i])->Spend(0);
+        }
+        child.SetBestBlock(hashBlock2);
+        BOOST_CHECK(child.Flush());
+    }
+    readers.join_all();
+    BOOST_CHECK(nFound >= 4 * 50);
+
+    // The height of the previous best block no longer applies.
+    BOOST_CHECK(shared.GetBestBlockHeight().second == -1);
+    shared.SetBestBlockHeight(hashBlock2, 2);
+    BOOST_CHECK(shared.GetBestBlockHeight() == std::make_pair(hashBlock2, 2));
+
+    for (size_t i = 0; i < txids.size(); i++) {
+        CCoins coins;
+        bool fAvailable = shared.GetCoins(txids[i], coins) && coins.IsAvailable(0);
+        BOOST_CHECK_EQUAL(fAvailable, i % 2 == 1);
+    }
+
+    // Flushing to the base view keeps the best block and its height.
+    BOOST_CHECK(shared.Flush());
+    BOOST_CHECK_EQUAL(shared.GetCacheSize(), 0);
+    BOOST_CHECK(base.GetBestBlock() == hashBlock2);
+    BOOST_CHECK(shared.GetBestBlockHeight() == std::make_pair(hashBlock2, 2));
+    CCoins coins;
+    BOOST_CHECK(shared.GetCoins(txids[1], coins));
+    BOOST_CHECK(coins.IsAvailable(0));
+}
+
+namespace {
+
+//! Gives tests access to the underlying database of a CCoinsViewDB.
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    void WriteLegacyCoins(const uint256& txid, const CCoins& coins) {
+        BOOST_CHECK(db.Write(std::make_pair('c', txid), coins));
+    }
+};
+
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_simulation_test, TestingSetup)
+{
+    // Create, spend and restore outputs through a stack of caches on top of
+    // the database, which only writes the outputs that changed, and check
+    // that the database reads back what the caches held.
+    CCoinsViewDBTest db;
+    std::map<uint256, CCoins> result;
+    std::vector<CCoinsViewCache*> stack;
+    stack.push_back(new CCoinsViewCache(&db));
+
+    std::vector<uint256> txids;
+    for (unsigned int i = 0; i < 50; i++) {
+        txids.push_back(GetRandHash());
+    }
+
+    for (unsigned int i = 0; i < 5000; i++) {
+        uint256 txid = txids[insecure_rand() % txids.size()];
+        CCoins& coins = result[txid];
+        if (coins.IsPruned()) {
+            // Create the outputs of a transaction.
+            CCoinsModifier entry = stack.back()->ModifyNewCoins(txid);
+            coins.nVersion = 1 + insecure_rand() % 4;
+            coins.nHeight = insecure_rand() % 1000;
+            coins.fCoinBase = insecure_rand() % 2;
+            coins.vout.resize(1 + insecure_rand() % 6);
+            for (CTxOut& out : coins.vout) {
+                out.nValue = insecure_rand() % 100000;
+                out.scriptPubKey = CScript() << OP_TRUE;
+            }
+            *entry = coins;
+        } else {
+            unsigned int n = insecure_rand() % (coins.vout.size() + 1);
+            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
+            if (coins.IsAvailable(n)) {
+                coins.Spend(n);
+                entry->Spend(n);
+            } else {
+                // Restore an output, the way that undo data does.
+                CTxOut out(insecure_rand() % 100000, CScript() << OP_TRUE);
+                if (coins.vout.size() <= n) {
+                    coins.vout.resize(n + 1);
+                    entry->vout.resize(n + 1);
+                }
+                coins.vout[n] = out;
+                entry->vout[n] = out;
+            }
+            coins.Cleanup();
+        }
+
+        if (insecure_rand() % 50 == 0) {
+            // Flush and remove the top cache, flush the bottom one to the
+            // database, or add a new one.
+            if (stack.size() > 1 && insecure_rand() % 2 == 0) {
+                stack.back()->Flush();
+                delete stack.back();
+                stack.pop_back();
+            } else if (stack.size() == 1 && insecure_rand() % 2 == 0) {
+                stack.back()->Flush();
+            } else if (stack.size() < 4) {
+                stack.push_back(new CCoinsViewCache(stack.back()));
+            }
+        }
+    }
+
+    while (!stack.empty()) {
+        stack.back()->Flush();
+        delete stack.back();
+        stack.pop_back();
+    }
+
+    for (const uint256& txid : txids) {
+        CCoins coins;
+        bool fHave = db.GetCoins(txid, coins);
+        BOOST_CHECK_EQUAL(fHave, !result[txid].IsPruned());
+        BOOST_CHECK_EQUAL(db.HaveCoins(txid), fHave);
+        BOOST_CHECK(coins == result[txid]);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_upgrade_test, TestingSetup)
+{
+    CCoinsViewDBTest db;
+    std::map<uint256, CCoins> coinsMap;
+    for (unsigned int i = 0; i < 100; i++) {
+        CCoins coins;
+        coins.nVersion = 2;
+        coins.nHeight = i;
+        coins.fCoinBase = i % 2;
+        coins.vout.resize(1 + i % 5);
+        for (CTxOut& out : coins.vout) {
+            out.nValue = insecure_rand() % 100000;
+            out.scriptPubKey = CScript() << OP_TRUE;
+        }
+        if (coins.vout.size() > 1) {
+            coins.Spend(0);
+        }
+        uint256 txid = GetRandHash();
+        db.WriteLegacyCoins(txid, coins);
+        coinsMap[txid] = coins;
+    }
+    BOOST_CHECK(!db.HaveCoins(coinsMap.begin()->first));
+
+    BOOST_CHECK(db.Upgrade());
+    for (const auto& entry : coinsMap) {
+        CCoins coins;
+        BOOST_CHECK(db.GetCoins(entry.first, coins));
+        BOOST_CHECK(db.HaveCoins(entry.first));
+        BOOST_CHECK(coins == entry.second);
+    }
+    BOOST_CHECK(!db.HaveCoins(GetRandHash()));
+
+    // Upgrading again has no effect.
+    BOOST_CHECK(db.Upgrade());
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(coinsMap.begin()->first, coins));
+    BOOST_CHECK(coins == coinsMap.begin()->second);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
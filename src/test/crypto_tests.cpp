@@ -10,6 +10,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "test_random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -482,6 +483,56 @@ BOOST_AUTO_TEST_CASE(chacha20_testvector)
                  "fab78c9");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    const sha256_implementation::UseImplementation impls[] = {
+        sha256_implementation::STANDARD,
+        sha256_implementation::USE_SSE41,
+        sha256_implementation::USE_AVX2,
+        sha256_implementation::USE_SHANI,
+        sha256_implementation::USE_ALL,
+    };
+
+    FastRandomContext ctx(true);
+    std::vector<unsigned char> in(64 * 32 + 1000);
+    for (size_t i = 0; i < in.size(); i += 8) {
+        uint64_t x = ctx.rand64();
+        memcpy(&in[i], &x, std::min<size_t>(8, in.size() - i));
+    }
+    // An odd offset, as merkle tree hashes need not be aligned
+    const unsigned char* data = &in[1];
+
+    // The reference hashes come from the standard code, so that each of the
+    // other backends is checked against it rather than against itself
+    SHA256AutoDetect(sha256_implementation::STANDARD);
+    uint256 expected_stream;
+    CSHA256().Write(&in[0], in.size()).Finalize(expected_stream.begin());
+    std::vector<uint256> expected_d64;
+    for (int i = 0; i < 32; i++) {
+        expected_d64.push_back(Hash(data + 64 * i, data + 64 * (i + 1)));
+    }
+
+    for (auto impl : impls) {
+        BOOST_TEST_MESSAGE("Using the '" << SHA256AutoDetect(impl) << "' SHA256 implementation");
+
+        // Streams of many blocks go through the same backend
+        uint256 stream;
+        CSHA256().Write(&in[0], 100).Write(&in[100], in.size() - 100).Finalize(stream.begin());
+        BOOST_CHECK(stream == expected_stream);
+
+        // Every number of blobs, to cover both the multi-way backends and
+        // the blobs that are left over for the single-way one
+        for (int blocks = 0; blocks <= 32; blocks++) {
+            std::vector<unsigned char> out(32 * blocks);
+            SHA256D64(out.data(), data, blocks);
+            for (int i = 0; i < blocks; i++) {
+                BOOST_CHECK(memcmp(&out[32 * i], expected_d64[i].begin(), 32) == 0);
+            }
+        }
+    }
+    SHA256AutoDetect();
+}
+
 BOOST_AUTO_TEST_CASE(countbits_tests)
 {
     FastRandomContext ctx;
@@ -0,0 +1,133 @@
+// Copyright (c) 2012-2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "cuckoocache.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+/** Test Suite for CuckooCache
+ *
+ *  1) All tests should have a deterministic result (using deterministic seeds)
+ *  2) Some test methods are templated to allow for easier testing
+ *  against new versions / comparing
+ *  3) Results should be treated as a regression test, i.e., did the behavior
+ *  change significantly from what was expected. This can be OK, depending on
+ *  the nature of the change, but requires updating the tests to reflect the new
+ *  expected behavior. For example improving the hit rate may cause some tests
+ *  using BOOST_CHECK_CLOSE to fail.
+ *
+ */
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+namespace {
+
+typedef CuckooCache::cache<uint256, SignatureCacheHasher> sigcache_type;
+
+uint256 RandomEntry(FastRandomContext& rng)
+{
+    uint256 entry;
+    for (int i = 0; i < 4; i++) {
+        uint64_t n = rng.rand64();
+        memcpy(entry.begin() + 8 * i, &n, 8);
+    }
+    return entry;
+}
+
+/** Inserts size * load random entries, and returns the fraction of them that can be found. */
+double HitRate(double load, uint32_t size)
+{
+    FastRandomContext rng(true);
+    sigcache_type cache;
+    size = cache.setup(size);
+    std::vector<uint256> entries;
+    for (uint32_t i = 0; i < size * load; i++)
+        entries.push_back(RandomEntry(rng));
+    for (const uint256& entry : entries)
+        cache.insert(entry);
+    uint32_t count = 0;
+    for (const uint256& entry : entries)
+        count += cache.contains(entry, false);
+    return double(count) / entries.size();
+}
+
+}
+
+/* Test that no values not inserted into the cache are read out of it. */
+BOOST_AUTO_TEST_CASE(cuckoocache_no_fakes)
+{
+    FastRandomContext rng(true);
+    sigcache_type cache;
+    cache.setup_bytes(32 << 20);
+    for (int x = 0; x < 100000; ++x)
+        cache.insert(RandomEntry(rng));
+    for (int x = 0; x < 100000; ++x)
+        BOOST_CHECK(!cache.contains(RandomEntry(rng), false));
+}
+
+/** Check the hit rate of caches filled to various loads. Below about 90% of
+ * the size, almost everything that was inserted can be found again.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate_ok)
+{
+    for (double load = 0.1; load < 0.9; load += 0.2)
+        BOOST_CHECK_GE(HitRate(load, 1 << 16), 0.98);
+    // An overfull cache holds on to most of what it has room for
+    BOOST_CHECK_GE(HitRate(2.0, 1 << 16) * 2.0, 0.75);
+}
+
+/** Entries that were erased are evicted before the ones that were not. */
+BOOST_AUTO_TEST_CASE(cuckoocache_erase_ok)
+{
+    FastRandomContext rng(true);
+    sigcache_type cache;
+    uint32_t size = cache.setup(1 << 16);
+    std::vector<uint256> entries;
+    for (uint32_t i = 0; i < size; i++)
+        entries.push_back(RandomEntry(rng));
+
+    // Insert the first half, and erase half of those
+    for (uint32_t i = 0; i < size / 2; i++)
+        cache.insert(entries[i]);
+    for (uint32_t i = 0; i < size / 4; i++)
+        BOOST_CHECK(cache.contains(entries[i], true));
+
+    // Erased entries are still found until their space is needed
+    BOOST_CHECK(cache.contains(entries[0], false));
+
+    // Adding another quarter reuses the erased slots, rather than evicting
+    // the entries that were not erased
+    for (uint32_t i = size / 2; i < 3 * size / 4; i++)
+        cache.insert(entries[i]);
+    uint32_t nKept = 0, nErasedKept = 0;
+    for (uint32_t i = size / 4; i < size / 2; i++)
+        nKept += cache.contains(entries[i], false);
+    for (uint32_t i = 0; i < size / 4; i++)
+        nErasedKept += cache.contains(entries[i], false);
+    BOOST_CHECK_GE(double(nKept) / (size / 4), 0.99);
+    BOOST_CHECK_LT(nErasedKept, nKept);
+}
+
+/** Once the cache has filled up, the most recent entries are kept. */
+BOOST_AUTO_TEST_CASE(cuckoocache_generations)
+{
+    FastRandomContext rng(true);
+    sigcache_type cache;
+    uint32_t size = cache.setup(1 << 16);
+    std::vector<uint256> entries;
+    for (uint32_t i = 0; i < 3 * size; i++) {
+        entries.push_back(RandomEntry(rng));
+        cache.insert(entries.back());
+    }
+    // The latest generation is 45% of the size
+    uint32_t nRecent = (45 * size) / 100;
+    uint32_t nKept = 0;
+    for (uint32_t i = entries.size() - nRecent; i < entries.size(); i++)
+        nKept += cache.contains(entries[i], false);
+    BOOST_CHECK_GE(double(nKept) / nRecent, 0.95);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,55 @@
+// Copyright (c) 2026 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "chainparams.h"
+#include "main.h"
+#include "streams.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(loadblock_tests)
+
+#ifdef ENABLE_MINING
+BOOST_AUTO_TEST_CASE(import_whole_file)
+{
+    // Mine a chain, and keep its blocks
+    std::vector<CBlock> blocks;
+    {
+        TestChain100Setup setup;
+        for (int i = 1; i <= chainActive.Height(); i++) {
+            CBlock block;
+            BOOST_REQUIRE(ReadBlockFromDisk(block, chainActive[i], Params().GetConsensus()));
+            blocks.push_back(block);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(blocks.size(), (size_t)COINBASE_MATURITY);
+
+    // Import them into a fresh chain from a file in block file format. The
+    // whole file fits in one batch, so the batch that holds the blocks is
+    // also the one that reaches the end of the file.
+    TestingSetup setup(CBaseChainParams::REGTEST);
+    fs::path path = setup.pathTemp / "bootstrap.dat";
+    {
+        CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!fileout.IsNull());
+        for (const CBlock& block : blocks) {
+            unsigned int nSize = GetSerializeSize(fileout, block);
+            fileout << FLATDATA(Params().MessageStart()) << nSize << block;
+        }
+    }
+
+    FILE* file = fsbridge::fopen(path, "rb");
+    BOOST_REQUIRE(file != NULL);
+    BOOST_CHECK(LoadExternalBlockFile(Params(), file));
+
+    BOOST_CHECK_EQUAL((size_t)chainActive.Height(), blocks.size());
+    for (const CBlock& block : blocks) {
+        BOOST_CHECK(chainActive.Contains(mapBlockIndex[block.GetHash()]));
+    }
+}
+#endif // ENABLE_MINING
+
+BOOST_AUTO_TEST_SUITE_END()
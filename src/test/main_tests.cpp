@@ -4,6 +4,7 @@
 
 #include "chainparams.h"
 #include "main.h"
+#include "txdb.h"
 
 #include "test/test_bitcoin.h"
 
@@ -123,4 +124,31 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     BOOST_CHECK(Test());
 }
 
+BOOST_AUTO_TEST_CASE(block_index_solution_trim)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    uint256 hash = genesis.GetHash();
+    CBlockIndex index(genesis);
+    index.phashBlock = &hash;
+    BOOST_CHECK(index.HasSolution());
+
+    // The solution can only be trimmed once the entry has been written
+    std::vector<std::pair<int, const CBlockFileInfo*>> vFiles;
+    BOOST_CHECK(pblocktree->WriteBatchSync(vFiles, 0, {&index}));
+    index.TrimSolution();
+    BOOST_CHECK(!index.HasSolution());
+
+    LOCK(cs_main);
+    BOOST_CHECK(index.GetSolution() == genesis.nSolution);
+    BOOST_CHECK(index.GetBlockHeader().GetHash() == hash);
+
+    // Writing the entry again keeps its solution
+    index.nStatus |= BLOCK_VALID_TREE;
+    BOOST_CHECK(pblocktree->WriteBatchSync(vFiles, 0, {&index}));
+    CDiskBlockIndex dbindex;
+    BOOST_CHECK(pblocktree->ReadDiskBlockIndex(hash, dbindex));
+    BOOST_CHECK(dbindex.GetDiskSolution() == genesis.nSolution);
+    BOOST_CHECK(dbindex.nStatus & BLOCK_VALID_TREE);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
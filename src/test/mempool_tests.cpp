@@ -157,6 +157,118 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     BOOST_CHECK(it == pool.mapTx.get<1>().end());
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorStateTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+
+    // A parent paying a low fee, with a child paying a high one, and a
+    // grandchild:
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 10 * COIN;
+    }
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+    CMutableTransaction txGrandChild;
+    txGrandChild.vin.resize(1);
+    txGrandChild.vin[0].scriptSig = CScript() << OP_11;
+    txGrandChild.vin[0].prevout = COutPoint(txChild.GetHash(), 0);
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txGrandChild.vout[0].nValue = 8 * COIN;
+    // ... and an unrelated transaction
+    CMutableTransaction txOther;
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txOther.vout[0].nValue = 5 * COIN;
+
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(30000LL).FromTx(txChild));
+    pool.addUnchecked(txGrandChild.GetHash(), entry.Fee(2000LL).FromTx(txGrandChild));
+    pool.addUnchecked(txOther.GetHash(), entry.Fee(1500LL).FromTx(txOther));
+
+    CTxMemPool::txiter parentIt = pool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter childIt = pool.mapTx.find(txChild.GetHash());
+    CTxMemPool::txiter grandChildIt = pool.mapTx.find(txGrandChild.GetHash());
+    CTxMemPool::txiter otherIt = pool.mapTx.find(txOther.GetHash());
+    uint64_t nParentSize = parentIt->GetTxSize();
+    uint64_t nChildSize = childIt->GetTxSize();
+    uint64_t nGrandChildSize = grandChildIt->GetTxSize();
+
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(parentIt->GetSizeWithDescendants(), nParentSize + nChildSize + nGrandChildSize);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 33000LL);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(childIt->GetSizeWithAncestors(), nParentSize + nChildSize);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 31000LL);
+    BOOST_CHECK_EQUAL(grandChildIt->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(grandChildIt->GetModFeesWithAncestors(), 33000LL);
+    BOOST_CHECK_EQUAL(otherIt->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(otherIt->GetCountWithDescendants(), 1);
+
+    // The child's package pays the best fee rate, and the parent on its own
+    // the worst
+    BOOST_CHECK(pool.mapTx.get<3>().begin()->GetTx().GetHash() == txChild.GetHash());
+    BOOST_CHECK(pool.mapTx.get<3>().rbegin()->GetTx().GetHash() == txParent.GetHash());
+
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*grandChildIt, setAncestors, nNoLimit, nNoLimit, errString, false));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 2);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(*grandChildIt, setAncestors, 2, nNoLimit, errString, false));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(*grandChildIt, setAncestors, nNoLimit, 2, errString, false));
+
+    // Prioritising the grandchild changes the state of all three
+    pool.PrioritiseTransaction(txGrandChild.GetHash(), txGrandChild.GetHash().ToString(), 0, 5000LL);
+    BOOST_CHECK_EQUAL(grandChildIt->GetModifiedFee(), 7000LL);
+    BOOST_CHECK_EQUAL(grandChildIt->GetModFeesWithAncestors(), 38000LL);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithDescendants(), 37000LL);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 38000LL);
+
+    // Removing the parent without its descendants, as when it is mined,
+    // leaves the child at the top of its package
+    std::list<CTransaction> removed;
+    pool.remove(txParent, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 30000LL);
+    BOOST_CHECK_EQUAL(grandChildIt->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(grandChildIt->GetSizeWithAncestors(), nChildSize + nGrandChildSize);
+    BOOST_CHECK(pool.GetMemPoolParents(childIt).empty());
+
+    // Adding it back, as when its block is disconnected, links it up again
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+    parentIt = pool.mapTx.find(txParent.GetHash());
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 38000LL);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(grandChildIt->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(grandChildIt->GetModFeesWithAncestors(), 38000LL);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(parentIt).size(), 1);
+
+    // Removing the grandchild updates its ancestors
+    removed.clear();
+    pool.remove(txGrandChild, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(parentIt->GetSizeWithDescendants(), nParentSize + nChildSize);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 31000LL);
+    BOOST_CHECK(pool.GetMemPoolChildren(childIt).empty());
+}
+
 BOOST_AUTO_TEST_CASE(RemoveWithoutBranchId) {
     CTxMemPool pool(CFeeRate(0));
     TestMemPoolEntryHelper entry;
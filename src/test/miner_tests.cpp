@@ -7,6 +7,7 @@
 #include "main.h"
 #include "miner.h"
 #include "pubkey.h"
+#include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
 #include "crypto/equihash.h"
@@ -465,4 +466,146 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCoinbaseEnforcedShieldingEnabled = true;
 }
 
+#ifdef ENABLE_MINING
+BOOST_FIXTURE_TEST_CASE(CreateNewBlock_incremental, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    boost::shared_ptr<CReserveScript> minerAddress(new CReserveScript());
+    minerAddress->reserveScript = scriptPubKey;
+    TestMemPoolEntryHelper entry;
+
+    // Spend the first three mature coinbase transactions
+    std::vector<CMutableTransaction> spends(3);
+    for (int i = 0; i < 3; i++) {
+        spends[i].vin.resize(1);
+        spends[i].vin[0].prevout.hash = coinbaseTxns[i].GetHash();
+        spends[i].vin[0].prevout.n = 0;
+        spends[i].vout.resize(1);
+        spends[i].vout[0].nValue = 11*CENT;
+        spends[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, spends[i], 0, SIGHASH_ALL, coinbaseTxns[i].vout[0].nValue, SPROUT_BRANCH_ID);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spends[i].vin[0].scriptSig << vchSig;
+    }
+
+    LOCK(cs_main);
+    mempool.addUnchecked(spends[0].GetHash(), entry.Time(GetTime()).SpendsCoinbase(true).FromTx(spends[0]));
+    std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(chainparams, minerAddress));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+
+    // Transactions that arrive later are added to the existing selection
+    mempool.addUnchecked(spends[1].GetHash(), entry.Time(GetTime()).SpendsCoinbase(true).FromTx(spends[1]));
+    mempool.addUnchecked(spends[2].GetHash(), entry.Time(GetTime()).SpendsCoinbase(true).FromTx(spends[2]));
+    pblocktemplate.reset(CreateNewBlock(chainparams, minerAddress));
+    std::vector<CTransaction> vtx = pblocktemplate->block.vtx;
+    BOOST_CHECK_EQUAL(vtx.size(), 4);
+    BOOST_CHECK(vtx[1].GetHash() == spends[0].GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -(pblocktemplate->vTxFees[1] + pblocktemplate->vTxFees[2] + pblocktemplate->vTxFees[3]));
+
+    // Without any changes to the mempool, the same selection is returned
+    pblocktemplate.reset(CreateNewBlock(chainparams, minerAddress));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+    for (size_t i = 1; i < vtx.size(); i++)
+        BOOST_CHECK(pblocktemplate->block.vtx[i].GetHash() == vtx[i].GetHash());
+
+    // A removal means starting over
+    std::list<CTransaction> removed;
+    mempool.remove(spends[0], removed);
+    pblocktemplate.reset(CreateNewBlock(chainparams, minerAddress));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    for (const CTransaction& tx : pblocktemplate->block.vtx)
+        BOOST_CHECK(tx.GetHash() != spends[0].GetHash());
+
+    // An empty block leaves the selection alone
+    CMutableTransaction next_cb_mtx = CreateCoinbaseTransaction(chainparams, 0, minerAddress, chainActive.Height() + 1);
+    pblocktemplate.reset(CreateNewBlock(chainparams, minerAddress, next_cb_mtx));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    pblocktemplate.reset(CreateNewBlock(chainparams, minerAddress));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+
+    mempool.clear();
+}
+
+BOOST_FIXTURE_TEST_CASE(CreateNewBlock_cpfp, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    boost::shared_ptr<CReserveScript> minerAddress(new CReserveScript());
+    minerAddress->reserveScript = scriptPubKey;
+    TestMemPoolEntryHelper entry;
+    entry.nTime = GetTime();
+
+    auto sign = [&](CMutableTransaction& mtx, CAmount amount) {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, mtx, 0, SIGHASH_ALL, amount, SPROUT_BRANCH_ID);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        mtx.vin[0].scriptSig << vchSig;
+    };
+
+    // A parent paying no fee, which couldn't be mined on its own
+    CMutableTransaction parent;
+    parent.vin.resize(1);
+    parent.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    parent.vout.resize(1);
+    parent.vout[0].nValue = coinbaseTxns[0].vout[0].nValue;
+    parent.vout[0].scriptPubKey = scriptPubKey;
+    sign(parent, coinbaseTxns[0].vout[0].nValue);
+
+    // ... a child paying enough for both
+    CMutableTransaction child;
+    child.vin.resize(1);
+    child.vin[0].prevout = COutPoint(parent.GetHash(), 0);
+    child.vout.resize(1);
+    child.vout[0].nValue = parent.vout[0].nValue - 10000;
+    child.vout[0].scriptPubKey = scriptPubKey;
+    sign(child, parent.vout[0].nValue);
+
+    // ... and an unrelated transaction paying less than the child
+    CMutableTransaction other;
+    other.vin.resize(1);
+    other.vin[0].prevout = COutPoint(coinbaseTxns[1].GetHash(), 0);
+    other.vout.resize(1);
+    other.vout[0].nValue = coinbaseTxns[1].vout[0].nValue - 1000;
+    other.vout[0].scriptPubKey = scriptPubKey;
+    sign(other, coinbaseTxns[1].vout[0].nValue);
+
+    // Select by fee rate only
+    mapArgs["-blockprioritysize"] = "0";
+
+    LOCK(cs_main);
+    mempool.addUnchecked(parent.GetHash(), entry.Fee(0).SpendsCoinbase(true).FromTx(parent));
+    mempool.addUnchecked(other.GetHash(), entry.Fee(1000).SpendsCoinbase(true).FromTx(other));
+    std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(chainparams, minerAddress));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == other.GetHash());
+
+    // The child brings its parent into the block
+    mempool.addUnchecked(child.GetHash(), entry.Fee(10000).SpendsCoinbase(false).FromTx(child));
+    pblocktemplate.reset(CreateNewBlock(chainparams, minerAddress));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == parent.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[3].GetHash() == child.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -11000);
+
+    // ... and a selection from scratch puts their package first
+    std::list<CTransaction> removed;
+    mempool.remove(other, removed);
+    mempool.addUnchecked(other.GetHash(), entry.Fee(1000).SpendsCoinbase(true).FromTx(other));
+    pblocktemplate.reset(CreateNewBlock(chainparams, minerAddress));
+    std::vector<CTransaction>& vtx = pblocktemplate->block.vtx;
+    BOOST_CHECK_EQUAL(vtx.size(), 4);
+    BOOST_CHECK(vtx[1].GetHash() == parent.GetHash());
+    BOOST_CHECK(vtx[2].GetHash() == child.GetHash());
+    BOOST_CHECK(vtx[3].GetHash() == other.GetHash());
+
+    mapArgs.erase("-blockprioritysize");
+    mempool.clear();
+}
+#endif // ENABLE_MINING
+
 BOOST_AUTO_TEST_SUITE_END()
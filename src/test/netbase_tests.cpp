@@ -251,4 +251,59 @@ BOOST_AUTO_TEST_CASE(netbase_getgroup)
     BOOST_CHECK(CNetAddr("2001:2001:9999:9999:9999:9999:9999:9999").GetGroup() == boost::assign::list_of((unsigned char)NET_IPV6)(32)(1)(32)(1)); //IPv6
 }
 
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(netbase_socket_events)
+{
+    for (CSocketEvents::Mode mode : {CSocketEvents::SELECT, CSocketEvents::POLL, CSocketEvents::EPOLL}) {
+        CSocketEvents socketEvents(mode);
+        BOOST_CHECK(socketEvents.GetMode() <= mode);
+
+        int fds[2];
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        std::vector<std::pair<SOCKET, uint8_t>> vReady;
+
+        // Nothing to receive yet
+        socketEvents.Set(fds[0], CSocketEvents::RECV);
+        socketEvents.Wait(0, vReady);
+        BOOST_CHECK(vReady.empty());
+
+        // Ready once there is
+        BOOST_REQUIRE(write(fds[1], "x", 1) == 1);
+        socketEvents.Wait(1000, vReady);
+        BOOST_REQUIRE_EQUAL(vReady.size(), 1);
+        BOOST_CHECK_EQUAL(vReady[0].first, (SOCKET)fds[0]);
+        BOOST_CHECK_EQUAL(vReady[0].second, CSocketEvents::RECV);
+
+        // ... unless it isn't being waited for
+        vReady.clear();
+        socketEvents.Set(fds[0], 0);
+        socketEvents.Wait(0, vReady);
+        BOOST_CHECK(vReady.empty());
+
+        // The socket can always send
+        socketEvents.Set(fds[0], CSocketEvents::SEND);
+        socketEvents.Wait(1000, vReady);
+        BOOST_REQUIRE_EQUAL(vReady.size(), 1);
+        BOOST_CHECK_EQUAL(vReady[0].second, CSocketEvents::SEND);
+
+        // Removed sockets aren't waited on at all
+        vReady.clear();
+        socketEvents.Set(fds[1], CSocketEvents::RECV);
+        socketEvents.Remove(fds[0]);
+        socketEvents.Wait(0, vReady);
+        BOOST_CHECK(vReady.empty());
+
+        // A hangup is reported
+        close(fds[0]);
+        socketEvents.Wait(1000, vReady);
+        BOOST_REQUIRE_EQUAL(vReady.size(), 1);
+        BOOST_CHECK_EQUAL(vReady[0].first, (SOCKET)fds[1]);
+        BOOST_CHECK(vReady[0].second & (CSocketEvents::RECV | CSocketEvents::ERR));
+
+        socketEvents.Remove(fds[1]);
+        close(fds[1]);
+    }
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
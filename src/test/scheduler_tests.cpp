@@ -4,9 +4,13 @@
 
 #include "random.h"
 #include "scheduler.h"
+#include "validationinterface.h"
 
 #include "test/test_bitcoin.h"
 
+#include <atomic>
+#include <future>
+
 #include <boost/bind/bind.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
@@ -107,4 +111,134 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+BOOST_AUTO_TEST_CASE(singlethreadedscheduler_ordered)
+{
+    CScheduler scheduler;
+
+    // each queue should be well ordered with respect to itself but not other queues
+    SingleThreadedSchedulerClient queue1(&scheduler);
+    SingleThreadedSchedulerClient queue2(&scheduler);
+
+    // create more threads than queues
+    // if the queues only permit execution of one task at once then
+    // the extra threads should effectively be doing nothing
+    // if they don't we'll get out of order behaviour
+    boost::thread_group threads;
+    for (int i = 0; i < 5; ++i) {
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    }
+
+    // these are not atomic, if SingleThreadedSchedulerClient prevents
+    // parallel execution at the queue level no synchronization should be required here
+    int counter1 = 0;
+    int counter2 = 0;
+
+    // just simply count up on each queue - if execution is properly ordered then
+    // the callbacks should run in exactly the order in which they were enqueued
+    for (int i = 0; i < 100; ++i) {
+        queue1.AddToProcessQueue([i, &counter1]() {
+            BOOST_CHECK_EQUAL(i, counter1++);
+        });
+
+        queue2.AddToProcessQueue([i, &counter2]() {
+            BOOST_CHECK_EQUAL(i, counter2++);
+        });
+    }
+
+    // finish up
+    scheduler.stop(true);
+    threads.join_all();
+
+    BOOST_CHECK_EQUAL(counter1, 100);
+    BOOST_CHECK_EQUAL(counter2, 100);
+}
+
+BOOST_AUTO_TEST_CASE(validationinterface_queue)
+{
+    // Without a scheduler, queued callbacks run inline
+    int counter = 0;
+    CallFunctionInValidationInterfaceQueue([&counter] { counter++; });
+    BOOST_CHECK_EQUAL(counter, 1);
+
+    CScheduler scheduler;
+    RegisterBackgroundSignalScheduler(scheduler);
+    boost::thread_group threads;
+    threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+
+    // Callbacks run in order, and the barrier waits for all of them
+    std::atomic<int> nRun(0);
+    for (int i = 0; i < 100; i++) {
+        CallFunctionInValidationInterfaceQueue([i, &nRun] {
+            BOOST_CHECK_EQUAL(i, nRun++);
+        });
+    }
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(nRun, 100);
+    BOOST_CHECK_EQUAL(ValidationInterfaceCallbacksPending(), 0);
+
+    // Callbacks that are still queued when the scheduler stops are run by
+    // FlushBackgroundCallbacks
+    scheduler.stop(false);
+    threads.join_all();
+    for (int i = 0; i < 5; i++) {
+        CallFunctionInValidationInterfaceQueue([&nRun] { nRun++; });
+    }
+    BOOST_CHECK_EQUAL(ValidationInterfaceCallbacksPending(), 5);
+    FlushBackgroundCallbacks();
+    BOOST_CHECK_EQUAL(nRun, 105);
+    UnregisterBackgroundSignalScheduler();
+}
+
+BOOST_AUTO_TEST_CASE(validationinterface_queue_interrupted)
+{
+    CScheduler scheduler;
+    RegisterBackgroundSignalScheduler(scheduler);
+    boost::thread_group threads;
+    threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+
+    // Interrupt the scheduler thread while it is running a callback, without
+    // joining it, as a failed startup does
+    std::promise<void> started, release;
+    std::shared_future<void> released = release.get_future().share();
+    std::atomic<int> nRun(0);
+    CallFunctionInValidationInterfaceQueue([&started, released, &nRun] {
+        started.set_value();
+        released.wait();
+        nRun++;
+    });
+    for (int i = 0; i < 5; i++) {
+        CallFunctionInValidationInterfaceQueue([i, &nRun] {
+            BOOST_CHECK_EQUAL(i + 1, nRun++);
+        });
+    }
+    started.get_future().wait();
+    threads.interrupt_all();
+    release.set_value();
+
+    // FlushBackgroundCallbacks waits for the thread, then runs whatever it
+    // left in the queue
+    FlushBackgroundCallbacks();
+    BOOST_CHECK(!scheduler.AreThreadsServicingQueue());
+    BOOST_CHECK_EQUAL(nRun, 6);
+    BOOST_CHECK_EQUAL(ValidationInterfaceCallbacksPending(), 0);
+    UnregisterBackgroundSignalScheduler();
+    threads.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(validationinterface_sync_without_thread)
+{
+    // Waiting for the queue returns, rather than blocking forever, when no
+    // thread is running it
+    CScheduler scheduler;
+    RegisterBackgroundSignalScheduler(scheduler);
+    int counter = 0;
+    CallFunctionInValidationInterfaceQueue([&counter] { counter++; });
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(counter, 0);
+
+    FlushBackgroundCallbacks();
+    BOOST_CHECK_EQUAL(counter, 1);
+    UnregisterBackgroundSignalScheduler();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "chainparams.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
 #ifdef ENABLE_MINING
 #include "crypto/equihash.h"
 #endif
@@ -16,8 +17,10 @@
 #include "key.h"
 #include "main.h"
 #include "miner.h"
+#include "proof_verifier.h"
 #include "pubkey.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -71,6 +74,7 @@ JoinSplitTestingSetup::~JoinSplitTestingSetup()
 BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
 {
     assert(sodium_init() != -1);
+    SHA256AutoDetect();
     ECC_Start();
     SetupEnvironment();
     SetupNetworking();
@@ -78,6 +82,8 @@ BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
     fCheckBlockIndex = true;
     SelectParams(chainName);
     noui_connect();
+    InitSignatureCache();
+    InitProofValidityCache();
 }
 
 BasicTestingSetup::~BasicTestingSetup()
@@ -101,7 +107,7 @@ TestingSetup::TestingSetup(const std::string& chainName) : JoinSplitTestingSetup
         mapArgs["-datadir"] = pathTemp.string();
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
-        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        pcoinsTip = new CCoinsViewSharedCache(pcoinsdbview);
         InitBlockIndex(chainparams);
         nScriptCheckThreads = 3;
         for (int i=0; i < nScriptCheckThreads-1; i++)
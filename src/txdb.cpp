@@ -7,9 +7,12 @@
 
 #include "chainparams.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
 
 #include <stdint.h>
 
@@ -24,6 +27,8 @@ static const char DB_SAPLING_ANCHOR = 'Z';
 static const char DB_NULLIFIER = 's';
 static const char DB_SAPLING_NULLIFIER = 'S';
 static const char DB_COINS = 'c';
+static const char DB_COIN = 'o';
+static const char DB_COIN_TX = 'O';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
@@ -34,6 +39,7 @@ static const char DB_BEST_SAPLING_ANCHOR = 'z';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_BLOCK_INDEX_SNAPSHOT = 'I';
 
 static const char DB_MMR_LENGTH = 'M';
 static const char DB_MMR_NODE = 'm';
@@ -46,6 +52,111 @@ static const char DB_SPENTINDEX = 'p';
 static const char DB_TIMESTAMPINDEX = 'T';
 static const char DB_BLOCKHASHINDEX = 'h';
 
+static const char DB_SHIELDEDINDEX = 'C';
+
+namespace {
+
+/**
+ * The key of an unspent output in the coin database. The output index is
+ * serialized big-endian so that the outputs of a transaction are stored
+ * together and in order.
+ *
+ * A transaction that has unspent outputs also has a DB_COIN_TX record keyed by
+ * its txid. Looking that up can use the bloom filters, which a seek over the
+ * outputs cannot, so a txid that is not in the database is rejected without
+ * reading any outputs.
+ */
+struct CoinKey {
+    uint256 txid;
+    uint32_t n;
+
+    CoinKey() : n(0) {}
+    CoinKey(const uint256& txidIn, uint32_t nIn) : txid(txidIn), n(nIn) {}
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 36;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        txid.Serialize(s);
+        ser_writedata32be(s, n);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        txid.Unserialize(s);
+        n = ser_readdata32be(s);
+    }
+};
+
+/**
+ * The record of an unspent output in the coin database. Each record repeats
+ * the metadata of its transaction, so that an output can be written or erased
+ * without touching the other outputs of the transaction.
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nHeight * 2 + fCoinBase)
+ * - the output, compressed with CTxOutCompressor
+ */
+struct CoinEntry {
+    int nVersion;
+    int nHeight;
+    bool fCoinBase;
+    CTxOut out;
+
+    CoinEntry() : nVersion(0), nHeight(0), fCoinBase(false) {}
+    CoinEntry(const CCoins& coins, unsigned int n) :
+        nVersion(coins.nVersion), nHeight(coins.nHeight), fCoinBase(coins.fCoinBase), out(coins.vout[n]) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        unsigned int nCode = nHeight * 2 + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(nVersion));
+        READWRITE(VARINT(nCode));
+        nHeight = nCode / 2;
+        fCoinBase = nCode & 1;
+        READWRITE(REF(CTxOutCompressor(out)));
+    }
+
+    //! Adds this output, as output n, to coins.
+    void AddTo(CCoins& coins, unsigned int n) const {
+        coins.nVersion = nVersion;
+        coins.nHeight = nHeight;
+        coins.fCoinBase = fCoinBase;
+        if (coins.vout.size() <= n)
+            coins.vout.resize(n + 1);
+        coins.vout[n] = out;
+    }
+};
+
+/**
+ * Reads the outputs of txid from the cursor, which must be positioned at its
+ * first output (if any). Returns false if the transaction has no outputs.
+ */
+bool ReadCoins(CDBIterator& cursor, const uint256& txid, CCoins& coins)
+{
+    coins.Clear();
+    bool fFound = false;
+    while (cursor.Valid()) {
+        std::pair<char, CoinKey> key;
+        if (!cursor.GetKey(key) || key.first != DB_COIN || key.second.txid != txid)
+            break;
+        CoinEntry entry;
+        if (!cursor.GetValue(entry))
+            throw std::runtime_error("Coin database corrupted - reindex?");
+        entry.AddTo(coins, key.second.n);
+        fFound = true;
+        cursor.Next();
+    }
+    return fFound;
+}
+
+}
+
 CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
 }
 
@@ -95,11 +206,16 @@ bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+    if (!db.Exists(make_pair(DB_COIN_TX, txid)))
+        return false;
+    // There are no const iterators for LevelDB; see GetStats.
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(make_pair(DB_COIN, CoinKey(txid, 0)));
+    return ReadCoins(*pcursor, txid, coins);
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+    return db.Exists(make_pair(DB_COIN_TX, txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -238,11 +354,35 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
-            else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
-            changed++;
+            // Only write the outputs that were spent or restored. A fresh
+            // entry has no outputs in the database yet, so all of its
+            // available outputs are written.
+            const CCoins &coins = it->second.coins;
+            const std::vector<bool> &dirtyOutputs = it->second.dirtyOutputs;
+            bool fFresh = it->second.flags & CCoinsCacheEntry::FRESH;
+            size_t nOutputs = std::max(coins.vout.size(), dirtyOutputs.size());
+            bool fChanged = false;
+            for (unsigned int i = 0; i < nOutputs; i++) {
+                bool fAvailable = coins.IsAvailable(i);
+                bool fDirty = i < dirtyOutputs.size() && dirtyOutputs[i];
+                if (fAvailable && (fFresh || fDirty)) {
+                    batch.Write(make_pair(DB_COIN, CoinKey(it->first, i)), CoinEntry(coins, i));
+                    fChanged = true;
+                    changed++;
+                } else if (!fAvailable && fDirty) {
+                    batch.Erase(make_pair(DB_COIN, CoinKey(it->first, i)));
+                    fChanged = true;
+                    changed++;
+                }
+            }
+            // The entry holds all of the transaction's outputs, so it knows
+            // whether any are left in the database.
+            if (fChanged) {
+                if (coins.IsPruned())
+                    batch.Erase(make_pair(DB_COIN_TX, it->first));
+                else
+                    batch.Write(make_pair(DB_COIN_TX, it->first), true);
+            }
         }
         count++;
         it = mapCoins.erase(it);
@@ -263,7 +403,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
     if (!hashSaplingAnchor.IsNull())
         batch.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed outputs of %u transactions to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
@@ -286,6 +426,18 @@ bool CBlockTreeDB::ReadReindexing(bool &fReindexing) {
     return true;
 }
 
+bool CBlockTreeDB::WriteBlockIndexSnapshotId(const uint256 &id) {
+    return Write(DB_BLOCK_INDEX_SNAPSHOT, id, true);
+}
+
+bool CBlockTreeDB::ReadBlockIndexSnapshotId(uint256 &id) {
+    return Read(DB_BLOCK_INDEX_SNAPSHOT, id);
+}
+
+bool CBlockTreeDB::EraseBlockIndexSnapshotId() {
+    return Erase(DB_BLOCK_INDEX_SNAPSHOT, true);
+}
+
 bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
@@ -295,30 +447,34 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
+    pcursor->Seek(DB_COIN);
 
+    // The outputs of each transaction are stored together, so the hash is the
+    // same as when the database held one record per transaction.
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
+    bool fFirst = true;
+    uint256 prevTxid;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+        std::pair<char, CoinKey> key;
+        CoinEntry entry;
+        if (pcursor->GetKey(key) && key.first == DB_COIN) {
+            if (pcursor->GetValue(entry)) {
+                if (fFirst || key.second.txid != prevTxid) {
+                    if (!fFirst)
+                        ss << VARINT(0);
+                    stats.nTransactions++;
+                    fFirst = false;
+                    prevTxid = key.second.txid;
                 }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
+                stats.nTransactionOutputs++;
+                ss << VARINT(key.second.n + 1);
+                ss << entry.out;
+                nTotalAmount += entry.out.nValue;
+                stats.nSerializedSize += 36 + pcursor->GetValueSize();
             } else {
                 return error("CCoinsViewDB::GetStats() : unable to read value");
             }
@@ -327,6 +483,8 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
         }
         pcursor->Next();
     }
+    if (!fFirst)
+        ss << VARINT(0);
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
@@ -336,6 +494,59 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     return true;
 }
 
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    std::pair<char, uint256> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COINS) {
+        return true;
+    }
+
+    LogPrintf("Upgrading the coin database to one record per output...\n");
+    uiInterface.InitMessage(_("Upgrading coin database..."));
+    size_t nTransactions = 0;
+    // The cursor reads from a snapshot of the database, so the batches that
+    // are written while it iterates do not affect it. Each batch erases the
+    // records that it converts, so an interrupted upgrade resumes where it
+    // left off.
+    while (pcursor->Valid()) {
+        CDBBatch batch(db);
+        size_t nBatch = 0;
+        for (; pcursor->Valid() && nBatch < COINS_UPGRADE_BATCH_SIZE; pcursor->Next(), nBatch++) {
+            boost::this_thread::interruption_point();
+            if (!pcursor->GetKey(key) || key.first != DB_COINS) {
+                break;
+            }
+            CCoins coins;
+            if (!pcursor->GetValue(coins)) {
+                return error("%s: cannot parse coins record", __func__);
+            }
+            for (unsigned int i = 0; i < coins.vout.size(); i++) {
+                if (!coins.vout[i].IsNull()) {
+                    batch.Write(make_pair(DB_COIN, CoinKey(key.second, i)), CoinEntry(coins, i));
+                }
+            }
+            if (!coins.IsPruned()) {
+                batch.Write(make_pair(DB_COIN_TX, key.second), true);
+            }
+            batch.Erase(key);
+        }
+        if (nBatch == 0) {
+            break;
+        }
+        if (!db.WriteBatch(batch)) {
+            return error("%s: failed to write upgraded coins", __func__);
+        }
+        nTransactions += nBatch;
+        LogPrintf("Upgraded the outputs of %u transactions\n", (unsigned int)nTransactions);
+        if (ShutdownRequested()) {
+            return false;
+        }
+    }
+    LogPrintf("Coin database upgrade done\n");
+    return true;
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -343,11 +554,21 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
-        batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+        // An entry whose solution has been trimmed is already in the database
+        batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it, [&]() {
+            CDiskBlockIndex dbindex;
+            if (!ReadDiskBlockIndex((*it)->GetBlockHash(), dbindex))
+                throw std::runtime_error("Failed to read block index entry " + (*it)->GetBlockHash().ToString());
+            return dbindex.GetDiskSolution();
+        }));
     }
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadDiskBlockIndex(const uint256 &blockHash, CDiskBlockIndex &dbindex) {
+    return Read(make_pair(DB_BLOCK_INDEX, blockHash), dbindex);
+}
+
 bool CBlockTreeDB::EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
@@ -367,6 +588,14 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadShieldedIndex(const uint256 &blockHash, CCompactBlock &block) {
+    return Read(make_pair(DB_SHIELDEDINDEX, blockHash), block);
+}
+
+bool CBlockTreeDB::WriteShieldedIndex(const uint256 &blockHash, const CCompactBlock &block) {
+    return Write(make_pair(DB_SHIELDEDINDEX, blockHash), block);
+}
+
 // START insightexplorer
 // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-81e4f16a1b5d5b7ca25351a63d07cb80R183
 bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDbEntry> &vect)
@@ -540,7 +769,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts(
             CDiskBlockIndex diskindex;
             if (pcursor->GetValue(diskindex)) {
                 // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
+                uint256 hash = diskindex.GetBlockHash();
+                CBlockIndex* pindexNew = insertBlockIndex(hash);
                 pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
                 pindexNew->nHeight        = diskindex.nHeight;
                 pindexNew->nFile          = diskindex.nFile;
@@ -553,7 +783,7 @@ bool CBlockTreeDB::LoadBlockIndexGuts(
                 pindexNew->nTime          = diskindex.nTime;
                 pindexNew->nBits          = diskindex.nBits;
                 pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
+                // The solution is left in the database, see CBlockIndex::GetSolution
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
                 pindexNew->nTx            = diskindex.nTx;
@@ -563,8 +793,7 @@ bool CBlockTreeDB::LoadBlockIndexGuts(
                 pindexNew->hashChainHistoryRoot = diskindex.hashChainHistoryRoot;
 
                 // Consistency checks
-                auto header = pindexNew->GetBlockHeader();
-                if (header.GetHash() != pindexNew->GetBlockHash())
+                if (hash != key.second)
                     return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
                        diskindex.ToString(),  pindexNew->ToString());
                 if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
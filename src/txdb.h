@@ -38,6 +38,8 @@ typedef std::pair<CAddressIndexKey, CAmount> CAddressIndexDbEntry;
 typedef std::pair<CSpentIndexKey, CSpentIndexValue> CSpentIndexDbEntry;
 // END insightexplorer
 
+struct CCompactBlock;
+
 class uint256;
 
 //! -dbcache default (MiB)
@@ -46,6 +48,8 @@ static const int64_t nDefaultDbCache = 450;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! Number of transactions converted per batch by CCoinsViewDB::Upgrade
+static const size_t COINS_UPGRADE_BATCH_SIZE = 10000;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -101,6 +105,13 @@ public:
                     CNullifiersMap &mapSaplingNullifiers,
                     CHistoryCacheMap &historyCacheMap);
     bool GetStats(CCoinsStats &stats) const;
+
+    /**
+     * Converts a coin database that holds one record per transaction to one
+     * record per unspent output. Returns false if the upgrade failed or was
+     * interrupted by a shutdown request.
+     */
+    bool Upgrade();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -115,9 +126,14 @@ public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &info);
+    bool ReadDiskBlockIndex(const uint256 &blockHash, CDiskBlockIndex &dbindex);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindexing);
     bool ReadReindexing(bool &fReindexing);
+    //! The id of the block index snapshot that matches the database, if any
+    bool WriteBlockIndexSnapshotId(const uint256 &id);
+    bool ReadBlockIndexSnapshotId(uint256 &id);
+    bool EraseBlockIndexSnapshotId();
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
 
@@ -137,6 +153,8 @@ public:
     bool ReadTimestampBlockIndex(const uint256 &hash, unsigned int &logicalTS);
     // END insightexplorer
 
+    bool ReadShieldedIndex(const uint256 &blockHash, CCompactBlock &block);
+    bool WriteShieldedIndex(const uint256 &blockHash, const CCompactBlock &block);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(
@@ -8,27 +8,102 @@
 #include "chainparams.h"
 #include "init.h"
 #include "main.h"
+#include "scheduler.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 
 #include <boost/thread.hpp>
 
 #include <chrono>
+#include <future>
+#include <memory>
 #include <thread>
 
 using namespace boost::placeholders;
 
 static CMainSignals g_signals;
 
+// Set while a scheduler thread runs the queued callbacks. These are only
+// changed at startup and shutdown, while validation is not running.
+static CScheduler* g_scheduler = nullptr;
+static std::unique_ptr<SingleThreadedSchedulerClient> g_scheduler_client;
+
 CMainSignals& GetMainSignals()
 {
     return g_signals;
 }
 
+void RegisterBackgroundSignalScheduler(CScheduler& scheduler)
+{
+    assert(!g_scheduler_client);
+    g_scheduler = &scheduler;
+    g_scheduler_client.reset(new SingleThreadedSchedulerClient(&scheduler));
+}
+
+void UnregisterBackgroundSignalScheduler()
+{
+    g_scheduler_client.reset();
+    g_scheduler = nullptr;
+}
+
+void FlushBackgroundCallbacks()
+{
+    if (!g_scheduler_client) {
+        return;
+    }
+    // After a failed startup the scheduler thread has been interrupted but
+    // not joined. Wait for it to return, so that it can't be running a
+    // queued callback when the client is destroyed.
+    g_scheduler->stop();
+    g_scheduler->waitUntilStopped();
+    g_scheduler_client->EmptyQueue();
+}
+
+size_t ValidationInterfaceCallbacksPending()
+{
+    return g_scheduler_client ? g_scheduler_client->CallbacksPending() : 0;
+}
+
+void CallFunctionInValidationInterfaceQueue(std::function<void ()> func)
+{
+    if (g_scheduler_client) {
+        g_scheduler_client->AddToProcessQueue(std::move(func));
+    } else {
+        func();
+    }
+}
+
+void SyncWithValidationInterfaceQueue()
+{
+    // The promise is shared with the callback, which may still be queued if
+    // this returns early.
+    auto promise = std::make_shared<std::promise<void>>();
+    std::future<void> future = promise->get_future();
+    CallFunctionInValidationInterfaceQueue([promise] {
+        promise->set_value();
+    });
+    while (future.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+        boost::this_thread::interruption_point();
+        // Once the scheduler thread has been interrupted at shutdown, nothing
+        // runs the queue until FlushBackgroundCallbacks.
+        if (!g_scheduler || !g_scheduler->AreThreadsServicingQueue()) {
+            return;
+        }
+    }
+}
+
+void LimitValidationInterfaceQueue()
+{
+    if (ValidationInterfaceCallbacksPending() > MAX_VALIDATION_INTERFACE_CALLBACKS_PENDING) {
+        SyncWithValidationInterfaceQueue();
+    }
+}
+
 void RegisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
     g_signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
+    g_signals.TransactionRemovedFromMempool.connect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pwalletIn, _1));
     g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     g_signals.ChainTip.connect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3));
     g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
@@ -46,6 +121,7 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
     g_signals.ChainTip.disconnect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3));
     g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+    g_signals.TransactionRemovedFromMempool.disconnect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pwalletIn, _1));
     g_signals.EraseTransaction.disconnect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
     g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
     g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
@@ -59,6 +135,7 @@ void UnregisterAllValidationInterfaces() {
     g_signals.Inventory.disconnect_all_slots();
     g_signals.ChainTip.disconnect_all_slots();
     g_signals.UpdatedTransaction.disconnect_all_slots();
+    g_signals.TransactionRemovedFromMempool.disconnect_all_slots();
     g_signals.EraseTransaction.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
     g_signals.UpdatedBlockTip.disconnect_all_slots();
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_VALIDATIONINTERFACE_H
 #define BITCOIN_VALIDATIONINTERFACE_H
 
+#include <functional>
 #include <optional>
 
 #include <boost/signals2/signal.hpp>
@@ -18,6 +19,7 @@ class CBlock;
 class CBlockIndex;
 struct CBlockLocator;
 class CReserveScript;
+class CScheduler;
 class CTransaction;
 class CValidationInterface;
 class CValidationState;
@@ -32,11 +34,49 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
 void UnregisterAllValidationInterfaces();
 
+/** The number of queued callbacks above which validation waits for the queue to drain */
+static const size_t MAX_VALIDATION_INTERFACE_CALLBACKS_PENDING = 10;
+
+/**
+ * Run the callbacks passed to CallFunctionInValidationInterfaceQueue on the
+ * scheduler's thread, in the order in which they were queued. Until this is
+ * called, and after UnregisterBackgroundSignalScheduler, they are run inline.
+ */
+void RegisterBackgroundSignalScheduler(CScheduler& scheduler);
+/** Stop queueing callbacks on the scheduler, after the queue has been flushed */
+void UnregisterBackgroundSignalScheduler();
+/** Stop the scheduler, wait for its threads, and run the callbacks left in the queue on the calling thread */
+void FlushBackgroundCallbacks();
+/** The number of callbacks waiting to be run */
+size_t ValidationInterfaceCallbacksPending();
+
+/**
+ * Pushes a function to the back of the validation interface queue, to be run
+ * after every notification queued before it. This is how notifications that
+ * listeners need not see synchronously are moved off the validation thread.
+ */
+void CallFunctionInValidationInterfaceQueue(std::function<void ()> func);
+/**
+ * Blocks until every callback queued so far has been run. This is for RPCs
+ * and tests that need listeners to be consistent with the chain state, and
+ * must not be called with any lock held that a callback might take, such as
+ * cs_main or cs_wallet. It is an interruption point, and returns early if the
+ * scheduler thread has stopped.
+ */
+void SyncWithValidationInterfaceQueue();
+/**
+ * Waits for the queue to drain if too many callbacks are pending, so that
+ * validation can't run arbitrarily far ahead of slow listeners. The same
+ * locking rules as for SyncWithValidationInterfaceQueue apply.
+ */
+void LimitValidationInterfaceQueue();
+
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock, const int nHeight) {}
     virtual void EraseFromWallet(const uint256 &hash) {}
+    virtual void TransactionRemovedFromMempool(const uint256 &hash) {}
     virtual void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, std::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
     virtual void Inventory(const uint256 &hash) {}
@@ -56,6 +96,8 @@ struct CMainSignals {
     boost::signals2::signal<void (const CTransaction &, const CBlock *, const int nHeight)> SyncTransaction;
     /** Notifies listeners of an erased transaction (currently disabled, requires transaction replacement). */
     boost::signals2::signal<void (const uint256 &)> EraseTransaction;
+    /** Notifies listeners of a transaction leaving the mempool, for any reason. Sent through the validation interface queue. */
+    boost::signals2::signal<void (const uint256 &)> TransactionRemovedFromMempool;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
     boost::signals2::signal<void (const uint256 &)> UpdatedTransaction;
     /** Notifies listeners of a change to the tip of the active block chain. */
@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+
+#include "wallet/trialdecryption.h"
+
+#include <atomic>
+
+// Output o decrypts with key (o * 7) % 100, and additionally with key 99 when
+// o is even; outputs that are a multiple of 5 don't decrypt with any key.
+static std::optional<size_t> TryDecryptForTest(size_t output, size_t keyBegin, size_t keyEnd)
+{
+    EXPECT_LT(keyBegin, keyEnd);
+    EXPECT_LE(keyEnd - keyBegin, TRIAL_DECRYPTION_KEYS_PER_JOB);
+    if (output % 5 == 0) {
+        return std::nullopt;
+    }
+    for (size_t key = keyBegin; key < keyEnd; key++) {
+        if (key == (output * 7) % 100 || (output % 2 == 0 && key == 99)) {
+            return key;
+        }
+    }
+    return std::nullopt;
+}
+
+static void CheckResults(const std::vector<std::optional<size_t>>& results, size_t nOutputs)
+{
+    ASSERT_EQ(nOutputs, results.size());
+    for (size_t o = 0; o < nOutputs; o++) {
+        if (o % 5 == 0) {
+            EXPECT_FALSE(results[o]);
+        } else {
+            ASSERT_TRUE(results[o]);
+            EXPECT_EQ((o * 7) % 100, *results[o]);
+        }
+    }
+}
+
+TEST(TrialDecryption, Inline) {
+    StopTrialDecryptionThreads();
+    EXPECT_EQ(1, GetTrialDecryptionThreads());
+
+    CheckResults(TrialDecrypt(50, 100, TryDecryptForTest), 50);
+}
+
+TEST(TrialDecryption, Threaded) {
+    StartTrialDecryptionThreads(4);
+    EXPECT_EQ(4, GetTrialDecryptionThreads());
+
+    // Each output is tried against 100 keys in ranges of 32 keys.
+    std::atomic<size_t> calls(0);
+    auto results = TrialDecrypt(50, 100, [&](size_t output, size_t keyBegin, size_t keyEnd) {
+        calls++;
+        return TryDecryptForTest(output, keyBegin, keyEnd);
+    });
+    CheckResults(results, 50);
+    EXPECT_EQ(50u * 4u, calls.load());
+
+    StopTrialDecryptionThreads();
+}
+
+TEST(TrialDecryption, Empty) {
+    StartTrialDecryptionThreads(2);
+
+    EXPECT_TRUE(TrialDecrypt(0, 100, TryDecryptForTest).empty());
+    auto results = TrialDecrypt(3, 0, TryDecryptForTest);
+    ASSERT_EQ(3, results.size());
+    for (auto& result : results) {
+        EXPECT_FALSE(result);
+    }
+
+    StopTrialDecryptionThreads();
+}
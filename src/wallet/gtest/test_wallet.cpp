@@ -17,6 +17,7 @@
 
 #include <optional>
 
+using ::testing::An;
 using ::testing::Return;
 
 ACTION(ThrowLogicError) {
@@ -32,6 +33,13 @@ public:
     MOCK_METHOD2(WriteTx, bool(uint256 hash, const CWalletTx& wtx));
     MOCK_METHOD1(WriteWitnessCacheSize, bool(int64_t nWitnessCacheSize));
     MOCK_METHOD1(WriteBestBlock, bool(const CBlockLocator& loc));
+
+    MOCK_METHOD3(WriteNoteWitness, bool(const JSOutPoint& op, int nHeight, const SproutWitness& witness));
+    MOCK_METHOD3(WriteNoteWitness, bool(const SaplingOutPoint& op, int nHeight, const SaplingWitness& witness));
+    MOCK_METHOD2(EraseNoteWitness, bool(const JSOutPoint& op, int nHeight));
+    MOCK_METHOD2(EraseNoteWitness, bool(const SaplingOutPoint& op, int nHeight));
+    MOCK_METHOD3(WriteNoteWitnessTip, bool(const JSOutPoint& op, int nHeight, uint64_t nCount));
+    MOCK_METHOD3(WriteNoteWitnessTip, bool(const SaplingOutPoint& op, int nHeight, uint64_t nCount));
 };
 
 template void CWallet::SetBestChainINTERNAL<MockWalletDB>(
@@ -55,6 +63,12 @@ public:
                                 SaplingMerkleTree& saplingTree) {
         CWallet::IncrementNoteWitnesses(pindex, pblock, sproutTree, saplingTree);
     }
+    void IncrementNoteWitnesses(const CBlockIndex* pindex,
+                                const CCompactBlock& block,
+                                SproutMerkleTree& sproutTree,
+                                SaplingMerkleTree& saplingTree) {
+        CWallet::IncrementNoteWitnesses(pindex, block, sproutTree, saplingTree);
+    }
     void DecrementNoteWitnesses(const CBlockIndex* pindex) {
         CWallet::DecrementNoteWitnesses(pindex);
     }
@@ -327,6 +341,175 @@ TEST(WalletTests, FindUnspentSproutNotes) {
 }
 
 
+TEST(WalletTests, GetFilteredNotesByAddress) {
+    CWallet wallet;
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    // Receive a note on each of two addresses.
+    std::vector<libzcash::SproutSpendingKey> sks;
+    std::vector<JSOutPoint> jsoutpts;
+    for (CAmount value : {10, 20}) {
+        auto sk = libzcash::SproutSpendingKey::random();
+        wallet.AddSproutSpendingKey(sk);
+
+        auto wtx = GetValidSproutReceive(sk, value, true);
+        auto note = GetSproutNote(sk, wtx, 0, 1);
+        mapSproutNoteData_t noteData;
+        JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+        noteData[jsoutpt] = SproutNoteData {sk.address(), note.nullifier(sk)};
+        wtx.SetSproutNoteData(noteData);
+        wallet.AddToWallet(wtx, true, NULL);
+
+        sks.push_back(sk);
+        jsoutpts.push_back(jsoutpt);
+    }
+
+    KeyIO keyIO(Params());
+    std::vector<SproutNoteEntry> sproutEntries;
+    std::vector<SaplingNoteEntry> saplingEntries;
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, "", -1);
+    EXPECT_EQ(2, sproutEntries.size());
+
+    // Each address only finds its own note, with the memo of the note.
+    for (size_t i = 0; i < sks.size(); i++) {
+        sproutEntries.clear();
+        wallet.GetFilteredNotes(sproutEntries, saplingEntries, keyIO.EncodePaymentAddress(sks[i].address()), -1);
+        ASSERT_EQ(1, sproutEntries.size());
+        EXPECT_EQ(jsoutpts[i], sproutEntries[0].jsop);
+        EXPECT_EQ(sks[i].address(), sproutEntries[0].address);
+        EXPECT_EQ(i == 0 ? 10u : 20u, sproutEntries[0].note.value());
+        std::array<unsigned char, ZC_MEMO_SIZE> memo = {{0xF6}};
+        EXPECT_EQ(memo, sproutEntries[0].memo);
+    }
+
+    // An address without notes finds none.
+    sproutEntries.clear();
+    auto skOther = libzcash::SproutSpendingKey::random();
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, keyIO.EncodePaymentAddress(skOther.address()), -1);
+    EXPECT_EQ(0, sproutEntries.size());
+}
+
+TEST(WalletTests, GetFilteredNotesSkipsUndecryptableNotes) {
+    CWallet wallet;
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    // Receive a note that the wallet can decrypt
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+    auto wtx = GetValidSproutReceive(sk, 10, true);
+    auto note = GetSproutNote(sk, wtx, 0, 1);
+    mapSproutNoteData_t noteData;
+    JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+    noteData[jsoutpt] = SproutNoteData {sk.address(), note.nullifier(sk)};
+    wtx.SetSproutNoteData(noteData);
+    wallet.AddToWallet(wtx, true, NULL);
+
+    // ... and one for an address that it has no decryptor for
+    auto skOther = libzcash::SproutSpendingKey::random();
+    auto wtxOther = GetValidSproutReceive(skOther, 20, true);
+    mapSproutNoteData_t noteDataOther;
+    noteDataOther[JSOutPoint {wtxOther.GetHash(), 0, 1}] = SproutNoteData {skOther.address()};
+    wtxOther.SetSproutNoteData(noteDataOther);
+    wallet.AddToWallet(wtxOther, true, NULL);
+
+    KeyIO keyIO(Params());
+    std::vector<SproutNoteEntry> sproutEntries;
+    std::vector<SaplingNoteEntry> saplingEntries;
+
+    // Looking up other addresses doesn't touch the undecryptable note
+    auto saplingAddr = GetTestMasterSaplingSpendingKey().DefaultAddress();
+    EXPECT_NO_THROW(wallet.GetFilteredNotes(sproutEntries, saplingEntries, keyIO.EncodePaymentAddress(saplingAddr), -1));
+    EXPECT_EQ(0, sproutEntries.size());
+    EXPECT_EQ(0, saplingEntries.size());
+    EXPECT_NO_THROW(wallet.GetFilteredNotes(sproutEntries, saplingEntries, keyIO.EncodePaymentAddress(sk.address()), -1));
+    ASSERT_EQ(1, sproutEntries.size());
+    EXPECT_EQ(jsoutpt, sproutEntries[0].jsop);
+
+    // Looking up all notes skips it, and it doesn't fail later lookups
+    for (int i = 0; i < 2; i++) {
+        sproutEntries.clear();
+        EXPECT_NO_THROW(wallet.GetFilteredNotes(sproutEntries, saplingEntries, "", -1));
+        ASSERT_EQ(1, sproutEntries.size());
+        EXPECT_EQ(jsoutpt, sproutEntries[0].jsop);
+    }
+    // The note stays queued, and is indexed once it can be decrypted
+    wallet.AddSproutSpendingKey(skOther);
+    sproutEntries.clear();
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, "", -1);
+    EXPECT_EQ(2, sproutEntries.size());
+}
+
+TEST(WalletTests, NoteIndexEntryMemo) {
+    auto sk = libzcash::SproutSpendingKey::random();
+    std::array<unsigned char, ZC_MEMO_SIZE> memo = {};
+    memo[0] = 0x01;
+    memo[10] = 0x02;
+    SproutNoteIndexEntry entry(sk.address(), libzcash::SproutNote(), memo);
+    EXPECT_EQ(11, entry.memo.size());
+    EXPECT_EQ(memo, entry.GetMemo());
+
+    std::array<unsigned char, ZC_MEMO_SIZE> full;
+    full.fill(0xFF);
+    SproutNoteIndexEntry fullEntry(sk.address(), libzcash::SproutNote(), full);
+    EXPECT_EQ(full, fullEntry.GetMemo());
+}
+
+TEST(WalletTests, CachedBalances) {
+    CWallet wallet;
+    int nComputed = 0;
+    auto compute = [&]() {
+        nComputed++;
+        return CAmount(nComputed * 10);
+    };
+
+    // A balance is computed once, and then returned from the cache.
+    EXPECT_EQ(10, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(10, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(1, nComputed);
+    EXPECT_EQ(20, wallet.GetCachedBalance("b", compute));
+    EXPECT_EQ(2, nComputed);
+
+    // Changes to the wallet's transactions invalidate all of the balances.
+    {
+        LOCK(wallet.cs_wallet);
+        CWalletTx wtx(&wallet, CTransaction());
+        wtx.MarkDirty();
+    }
+    EXPECT_EQ(30, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(30, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(40, wallet.GetCachedBalance("b", compute));
+    EXPECT_EQ(4, nComputed);
+
+    // Mempool changes that don't involve the wallet leave them cached.
+    mempool.AddTransactionsUpdated(1);
+    EXPECT_EQ(30, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(4, nComputed);
+
+    // Changes to the locked notes invalidate them.
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.LockNote(SaplingOutPoint(uint256(), 0));
+    }
+    EXPECT_EQ(50, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(50, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(5, nComputed);
+
+    // So does a wallet transaction leaving the mempool, but not another one.
+    CMutableTransaction mtx;
+    mtx.nLockTime = 1;
+    CWalletTx wtx(&wallet, mtx);
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.mapWallet.emplace(wtx.GetHash(), wtx);
+    }
+    wallet.TransactionRemovedFromMempool(uint256());
+    EXPECT_EQ(50, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(5, nComputed);
+    wallet.TransactionRemovedFromMempool(wtx.GetHash());
+    EXPECT_EQ(60, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(6, nComputed);
+}
+
 TEST(WalletTests, SetSproutNoteAddrsInCWalletTx) {
     auto sk = libzcash::SproutSpendingKey::random();
     auto wtx = GetValidSproutReceive(sk, 10, true);
@@ -517,12 +700,17 @@ TEST(WalletTests, FindMySaplingNotes) {
     ASSERT_FALSE(wallet.HaveSaplingSpendingKey(extfvk));
     auto noteMap = wallet.FindMySaplingNotes(wtx, 1).first;
     EXPECT_EQ(0, noteMap.size());
+    CBlock block;
+    block.vtx.push_back(tx);
+    CCompactBlock compact(block);
+    EXPECT_FALSE(wallet.CompactBlockMatchesKeys(compact, 1));
 
     // Add spending key to wallet, so Sapling notes can be found
     ASSERT_TRUE(wallet.AddSaplingZKey(sk));
     ASSERT_TRUE(wallet.HaveSaplingSpendingKey(extfvk));
     noteMap = wallet.FindMySaplingNotes(wtx, 1).first;
     EXPECT_EQ(2, noteMap.size());
+    EXPECT_TRUE(wallet.CompactBlockMatchesKeys(compact, 1));
 
     // Revert to default
     RegtestDeactivateSapling();
@@ -1306,6 +1494,57 @@ TEST(WalletTests, CachedWitnessesChainTip) {
     }
 }
 
+TEST(WalletTests, CachedWitnessesFromShieldedIndex) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    // First block, with a note for the wallet
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto outpts = CreateValidBlock(wallet, sk, index1, block1, sproutTree, saplingTree);
+    std::vector<JSOutPoint> sproutNotes {outpts.first};
+    std::vector<SaplingOutPoint> saplingNotes {outpts.second};
+
+    // Second block, with a transaction that is not in the wallet
+    CBlock block2;
+    block2.hashPrevBlock = block1.GetHash();
+    block2.vtx.push_back(GetValidSproutReceive(sk, 10, true));
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+
+    std::vector<std::optional<SproutWitness>> sproutWitnesses;
+    std::vector<std::optional<SaplingWitness>> saplingWitnesses;
+    {
+        SproutMerkleTree sproutTree2 {sproutTree};
+        SaplingMerkleTree saplingTree2 {saplingTree};
+        wallet.IncrementNoteWitnesses(&index2, &block2, sproutTree2, saplingTree2);
+    }
+    auto anchors2 = GetWitnessesAndAnchors(wallet, sproutNotes, saplingNotes, sproutWitnesses, saplingWitnesses);
+    wallet.DecrementNoteWitnesses(&index2);
+
+    // The shielded index record of the block gives the same witnesses
+    std::vector<std::optional<SproutWitness>> sproutWitnesses3;
+    std::vector<std::optional<SaplingWitness>> saplingWitnesses3;
+    {
+        SproutMerkleTree sproutTree3 {sproutTree};
+        SaplingMerkleTree saplingTree3 {saplingTree};
+        wallet.IncrementNoteWitnesses(&index2, CCompactBlock(block2), sproutTree3, saplingTree3);
+    }
+    auto anchors3 = GetWitnessesAndAnchors(wallet, sproutNotes, saplingNotes, sproutWitnesses3, saplingWitnesses3);
+
+    EXPECT_TRUE((bool) sproutWitnesses3[0]);
+    EXPECT_EQ(sproutWitnesses, sproutWitnesses3);
+    EXPECT_EQ(saplingWitnesses, saplingWitnesses3);
+    EXPECT_EQ(anchors2.first, anchors3.first);
+    EXPECT_EQ(anchors2.second, anchors3.second);
+}
+
 TEST(WalletTests, CachedWitnessesDecrementFirst) {
     TestWallet wallet;
     LOCK(wallet.cs_wallet);
@@ -1710,6 +1949,151 @@ TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
     wallet.SetBestChain(walletdb, loc);
 }
 
+TEST(WalletTests, SetBestChainKeepsWitnessesInTxsForOlderWallets) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+    MockWalletDB walletdb;
+    CBlockLocator loc;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto note1 = CreateValidBlock(wallet, sk, index1, block1, sproutTree, saplingTree).first;
+
+    // The wallet hasn't been upgraded, so the transaction is rewritten with
+    // its witnesses on every write, and no witness records are written.
+    for (int i = 0; i < 2; i++) {
+        EXPECT_CALL(walletdb, TxnBegin()).WillOnce(Return(true));
+        EXPECT_CALL(walletdb, WriteTx(note1.hash, ::testing::_)).WillOnce(Return(true));
+        EXPECT_CALL(walletdb, WriteTx(::testing::Ne(note1.hash), ::testing::_)).WillRepeatedly(Return(true));
+        EXPECT_CALL(walletdb, WriteNoteWitness(An<const JSOutPoint&>(), ::testing::_, ::testing::_)).Times(0);
+        EXPECT_CALL(walletdb, WriteNoteWitness(An<const SaplingOutPoint&>(), ::testing::_, ::testing::_)).Times(0);
+        EXPECT_CALL(walletdb, WriteNoteWitnessTip(An<const JSOutPoint&>(), ::testing::_, ::testing::_)).Times(0);
+        EXPECT_CALL(walletdb, WriteNoteWitnessTip(An<const SaplingOutPoint&>(), ::testing::_, ::testing::_)).Times(0);
+        EXPECT_CALL(walletdb, WriteWitnessCacheSize(::testing::_)).WillOnce(Return(true));
+        EXPECT_CALL(walletdb, WriteBestBlock(loc)).WillOnce(Return(true));
+        EXPECT_CALL(walletdb, TxnCommit()).WillOnce(Return(true));
+        wallet.SetBestChain(walletdb, loc);
+        ::testing::Mock::VerifyAndClearExpectations(&walletdb);
+    }
+
+    // Nor is the wallet upgraded behind the user's back
+    EXPECT_LT(wallet.GetVersion(), FEATURE_WITNESSSTORE);
+}
+
+TEST(WalletTests, SetBestChainWritesWitnessesIncrementally) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+    MockWalletDB walletdb;
+    CBlockLocator loc;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    // As for a wallet created or upgraded with -upgradewallet
+    wallet.SetMinVersion(FEATURE_WITNESSSTORE);
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    auto expectFlush = [&]() {
+        EXPECT_CALL(walletdb, TxnBegin()).WillOnce(Return(true));
+        EXPECT_CALL(walletdb, WriteWitnessCacheSize(::testing::_)).WillOnce(Return(true));
+        EXPECT_CALL(walletdb, WriteBestBlock(loc)).WillOnce(Return(true));
+        EXPECT_CALL(walletdb, TxnCommit()).WillOnce(Return(true));
+        // The Sapling notes made by CreateValidBlock are never witnessed.
+        EXPECT_CALL(walletdb, WriteNoteWitnessTip(An<const SaplingOutPoint&>(), ::testing::_, 0))
+            .WillRepeatedly(Return(true));
+        EXPECT_CALL(walletdb, WriteNoteWitness(An<const JSOutPoint&>(), ::testing::_, ::testing::_)).Times(0);
+        EXPECT_CALL(walletdb, EraseNoteWitness(An<const JSOutPoint&>(), ::testing::_)).Times(0);
+        EXPECT_CALL(walletdb, WriteNoteWitnessTip(An<const JSOutPoint&>(), ::testing::_, ::testing::_)).Times(0);
+        EXPECT_CALL(walletdb, WriteTx(::testing::_, ::testing::_)).Times(0);
+    };
+
+    // First block: the new note's transaction and witness are written
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto note1 = CreateValidBlock(wallet, sk, index1, block1, sproutTree, saplingTree).first;
+    SproutMerkleTree sproutTree1 {sproutTree};
+    SaplingMerkleTree saplingTree1 {saplingTree};
+
+    expectFlush();
+    EXPECT_CALL(walletdb, WriteTx(note1.hash, ::testing::_)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitness(note1, 1, ::testing::_)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessTip(note1, 1, 1)).WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+    ::testing::Mock::VerifyAndClearExpectations(&walletdb);
+
+    // Second block: only the newest witness of the first note is written
+    CBlock block2;
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+    auto note2 = CreateValidBlock(wallet, sk, index2, block2, sproutTree, saplingTree).first;
+
+    expectFlush();
+    EXPECT_CALL(walletdb, WriteNoteWitness(note1, 2, ::testing::_)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessTip(note1, 2, 2)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteTx(note2.hash, ::testing::_)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitness(note2, 2, ::testing::_)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessTip(note2, 2, 1)).WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+    ::testing::Mock::VerifyAndClearExpectations(&walletdb);
+
+    // Nothing has changed, so nothing but the tip is written
+    expectFlush();
+    wallet.SetBestChain(walletdb, loc);
+    ::testing::Mock::VerifyAndClearExpectations(&walletdb);
+
+    // Reorg: the second block is replaced with another one, so the first
+    // note's witness at that height is rewritten, and the second note's is
+    // erased.
+    wallet.DecrementNoteWitnesses(&index2);
+    CBlock block2b;
+    CBlockIndex index2b(block2b);
+    index2b.nHeight = 2;
+    auto note3 = CreateValidBlock(wallet, sk, index2b, block2b, sproutTree1, saplingTree1).first;
+
+    expectFlush();
+    EXPECT_CALL(walletdb, WriteNoteWitness(note1, 2, ::testing::_)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, EraseNoteWitness(note2, 2)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessTip(note2, 2, 0)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteTx(note3.hash, ::testing::_)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitness(note3, 2, ::testing::_)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessTip(note3, 2, 1)).WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+    ::testing::Mock::VerifyAndClearExpectations(&walletdb);
+
+    // A failed write leaves everything to be written next time
+    wallet.ClearNoteWitnessCache();
+    EXPECT_CALL(walletdb, TxnBegin()).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, EraseNoteWitness(An<const JSOutPoint&>(), ::testing::_)).WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessTip(An<const SaplingOutPoint&>(), ::testing::_, ::testing::_)).WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessTip(An<const JSOutPoint&>(), ::testing::_, ::testing::_)).WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(0)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteBestBlock(loc)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, TxnCommit()).WillOnce(Return(false));
+    wallet.SetBestChain(walletdb, loc);
+    ::testing::Mock::VerifyAndClearExpectations(&walletdb);
+
+    EXPECT_CALL(walletdb, TxnBegin()).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, EraseNoteWitness(note1, 1)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, EraseNoteWitness(note1, 2)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, EraseNoteWitness(note3, 2)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessTip(An<const SaplingOutPoint&>(), -1, 0)).WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessTip(note1, -1, 0)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessTip(note2, -1, 0)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessTip(note3, -1, 0)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(0)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteBestBlock(loc)).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, TxnCommit()).WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+}
+
 TEST(WalletTests, UpdateSproutNullifierNoteMap) {
     TestWallet wallet;
     LOCK(wallet.cs_wallet);
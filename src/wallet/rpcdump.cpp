@@ -31,6 +31,9 @@ bool EnsureWalletIsAvailable(bool avoidException);
 
 UniValue dumpwallet_impl(const UniValue& params, bool fDumpZKeys);
 UniValue importwallet_impl(const UniValue& params, bool fImportZKeys);
+static CBlockIndex* ImportWalletKeys(const UniValue& params, bool fImportZKeys, bool& fGood);
+static CBlockIndex* ImportSpendingKey(const UniValue& params, UniValue& result);
+static CBlockIndex* ImportViewingKey(const UniValue& params, UniValue& result);
 
 
 std::string static EncodeDumpTime(int64_t nTime) {
@@ -104,10 +107,6 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
     if (fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Importing keys is disabled in pruned mode");
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    EnsureWalletIsUnlocked();
-
     string strSecret = params[0].get_str();
     string strLabel = "";
     if (params.size() > 1)
@@ -126,7 +125,12 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
     CPubKey pubkey = key.GetPubKey();
     assert(key.VerifyPubKey(pubkey));
     CKeyID vchAddress = pubkey.GetID();
+    CBlockIndex* pindexRescan;
     {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        EnsureWalletIsUnlocked();
+
         pwalletMain->MarkDirty();
         pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
 
@@ -142,10 +146,11 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
 
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+        pindexRescan = chainActive.Genesis();
+    }
 
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-        }
+    if (fRescan) {
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
     }
 
     return keyIO.EncodeDestination(vchAddress);
@@ -229,25 +234,29 @@ UniValue importaddress(const UniValue& params, bool fHelp)
     if (params.size() > 3)
         fP2SH = params[3].get_bool();
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CBlockIndex* pindexRescan;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    KeyIO keyIO(Params());
-    CTxDestination dest = keyIO.DecodeDestination(params[0].get_str());
-    if (IsValidDestination(dest)) {
-        if (fP2SH) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Cannot use the p2sh flag with an address - use a script instead");
+        KeyIO keyIO(Params());
+        CTxDestination dest = keyIO.DecodeDestination(params[0].get_str());
+        if (IsValidDestination(dest)) {
+            if (fP2SH) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Cannot use the p2sh flag with an address - use a script instead");
+            }
+            ImportAddress(dest, strLabel);
+        } else if (IsHex(params[0].get_str())) {
+            std::vector<unsigned char> data(ParseHex(params[0].get_str()));
+            ImportScript(CScript(data.begin(), data.end()), strLabel, fP2SH);
+        } else {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Zcash address or script");
         }
-        ImportAddress(dest, strLabel);
-    } else if (IsHex(params[0].get_str())) {
-        std::vector<unsigned char> data(ParseHex(params[0].get_str()));
-        ImportScript(CScript(data.begin(), data.end()), strLabel, fP2SH);
-    } else {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Zcash address or script");
+        pindexRescan = chainActive.Genesis();
     }
 
     if (fRescan)
     {
-        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
         pwalletMain->ReacceptWalletTransactions();
     }
 
@@ -296,14 +305,18 @@ UniValue importpubkey(const UniValue& params, bool fHelp)
     if (!pubKey.IsFullyValid())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Pubkey is not a valid public key");
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CBlockIndex* pindexRescan;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    ImportAddress(pubKey.GetID(), strLabel);
-    ImportScript(GetScriptForRawPubKey(pubKey), strLabel, false);
+        ImportAddress(pubKey.GetID(), strLabel);
+        ImportScript(GetScriptForRawPubKey(pubKey), strLabel, false);
+        pindexRescan = chainActive.Genesis();
+    }
 
     if (fRescan)
     {
-        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
         pwalletMain->ReacceptWalletTransactions();
     }
 
@@ -362,6 +375,24 @@ UniValue importwallet_impl(const UniValue& params, bool fImportZKeys)
     if (fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Importing wallets is disabled in pruned mode");
 
+    bool fGood = true;
+    CBlockIndex* pindex = ImportWalletKeys(params, fImportZKeys, fGood);
+
+    pwalletMain->ScanForWalletTransactions(pindex);
+    pwalletMain->MarkDirty();
+
+    if (!fGood)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
+
+    return NullUniValue;
+}
+
+/**
+ * Adds the keys in a wallet dump file to the wallet, and returns the block to
+ * rescan from. fGood is set to false if any of the keys could not be added.
+ */
+static CBlockIndex* ImportWalletKeys(const UniValue& params, bool fImportZKeys, bool& fGood)
+{
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
@@ -373,8 +404,6 @@ UniValue importwallet_impl(const UniValue& params, bool fImportZKeys)
 
     int64_t nTimeBegin = chainActive.Tip()->GetBlockTime();
 
-    bool fGood = true;
-
     int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
     file.seekg(0, file.beg);
 
@@ -463,13 +492,7 @@ UniValue importwallet_impl(const UniValue& params, bool fImportZKeys)
         pwalletMain->nTimeFirstKey = nTimeBegin;
 
     LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
-    pwalletMain->ScanForWalletTransactions(pindex);
-    pwalletMain->MarkDirty();
-
-    if (!fGood)
-        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
-
-    return NullUniValue;
+    return pindex;
 }
 
 UniValue dumpprivkey(const UniValue& params, bool fHelp)
@@ -711,6 +734,22 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
     if (fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Importing keys is disabled in pruned mode");
 
+    UniValue result(UniValue::VOBJ);
+    CBlockIndex* pindexRescan = ImportSpendingKey(params, result);
+
+    if (pindexRescan) {
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+    }
+
+    return result;
+}
+
+/**
+ * Adds the spending key in params to the wallet and fills in result. Returns
+ * the block to rescan from, or nullptr if no rescan is needed.
+ */
+static CBlockIndex* ImportSpendingKey(const UniValue& params, UniValue& result)
+{
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
@@ -756,14 +795,13 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
     }
 
     auto addrInfo = std::visit(libzcash::AddressInfoFromSpendingKey{}, spendingkey);
-    UniValue result(UniValue::VOBJ);
     result.pushKV("type", addrInfo.first);
     result.pushKV("address", keyIO.EncodePaymentAddress(addrInfo.second));
 
     // Sapling support
     auto addResult = std::visit(AddSpendingKeyToWallet(pwalletMain, Params().GetConsensus()), spendingkey);
     if (addResult == KeyAlreadyExists && fIgnoreExistingKey) {
-        return result;
+        return nullptr;
     }
     pwalletMain->MarkDirty();
     if (addResult == KeyNotAdded) {
@@ -775,10 +813,9 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
     
     // We want to scan for transactions and notes
     if (fRescan) {
-        pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+        return chainActive[nRescanHeight];
     }
-
-    return result;
+    return nullptr;
 }
 
 UniValue z_importviewingkey(const UniValue& params, bool fHelp)
@@ -813,6 +850,22 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_importviewingkey", "\"vkey\", \"no\"")
         );
 
+    UniValue result(UniValue::VOBJ);
+    CBlockIndex* pindexRescan = ImportViewingKey(params, result);
+
+    if (pindexRescan) {
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+    }
+
+    return result;
+}
+
+/**
+ * Adds the viewing key in params to the wallet and fills in result. Returns
+ * the block to rescan from, or nullptr if no rescan is needed.
+ */
+static CBlockIndex* ImportViewingKey(const UniValue& params, UniValue& result)
+{
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
@@ -851,7 +904,6 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
     }
 
     auto addrInfo = std::visit(libzcash::AddressInfoFromViewingKey{}, viewingkey);
-    UniValue result(UniValue::VOBJ);
     const string strAddress = keyIO.EncodePaymentAddress(addrInfo.second);
     result.pushKV("type", addrInfo.first);
     result.pushKV("address", strAddress);
@@ -862,7 +914,7 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
             RPC_WALLET_ERROR,
             "The wallet already contains the private key for this viewing key (address: " + strAddress + ")");
     } else if (addResult == KeyAlreadyExists && fIgnoreExistingKey) {
-        return result;
+        return nullptr;
     }
     pwalletMain->MarkDirty();
     if (addResult == KeyNotAdded) {
@@ -871,10 +923,9 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
 
     // We want to scan for transactions and notes
     if (fRescan) {
-        pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+        return chainActive[nRescanHeight];
     }
-
-    return result;
+    return nullptr;
 }
 
 UniValue z_exportkey(const UniValue& params, bool fHelp)
@@ -799,11 +799,11 @@ UniValue getbalance(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbalance", "\"*\", 6")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     if (params.size() == 0)
         return  ValueFromAmount(pwalletMain->GetBalance());
 
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
     int nMinDepth = 1;
     if (params.size() > 1)
         nMinDepth = params[1].get_int();
@@ -2373,13 +2373,21 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
+    // The balances can't be invalidated while cs_wallet is held, so they are
+    // all read from the same state of the wallet.
+    CAmount nBalance = pwalletMain->GetBalance();
+    CAmount nUnconfirmedBalance = pwalletMain->GetUnconfirmedBalance();
+    CAmount nImmatureBalance = pwalletMain->GetImmatureBalance();
+    CAmount nShieldedBalance = getBalanceZaddr("", 1, INT_MAX);
+    CAmount nShieldedUnconfirmedBalance = getBalanceZaddr("", 0, 0);
+
     UniValue obj(UniValue::VOBJ);
     obj.pushKV("walletversion", pwalletMain->GetVersion());
-    obj.pushKV("balance",       ValueFromAmount(pwalletMain->GetBalance()));
-    obj.pushKV("unconfirmed_balance", ValueFromAmount(pwalletMain->GetUnconfirmedBalance()));
-    obj.pushKV("immature_balance",    ValueFromAmount(pwalletMain->GetImmatureBalance()));
-    obj.pushKV("shielded_balance",    FormatMoney(getBalanceZaddr("", 1, INT_MAX)));
-    obj.pushKV("shielded_unconfirmed_balance", FormatMoney(getBalanceZaddr("", 0, 0)));
+    obj.pushKV("balance",       ValueFromAmount(nBalance));
+    obj.pushKV("unconfirmed_balance", ValueFromAmount(nUnconfirmedBalance));
+    obj.pushKV("immature_balance",    ValueFromAmount(nImmatureBalance));
+    obj.pushKV("shielded_balance",    FormatMoney(nShieldedBalance));
+    obj.pushKV("shielded_unconfirmed_balance", FormatMoney(nShieldedUnconfirmedBalance));
     obj.pushKV("txcount",       (int)pwalletMain->mapWallet.size());
     obj.pushKV("keypoololdest", pwalletMain->GetOldestKeyPoolTime());
     obj.pushKV("keypoolsize",   (int)pwalletMain->GetKeyPoolSize());
@@ -2800,11 +2808,16 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
 
     if (fHelp || params.size() < 2) {
         throw runtime_error(
-            "zcbenchmark benchmarktype samplecount\n"
+            "zcbenchmark benchmarktype samplecount ( arg ) ( nthreads )\n"
             "\n"
             "Runs a benchmark of the selected type samplecount times,\n"
             "returning the running times of each sample.\n"
             "\n"
+            "Some benchmark types take an argument, such as the number of keys\n"
+            "for trydecryptsaplingnotes. If nthreads is given to\n"
+            "trydecryptsaplingnotes, each sample is run with 1 to nthreads trial\n"
+            "decryption threads, and the running time for each is returned.\n"
+            "\n"
             "Output: [\n"
             "  {\n"
             "    \"runningtime\": runningtime\n"
@@ -2876,7 +2889,13 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             sample_times.push_back(benchmark_try_decrypt_sprout_notes(nKeys));
         } else if (benchmarktype == "trydecryptsaplingnotes") {
             int nKeys = params[2].get_int();
-            sample_times.push_back(benchmark_try_decrypt_sapling_notes(nKeys));
+            if (params.size() < 4) {
+                sample_times.push_back(benchmark_try_decrypt_sapling_notes(nKeys));
+            } else {
+                int nThreads = params[3].get_int();
+                std::vector<double> vals = benchmark_try_decrypt_sapling_notes_threaded(nKeys, nThreads);
+                sample_times.insert(sample_times.end(), vals.begin(), vals.end());
+            }
         } else if (benchmarktype == "incnotewitnesses") {
             int nTxs = params[2].get_int();
             sample_times.push_back(benchmark_increment_sprout_note_witnesses(nTxs));
@@ -3362,41 +3381,49 @@ CAmount getBalanceTaddr(std::string transparentAddress, int minDepth=1, bool ign
         destinations.insert(taddr);
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    auto computeBalance = [&]() {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
+        pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
 
-    for (const COutput& out : vecOutputs) {
-        if (out.nDepth < minDepth) {
-            continue;
-        }
-
-        if (ignoreUnspendable && !out.fSpendable) {
-            continue;
-        }
-
-        if (destinations.size()) {
-            CTxDestination address;
-            if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
+        for (const COutput& out : vecOutputs) {
+            if (out.nDepth < minDepth) {
                 continue;
             }
 
-            if (!destinations.count(address)) {
+            if (ignoreUnspendable && !out.fSpendable) {
                 continue;
             }
+
+            if (destinations.size()) {
+                CTxDestination address;
+                if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
+                    continue;
+                }
+
+                if (!destinations.count(address)) {
+                    continue;
+                }
+            }
+
+            CAmount nValue = out.tx->vout[out.i].nValue;
+            balance += nValue;
         }
+        return balance;
+    };
 
-        CAmount nValue = out.tx->vout[out.i].nValue;
-        balance += nValue;
+    // The balance of the whole wallet is cached.
+    if (destinations.empty()) {
+        return pwalletMain->GetCachedBalance(
+            strprintf("transparent %d %d", minDepth, ignoreUnspendable), computeBalance);
     }
-    return balance;
+    return computeBalance();
 }
 
 CAmount getBalanceZaddr(std::string address, int minDepth, int maxDepth, bool ignoreUnspendable) {
     CAmount balance = 0;
     std::vector<SproutNoteEntry> sproutEntries;
     std::vector<SaplingNoteEntry> saplingEntries;
-    LOCK2(cs_main, pwalletMain->cs_wallet);
 
     std::set<PaymentAddress> filterAddresses;
     if (address.length() > 0) {
@@ -3404,14 +3431,25 @@ CAmount getBalanceZaddr(std::string address, int minDepth, int maxDepth, bool ig
         filterAddresses.insert(keyIO.DecodePaymentAddress(address));
     }
 
-    pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, filterAddresses, minDepth, maxDepth, true, ignoreUnspendable);
-    for (auto & entry : sproutEntries) {
-        balance += CAmount(entry.note.value());
-    }
-    for (auto & entry : saplingEntries) {
-        balance += CAmount(entry.note.value());
+    auto computeBalance = [&]() {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, filterAddresses, minDepth, maxDepth, true, ignoreUnspendable);
+        for (auto & entry : sproutEntries) {
+            balance += CAmount(entry.note.value());
+        }
+        for (auto & entry : saplingEntries) {
+            balance += CAmount(entry.note.value());
+        }
+        return balance;
+    };
+
+    // The balance of the whole wallet is cached.
+    if (filterAddresses.empty()) {
+        return pwalletMain->GetCachedBalance(
+            strprintf("shielded %d %d %d", minDepth, maxDepth, ignoreUnspendable), computeBalance);
     }
-    return balance;
+    return computeBalance();
 }
 
 struct txblock
@@ -3643,8 +3681,7 @@ UniValue z_gettotalbalance(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_gettotalbalance", "5")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
+    // The balances below take the locks themselves, and are usually cached.
     int nMinDepth = 1;
     if (params.size() > 0) {
         nMinDepth = params[0].get_int();
@@ -3662,6 +3699,7 @@ UniValue z_gettotalbalance(const UniValue& params, bool fHelp)
     // but they don't because wtx.GetAmounts() does not handle tx where there are no outputs
     // pwalletMain->GetBalance() does not accept min depth parameter
     // so we use our own method to get balance of utxos.
+    LOCK2(cs_main, pwalletMain->cs_wallet);
     CAmount nBalance = getBalanceTaddr("", nMinDepth, !fIncludeWatchonly);
     CAmount nPrivateBalance = getBalanceZaddr("", nMinDepth, INT_MAX, !fIncludeWatchonly);
     CAmount nTotalBalance = nBalance + nPrivateBalance;
@@ -4,6 +4,10 @@
 
 #include "wallet/wallet.h"
 
+#include "consensus/validation.h"
+
+#include <chrono>
+#include <future>
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -327,4 +331,63 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+#ifdef ENABLE_MINING
+BOOST_FIXTURE_TEST_CASE(rescan_stops_at_wallet_tip, TestChain100Setup)
+{
+    CWallet wallet;
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.AddKey(coinbaseKey);
+    }
+
+    // Before the wallet has been given a tip, it is at the genesis block, and
+    // none of the blocks it has not been notified of are scanned
+    BOOST_CHECK_EQUAL(wallet.ScanForWalletTransactions(chainActive.Genesis()), 0);
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 0);
+
+    // The scan covers several batches of blocks, and stops at the wallet tip
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        wallet.SetWalletTip(chainActive[50]);
+    }
+    BOOST_CHECK_EQUAL(wallet.ScanForWalletTransactions(chainActive.Genesis()), 50);
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 50);
+    BOOST_CHECK(!wallet.mapWallet.count(coinbaseTxns[50].GetHash()));
+}
+
+BOOST_FIXTURE_TEST_CASE(rescan_waits_for_wallet_tip, TestChain100Setup)
+{
+    CWallet wallet;
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.AddKey(coinbaseKey);
+    }
+
+    // The wallet has been notified of the tip, which is then disconnected
+    CBlockIndex* pindexTip;
+    CBlock tip;
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        pindexTip = chainActive.Tip();
+        wallet.SetWalletTip(pindexTip);
+        BOOST_CHECK(ReadBlockFromDisk(tip, pindexTip, Params().GetConsensus()));
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), pindexTip));
+        BOOST_CHECK(chainActive.Tip() == pindexTip->pprev);
+    }
+
+    // The scan applies the blocks up to the fork, then waits until the wallet
+    // is notified of the disconnect
+    auto scan = std::async(std::launch::async, [&]() {
+        return wallet.ScanForWalletTransactions(chainActive.Genesis());
+    });
+    BOOST_CHECK(scan.wait_for(std::chrono::milliseconds(500)) == std::future_status::timeout);
+
+    wallet.ChainTip(pindexTip, &tip, std::nullopt);
+    BOOST_REQUIRE(scan.wait_for(std::chrono::seconds(30)) == std::future_status::ready);
+    BOOST_CHECK_EQUAL(scan.get(), 99);
+    BOOST_CHECK(!wallet.mapWallet.count(coinbaseTxns[99].GetHash()));
+}
+#endif // ENABLE_MINING
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,136 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "wallet/trialdecryption.h"
+
+#include "checkqueue.h"
+#include "sync.h"
+#include "util.h"
+
+#include <memory>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+/**
+ * Closure representing the trial decryption of one output with a range of keys
+ */
+class CTrialDecryptionCheck
+{
+private:
+    std::function<void()> job;
+
+public:
+    CTrialDecryptionCheck() {}
+    CTrialDecryptionCheck(std::function<void()> jobIn) : job(std::move(jobIn)) {}
+
+    bool operator()() {
+        job();
+        return true;
+    }
+
+    void swap(CTrialDecryptionCheck &check) {
+        job.swap(check.job);
+    }
+};
+
+/** Guards the queue and threads below, and serializes uses of the queue. */
+static CCriticalSection cs_trialDecryption;
+static std::unique_ptr<CCheckQueue<CTrialDecryptionCheck>> trialDecryptionQueue;
+static boost::thread_group trialDecryptionThreads;
+static int nTrialDecryptionThreads = 0;
+
+static void ThreadTrialDecryption(CCheckQueue<CTrialDecryptionCheck>* queue)
+{
+    RenameThread("zcash-trialdec");
+    queue->Thread();
+}
+
+static void StopTrialDecryptionThreadsLocked()
+{
+    AssertLockHeld(cs_trialDecryption);
+    trialDecryptionThreads.interrupt_all();
+    trialDecryptionThreads.join_all();
+    trialDecryptionQueue.reset();
+    nTrialDecryptionThreads = 0;
+}
+
+void StartTrialDecryptionThreads(int nThreads)
+{
+    LOCK(cs_trialDecryption);
+    StopTrialDecryptionThreadsLocked();
+
+    if (nThreads > 1) {
+        trialDecryptionQueue.reset(new CCheckQueue<CTrialDecryptionCheck>(8));
+        for (int i = 0; i < nThreads - 1; i++) {
+            trialDecryptionThreads.create_thread(boost::bind(&ThreadTrialDecryption, trialDecryptionQueue.get()));
+        }
+        nTrialDecryptionThreads = nThreads;
+    }
+}
+
+void StopTrialDecryptionThreads()
+{
+    LOCK(cs_trialDecryption);
+    StopTrialDecryptionThreadsLocked();
+}
+
+int GetTrialDecryptionThreads()
+{
+    LOCK(cs_trialDecryption);
+    return std::max(1, nTrialDecryptionThreads);
+}
+
+std::vector<std::optional<size_t>> TrialDecrypt(
+    size_t nOutputs,
+    size_t nKeys,
+    const std::function<std::optional<size_t>(size_t, size_t, size_t)>& tryDecrypt)
+{
+    std::vector<std::optional<size_t>> results(nOutputs);
+    if (nOutputs == 0 || nKeys == 0) {
+        return results;
+    }
+
+    // Each job tries one output against a contiguous range of keys, and
+    // records the first key that succeeded in its own slot, so that the jobs
+    // never write to shared state.
+    size_t nKeyRanges = (nKeys + TRIAL_DECRYPTION_KEYS_PER_JOB - 1) / TRIAL_DECRYPTION_KEYS_PER_JOB;
+    std::vector<std::optional<size_t>> jobResults(nOutputs * nKeyRanges);
+
+    std::vector<CTrialDecryptionCheck> vChecks;
+    vChecks.reserve(nOutputs * nKeyRanges);
+    for (size_t output = 0; output < nOutputs; output++) {
+        for (size_t range = 0; range < nKeyRanges; range++) {
+            vChecks.emplace_back([&, output, range]() {
+                size_t keyBegin = range * TRIAL_DECRYPTION_KEYS_PER_JOB;
+                size_t keyEnd = std::min(nKeys, keyBegin + TRIAL_DECRYPTION_KEYS_PER_JOB);
+                jobResults[output * nKeyRanges + range] = tryDecrypt(output, keyBegin, keyEnd);
+            });
+        }
+    }
+
+    {
+        LOCK(cs_trialDecryption);
+        if (trialDecryptionQueue && vChecks.size() > 1) {
+            CCheckQueueControl<CTrialDecryptionCheck> control(trialDecryptionQueue.get());
+            control.Add(vChecks);
+            control.Wait();
+        } else {
+            for (CTrialDecryptionCheck& check : vChecks) {
+                check();
+            }
+        }
+    }
+
+    for (size_t output = 0; output < nOutputs; output++) {
+        for (size_t range = 0; range < nKeyRanges; range++) {
+            if (jobResults[output * nKeyRanges + range]) {
+                results[output] = jobResults[output * nKeyRanges + range];
+                break;
+            }
+        }
+    }
+
+    return results;
+}
@@ -0,0 +1,48 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_WALLET_TRIALDECRYPTION_H
+#define ZCASH_WALLET_TRIALDECRYPTION_H
+
+#include <functional>
+#include <optional>
+#include <stddef.h>
+#include <vector>
+
+/** Default for -walletdecryptthreads; 0 means one thread per core. */
+static const int DEFAULT_TRIAL_DECRYPTION_THREADS = 0;
+/** Number of keys that one trial decryption job tries against an output. */
+static const size_t TRIAL_DECRYPTION_KEYS_PER_JOB = 32;
+
+/**
+ * Start (or restart with a different size) the pool of threads used for
+ * trial decryption. nThreads includes the calling thread, so values of 0
+ * or 1 mean that trial decryption is performed inline.
+ */
+void StartTrialDecryptionThreads(int nThreads);
+
+/** Stop the trial decryption threads. */
+void StopTrialDecryptionThreads();
+
+/** Returns the number of threads used for trial decryption. */
+int GetTrialDecryptionThreads();
+
+/**
+ * Trial-decrypts nOutputs outputs with nKeys keys, with the work split across
+ * the trial decryption threads. tryDecrypt(output, keyBegin, keyEnd) is called
+ * with ranges of up to TRIAL_DECRYPTION_KEYS_PER_JOB keys, and returns the
+ * index of the first key in [keyBegin, keyEnd) with which the output
+ * decrypted, if any; working on a range lets it share work between the keys.
+ * Returns, for each output, the index of the first key with which it
+ * decrypted, if any.
+ *
+ * tryDecrypt is called concurrently from several threads, so it must not
+ * throw, and must not take any lock that the caller holds.
+ */
+std::vector<std::optional<size_t>> TrialDecrypt(
+    size_t nOutputs,
+    size_t nKeys,
+    const std::function<std::optional<size_t>(size_t, size_t, size_t)>& tryDecrypt);
+
+#endif // ZCASH_WALLET_TRIALDECRYPTION_H
@@ -29,9 +29,11 @@
 #include "zcash/Note.hpp"
 #include "crypter.h"
 #include "wallet/asyncrpcoperation_saplingmigration.h"
+#include "wallet/trialdecryption.h"
 
 #include <algorithm>
 #include <assert.h>
+#include <future>
 #include <variant>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -588,30 +590,44 @@ void CWallet::ChainTipAdded(const CBlockIndex *pindex,
                             SproutMerkleTree sproutTree,
                             SaplingMerkleTree saplingTree)
 {
+    AssertLockHeld(cs_wallet);
     IncrementNoteWitnesses(pindex, pblock, sproutTree, saplingTree);
     UpdateSaplingNullifierNoteMapForBlock(pblock);
+}
 
+/**
+ * Writes the witness caches out as of pindex, which must be the last block
+ * applied to them, once enough blocks or time have passed since the last write.
+ * Must not be called with cs_wallet held, as the locator needs cs_main.
+ */
+void CWallet::SetBestChainIfDue(const CBlockIndex *pindex, int nUpdates)
+{
     // SetBestChain() can be expensive for large wallets, so do only
     // this sometimes; the wallet state will be brought up to date
     // during rescanning on startup.
-    int64_t nNow = GetTimeMicros();
-    if (nLastSetChain == 0) {
-        // Don't flush during startup.
-        nLastSetChain = nNow;
-    }
-    if (++nSetChainUpdates >= WITNESS_WRITE_UPDATES ||
-            nLastSetChain + (int64_t)WITNESS_WRITE_INTERVAL * 1000000 < nNow) {
+    {
+        LOCK(cs_wallet);
+        int64_t nNow = GetTimeMicros();
+        if (nLastSetChain == 0) {
+            // Don't flush during startup.
+            nLastSetChain = nNow;
+        }
+        nSetChainUpdates += nUpdates;
+        if (nSetChainUpdates < WITNESS_WRITE_UPDATES &&
+                nLastSetChain + (int64_t)WITNESS_WRITE_INTERVAL * 1000000 >= nNow) {
+            return;
+        }
         nLastSetChain = nNow;
         nSetChainUpdates = 0;
-        CBlockLocator loc;
-        {
-            // The locator must be derived from the pindex used to increment
-            // the witnesses above; pindex can be behind chainActive.Tip().
-            LOCK(cs_main);
-            loc = chainActive.GetLocator(pindex);
-        }
-        SetBestChain(loc);
     }
+    CBlockLocator loc;
+    {
+        // The locator must be derived from the pindex used to increment
+        // the witnesses; pindex can be behind chainActive.Tip().
+        LOCK(cs_main);
+        loc = chainActive.GetLocator(pindex);
+    }
+    SetBestChain(loc);
 }
 
 void CWallet::ChainTip(const CBlockIndex *pindex, 
@@ -619,7 +635,17 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
                        std::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added)
 {
     if (added) {
-        ChainTipAdded(pindex, pblock, added->first, added->second);
+        {
+            LOCK(cs_wallet);
+            SetWalletTip(pindex);
+            MarkBalancesDirty();
+            if (fScanningWallet) {
+                // The running rescan will apply this block once it gets here.
+                return;
+            }
+            ChainTipAdded(pindex, pblock, added->first, added->second);
+        }
+        SetBestChainIfDue(pindex, 1);
         // Prevent migration transactions from being created when node is syncing after launch,
         // and also when node wakes up from suspension/hibernation and incoming blocks are old.
         if (!IsInitialBlockDownload(Params().GetConsensus()) &&
@@ -628,6 +654,9 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
             RunSaplingMigration(pindex->nHeight);
         }
     } else {
+        LOCK(cs_wallet);
+        SetWalletTip(pindex->pprev);
+        MarkBalancesDirty();
         DecrementNoteWitnesses(pindex);
         UpdateSaplingNullifierNoteMapForBlock(pblock);
     }
@@ -1090,10 +1119,12 @@ void CWallet::ClearNoteWitnessCache()
         for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
+            item.second.witnessStore.dirtyHeight = 0;
         }
         for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
+            item.second.witnessStore.dirtyHeight = 0;
         }
     }
     nWitnessCacheSize = 0;
@@ -1126,16 +1157,19 @@ void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nW
     }
 }
 
-template<typename NoteDataMap>
-void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const uint256& note_commitment)
+template<typename OutPoint, typename NoteData, typename WitnessUpdater>
+void TrackNoteWitnesses(std::map<OutPoint, NoteData>& noteDataMap, int indexHeight, int64_t nWitnessCacheSize,
+                        const std::set<OutPoint>& witnessedInBlock, WitnessUpdater& updater)
 {
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
-        if (nd->witnessHeight < indexHeight && nd->witnesses.size() > 0) {
+        // Notes from this block are witnessed afresh by WitnessNoteIfMine,
+        // which discards any witnesses they already had.
+        if (nd->witnessHeight < indexHeight && nd->witnesses.size() > 0 && !witnessedInBlock.count(item.first)) {
             // Check the validity of the cache
             // See comment in CopyPreviousWitnesses about validity.
             assert(nWitnessCacheSize >= nd->witnesses.size());
-            nd->witnesses.front().append(note_commitment);
+            updater.track(nd->witnesses.front());
         }
     }
 }
@@ -1165,6 +1199,8 @@ void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeigh
         nd->witnesses.push_front(witness);
         // Set height to one less than pindex so it gets incremented
         nd->witnessHeight = indexHeight - 1;
+        // Any witness already stored at this height is for a different tree
+        nd->witnessStore.dirtyHeight = std::min(nd->witnessStore.dirtyHeight, indexHeight);
         // Check the validity of the cache
         assert(nWitnessCacheSize >= nd->witnesses.size());
     }
@@ -1185,10 +1221,46 @@ void UpdateWitnessHeights(NoteDataMap& noteDataMap, int indexHeight, int64_t nWi
     }
 }
 
+// The note commitments of a transaction, either in full or as recorded in the
+// shielded index, for IncrementNoteWitnessesForTxs.
+static uint256 WitnessedTxHash(const CTransaction& tx) { return tx.GetHash(); }
+static uint256 WitnessedTxHash(const CCompactTx& tx) { return tx.hash; }
+static size_t JoinSplitCount(const CTransaction& tx) { return tx.vJoinSplit.size(); }
+static size_t JoinSplitCount(const CCompactTx& tx) { return tx.vSproutCommitments.size(); }
+static const std::array<uint256, ZC_NUM_JS_OUTPUTS>& JoinSplitCommitments(const CTransaction& tx, size_t i) { return tx.vJoinSplit[i].commitments; }
+static const std::array<uint256, ZC_NUM_JS_OUTPUTS>& JoinSplitCommitments(const CCompactTx& tx, size_t i) { return tx.vSproutCommitments[i]; }
+static size_t SaplingOutputCount(const CTransaction& tx) { return tx.vShieldedOutput.size(); }
+static size_t SaplingOutputCount(const CCompactTx& tx) { return tx.vSaplingOutputs.size(); }
+static const uint256& SaplingOutputCmu(const CTransaction& tx, size_t i) { return tx.vShieldedOutput[i].cmu; }
+static const uint256& SaplingOutputCmu(const CCompactTx& tx, size_t i) { return tx.vSaplingOutputs[i].cmu; }
+
 void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                                      const CBlock* pblockIn,
                                      SproutMerkleTree& sproutTree,
                                      SaplingMerkleTree& saplingTree)
+{
+    const CBlock* pblock {pblockIn};
+    CBlock block;
+    if (!pblock) {
+        ReadBlockFromDisk(block, pindex, Params().GetConsensus());
+        pblock = &block;
+    }
+    IncrementNoteWitnessesForTxs(pindex, pblock->vtx, sproutTree, saplingTree);
+}
+
+void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
+                                     const CCompactBlock& block,
+                                     SproutMerkleTree& sproutTree,
+                                     SaplingMerkleTree& saplingTree)
+{
+    IncrementNoteWitnessesForTxs(pindex, block.vtx, sproutTree, saplingTree);
+}
+
+template <typename Tx>
+void CWallet::IncrementNoteWitnessesForTxs(const CBlockIndex* pindex,
+                                           const std::vector<Tx>& vtx,
+                                           SproutMerkleTree& sproutTree,
+                                           SaplingMerkleTree& saplingTree)
 {
     LOCK(cs_wallet);
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
@@ -1200,53 +1272,63 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
         nWitnessCacheSize += 1;
     }
 
-    const CBlock* pblock {pblockIn};
-    CBlock block;
-    if (!pblock) {
-        ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-        pblock = &block;
-    }
+    // Rather than appending each of the block's note commitments to every
+    // witness in the wallet, queue them up and bring all of the witnesses up
+    // to date in one pass, sharing the subtree hashes between them.
+    SproutWitnessUpdater sproutUpdater(sproutTree);
+    SaplingWitnessUpdater saplingUpdater(saplingTree);
+    std::vector<std::pair<JSOutPoint, uint64_t>> newSproutNotes;
+    std::vector<std::pair<SaplingOutPoint, uint64_t>> newSaplingNotes;
+    std::set<JSOutPoint> newSproutOutPoints;
+    std::set<SaplingOutPoint> newSaplingOutPoints;
 
-    for (const CTransaction& tx : pblock->vtx) {
-        auto hash = tx.GetHash();
-        bool txIsOurs = mapWallet.count(hash);
+    for (const Tx& tx : vtx) {
+        auto hash = WitnessedTxHash(tx);
+        auto wtxIt = mapWallet.find(hash);
         // Sprout
-        for (size_t i = 0; i < tx.vJoinSplit.size(); i++) {
-            const JSDescription& jsdesc = tx.vJoinSplit[i];
-            for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
-                const uint256& note_commitment = jsdesc.commitments[j];
-                sproutTree.append(note_commitment);
-
-                // Increment existing witnesses
-                for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                    ::AppendNoteCommitment(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-                }
+        for (size_t i = 0; i < JoinSplitCount(tx); i++) {
+            const std::array<uint256, ZC_NUM_JS_OUTPUTS>& commitments = JoinSplitCommitments(tx, i);
+            for (uint8_t j = 0; j < commitments.size(); j++) {
+                uint64_t position = sproutUpdater.append(commitments[j]);
 
                 // If this is our note, witness it
-                if (txIsOurs) {
-                    JSOutPoint jsoutpt {hash, i, j};
-                    ::WitnessNoteIfMine(mapWallet[hash].mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, jsoutpt, sproutTree.witness());
+                JSOutPoint jsoutpt {hash, i, j};
+                if (wtxIt != mapWallet.end() && wtxIt->second.mapSproutNoteData.count(jsoutpt)) {
+                    sproutUpdater.witness(position);
+                    newSproutNotes.push_back(std::make_pair(jsoutpt, position));
+                    newSproutOutPoints.insert(jsoutpt);
                 }
             }
         }
         // Sapling
-        for (uint32_t i = 0; i < tx.vShieldedOutput.size(); i++) {
-            const uint256& note_commitment = tx.vShieldedOutput[i].cmu;
-            saplingTree.append(note_commitment);
-
-            // Increment existing witnesses
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                ::AppendNoteCommitment(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-            }
+        for (uint32_t i = 0; i < SaplingOutputCount(tx); i++) {
+            uint64_t position = saplingUpdater.append(SaplingOutputCmu(tx, i));
 
             // If this is our note, witness it
-            if (txIsOurs) {
-                SaplingOutPoint outPoint {hash, i};
-                ::WitnessNoteIfMine(mapWallet[hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, outPoint, saplingTree.witness());
+            SaplingOutPoint outPoint {hash, i};
+            if (wtxIt != mapWallet.end() && wtxIt->second.mapSaplingNoteData.count(outPoint)) {
+                saplingUpdater.witness(position);
+                newSaplingNotes.push_back(std::make_pair(outPoint, position));
+                newSaplingOutPoints.insert(outPoint);
             }
         }
     }
 
+    // Increment existing witnesses
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        ::TrackNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, newSproutOutPoints, sproutUpdater);
+        ::TrackNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, newSaplingOutPoints, saplingUpdater);
+    }
+    auto sproutWitnesses = sproutUpdater.apply();
+    auto saplingWitnesses = saplingUpdater.apply();
+
+    for (const auto& note : newSproutNotes) {
+        ::WitnessNoteIfMine(mapWallet[note.first.hash].mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, note.first, sproutWitnesses.at(note.second));
+    }
+    for (const auto& note : newSaplingNotes) {
+        ::WitnessNoteIfMine(mapWallet[note.first.hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, note.first, saplingWitnesses.at(note.second));
+    }
+
     // Update witness heights
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
         ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
@@ -1259,10 +1341,16 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
 }
 
 template<typename NoteDataMap>
-void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, bool fAheadOfScan)
 {
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
+        // Ahead of a running rescan, only the notes that were already
+        // witnessed at this block before the rescan started are unwound; the
+        // rest have not had this block applied to them yet.
+        if (fAheadOfScan && nd->witnessHeight != indexHeight) {
+            continue;
+        }
         // Only decrement witnesses that are not above the current height
         if (nd->witnessHeight <= indexHeight) {
             // Check the validity of the cache
@@ -1279,6 +1367,9 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
             // indexHeight is the height of the block being removed, so 
             // the new witness cache height is one below it.
             nd->witnessHeight = indexHeight - 1;
+            // If a different block is connected at indexHeight, its witness
+            // must replace the one stored for this block.
+            nd->witnessStore.dirtyHeight = std::min(nd->witnessStore.dirtyHeight, indexHeight);
         }
         // Check the validity of the cache
         // Technically if there are notes witnessed above the current
@@ -1301,9 +1392,18 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
 void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
 {
     LOCK(cs_wallet);
+    bool fAheadOfScan = fScanningWallet && pindex != pindexScanned;
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        ::DecrementNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-        ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+        ::DecrementNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, fAheadOfScan);
+        ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, fAheadOfScan);
+    }
+    if (fAheadOfScan) {
+        // The rescan has not applied this block, so it has not grown the
+        // cache for it either.
+        return;
+    }
+    if (fScanningWallet) {
+        pindexScanned = pindex->pprev;
     }
     nWitnessCacheSize -= 1;
     // TODO: If nWitnessCache is zero, we need to regenerate the caches (#1302)
@@ -1448,6 +1548,7 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (std::pair<const uint256, CWalletTx>& item : mapWallet)
             item.second.MarkDirty();
+        MarkBalancesDirty();
     }
 }
 
@@ -1488,6 +1589,7 @@ bool CWallet::UpdateNullifierNoteMap()
 
             UpdateNullifierNoteMapWithTx(wtxItem.second);
         }
+        MarkBalancesDirty();
     }
     return true;
 }
@@ -1587,6 +1689,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         mapWallet[hash].BindWallet(this);
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
         AddToSpends(hash);
+        QueueNotesForIndex(mapWallet[hash]);
+        MarkBalancesDirty();
     }
     else
     {
@@ -1675,6 +1779,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             }
         }
 
+        QueueNotesForIndex(wtx);
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -1714,6 +1820,7 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
                         nd.second.witnesses.cbegin(), nd.second.witnesses.cend());
             }
             tmp.at(nd.first).witnessHeight = nd.second.witnessHeight;
+            tmp.at(nd.first).witnessStore = nd.second.witnessStore;
         }
         // Now copy over the updated note data
         wtx.mapSproutNoteData = tmp;
@@ -1730,6 +1837,7 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
                         nd.second.witnesses.cbegin(), nd.second.witnesses.cend());
             }
             tmp.at(nd.first).witnessHeight = nd.second.witnessHeight;
+            tmp.at(nd.first).witnessStore = nd.second.witnessStore;
         }
 
         // Now copy over the updated note data
@@ -1751,14 +1859,16 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
  * updated; instead, the transaction being in the mempool or conflicted is determined on
  * the fly in CMerkleTx::GetDepthInMainChain().
  */
-bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate)
+bool CWallet::AddToWalletIfInvolvingMe(
+    const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate,
+    const WalletTxMatch* match)
 {
     {
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        auto sproutNoteData = FindMySproutNotes(tx);
-        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx, nHeight);
+        auto sproutNoteData = match ? match->sproutNotes : FindMySproutNotes(tx);
+        auto saplingNoteDataAndAddressesToAdd = match ? match->saplingNotes : FindMySaplingNotes(tx, nHeight);
         auto saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
         auto addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
         for (const auto &addressToAdd : addressesToAdd) {
@@ -1766,7 +1876,7 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
                 return false;
             }
         }
-        if (fExisted || IsMine(tx) || IsFromMe(tx) || sproutNoteData.size() > 0 || saplingNoteData.size() > 0)
+        if (fExisted || (match ? match->fIsMine : IsMine(tx)) || IsFromMe(tx) || sproutNoteData.size() > 0 || saplingNoteData.size() > 0)
         {
             CWalletTx wtx(this,tx);
 
@@ -1799,6 +1909,9 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock, cons
         return; // Not one of ours
 
     MarkAffectedTransactionsDirty(tx);
+    // The record may be unchanged, but whether the transaction is in the
+    // mempool decides whether it counts towards the balances.
+    MarkBalancesDirty();
 }
 
 void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
@@ -1829,14 +1942,30 @@ void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
     }
 }
 
+void CWallet::TransactionRemovedFromMempool(const uint256 &hash)
+{
+    // Without a scheduler thread this runs with the mempool lock held, which
+    // must not be taken before cs_wallet. If cs_wallet is busy, the balances
+    // are invalidated without checking that the transaction is ours.
+    TRY_LOCK(cs_wallet, lockWallet);
+    if (!lockWallet || mapWallet.count(hash)) {
+        MarkBalancesDirty();
+    }
+}
+
 void CWallet::EraseFromWallet(const uint256 &hash)
 {
     if (!fFileBacked)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        auto mi = mapWallet.find(hash);
+        if (mi != mapWallet.end()) {
+            RemoveFromNoteIndex(mi->second);
+            mapWallet.erase(mi);
+            MarkBalancesDirty();
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
     }
     return;
 }
@@ -1889,39 +2018,79 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
     LOCK(cs_KeyStore);
     uint256 hash = tx.GetHash();
 
-    mapSproutNoteData_t noteData;
+    std::vector<uint256> hSigs;
+    std::vector<std::pair<size_t, uint8_t>> ciphertexts;
     for (size_t i = 0; i < tx.vJoinSplit.size(); i++) {
-        auto hSig = ZCJoinSplit::h_sig(
+        hSigs.push_back(ZCJoinSplit::h_sig(
             tx.vJoinSplit[i].randomSeed,
             tx.vJoinSplit[i].nullifiers,
-            tx.joinSplitPubKey);
+            tx.joinSplitPubKey));
         for (uint8_t j = 0; j < tx.vJoinSplit[i].ciphertexts.size(); j++) {
-            for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
-                try {
-                    auto address = item.first;
-                    JSOutPoint jsoutpt {hash, i, j};
-                    auto nullifier = GetSproutNoteNullifier(
-                        tx.vJoinSplit[i],
-                        address,
-                        item.second,
-                        hSig, j);
-                    if (nullifier) {
-                        SproutNoteData nd {address, *nullifier};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    } else {
-                        SproutNoteData nd {address};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    }
-                    break;
-                } catch (const note_decryption_failed &err) {
-                    // Couldn't decrypt with this decryptor
-                } catch (const std::exception &exc) {
-                    // Unexpected failure
-                    LogPrintf("FindMySproutNotes(): Unexpected error while testing decrypt:\n");
-                    LogPrintf("%s\n", exc.what());
+            ciphertexts.push_back(std::make_pair(i, j));
+        }
+    }
+
+    std::vector<const NoteDecryptorMap::value_type*> decryptors;
+    for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
+        decryptors.push_back(&item);
+    }
+
+    // The trial decryptions run on the trial decryption threads, which must
+    // not touch the keystore as cs_KeyStore is held here.
+    auto hits = TrialDecrypt(ciphertexts.size(), decryptors.size(), [&](size_t c, size_t dBegin, size_t dEnd) {
+        const JSDescription& jsdesc = tx.vJoinSplit[ciphertexts[c].first];
+        uint8_t j = ciphertexts[c].second;
+        std::optional<size_t> hit;
+        for (size_t d = dBegin; d < dEnd && !hit; d++) {
+            try {
+                auto note_pt = libzcash::SproutNotePlaintext::decrypt(
+                    decryptors[d]->second,
+                    jsdesc.ciphertexts[j],
+                    jsdesc.ephemeralKey,
+                    hSigs[ciphertexts[c].first],
+                    (unsigned char) j);
+                if (note_pt.note(decryptors[d]->first).cm() == jsdesc.commitments[j]) {
+                    hit = d;
                 }
+            } catch (const note_decryption_failed &err) {
+                // Couldn't decrypt with this decryptor
+            } catch (const std::exception &exc) {
+                // Unexpected failure
+                LogPrintf("FindMySproutNotes(): Unexpected error while testing decrypt:\n");
+                LogPrintf("%s\n", exc.what());
             }
         }
+        return hit;
+    });
+
+    mapSproutNoteData_t noteData;
+    for (size_t c = 0; c < ciphertexts.size(); c++) {
+        if (!hits[c]) {
+            continue;
+        }
+        size_t i = ciphertexts[c].first;
+        uint8_t j = ciphertexts[c].second;
+        const NoteDecryptorMap::value_type& item = *decryptors[*hits[c]];
+        try {
+            auto address = item.first;
+            JSOutPoint jsoutpt {hash, i, j};
+            auto nullifier = GetSproutNoteNullifier(
+                tx.vJoinSplit[i],
+                address,
+                item.second,
+                hSigs[i], j);
+            if (nullifier) {
+                SproutNoteData nd {address, *nullifier};
+                noteData.insert(std::make_pair(jsoutpt, nd));
+            } else {
+                SproutNoteData nd {address};
+                noteData.insert(std::make_pair(jsoutpt, nd));
+            }
+        } catch (const std::exception &exc) {
+            // Unexpected failure
+            LogPrintf("FindMySproutNotes(): Unexpected error while testing decrypt:\n");
+            LogPrintf("%s\n", exc.what());
+        }
     }
     return noteData;
 }
@@ -1936,38 +2105,161 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
  * already have been cached in CWalletTx.mapSaplingNoteData.
  */
 std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx, int height) const
+{
+    return FindMySaplingNotes(std::vector<const CTransaction*> {&tx}, height)[0];
+}
+
+/**
+ * Finds the notes sent to this wallet in each of the given transactions, which
+ * are all mined at the given height. The outputs of all of the transactions
+ * are trial-decrypted as one batch, which spreads the work across the trial
+ * decryption threads.
+ */
+std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> CWallet::FindMySaplingNotes(
+    const std::vector<const CTransaction*>& vtx, int height) const
 {
     LOCK(cs_KeyStore);
-    uint256 hash = tx.GetHash();
+    const Consensus::Params& consensusParams = Params().GetConsensus();
 
-    mapSaplingNoteData_t noteData;
-    SaplingIncomingViewingKeyMap viewingKeysToAdd;
+    std::vector<std::pair<size_t, uint32_t>> outputs;
+    for (size_t t = 0; t < vtx.size(); t++) {
+        for (uint32_t i = 0; i < vtx[t]->vShieldedOutput.size(); ++i) {
+            outputs.push_back(std::make_pair(t, i));
+        }
+    }
 
-    // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
-    for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
-        const OutputDescription output = tx.vShieldedOutput[i];
-        for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
-            SaplingIncomingViewingKey ivk = it->first;
+    std::vector<uint256> ivks;
+    for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
+        ivks.push_back(it->first);
+    }
 
-            auto result = SaplingNotePlaintext::decrypt(Params().GetConsensus(), height, output.encCiphertext, ivk, output.ephemeralKey, output.cmu);
-            if (!result) {
-                continue;
+    // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
+    auto hits = TrialDecrypt(outputs.size(), ivks.size(), [&](size_t o, size_t kBegin, size_t kEnd) {
+        const OutputDescription& output = vtx[outputs[o].first]->vShieldedOutput[outputs[o].second];
+        // The key agreements with this range of ivks share the decompression
+        // of epk, so compute them together.
+        auto dhsecrets = SaplingKeyAgreementBatch(
+            {output.ephemeralKey},
+            std::vector<uint256>(ivks.begin() + kBegin, ivks.begin() + kEnd));
+        for (size_t k = kBegin; k < kEnd; k++) {
+            const std::optional<uint256>& dhsecret = dhsecrets[k - kBegin];
+            if (dhsecret && SaplingNotePlaintext::decrypt_with_shared_secret(
+                    consensusParams, height, output.encCiphertext, ivks[k], output.ephemeralKey, output.cmu, *dhsecret)) {
+                return std::optional<size_t>(k);
             }
-            auto address = ivk.address(result.value().d);
-            if (address && mapSaplingIncomingViewingKeys.count(address.value()) == 0) {
-                viewingKeysToAdd[address.value()] = ivk;
+        }
+        return std::optional<size_t>();
+    });
+
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> ret(vtx.size());
+    for (size_t o = 0; o < outputs.size(); o++) {
+        if (!hits[o]) {
+            continue;
+        }
+        const CTransaction& tx = *vtx[outputs[o].first];
+        uint32_t i = outputs[o].second;
+        const OutputDescription& output = tx.vShieldedOutput[i];
+        SaplingIncomingViewingKey ivk(ivks[*hits[o]]);
+        mapSaplingNoteData_t& noteData = ret[outputs[o].first].first;
+        SaplingIncomingViewingKeyMap& viewingKeysToAdd = ret[outputs[o].first].second;
+
+        // Decrypt again to recover the diversifier; this only happens for the
+        // outputs that are ours.
+        auto result = SaplingNotePlaintext::decrypt(consensusParams, height, output.encCiphertext, ivk, output.ephemeralKey, output.cmu);
+        assert(result);
+        auto address = ivk.address(result.value().d);
+        if (address && mapSaplingIncomingViewingKeys.count(address.value()) == 0) {
+            viewingKeysToAdd[address.value()] = ivk;
+        }
+        // We don't cache the nullifier here as computing it requires knowledge of the note position
+        // in the commitment tree, which can only be determined when the transaction has been mined.
+        SaplingOutPoint op {tx.GetHash(), i};
+        SaplingNoteData nd;
+        nd.ivk = ivk;
+        noteData.insert(std::make_pair(op, nd));
+    }
+
+    return ret;
+}
+
+/**
+ * Returns true if the keys in this wallet may receive any of the outputs in the
+ * given shielded index record of a block mined at the given height. The Sapling
+ * outputs are trial-decrypted from the leading bytes of their ciphertexts. The
+ * record does not hold Sprout ciphertexts, so any JoinSplit is a match for a
+ * wallet that has Sprout keys.
+ */
+bool CWallet::CompactBlockMatchesKeys(const CCompactBlock& block, int height) const
+{
+    LOCK(cs_KeyStore);
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    std::vector<const CCompactSaplingOutput*> outputs;
+    for (const CCompactTx& tx : block.vtx) {
+        for (const CTxOut& txout : tx.vout) {
+            if (::IsMine(*this, txout.scriptPubKey) != ISMINE_NO) {
+                return true;
             }
-            // We don't cache the nullifier here as computing it requires knowledge of the note position
-            // in the commitment tree, which can only be determined when the transaction has been mined.
-            SaplingOutPoint op {hash, i};
-            SaplingNoteData nd;
-            nd.ivk = ivk;
-            noteData.insert(std::make_pair(op, nd));
-            break;
+        }
+        if (!tx.vSproutCommitments.empty() && !mapNoteDecryptors.empty()) {
+            return true;
+        }
+        for (const CCompactSaplingOutput& output : tx.vSaplingOutputs) {
+            outputs.push_back(&output);
         }
     }
 
-    return std::make_pair(noteData, viewingKeysToAdd);
+    std::vector<uint256> ivks;
+    for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
+        ivks.push_back(it->first);
+    }
+
+    auto hits = TrialDecrypt(outputs.size(), ivks.size(), [&](size_t o, size_t kBegin, size_t kEnd) {
+        const CCompactSaplingOutput& output = *outputs[o];
+        auto dhsecrets = SaplingKeyAgreementBatch(
+            {output.epk},
+            std::vector<uint256>(ivks.begin() + kBegin, ivks.begin() + kEnd));
+        for (size_t k = kBegin; k < kEnd; k++) {
+            const std::optional<uint256>& dhsecret = dhsecrets[k - kBegin];
+            if (dhsecret && SaplingNotePlaintext::decrypt_compact_with_shared_secret(
+                    consensusParams, height, output.encCiphertext, ivks[k], output.epk, output.cmu, *dhsecret)) {
+                return std::optional<size_t>(k);
+            }
+        }
+        return std::optional<size_t>();
+    });
+
+    return std::any_of(hits.begin(), hits.end(), [](const std::optional<size_t>& hit) { return hit.has_value(); });
+}
+
+/**
+ * Returns true if any transaction in the given shielded index record is already
+ * in the wallet, or spends one of its outputs or notes.
+ */
+bool CWallet::CompactBlockInvolvesWallet(const CCompactBlock& block) const
+{
+    AssertLockHeld(cs_wallet);
+    for (const CCompactTx& tx : block.vtx) {
+        if (mapWallet.count(tx.hash)) {
+            return true;
+        }
+        for (const COutPoint& prevout : tx.vPrevouts) {
+            if (mapWallet.count(prevout.hash)) {
+                return true;
+            }
+        }
+        for (const uint256& nullifier : tx.vSproutNullifiers) {
+            if (mapSproutNullifiersToNotes.count(nullifier)) {
+                return true;
+            }
+        }
+        for (const uint256& nullifier : tx.vSaplingNullifiers) {
+            if (mapSaplingNullifiersToNotes.count(nullifier)) {
+                return true;
+            }
+        }
+    }
+    return false;
 }
 
 bool CWallet::IsSproutNullifierFromMe(const uint256& nullifier) const
@@ -2278,6 +2570,21 @@ bool CWallet::LoadCryptedHDSeed(const uint256& seedFp, const std::vector<unsigne
     return CCryptoKeyStore::SetCryptedHDSeed(seedFp, seed);
 }
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+    if (pwallet) {
+        pwallet->MarkBalancesDirty();
+    }
+}
+
 void CWalletTx::SetSproutNoteData(mapSproutNoteData_t &noteData)
 {
     mapSproutNoteData.clear();
@@ -2687,7 +2994,18 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived,
 
 bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
 {
-    return pwalletdb->WriteTx(GetHash(), *this);
+    if (!pwalletdb->WriteTx(GetHash(), *this)) {
+        return false;
+    }
+    // Record the nullifiers that are now on disk, so that SetBestChain
+    // doesn't rewrite this transaction for them.
+    for (mapSproutNoteData_t::value_type& item : mapSproutNoteData) {
+        item.second.witnessStore.nullifier = item.second.nullifier;
+    }
+    for (mapSaplingNoteData_t::value_type& item : mapSaplingNoteData) {
+        item.second.witnessStore.nullifier = item.second.nullifier;
+    }
+    return true;
 }
 
 void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
@@ -2748,24 +3066,186 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
     }
 }
 
+/**
+ * Sets the block that the wallet's witness caches are to be brought up to.
+ * This is called by ChainTip, and when the wallet is loaded with the tip that
+ * ThreadNotifyWallets will notify it from. Wakes up a rescan that is waiting
+ * for the notifications to catch up with the active chain.
+ */
+void CWallet::SetWalletTip(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_wallet);
+    pindexWalletTip = pindex;
+    {
+        std::lock_guard<std::mutex> lock(cs_walletTipChanged);
+        nWalletTipUpdates++;
+    }
+    condWalletTipChanged.notify_all();
+}
+
+/**
+ * The block that the wallet's witness caches are being brought up to. A wallet
+ * whose tip was never set is at the genesis block, which is where
+ * ThreadNotifyWallets starts on an empty chain. This is never the active tip,
+ * which the wallet may not have been notified of yet: blocks that a rescan
+ * applied past the wallet tip would be applied again by ChainTip.
+ */
+const CBlockIndex* CWallet::GetWalletTip() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    return pindexWalletTip ? pindexWalletTip : chainActive.Genesis();
+}
+
+/**
+ * Returns up to WALLET_RESCAN_BLOCKS blocks that follow pindexFrom (or that
+ * start at the genesis block, if it is null) towards the wallet tip. Only
+ * blocks that are also in the active chain are returned, as the commitment
+ * trees of a disconnected block can no longer be looked up.
+ */
+std::vector<CBlockIndex*> CWallet::NextBlocksToScan(const CBlockIndex* pindexFrom) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    std::vector<CBlockIndex*> vBlocks;
+    const CBlockIndex* pindexTip = GetWalletTip();
+    const CBlockIndex* pindexPrev = pindexFrom;
+    while (pindexTip && vBlocks.size() < WALLET_RESCAN_BLOCKS) {
+        int nHeight = pindexPrev ? pindexPrev->nHeight + 1 : 0;
+        if (nHeight > pindexTip->nHeight) {
+            break;
+        }
+        CBlockIndex* pindex = chainActive[nHeight];
+        if (!pindex || pindex->pprev != pindexPrev || pindexTip->GetAncestor(nHeight) != pindex) {
+            break;
+        }
+        vBlocks.push_back(pindex);
+        pindexPrev = pindex;
+    }
+    return vBlocks;
+}
+
+namespace {
+
+/** A block read ahead by a wallet rescan, and what it holds for the wallet. */
+struct RescanBlock
+{
+    CBlockIndex* pindex;
+    CDiskBlockPos pos;
+    uint256 hash;
+    //! Whether the index entry had reached BLOCK_VALID_TREE, so that the
+    //! header can be trusted once the hash of the block read matches
+    bool fValidTree = false;
+    CBlock block;
+    bool fRead = false;
+    //! The shielded index record, while the full block has not been read
+    std::optional<CCompactBlock> compact;
+    std::vector<WalletTxMatch> matches;
+
+    void ReadFullBlock()
+    {
+        compact.reset();
+        fRead = ReadBlockFromDisk(block, pos, Params().GetConsensus(), !fValidTree) &&
+            block.GetHash() == hash;
+    }
+};
+
+/**
+ * Reads and deserializes the given blocks on a thread of their own, so that a
+ * rescan can match and apply one batch of blocks while reading the next. With
+ * -shieldedindex, only the index record is read for the blocks that have one.
+ */
+std::future<std::vector<RescanBlock>> ReadRescanBlocks(std::vector<RescanBlock> vBlocks)
+{
+    return std::async(std::launch::async, [](std::vector<RescanBlock> vBlocks) {
+        for (RescanBlock& rb : vBlocks) {
+            CCompactBlock compact;
+            if (fShieldedIndex && pblocktree->ReadShieldedIndex(rb.hash, compact)) {
+                rb.compact = std::move(compact);
+            } else {
+                rb.ReadFullBlock();
+            }
+        }
+        return vBlocks;
+    }, std::move(vBlocks));
+}
+
+/**
+ * Finds what each transaction in the given blocks holds for the wallet. This
+ * runs without cs_wallet, and the trial decryptions are spread across the
+ * trial decryption threads. The transparent outputs are matched here rather
+ * than on those threads, as IsMine takes cs_KeyStore, which is taken before
+ * the lock that serializes uses of the threads. A block that was only read
+ * from the shielded index is read in full if it may hold outputs for the
+ * wallet's keys.
+ */
+void MatchRescanBlocks(const CWallet& wallet, std::vector<RescanBlock>& vBlocks)
+{
+    for (RescanBlock& rb : vBlocks) {
+        if (rb.compact) {
+            if (!wallet.CompactBlockMatchesKeys(*rb.compact, rb.pindex->nHeight)) {
+                continue;
+            }
+            rb.ReadFullBlock();
+        }
+        std::vector<const CTransaction*> vtx;
+        for (const CTransaction& tx : rb.block.vtx) {
+            vtx.push_back(&tx);
+        }
+        auto saplingNotes = wallet.FindMySaplingNotes(vtx, rb.pindex->nHeight);
+        rb.matches.resize(vtx.size());
+        for (size_t i = 0; i < vtx.size(); i++) {
+            rb.matches[i].sproutNotes = wallet.FindMySproutNotes(*vtx[i]);
+            rb.matches[i].saplingNotes = std::move(saplingNotes[i]);
+            rb.matches[i].fIsMine = wallet.IsMine(*vtx[i]);
+        }
+    }
+}
+
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * The scan is pipelined: while one batch of blocks is matched against the
+ * wallet and then applied to it in order, the next batch is read from disk.
+ * cs_main and cs_wallet are only held to apply each batch, so this must be
+ * called without them. Until the scan reaches the wallet tip, ChainTip leaves
+ * the blocks it is notified of for the scan to apply.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
+    LOCK(cs_walletRescan);
+
     int ret = 0;
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
 
-    CBlockIndex* pindex = pindexStart;
-
     std::vector<uint256> myTxHashes;
+    double dProgressStart = 0;
+    double dProgressTip = 0;
+
+    // Must be called with cs_main and cs_wallet held.
+    auto readBlocksAfter = [&](const CBlockIndex* pindexFrom) {
+        std::vector<RescanBlock> vBlocks;
+        for (CBlockIndex* pindex : NextBlocksToScan(pindexFrom)) {
+            RescanBlock rb;
+            rb.pindex = pindex;
+            rb.pos = pindex->GetBlockPos();
+            rb.hash = pindex->GetBlockHash();
+            rb.fValidTree = pindex->IsValid(BLOCK_VALID_TREE);
+            vBlocks.push_back(std::move(rb));
+        }
+        return ReadRescanBlocks(std::move(vBlocks));
+    };
+    std::future<std::vector<RescanBlock>> nextBlocks;
 
     {
         LOCK2(cs_main, cs_wallet);
 
+        CBlockIndex* pindex = pindexStart;
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
         while (pindex && nTimeFirstKey && pindex->GetBlockTime() < nTimeFirstKey - TIMESTAMP_WINDOW) {
@@ -2773,57 +3253,164 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         }
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+        if (!pindex) {
+            ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+            return ret;
+        }
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+
+        // ChainTip skips the blocks it is notified of from now on, so start
+        // on the wallet's own chain to be sure that the scan covers them.
+        const CBlockIndex* pindexTip = GetWalletTip();
+        const CBlockIndex* pindexFrom = pindex->pprev;
+        if (pindexFrom && pindexFrom->nHeight > pindexTip->nHeight) {
+            pindexFrom = pindexFrom->GetAncestor(pindexTip->nHeight);
+        }
+        while (pindexFrom && pindexTip->GetAncestor(pindexFrom->nHeight) != pindexFrom) {
+            pindexFrom = pindexFrom->pprev;
+        }
+        fScanningWallet = true;
+        pindexScanned = pindexFrom;
+        nextBlocks = readBlocksAfter(pindexScanned);
+    }
+
+    while (true) {
+        std::vector<RescanBlock> vBlocks = nextBlocks.get();
+        if (!vBlocks.empty()) {
+            LOCK2(cs_main, cs_wallet);
+            nextBlocks = readBlocksAfter(vBlocks.back().pindex);
+        }
+
+        MatchRescanBlocks(*this, vBlocks);
+
+        const CBlockIndex* pindexApplied = nullptr;
+        int nApplied = 0;
+        bool fCaughtUp = false;
+        uint64_t nTipUpdates = 0;
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            LOCK2(cs_main, cs_wallet);
+            nTipUpdates = nWalletTipUpdates;
+            for (RescanBlock& rb : vBlocks) {
+                // The chain, or the wallet's view of it, may have moved on
+                // since these blocks were picked.
+                if (rb.pindex->pprev != pindexScanned ||
+                        !chainActive.Contains(rb.pindex) ||
+                        GetWalletTip()->GetAncestor(rb.pindex->nHeight) != rb.pindex) {
+                    break;
+                }
+                if (rb.compact && CompactBlockInvolvesWallet(*rb.compact)) {
+                    // The block spends from the wallet, or holds one of its
+                    // transactions, so it has to be applied in full after all.
+                    rb.ReadFullBlock();
+                    rb.matches.clear();
+                }
+                if (!rb.fRead && !rb.compact) {
+                    LogPrintf("Rescanning... failed to read block %s\n", rb.hash.ToString());
+                }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            for (CTransaction& tx : block.vtx)
-            {
-                if (AddToWalletIfInvolvingMe(tx, &block, pindex->nHeight, fUpdate)) {
-                    myTxHashes.push_back(tx.GetHash());
-                    ret++;
+                if (rb.pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), rb.pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+                for (size_t i = 0; i < rb.block.vtx.size(); i++)
+                {
+                    const CTransaction& tx = rb.block.vtx[i];
+                    const WalletTxMatch* match = rb.matches.empty() ? nullptr : &rb.matches[i];
+                    if (AddToWalletIfInvolvingMe(tx, &rb.block, rb.pindex->nHeight, fUpdate, match)) {
+                        myTxHashes.push_back(tx.GetHash());
+                        ret++;
+                    }
                 }
-            }
 
-            SproutMerkleTree sproutTree;
-            SaplingMerkleTree saplingTree;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
-            if (pindex->pprev) {
-                if (Params().GetConsensus().NetworkUpgradeActive(pindex->pprev->nHeight,  Consensus::UPGRADE_SAPLING)) {
-                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                SproutMerkleTree sproutTree;
+                SaplingMerkleTree saplingTree;
+                // This should never fail: we should always be able to get the tree
+                // state on the path to the tip of our chain
+                assert(pcoinsTip->GetSproutAnchorAt(rb.pindex->hashSproutAnchor, sproutTree));
+                if (rb.pindex->pprev) {
+                    if (Params().GetConsensus().NetworkUpgradeActive(rb.pindex->pprev->nHeight,  Consensus::UPGRADE_SAPLING)) {
+                        assert(pcoinsTip->GetSaplingAnchorAt(rb.pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                    }
+                }
+                // Increment note witness caches. None of the wallet's
+                // transactions are in a block that was not read in full, so
+                // there are no nullifiers to update for it.
+                if (rb.compact) {
+                    IncrementNoteWitnesses(rb.pindex, *rb.compact, sproutTree, saplingTree);
+                } else {
+                    ChainTipAdded(rb.pindex, &rb.block, sproutTree, saplingTree);
+                }
+                pindexScanned = rb.pindex;
+                pindexApplied = rb.pindex;
+                nApplied++;
+
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", rb.pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), rb.pindex));
                 }
             }
-            // Increment note witness caches
-            ChainTipAdded(pindex, &block, sproutTree, saplingTree);
 
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+            if (pindexScanned == GetWalletTip()) {
+                // ChainTip applies the blocks that follow.
+                fScanningWallet = false;
+                fCaughtUp = true;
             }
         }
 
+        if (pindexApplied) {
+            SetBestChainIfDue(pindexApplied, nApplied);
+        }
+        if (fCaughtUp) {
+            break;
+        }
+        if (nApplied < (int)vBlocks.size() || vBlocks.empty()) {
+            // Either the chain was reorganized, or the active chain has moved
+            // past the wallet tip onto a branch that the wallet has not been
+            // notified of yet. Drop the blocks read ahead, and carry on from
+            // the last block applied once the notifications catch up.
+            if (nextBlocks.valid()) {
+                nextBlocks.get();
+            }
+            if (ShutdownRequested()) {
+                // Leave fScanningWallet set, so that the witness caches stay
+                // consistent with the best block written for the wallet.
+                LogPrintf("Rescan interrupted by shutdown at block %d\n", pindexScanned ? pindexScanned->nHeight : -1);
+                break;
+            }
+            if (nApplied == 0) {
+                // Wait for ChainTip to move the wallet tip. Shutdown doesn't
+                // signal this, so wake up every second to check for it.
+                std::unique_lock<std::mutex> lock(cs_walletTipChanged);
+                condWalletTipChanged.wait_for(lock, std::chrono::seconds(1), [&] {
+                    return nWalletTipUpdates != nTipUpdates;
+                });
+            }
+            LOCK2(cs_main, cs_wallet);
+            nextBlocks = readBlocksAfter(pindexScanned);
+        }
+    }
+    if (nextBlocks.valid()) {
+        nextBlocks.get();
+    }
+
+    {
+        LOCK(cs_wallet);
+
         // After rescanning, persist Sapling note data that might have changed, e.g. nullifiers.
-        // Do not flush the wallet here for performance reasons.
+        // The witness caches are left to SetBestChain, which writes them
+        // separately. Do not flush the wallet here for performance reasons.
         CWalletDB walletdb(strWalletFile, "r+", false);
         for (auto hash : myTxHashes) {
-            CWalletTx wtx = mapWallet[hash];
-            if (!wtx.mapSaplingNoteData.empty()) {
+            CWalletTx& wtx = mapWallet[hash];
+            if (NoteNullifiersChanged(wtx.mapSaplingNoteData)) {
                 if (!wtx.WriteToDisk(&walletdb)) {
                     LogPrintf("Rescanning... WriteToDisk failed to update Sapling note data for: %s\n", hash.ToString());
                 }
             }
         }
-
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -3130,94 +3717,117 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime)
  */
 
 
-CAmount CWallet::GetBalance() const
+CAmount CWallet::GetCachedBalance(const std::string& key, const std::function<CAmount()>& compute) const
 {
-    CAmount nTotal = 0;
+    uint64_t nGeneration = nBalanceGeneration;
+    {
+        LOCK(cs_balances);
+        if (nGeneration == nCachedBalanceGeneration) {
+            auto it = mapCachedBalances.find(key);
+            if (it != mapCachedBalances.end()) {
+                return it->second;
+            }
+        }
+    }
+
+    CAmount nBalance;
     {
         LOCK2(cs_main, cs_wallet);
+        // Anything that changes the balance after these are read will make
+        // the result stale.
+        nGeneration = nBalanceGeneration;
+        nBalance = compute();
+    }
+
+    LOCK(cs_balances);
+    if (nGeneration != nCachedBalanceGeneration) {
+        mapCachedBalances.clear();
+        nCachedBalanceGeneration = nGeneration;
+    }
+    mapCachedBalances[key] = nBalance;
+    return nBalance;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    return GetCachedBalance("balance", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
-    }
-
-    return nTotal;
+        return nTotal;
+    });
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    return GetCachedBalance("unconfirmed", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableCredit();
         }
-    }
-    return nTotal;
+        return nTotal;
+    });
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    return GetCachedBalance("immature", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureCredit();
         }
-    }
-    return nTotal;
+        return nTotal;
+    });
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    return GetCachedBalance("watchonly", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
-    }
-
-    return nTotal;
+        return nTotal;
+    });
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    return GetCachedBalance("unconfirmed_watchonly", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
-    }
-    return nTotal;
+        return nTotal;
+    });
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    return GetCachedBalance("immature_watchonly", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
-    }
-    return nTotal;
+        return nTotal;
+    });
 }
 
 void CWallet::AvailableCoins(vector<COutput>& vCoins,
@@ -4444,18 +5054,21 @@ void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    MarkBalancesDirty();
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    MarkBalancesDirty();
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    MarkBalancesDirty();
 }
 
 bool CWallet::IsLockedCoin(uint256 hash, unsigned int n) const
@@ -4483,18 +5096,21 @@ void CWallet::LockNote(const JSOutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedSproutNotes
     setLockedSproutNotes.insert(output);
+    MarkBalancesDirty();
 }
 
 void CWallet::UnlockNote(const JSOutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedSproutNotes
     setLockedSproutNotes.erase(output);
+    MarkBalancesDirty();
 }
 
 void CWallet::UnlockAllSproutNotes()
 {
     AssertLockHeld(cs_wallet); // setLockedSproutNotes
     setLockedSproutNotes.clear();
+    MarkBalancesDirty();
 }
 
 bool CWallet::IsLockedNote(const JSOutPoint& outpt) const
@@ -4515,18 +5131,21 @@ void CWallet::LockNote(const SaplingOutPoint& output)
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.insert(output);
+    MarkBalancesDirty();
 }
 
 void CWallet::UnlockNote(const SaplingOutPoint& output)
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.erase(output);
+    MarkBalancesDirty();
 }
 
 void CWallet::UnlockAllSaplingNotes()
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.clear();
+    MarkBalancesDirty();
 }
 
 bool CWallet::IsLockedNote(const SaplingOutPoint& output) const
@@ -4694,6 +5313,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format on startup"));
     strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file absolute path or a path relative to the data directory") + " " + strprintf(_("(default: %s)"), DEFAULT_WALLET_DAT));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), DEFAULT_WALLETBROADCAST));
+    strUsage += HelpMessageOpt("-walletdecryptthreads=<n>", strprintf(_("Set the number of threads used to detect notes sent to the wallet (0 = use all cores, default: %d)"), DEFAULT_TRIAL_DECRYPTION_THREADS));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
                                " " + _("(1 = keep tx meta data e.g. account owner and payment request information, 2 = drop tx meta data)"));
@@ -4804,6 +5424,12 @@ bool CWallet::InitLoadWallet(bool clearWitnessCaches)
     LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
 
     RegisterValidationInterface(walletInstance);
+    {
+        // ThreadNotifyWallets is started from the current tip after the wallet
+        // has been loaded, so the rescan below brings the wallet up to it.
+        LOCK2(cs_main, walletInstance->cs_wallet);
+        walletInstance->SetWalletTip(chainActive.Tip());
+    }
 
     CBlockIndex *pindexRescan = chainActive.Genesis();
     if (clearWitnessCaches || GetBoolArg("-rescan", false)) {
@@ -5043,136 +5669,300 @@ void CWallet::GetFilteredNotes(
 }
 
 /**
- * Find notes in the wallet filtered by payment addresses, min depth, max depth, 
- * if the note is spent, if a spending key is required, and if the notes are locked.
- * These notes are decrypted and added to the output parameter vector, outEntries.
+ * Queues the notes of a transaction that are not in the note index yet, to be
+ * decrypted and added to it when they are next looked up.
  */
-void CWallet::GetFilteredNotes(
-    std::vector<SproutNoteEntry>& sproutEntries,
-    std::vector<SaplingNoteEntry>& saplingEntries,
-    std::set<PaymentAddress>& filterAddresses,
-    int minDepth,
-    int maxDepth,
-    bool ignoreSpent,
-    bool requireSpendingKey,
-    bool ignoreLocked)
+void CWallet::QueueNotesForIndex(const CWalletTx& wtx)
 {
-    LOCK2(cs_main, cs_wallet);
+    AssertLockHeld(cs_wallet);
+
+    for (const auto& pair : wtx.mapSproutNoteData) {
+        if (!mapSproutNoteIndex.count(pair.first)) {
+            setSproutNoteIndexPending.insert(pair.first);
+        }
+    }
+    for (const auto& pair : wtx.mapSaplingNoteData) {
+        if (!mapSaplingNoteIndex.count(pair.first)) {
+            setSaplingNoteIndexPending.insert(pair.first);
+        }
+    }
+}
+
+/**
+ * Adds the queued notes of the given addresses (or of all addresses, if there
+ * are none) to the note index, decrypting each note once. The notes of other
+ * addresses are left queued. A note that can't be decrypted is logged and left
+ * queued, so that it is retried by the next update without stopping the lookup
+ * of any other note.
+ */
+void CWallet::UpdateNoteIndex(const std::set<PaymentAddress>& filterAddresses)
+{
+    AssertLockHeld(cs_wallet);
+
+    // The address of a Sapling note is only known once it has been decrypted,
+    // so Sapling notes are filtered by their incoming viewing key instead.
+    std::set<SaplingIncomingViewingKey> filterIvks;
+    for (const PaymentAddress& addr : filterAddresses) {
+        if (auto saplingAddr = std::get_if<SaplingPaymentAddress>(&addr)) {
+            SaplingIncomingViewingKey ivk;
+            if (GetSaplingIncomingViewingKey(*saplingAddr, ivk)) {
+                filterIvks.insert(ivk);
+            }
+        }
+    }
 
     KeyIO keyIO(Params());
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
+    for (auto it = setSproutNoteIndexPending.begin(); it != setSproutNoteIndexPending.end(); ) {
+        const JSOutPoint jsop = *it;
+        auto mi = mapWallet.find(jsop.hash);
+        if (mi == mapWallet.end() || !mi->second.mapSproutNoteData.count(jsop)) {
+            it = setSproutNoteIndexPending.erase(it);
+            continue;
+        }
+        const CWalletTx& wtx = mi->second;
+        const SproutPaymentAddress& pa = wtx.mapSproutNoteData.at(jsop).address;
 
-        // Filter the transactions before checking for notes
-        if (!CheckFinalTx(wtx) ||
-            wtx.GetDepthInMainChain() < minDepth ||
-            wtx.GetDepthInMainChain() > maxDepth) {
+        // skip notes which belong to a different payment address in the wallet
+        if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
+            ++it;
             continue;
         }
 
-        // Filter coinbase transactions that don't have Sapling outputs
-        if (wtx.IsCoinBase() && wtx.mapSaplingNoteData.empty()) {
+        int i = jsop.js; // Index into CTransaction.vJoinSplit
+        int j = jsop.n; // Index into JSDescription.ciphertexts
+
+        // Get cached decryptor
+        ZCNoteDecryption decryptor;
+        if (!GetNoteDecryptor(pa, decryptor)) {
+            // Note decryptors are created when the wallet is loaded, so it should always exist
+            LogPrintf("%s: Could not find note decryptor for payment address %s\n", __func__, keyIO.EncodePaymentAddress(pa));
+            ++it;
             continue;
         }
 
-        for (auto & pair : wtx.mapSproutNoteData) {
-            JSOutPoint jsop = pair.first;
-            SproutNoteData nd = pair.second;
-            SproutPaymentAddress pa = nd.address;
+        // determine amount of funds in the note
+        auto hSig = ZCJoinSplit::h_sig(
+            wtx.vJoinSplit[i].randomSeed,
+            wtx.vJoinSplit[i].nullifiers,
+            wtx.joinSplitPubKey);
+        try {
+            SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
+                    decryptor,
+                    wtx.vJoinSplit[i].ciphertexts[j],
+                    wtx.vJoinSplit[i].ephemeralKey,
+                    hSig,
+                    (unsigned char) j);
+
+            mapSproutNoteIndex.emplace(jsop, SproutNoteIndexEntry(pa, plaintext.note(pa), plaintext.memo()));
+            mapSproutNotesByAddress[pa].insert(jsop);
+            it = setSproutNoteIndexPending.erase(it);
+        } catch (const note_decryption_failed &err) {
+            // Couldn't decrypt with this spending key
+            LogPrintf("%s: Could not decrypt note %s for payment address %s\n", __func__, jsop.ToString(), keyIO.EncodePaymentAddress(pa));
+            ++it;
+        } catch (const std::exception &exc) {
+            // Unexpected failure
+            LogPrintf("%s: Error while decrypting note %s for payment address %s: %s\n", __func__, jsop.ToString(), keyIO.EncodePaymentAddress(pa), exc.what());
+            ++it;
+        }
+    }
 
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
+    for (auto it = setSaplingNoteIndexPending.begin(); it != setSaplingNoteIndexPending.end(); ) {
+        const SaplingOutPoint op = *it;
+        auto mi = mapWallet.find(op.hash);
+        if (mi == mapWallet.end() || !mi->second.mapSaplingNoteData.count(op)) {
+            it = setSaplingNoteIndexPending.erase(it);
+            continue;
+        }
+        const CWalletTx& wtx = mi->second;
+        const SaplingNoteData& nd = wtx.mapSaplingNoteData.at(op);
 
-            // skip note which has been spent
-            if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
-                continue;
-            }
+        if (!(filterAddresses.empty() || filterIvks.count(nd.ivk))) {
+            ++it;
+            continue;
+        }
 
-            // skip notes which cannot be spent
-            if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
-                continue;
-            }
+        // This should not fail, as the transaction would not have entered the
+        // wallet unless its plaintext had been successfully decrypted before.
+        auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
+        if (!optDeserialized) {
+            LogPrintf("%s: Could not decrypt Sapling note %s\n", __func__, op.ToString());
+            ++it;
+            continue;
+        }
+        auto notePt = optDeserialized.value();
+        auto maybe_pa = nd.ivk.address(notePt.d);
+        auto maybe_note = notePt.note(nd.ivk);
+        if (!maybe_pa || !maybe_note) {
+            LogPrintf("%s: Invalid diversifier in Sapling note %s\n", __func__, op.ToString());
+            ++it;
+            continue;
+        }
+        auto pa = maybe_pa.value();
 
-            // skip locked notes
-            if (ignoreLocked && IsLockedNote(jsop)) {
-                continue;
-            }
+        mapSaplingNoteIndex.emplace(op, SaplingNoteIndexEntry(pa, maybe_note.value(), notePt.memo()));
+        mapSaplingNotesByAddress[pa].insert(op);
+        it = setSaplingNoteIndexPending.erase(it);
+    }
+}
 
-            int i = jsop.js; // Index into CTransaction.vJoinSplit
-            int j = jsop.n; // Index into JSDescription.ciphertexts
+void CWallet::RemoveFromNoteIndex(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
 
-            // Get cached decryptor
-            ZCNoteDecryption decryptor;
-            if (!GetNoteDecryptor(pa, decryptor)) {
-                // Note decryptors are created when the wallet is loaded, so it should always exist
-                throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", keyIO.EncodePaymentAddress(pa)));
-            }
+    for (const auto& pair : wtx.mapSproutNoteData) {
+        auto it = mapSproutNoteIndex.find(pair.first);
+        if (it != mapSproutNoteIndex.end()) {
+            mapSproutNotesByAddress[it->second.address].erase(pair.first);
+            mapSproutNoteIndex.erase(it);
+        }
+        setSproutNoteIndexPending.erase(pair.first);
+    }
+    for (const auto& pair : wtx.mapSaplingNoteData) {
+        auto it = mapSaplingNoteIndex.find(pair.first);
+        if (it != mapSaplingNoteIndex.end()) {
+            mapSaplingNotesByAddress[it->second.address].erase(pair.first);
+            mapSaplingNoteIndex.erase(it);
+        }
+        setSaplingNoteIndexPending.erase(pair.first);
+    }
+}
 
-            // determine amount of funds in the note
-            auto hSig = ZCJoinSplit::h_sig(
-                wtx.vJoinSplit[i].randomSeed,
-                wtx.vJoinSplit[i].nullifiers,
-                wtx.joinSplitPubKey);
-            try {
-                SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
-                        decryptor,
-                        wtx.vJoinSplit[i].ciphertexts[j],
-                        wtx.vJoinSplit[i].ephemeralKey,
-                        hSig,
-                        (unsigned char) j);
+/**
+ * Find notes in the wallet filtered by payment addresses, min depth, max depth, 
+ * if the note is spent, if a spending key is required, and if the notes are locked.
+ * The notes are taken from the note index and added to the output parameter vectors.
+ */
+void CWallet::GetFilteredNotes(
+    std::vector<SproutNoteEntry>& sproutEntries,
+    std::vector<SaplingNoteEntry>& saplingEntries,
+    std::set<PaymentAddress>& filterAddresses,
+    int minDepth,
+    int maxDepth,
+    bool ignoreSpent,
+    bool requireSpendingKey,
+    bool ignoreLocked)
+{
+    LOCK2(cs_main, cs_wallet);
 
-                sproutEntries.push_back(SproutNoteEntry {
-                    jsop, pa, plaintext.note(pa), plaintext.memo(), wtx.GetDepthInMainChain() });
+    UpdateNoteIndex(filterAddresses);
 
-            } catch (const note_decryption_failed &err) {
-                // Couldn't decrypt with this spending key
-                throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", keyIO.EncodePaymentAddress(pa)));
-            } catch (const std::exception &exc) {
-                // Unexpected failure
-                throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", keyIO.EncodePaymentAddress(pa), exc.what()));
+    // Only look at the notes of the filtered addresses, in the same order as
+    // the notes of all addresses.
+    std::vector<JSOutPoint> sproutOutPoints;
+    std::vector<SaplingOutPoint> saplingOutPoints;
+    if (filterAddresses.empty()) {
+        for (const auto& pair : mapSproutNoteIndex) {
+            sproutOutPoints.push_back(pair.first);
+        }
+        for (const auto& pair : mapSaplingNoteIndex) {
+            saplingOutPoints.push_back(pair.first);
+        }
+    } else {
+        for (const PaymentAddress& addr : filterAddresses) {
+            if (auto sproutAddr = std::get_if<SproutPaymentAddress>(&addr)) {
+                auto it = mapSproutNotesByAddress.find(*sproutAddr);
+                if (it != mapSproutNotesByAddress.end()) {
+                    sproutOutPoints.insert(sproutOutPoints.end(), it->second.begin(), it->second.end());
+                }
+            } else if (auto saplingAddr = std::get_if<SaplingPaymentAddress>(&addr)) {
+                auto it = mapSaplingNotesByAddress.find(*saplingAddr);
+                if (it != mapSaplingNotesByAddress.end()) {
+                    saplingOutPoints.insert(saplingOutPoints.end(), it->second.begin(), it->second.end());
+                }
             }
         }
+        std::sort(sproutOutPoints.begin(), sproutOutPoints.end());
+        std::sort(saplingOutPoints.begin(), saplingOutPoints.end());
+    }
 
-        for (auto & pair : wtx.mapSaplingNoteData) {
-            SaplingOutPoint op = pair.first;
-            SaplingNoteData nd = pair.second;
+    // Filter the transactions before checking for notes. The notes of a
+    // transaction are adjacent, so each transaction is only checked once.
+    uint256 hashLast;
+    const CWalletTx* pwtxLast = nullptr;
+    int nDepth = 0;
+    auto filterTx = [&](const uint256& hash) -> const CWalletTx* {
+        if (hash == hashLast) {
+            return pwtxLast;
+        }
+        hashLast = hash;
+        pwtxLast = nullptr;
+        auto mi = mapWallet.find(hash);
+        if (mi == mapWallet.end()) {
+            return nullptr;
+        }
+        const CWalletTx& wtx = mi->second;
+        nDepth = wtx.GetDepthInMainChain();
+        if (!CheckFinalTx(wtx) || nDepth < minDepth || nDepth > maxDepth) {
+            return nullptr;
+        }
+        // Filter coinbase transactions that don't have Sapling outputs
+        if (wtx.IsCoinBase() && wtx.mapSaplingNoteData.empty()) {
+            return nullptr;
+        }
+        pwtxLast = &wtx;
+        return pwtxLast;
+    };
 
-            auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
+    for (const JSOutPoint& jsop : sproutOutPoints) {
+        const CWalletTx* pwtx = filterTx(jsop.hash);
+        if (!pwtx) {
+            continue;
+        }
+        auto itNoteData = pwtx->mapSproutNoteData.find(jsop);
+        if (itNoteData == pwtx->mapSproutNoteData.end()) {
+            continue;
+        }
+        const SproutNoteData& nd = itNoteData->second;
+        const SproutNoteIndexEntry& entry = mapSproutNoteIndex.at(jsop);
 
-            // The transaction would not have entered the wallet unless
-            // its plaintext had been successfully decrypted previously.
-            assert(optDeserialized != std::nullopt);
+        // skip note which has been spent
+        if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
+            continue;
+        }
 
-            auto notePt = optDeserialized.value();
-            auto maybe_pa = nd.ivk.address(notePt.d);
-            assert(static_cast<bool>(maybe_pa));
-            auto pa = maybe_pa.value();
+        // skip notes which cannot be spent
+        if (requireSpendingKey && !HaveSproutSpendingKey(entry.address)) {
+            continue;
+        }
 
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(jsop)) {
+            continue;
+        }
 
-            if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
-                continue;
-            }
+        sproutEntries.push_back(SproutNoteEntry {
+            jsop, entry.address, entry.note, entry.GetMemo(), nDepth });
+    }
 
-            // skip notes which cannot be spent
-            if (requireSpendingKey && !HaveSpendingKeyForPaymentAddress(this)(pa)) {
-                continue;
-            }
+    for (const SaplingOutPoint& op : saplingOutPoints) {
+        const CWalletTx* pwtx = filterTx(op.hash);
+        if (!pwtx) {
+            continue;
+        }
+        auto itNoteData = pwtx->mapSaplingNoteData.find(op);
+        if (itNoteData == pwtx->mapSaplingNoteData.end()) {
+            continue;
+        }
+        const SaplingNoteData& nd = itNoteData->second;
+        const SaplingNoteIndexEntry& entry = mapSaplingNoteIndex.at(op);
 
-            // skip locked notes
-            if (ignoreLocked && IsLockedNote(op)) {
-                continue;
-            }
+        if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
+            continue;
+        }
+
+        // skip notes which cannot be spent
+        if (requireSpendingKey && !HaveSpendingKeyForPaymentAddress(this)(entry.address)) {
+            continue;
+        }
 
-            auto note = notePt.note(nd.ivk).value();
-            saplingEntries.push_back(SaplingNoteEntry {
-                op, pa, note, notePt.memo(), wtx.GetDepthInMainChain() });
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(op)) {
+            continue;
         }
+
+        saplingEntries.push_back(SaplingNoteEntry {
+            op, entry.address, entry.note, entry.GetMemo(), nDepth });
     }
 }
 
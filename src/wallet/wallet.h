@@ -8,6 +8,7 @@
 
 #include "amount.h"
 #include "asyncrpcoperation.h"
+#include "clientversion.h"
 #include "coins.h"
 #include "key.h"
 #include "keystore.h"
@@ -28,7 +29,12 @@
 #include "base58.h"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <limits>
 #include <map>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <stdexcept>
@@ -71,6 +77,9 @@ static const bool DEFAULT_WALLETBROADCAST = true;
 //  unless there is some exceptional network disruption.
 static const unsigned int WITNESS_CACHE_SIZE = MAX_REORG_LENGTH + 1;
 
+//! Number of blocks that a wallet rescan reads ahead, matches and applies at a time
+static const unsigned int WALLET_RESCAN_BLOCKS = 16;
+
 //! Size of HD seed in bytes
 static const size_t HD_WALLET_SEED_LENGTH = 32;
 
@@ -91,8 +100,12 @@ enum WalletFeature
 
     FEATURE_WALLETCRYPT = 40000, // wallet encryption
     FEATURE_COMPRPUBKEY = 60000, // compressed public keys
+    FEATURE_WITNESSSTORE = 4040000, // v4.4.0: note witnesses stored apart from CWalletTx records (new wallets, or -upgradewallet)
 
-    FEATURE_LATEST = 60000
+    // A client only upgrades wallets to features that its own version covers,
+    // as it can't load a wallet whose minimum version is above its own. The
+    // witness store becomes the latest feature with the v4.4.0 version bump.
+    FEATURE_LATEST = CLIENT_VERSION >= FEATURE_WITNESSSTORE ? FEATURE_WITNESSSTORE : FEATURE_COMPRPUBKEY
 };
 
 
@@ -212,6 +225,26 @@ public:
     std::string ToString() const;
 };
 
+/**
+ * The part of a note's witness cache that has been written to the witness
+ * records in the wallet database, and the nullifier that was last written
+ * with the note's transaction. This is only kept in memory, so that
+ * CWallet::SetBestChain can write out just the witnesses that have changed.
+ */
+struct NoteWitnessStoreState
+{
+    /** Height of the newest witness written to the database. */
+    int witnessHeight = -1;
+    /** Number of witnesses written to the database, ending at witnessHeight. */
+    uint64_t witnessCount = 0;
+    /**
+     * Cached witnesses at or above this height may differ from the ones that
+     * were written, because blocks have been disconnected since then.
+     */
+    int dirtyHeight = 0;
+    std::optional<uint256> nullifier;
+};
+
 class SproutNoteData
 {
 public:
@@ -248,6 +281,9 @@ public:
      */
     int witnessHeight;
 
+    /** Not serialized; see NoteWitnessStoreState. */
+    NoteWitnessStoreState witnessStore;
+
     SproutNoteData() : address(), nullifier(), witnessHeight {-1} { }
     SproutNoteData(libzcash::SproutPaymentAddress a) :
             address {a}, nullifier(), witnessHeight {-1} { }
@@ -294,6 +330,9 @@ public:
     libzcash::SaplingIncomingViewingKey ivk;
     std::optional<uint256> nullifier;
 
+    /** Not serialized; see NoteWitnessStoreState. */
+    NoteWitnessStoreState witnessStore;
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -320,6 +359,17 @@ public:
 typedef std::map<JSOutPoint, SproutNoteData> mapSproutNoteData_t;
 typedef std::map<SaplingOutPoint, SaplingNoteData> mapSaplingNoteData_t;
 
+/**
+ * What a transaction holds for the wallet, found by a rescan before it takes
+ * cs_wallet to add the transaction.
+ */
+struct WalletTxMatch
+{
+    mapSproutNoteData_t sproutNotes;
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> saplingNotes;
+    bool fIsMine = false;
+};
+
 /** Sprout note, its location in a transaction, and number of confirmations. */
 struct SproutNoteEntry
 {
@@ -340,6 +390,39 @@ struct SaplingNoteEntry
     int confirmations;
 };
 
+/**
+ * The decrypted contents of a note received by the wallet, as kept by its
+ * note index so that the note doesn't have to be decrypted for each query.
+ */
+template <typename PaymentAddress, typename Note>
+struct NoteIndexEntry
+{
+    PaymentAddress address;
+    Note note;
+    //! The memo without its trailing zero bytes, which most memos are made of
+    std::vector<unsigned char> memo;
+
+    NoteIndexEntry(const PaymentAddress& addressIn, const Note& noteIn, const std::array<unsigned char, ZC_MEMO_SIZE>& memoIn) :
+        address(addressIn), note(noteIn)
+    {
+        size_t len = memoIn.size();
+        while (len > 0 && memoIn[len - 1] == 0) {
+            len--;
+        }
+        memo.assign(memoIn.begin(), memoIn.begin() + len);
+    }
+
+    std::array<unsigned char, ZC_MEMO_SIZE> GetMemo() const
+    {
+        std::array<unsigned char, ZC_MEMO_SIZE> ret = {};
+        std::copy(memo.begin(), memo.end(), ret.begin());
+        return ret;
+    }
+};
+
+typedef NoteIndexEntry<libzcash::SproutPaymentAddress, libzcash::SproutNote> SproutNoteIndexEntry;
+typedef NoteIndexEntry<libzcash::SaplingPaymentAddress, libzcash::SaplingNote> SaplingNoteIndexEntry;
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
 {
@@ -543,17 +626,7 @@ public:
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -772,6 +845,25 @@ private:
     int nSetChainUpdates;
     bool fBroadcastTransactions;
 
+    /**
+     * Serializes rescans; taken before cs_main and cs_wallet, which a rescan
+     * only holds while it applies each batch of blocks.
+     */
+    CCriticalSection cs_walletRescan;
+    //! Whether a rescan is bringing the witness caches up to pindexWalletTip
+    bool fScanningWallet;
+    //! The last block that the running rescan has applied to the wallet
+    const CBlockIndex* pindexScanned;
+    //! The block the witness caches are being brought up to: the last one the
+    //! wallet was notified of through ChainTip, or the one it was loaded at
+    const CBlockIndex* pindexWalletTip;
+    //! Counts the changes to pindexWalletTip, which are made with both cs_wallet
+    //! and cs_walletTipChanged held
+    uint64_t nWalletTipUpdates;
+    //! Signalled when pindexWalletTip changes, for a rescan waiting on it
+    std::mutex cs_walletTipChanged;
+    std::condition_variable condWalletTipChanged;
+
     template <class T>
     using TxSpendMap = std::multimap<T, uint256>;
     /**
@@ -789,6 +881,38 @@ private:
     TxNullifiers mapTxSproutNullifiers;
     TxNullifiers mapTxSaplingNullifiers;
 
+    /**
+     * The note index, which holds the decrypted contents of the wallet's
+     * notes and the notes received by each address, so that GetFilteredNotes
+     * neither decrypts notes nor walks all of mapWallet. Whether a note is
+     * spent and its depth still come from mapWallet, as they change with the
+     * chain. The notes that AddToWallet queues in the pending sets are added
+     * by UpdateNoteIndex, as they are looked up.
+     */
+    std::map<JSOutPoint, SproutNoteIndexEntry> mapSproutNoteIndex;
+    std::map<SaplingOutPoint, SaplingNoteIndexEntry> mapSaplingNoteIndex;
+    std::map<libzcash::SproutPaymentAddress, std::set<JSOutPoint>> mapSproutNotesByAddress;
+    std::map<libzcash::SaplingPaymentAddress, std::set<SaplingOutPoint>> mapSaplingNotesByAddress;
+    std::set<JSOutPoint> setSproutNoteIndexPending;
+    std::set<SaplingOutPoint> setSaplingNoteIndexPending;
+
+    void QueueNotesForIndex(const CWalletTx& wtx);
+    void UpdateNoteIndex(const std::set<libzcash::PaymentAddress>& filterAddresses);
+    void RemoveFromNoteIndex(const CWalletTx& wtx);
+
+    /**
+     * Balances computed by GetCachedBalance, which remain valid until
+     * nBalanceGeneration is incremented by MarkBalancesDirty. That is done
+     * for the events that can change a balance: changes to the wallet's
+     * transactions (including mempool transactions that involve it), notes,
+     * keys and locked coins, each new chain tip, and wallet transactions
+     * entering or leaving the mempool.
+     */
+    mutable std::atomic<uint64_t> nBalanceGeneration{0};
+    mutable CCriticalSection cs_balances;
+    mutable std::map<std::string, CAmount> mapCachedBalances;
+    mutable uint64_t nCachedBalanceGeneration = 0;
+
     std::vector<CTransaction> pendingSaplingMigrationTxs;
     AsyncRPCOperationId saplingMigrationOperationId;
 
@@ -816,32 +940,121 @@ protected:
                                 const CBlock* pblock,
                                 SproutMerkleTree& sproutTree,
                                 SaplingMerkleTree& saplingTree);
+    /**
+     * As above, from the shielded index record of a block that holds nothing
+     * for the wallet.
+     */
+    void IncrementNoteWitnesses(const CBlockIndex* pindex,
+                                const CCompactBlock& block,
+                                SproutMerkleTree& sproutTree,
+                                SaplingMerkleTree& saplingTree);
     /**
      * pindex is the old tip being disconnected.
      */
     void DecrementNoteWitnesses(const CBlockIndex* pindex);
 
+    template <typename NoteDataMap>
+    static bool NoteNullifiersChanged(const NoteDataMap& noteDataMap) {
+        for (const auto& item : noteDataMap) {
+            if (item.second.nullifier != item.second.witnessStore.nullifier) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Writes the witnesses in each note's cache that are not yet in the
+     * wallet database, erases the ones that have left the cache, and records
+     * the new extent of the cache. Witnesses that are already stored are not
+     * rewritten, so this costs one witness per note for each new block.
+     */
+    template <typename WalletDB, typename NoteDataMap>
+    static bool WriteNoteWitnessesINTERNAL(WalletDB& walletdb, const NoteDataMap& noteDataMap) {
+        for (const auto& item : noteDataMap) {
+            const auto& nd = item.second;
+            const NoteWitnessStoreState& stored = nd.witnessStore;
+            int lowest = nd.witnessHeight - (int) nd.witnesses.size() + 1;
+            int storedLowest = stored.witnessHeight - (int) stored.witnessCount + 1;
+
+            for (int height = storedLowest; height <= stored.witnessHeight; height++) {
+                if (height < lowest || height > nd.witnessHeight) {
+                    if (!walletdb.EraseNoteWitness(item.first, height)) {
+                        return false;
+                    }
+                }
+            }
+
+            int height = nd.witnessHeight;
+            for (const auto& witness : nd.witnesses) {
+                if (height < storedLowest || height > stored.witnessHeight || height >= stored.dirtyHeight) {
+                    if (!walletdb.WriteNoteWitness(item.first, height, witness)) {
+                        return false;
+                    }
+                }
+                height--;
+            }
+
+            if (nd.witnessHeight != stored.witnessHeight || nd.witnesses.size() != stored.witnessCount) {
+                if (!walletdb.WriteNoteWitnessTip(item.first, nd.witnessHeight, nd.witnesses.size())) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    template <typename NoteDataMap>
+    static void MarkNoteWitnessesWritten(NoteDataMap& noteDataMap) {
+        for (auto& item : noteDataMap) {
+            auto& nd = item.second;
+            nd.witnessStore.witnessHeight = nd.witnessHeight;
+            nd.witnessStore.witnessCount = nd.witnesses.size();
+            nd.witnessStore.dirtyHeight = std::numeric_limits<int>::max();
+            nd.witnessStore.nullifier = nd.nullifier;
+        }
+    }
+
     template <typename WalletDB>
     void SetBestChainINTERNAL(WalletDB& walletdb, const CBlockLocator& loc) {
+        LOCK(cs_wallet);
         if (!walletdb.TxnBegin()) {
             // This needs to be done atomically, so don't do it at all
             LogPrintf("SetBestChain(): Couldn't start atomic write\n");
             return;
         }
+        // Wallets from before FEATURE_WITNESSSTORE keep their witness caches
+        // in the CWalletTx records, so that older versions can still load them.
+        bool fWitnessStore = nWalletVersion >= FEATURE_WITNESSSTORE;
         try {
             for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                auto wtx = wtxItem.second;
+                const CWalletTx& wtx = wtxItem.second;
                 // We skip transactions for which mapSproutNoteData and mapSaplingNoteData
                 // are empty. This covers transactions that have no Sprout or Sapling data
                 // (i.e. are purely transparent), as well as shielding and unshielding
                 // transactions in which we only have transparent addresses involved.
-                if (!(wtx.mapSproutNoteData.empty() && wtx.mapSaplingNoteData.empty())) {
+                if (wtx.mapSproutNoteData.empty() && wtx.mapSaplingNoteData.empty()) {
+                    continue;
+                }
+                // The witness caches are written to their own records below, so
+                // the transaction itself only needs rewriting if the nullifiers
+                // that have been derived for its notes changed.
+                if (!fWitnessStore ||
+                    NoteNullifiersChanged(wtx.mapSproutNoteData) ||
+                    NoteNullifiersChanged(wtx.mapSaplingNoteData)) {
                     if (!walletdb.WriteTx(wtxItem.first, wtx)) {
                         LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
                         walletdb.TxnAbort();
                         return;
                     }
                 }
+                if (fWitnessStore &&
+                    (!WriteNoteWitnessesINTERNAL(walletdb, wtx.mapSproutNoteData) ||
+                     !WriteNoteWitnessesINTERNAL(walletdb, wtx.mapSaplingNoteData))) {
+                    LogPrintf("SetBestChain(): Failed to write note witnesses, aborting atomic write\n");
+                    walletdb.TxnAbort();
+                    return;
+                }
             }
             if (!walletdb.WriteWitnessCacheSize(nWitnessCacheSize)) {
                 LogPrintf("SetBestChain(): Failed to write nWitnessCacheSize, aborting atomic write\n");
@@ -865,12 +1078,28 @@ protected:
             LogPrintf("SetBestChain(): Couldn't commit atomic write\n");
             return;
         }
+        if (!fWitnessStore) {
+            return;
+        }
+        // Only now do the records match the in-memory witness caches.
+        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+            MarkNoteWitnessesWritten(wtxItem.second.mapSproutNoteData);
+            MarkNoteWitnessesWritten(wtxItem.second.mapSaplingNoteData);
+        }
     }
 
 private:
     template <class T>
     void SyncMetaData(std::pair<typename TxSpendMap<T>::iterator, typename TxSpendMap<T>::iterator>);
     void ChainTipAdded(const CBlockIndex *pindex, const CBlock *pblock, SproutMerkleTree sproutTree, SaplingMerkleTree saplingTree);
+    void SetBestChainIfDue(const CBlockIndex *pindex, int nUpdates);
+    const CBlockIndex* GetWalletTip() const;
+    std::vector<CBlockIndex*> NextBlocksToScan(const CBlockIndex* pindexFrom) const;
+    template <typename Tx>
+    void IncrementNoteWitnessesForTxs(const CBlockIndex* pindex,
+                                      const std::vector<Tx>& vtx,
+                                      SproutMerkleTree& sproutTree,
+                                      SaplingMerkleTree& saplingTree);
 
 protected:
     bool UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx);
@@ -934,6 +1163,10 @@ public:
         nSetChainUpdates = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        fScanningWallet = false;
+        pindexScanned = nullptr;
+        pindexWalletTip = nullptr;
+        nWalletTipUpdates = 0;
         nWitnessCacheSize = 0;
     }
 
@@ -1176,16 +1409,31 @@ public:
     void UpdateSaplingNullifierNoteMapForBlock(const CBlock* pblock);
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock, const int nHeight);
-    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate);
+    bool AddToWalletIfInvolvingMe(
+        const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate,
+        const WalletTxMatch* match = nullptr);
     void EraseFromWallet(const uint256 &hash);
+    void TransactionRemovedFromMempool(const uint256 &hash);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
          std::vector<std::optional<SproutWitness>>& witnesses,
          uint256 &final_anchor);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    void SetWalletTip(const CBlockIndex* pindex);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
+    /**
+     * Returns the balance computed by compute(), which is remembered under
+     * key until a transaction in the wallet, the chain tip, the mempool, the
+     * wallet's keys or its locked coins and notes change. Remembered balances
+     * are returned without taking cs_main or cs_wallet, so that polling the
+     * balance doesn't wait for blocks to be connected; compute() is called
+     * with both held, and must only depend on the state listed above.
+     */
+    CAmount GetCachedBalance(const std::string& key, const std::function<CAmount()>& compute) const;
+    //! Invalidates the balances remembered by GetCachedBalance.
+    void MarkBalancesDirty() const { nBalanceGeneration++; }
     CAmount GetBalance() const;
     CAmount GetUnconfirmedBalance() const;
     CAmount GetImmatureBalance() const;
@@ -1241,6 +1489,10 @@ public:
         uint8_t n) const;
     mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx) const;
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx, int height) const;
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> FindMySaplingNotes(
+        const std::vector<const CTransaction*>& vtx, int height) const;
+    bool CompactBlockMatchesKeys(const CCompactBlock& block, int height) const;
+    bool CompactBlockInvolvesWallet(const CCompactBlock& block) const;
     bool IsSproutNullifierFromMe(const uint256& nullifier) const;
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
 
@@ -257,6 +257,54 @@ bool CWalletDB::WriteWitnessCacheSize(int64_t nWitnessCacheSize)
     return Write(std::string("witnesscachesize"), nWitnessCacheSize);
 }
 
+bool CWalletDB::WriteNoteWitness(const JSOutPoint& op, int nHeight, const SproutWitness& witness)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("sproutwitness"), std::make_pair(op, nHeight)), witness);
+}
+
+bool CWalletDB::WriteNoteWitness(const SaplingOutPoint& op, int nHeight, const SaplingWitness& witness)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("saplingwitness"), std::make_pair(op, nHeight)), witness);
+}
+
+bool CWalletDB::EraseNoteWitness(const JSOutPoint& op, int nHeight)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("sproutwitness"), std::make_pair(op, nHeight)));
+}
+
+bool CWalletDB::EraseNoteWitness(const SaplingOutPoint& op, int nHeight)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("saplingwitness"), std::make_pair(op, nHeight)));
+}
+
+bool CWalletDB::WriteNoteWitnessTip(const JSOutPoint& op, int nHeight, uint64_t nCount)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("sproutwitnesstip"), op), std::make_pair(nHeight, nCount));
+}
+
+bool CWalletDB::WriteNoteWitnessTip(const SaplingOutPoint& op, int nHeight, uint64_t nCount)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("saplingwitnesstip"), op), std::make_pair(nHeight, nCount));
+}
+
+bool CWalletDB::EraseNoteWitnessTip(const JSOutPoint& op)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("sproutwitnesstip"), op));
+}
+
+bool CWalletDB::EraseNoteWitnessTip(const SaplingOutPoint& op)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("saplingwitnesstip"), op));
+}
+
 bool CWalletDB::ReadPool(int64_t nPool, CKeyPool& keypool)
 {
     return Read(std::make_pair(std::string("pool"), nPool), keypool);
@@ -445,6 +493,13 @@ public:
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
 
+    // Note witness records, which are matched up with the notes once all of
+    // the transactions have been loaded.
+    map<JSOutPoint, pair<int, uint64_t>> mapSproutWitnessTips;
+    map<pair<JSOutPoint, int>, SproutWitness> mapSproutWitnesses;
+    map<SaplingOutPoint, pair<int, uint64_t>> mapSaplingWitnessTips;
+    map<pair<SaplingOutPoint, int>, SaplingWitness> mapSaplingWitnesses;
+
     CWalletScanState() {
         nKeys = nCKeys = nKeyMeta = nZKeys = nCZKeys = nZKeyMeta = nSapZAddrs = 0;
         fIsEncrypted = false;
@@ -841,6 +896,32 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             ssValue >> pwallet->nWitnessCacheSize;
         }
+        else if (strType == "sproutwitness")
+        {
+            JSOutPoint op;
+            int nHeight;
+            ssKey >> op >> nHeight;
+            ssValue >> wss.mapSproutWitnesses[make_pair(op, nHeight)];
+        }
+        else if (strType == "saplingwitness")
+        {
+            SaplingOutPoint op;
+            int nHeight;
+            ssKey >> op >> nHeight;
+            ssValue >> wss.mapSaplingWitnesses[make_pair(op, nHeight)];
+        }
+        else if (strType == "sproutwitnesstip")
+        {
+            JSOutPoint op;
+            ssKey >> op;
+            ssValue >> wss.mapSproutWitnessTips[op];
+        }
+        else if (strType == "saplingwitnesstip")
+        {
+            SaplingOutPoint op;
+            ssKey >> op;
+            ssValue >> wss.mapSaplingWitnessTips[op];
+        }
         else if (strType == "hdseed")
         {
             uint256 seedFp;
@@ -897,6 +978,64 @@ static bool IsKeyType(string strType)
             strType == "mkey" || strType == "ckey");
 }
 
+/**
+ * Replaces the witness caches read from the CWalletTx records with the ones in
+ * the witness records, which are the ones kept up to date by SetBestChain.
+ * Records that no longer belong to a note in the wallet are left in
+ * tips and witnesses, to be erased. Returns false if any note is missing
+ * some of its witnesses.
+ */
+template<typename OutPoint, typename NoteData, typename Witness>
+static bool LoadNoteWitnesses(
+    CWallet* pwallet,
+    std::map<OutPoint, NoteData> CWalletTx::*noteDataMap,
+    std::map<OutPoint, std::pair<int, uint64_t>>& tips,
+    std::map<std::pair<OutPoint, int>, Witness>& witnesses)
+{
+    bool fComplete = true;
+    for (auto it = tips.begin(); it != tips.end(); ) {
+        const OutPoint& op = it->first;
+        auto wtxIt = pwallet->mapWallet.find(op.hash);
+        if (wtxIt == pwallet->mapWallet.end() || !(wtxIt->second.*noteDataMap).count(op)) {
+            it++;
+            continue;
+        }
+        NoteData& nd = (wtxIt->second.*noteDataMap)[op];
+        int nHeight = it->second.first;
+        uint64_t nCount = it->second.second;
+
+        std::list<Witness> cache;
+        for (uint64_t i = 0; i < nCount; i++) {
+            auto witnessIt = witnesses.find(std::make_pair(op, nHeight - (int) i));
+            if (witnessIt == witnesses.end()) {
+                break;
+            }
+            cache.push_back(std::move(witnessIt->second));
+            witnesses.erase(witnessIt);
+        }
+        if (cache.size() == nCount) {
+            nd.witnesses = std::move(cache);
+            nd.witnessHeight = nHeight;
+            nd.witnessStore.witnessHeight = nHeight;
+            nd.witnessStore.witnessCount = nCount;
+            nd.witnessStore.dirtyHeight = std::numeric_limits<int>::max();
+        } else {
+            LogPrintf("LoadWallet(): Missing witnesses for note %s\n", op.ToString());
+            nd.witnesses.clear();
+            nd.witnessHeight = -1;
+            fComplete = false;
+        }
+        it = tips.erase(it);
+    }
+
+    for (std::pair<const uint256, CWalletTx>& wtxItem : pwallet->mapWallet) {
+        for (auto& item : wtxItem.second.*noteDataMap) {
+            item.second.witnessStore.nullifier = item.second.nullifier;
+        }
+    }
+    return fComplete;
+}
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -957,6 +1096,15 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+
+        if (!LoadNoteWitnesses(pwallet, &CWalletTx::mapSproutNoteData,
+                               wss.mapSproutWitnessTips, wss.mapSproutWitnesses) ||
+            !LoadNoteWitnesses(pwallet, &CWalletTx::mapSaplingNoteData,
+                               wss.mapSaplingWitnessTips, wss.mapSaplingWitnesses)) {
+            // Rebuild the witness caches of the affected notes
+            fNoncriticalErrors = true;
+            SoftSetBoolArg("-rescan", true);
+        }
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -973,6 +1121,16 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if (result != DB_LOAD_OK)
         return result;
 
+    // Erase witness records for notes that are no longer in the wallet
+    for (const auto& tip : wss.mapSproutWitnessTips)
+        EraseNoteWitnessTip(tip.first);
+    for (const auto& witness : wss.mapSproutWitnesses)
+        EraseNoteWitness(witness.first.first, witness.first.second);
+    for (const auto& tip : wss.mapSaplingWitnessTips)
+        EraseNoteWitnessTip(tip.first);
+    for (const auto& witness : wss.mapSaplingWitnesses)
+        EraseNoteWitness(witness.first.first, witness.first.second);
+
     LogPrintf("nFileVersion = %d\n", wss.nFileVersion);
 
     LogPrintf("Keys: %u plaintext, %u encrypted, %u w/ metadata, %u total\n",
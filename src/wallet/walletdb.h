@@ -11,6 +11,7 @@
 #include "key.h"
 #include "keystore.h"
 #include "zcash/Address.hpp"
+#include "zcash/IncrementalMerkleTree.hpp"
 
 #include <list>
 #include <stdint.h>
@@ -28,6 +29,8 @@ class CMasterKey;
 class CScript;
 class CWallet;
 class CWalletTx;
+class JSOutPoint;
+class SaplingOutPoint;
 class uint160;
 class uint256;
 
@@ -153,6 +156,17 @@ public:
 
     bool WriteWitnessCacheSize(int64_t nWitnessCacheSize);
 
+    /// Write a note's witness as of the block at the given height.
+    bool WriteNoteWitness(const JSOutPoint& op, int nHeight, const SproutWitness& witness);
+    bool WriteNoteWitness(const SaplingOutPoint& op, int nHeight, const SaplingWitness& witness);
+    bool EraseNoteWitness(const JSOutPoint& op, int nHeight);
+    bool EraseNoteWitness(const SaplingOutPoint& op, int nHeight);
+    /// Write the height of a note's most recent stored witness, and how many are stored.
+    bool WriteNoteWitnessTip(const JSOutPoint& op, int nHeight, uint64_t nCount);
+    bool WriteNoteWitnessTip(const SaplingOutPoint& op, int nHeight, uint64_t nCount);
+    bool EraseNoteWitnessTip(const JSOutPoint& op);
+    bool EraseNoteWitnessTip(const SaplingOutPoint& op);
+
     bool ReadPool(int64_t nPool, CKeyPool& keypool);
     bool WritePool(int64_t nPool, const CKeyPool& keypool);
     bool ErasePool(int64_t nPool);
@@ -1011,6 +1011,28 @@ size_t IncrementalMerkleTree<Depth, Hash>::next_depth(size_t skip) const {
     return d + skip;
 }
 
+// This returns the subtree of the given depth (at least 1) that contains the
+// last leaf, for use as a witness cursor or to compute the subtree's root.
+template<size_t Depth, typename Hash>
+IncrementalMerkleTree<Depth, Hash> IncrementalMerkleTree<Depth, Hash>::last_subtree(size_t depth) const {
+    assert(depth >= 1);
+
+    IncrementalMerkleTree<Depth, Hash> subtree;
+    subtree.left = left;
+    subtree.right = right;
+
+    // parents[i] is the root of a subtree of depth i+1, so only those below
+    // the given depth are within the subtree.
+    for (size_t i = 0; i < parents.size() && i + 1 < depth; i++) {
+        subtree.parents.push_back(parents[i]);
+    }
+    while (!subtree.parents.empty() && !subtree.parents.back()) {
+        subtree.parents.pop_back();
+    }
+
+    return subtree;
+}
+
 // This calculates the root of the tree.
 template<size_t Depth, typename Hash>
 Hash IncrementalMerkleTree<Depth, Hash>::root(size_t depth,
@@ -1135,6 +1157,169 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj) {
     }
 }
 
+// This lists the uncle subtrees, as (depth, index) pairs, that a witness for
+// the given position will fill once the tree has `size` leaves, skipping the
+// first `skip` uncles that it has already filled.
+template<size_t Depth, typename Hash>
+void IncrementalWitness<Depth, Hash>::pending_subtrees(uint64_t position, size_t skip, uint64_t size,
+                                                       std::vector<std::pair<size_t, uint64_t>>& subtrees) {
+    for (size_t d = 0; d < Depth; d++) {
+        // Uncles are the right siblings of the subtrees containing the
+        // position, which exist wherever the position is a left child.
+        if ((position >> d) & 1) {
+            continue;
+        }
+        if (skip) {
+            skip--;
+            continue;
+        }
+
+        uint64_t index = (position >> d) + 1;
+        if (((index + 1) << d) > size) {
+            break;
+        }
+        subtrees.push_back(std::make_pair(d, index));
+    }
+}
+
+// This returns the size of the tree that the witness is up to date with. The
+// filled uncles and the cursor cover the leaves that follow the witnessed
+// position, in order.
+template<size_t Depth, typename Hash>
+uint64_t IncrementalWitness<Depth, Hash>::tree_size() const {
+    uint64_t pos = position();
+    uint64_t size = pos + 1;
+    size_t n = 0;
+    for (size_t d = 0; d < Depth && n < filled.size(); d++) {
+        if (!((pos >> d) & 1)) {
+            size += (uint64_t) 1 << d;
+            n++;
+        }
+    }
+    if (cursor) {
+        size += cursor->size();
+    }
+    return size;
+}
+
+// This brings the witness up to date with newTree, which must contain the
+// witnessed tree. Each uncle that has been completed since the witness was
+// last updated must be present in `roots`.
+template<size_t Depth, typename Hash>
+void IncrementalWitness<Depth, Hash>::advance(const IncrementalMerkleTree<Depth, Hash>& newTree,
+                                              const SubtreeRoots& roots) {
+    uint64_t size = newTree.size();
+    uint64_t pos = position();
+
+    while (true) {
+        cursor_depth = tree.next_depth(filled.size());
+        if (cursor_depth >= Depth) {
+            cursor = std::nullopt;
+            return;
+        }
+
+        uint64_t index = (pos >> cursor_depth) + 1;
+        uint64_t begin = index << cursor_depth;
+        uint64_t end = (index + 1) << cursor_depth;
+
+        if (end <= size) {
+            auto it = roots.find(std::make_pair(cursor_depth, index));
+            if (it == roots.end()) {
+                throw std::runtime_error("witness is not up to date with the tree");
+            }
+            filled.push_back(it->second);
+        } else {
+            if (begin < size) {
+                cursor = newTree.last_subtree(cursor_depth);
+            } else {
+                cursor = std::nullopt;
+            }
+            return;
+        }
+    }
+}
+
+template<size_t Depth, typename Hash>
+std::map<uint64_t, IncrementalWitness<Depth, Hash>> IncrementalWitnessUpdater<Depth, Hash>::apply() {
+    uint64_t finalSize = initialSize + leaves.size();
+
+    // Stale witnesses would be missing uncles that were completed before
+    // this batch, so they fall back to appending each commitment.
+    std::vector<IncrementalWitness<Depth, Hash>*> current;
+    std::vector<IncrementalWitness<Depth, Hash>*> stale;
+    for (IncrementalWitness<Depth, Hash>* witness : tracked) {
+        if (witness->tree_size() == initialSize) {
+            current.push_back(witness);
+        } else {
+            stale.push_back(witness);
+        }
+    }
+    tracked.clear();
+
+    // Find the uncles that the witnesses will be missing, indexed by the
+    // tree size at which they are completed.
+    std::vector<std::pair<size_t, uint64_t>> pending;
+    for (const IncrementalWitness<Depth, Hash>* witness : current) {
+        IncrementalWitness<Depth, Hash>::pending_subtrees(
+            witness->position(), witness->filled.size(), finalSize, pending);
+    }
+    for (const auto& item : newWitnesses) {
+        IncrementalWitness<Depth, Hash>::pending_subtrees(item.first, 0, finalSize, pending);
+    }
+    std::multimap<uint64_t, std::pair<size_t, uint64_t>> needed;
+    for (const auto& subtree : pending) {
+        needed.insert(std::make_pair((subtree.second + 1) << subtree.first, subtree));
+    }
+
+    // Append the leaves, computing each needed uncle once, when it is completed.
+    typename IncrementalWitness<Depth, Hash>::SubtreeRoots roots;
+    for (size_t i = 0; i < leaves.size(); i++) {
+        tree.append(leaves[i]);
+        uint64_t size = initialSize + i + 1;
+
+        auto range = needed.equal_range(size);
+        for (auto it = range.first; it != range.second; ++it) {
+            const std::pair<size_t, uint64_t>& subtree = it->second;
+            if (roots.count(subtree)) {
+                continue;
+            }
+            if (subtree.first == 0) {
+                roots[subtree] = leaves[i];
+            } else {
+                roots[subtree] = tree.last_subtree(subtree.first).root(subtree.first);
+            }
+        }
+
+        auto newWitness = newWitnesses.find(size - 1);
+        if (newWitness != newWitnesses.end()) {
+            newWitness->second = tree.witness();
+        }
+    }
+
+    for (IncrementalWitness<Depth, Hash>* witness : current) {
+        witness->advance(tree, roots);
+    }
+    for (IncrementalWitness<Depth, Hash>* witness : stale) {
+        for (const Hash& leaf : leaves) {
+            witness->append(leaf);
+        }
+    }
+
+    std::map<uint64_t, IncrementalWitness<Depth, Hash>> ret;
+    for (auto& item : newWitnesses) {
+        if (!item.second) {
+            throw std::runtime_error("witness requested for a commitment that was not queued");
+        }
+        item.second->advance(tree, roots);
+        ret.insert(std::make_pair(item.first, *item.second));
+    }
+    newWitnesses.clear();
+    leaves.clear();
+    initialSize = finalSize;
+
+    return ret;
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
@@ -1147,4 +1332,10 @@ template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, Pede
 template class IncrementalWitness<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
 template class IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
 
+template class IncrementalWitnessUpdater<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
+template class IncrementalWitnessUpdater<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
+
+template class IncrementalWitnessUpdater<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
+template class IncrementalWitnessUpdater<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
+
 } // end namespace `libzcash`
@@ -3,7 +3,9 @@
 
 #include <array>
 #include <deque>
+#include <map>
 #include <optional>
+#include <vector>
 
 #include "uint256.h"
 #include "serialize.h"
@@ -76,10 +78,14 @@ bool operator==(const EmptyMerkleRoots<Depth, Hash>& a,
 template<size_t Depth, typename Hash>
 class IncrementalWitness;
 
+template<size_t Depth, typename Hash>
+class IncrementalWitnessUpdater;
+
 template<size_t Depth, typename Hash>
 class IncrementalMerkleTree {
 
 friend class IncrementalWitness<Depth, Hash>;
+friend class IncrementalWitnessUpdater<Depth, Hash>;
 
 public:
     static_assert(Depth >= 1);
@@ -134,6 +140,7 @@ private:
     Hash root(size_t depth, std::deque<Hash> filler_hashes = std::deque<Hash>()) const;
     bool is_complete(size_t depth = Depth) const;
     size_t next_depth(size_t skip) const;
+    IncrementalMerkleTree<Depth, Hash> last_subtree(size_t depth) const;
     void wfcheck() const;
 };
 
@@ -149,6 +156,7 @@ bool operator==(const IncrementalMerkleTree<Depth, Hash>& a,
 template <size_t Depth, typename Hash>
 class IncrementalWitness {
 friend class IncrementalMerkleTree<Depth, Hash>;
+friend class IncrementalWitnessUpdater<Depth, Hash>;
 
 public:
     // Required for Unserialize()
@@ -190,12 +198,19 @@ public:
                            const IncrementalWitness<D, H>& b);
 
 private:
+    typedef std::map<std::pair<size_t, uint64_t>, Hash> SubtreeRoots;
+
     IncrementalMerkleTree<Depth, Hash> tree;
     std::vector<Hash> filled;
     std::optional<IncrementalMerkleTree<Depth, Hash>> cursor;
     size_t cursor_depth = 0;
     std::deque<Hash> partial_path() const;
     IncrementalWitness(IncrementalMerkleTree<Depth, Hash> tree) : tree(tree) {}
+
+    static void pending_subtrees(uint64_t position, size_t skip, uint64_t size,
+                                 std::vector<std::pair<size_t, uint64_t>>& subtrees);
+    uint64_t tree_size() const;
+    void advance(const IncrementalMerkleTree<Depth, Hash>& newTree, const SubtreeRoots& roots);
 };
 
 template<size_t Depth, typename Hash>
@@ -207,6 +222,56 @@ bool operator==(const IncrementalWitness<Depth, Hash>& a,
             a.cursor_depth == b.cursor_depth);
 }
 
+/**
+ * Appends a batch of commitments to a tree, and brings any number of witnesses
+ * into that tree up to date with it.
+ *
+ * Appending the commitments to each witness one at a time costs
+ * O(commitments * witnesses) hashes. Here the witnesses instead share the
+ * work: the commitments are appended once, to the tree, and each subtree that
+ * one or more witnesses need as an uncle is hashed once, as it is completed.
+ * A witness then takes those roots, and its new cursor from the frontier of
+ * the tree, in O(Depth) time.
+ */
+template<size_t Depth, typename Hash>
+class IncrementalWitnessUpdater {
+public:
+    IncrementalWitnessUpdater(IncrementalMerkleTree<Depth, Hash>& tree) :
+        tree(tree), initialSize(tree.size()) { }
+
+    // Queues a commitment to be appended to the tree, and returns the
+    // position that it will have.
+    uint64_t append(const Hash& obj) {
+        leaves.push_back(obj);
+        return initialSize + leaves.size() - 1;
+    }
+
+    // Requests a witness for the queued commitment at the given position.
+    void witness(uint64_t position) {
+        newWitnesses[position] = std::nullopt;
+    }
+
+    // Registers an existing witness into the tree, to be brought up to date by
+    // apply(). The witness must stay valid until then. A witness that is not
+    // up to date with the tree as it was before any commitments were queued
+    // (such as a stale cached witness after a reorg) cannot share the work,
+    // and has the commitments appended to it one at a time instead.
+    void track(IncrementalWitness<Depth, Hash>& witness) {
+        tracked.push_back(&witness);
+    }
+
+    // Appends the queued commitments to the tree, updates the tracked
+    // witnesses, and returns the requested witnesses by position.
+    std::map<uint64_t, IncrementalWitness<Depth, Hash>> apply();
+
+private:
+    IncrementalMerkleTree<Depth, Hash>& tree;
+    uint64_t initialSize;
+    std::vector<Hash> leaves;
+    std::map<uint64_t, std::optional<IncrementalWitness<Depth, Hash>>> newWitnesses;
+    std::vector<IncrementalWitness<Depth, Hash>*> tracked;
+};
+
 class SHA256Compress : public uint256 {
 public:
     SHA256Compress() : uint256() {}
@@ -256,4 +321,9 @@ typedef libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, l
 typedef libzcash::IncrementalWitness<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingWitness;
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingWitness;
 
+typedef libzcash::IncrementalWitnessUpdater<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> SproutWitnessUpdater;
+typedef libzcash::IncrementalWitnessUpdater<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::SHA256Compress> SproutTestingWitnessUpdater;
+typedef libzcash::IncrementalWitnessUpdater<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingWitnessUpdater;
+typedef libzcash::IncrementalWitnessUpdater<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingWitnessUpdater;
+
 #endif /* ZC_INCREMENTALMERKLETREE_H_ */
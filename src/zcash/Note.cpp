@@ -215,6 +215,28 @@ std::optional<SaplingOutgoingPlaintext> SaplingOutgoingPlaintext::decrypt(
     }
 }
 
+static std::optional<SaplingNotePlaintext> DeserializeSaplingEncPlaintext(
+    const std::optional<SaplingEncPlaintext> &encPlaintext)
+{
+    if (!encPlaintext) {
+        return std::nullopt;
+    }
+
+    // Deserialize from the plaintext
+    SaplingNotePlaintext ret;
+    try {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << encPlaintext.value();
+        ss >> ret;
+        assert(ss.size() == 0);
+        return ret;
+    } catch (const boost::thread_interrupted&) {
+        throw;
+    } catch (...) {
+        return std::nullopt;
+    }
+}
+
 std::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     const Consensus::Params& params,
     int height,
@@ -242,33 +264,73 @@ std::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     }
 }
 
-std::optional<SaplingNotePlaintext> SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(
+std::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt_with_shared_secret(
+    const Consensus::Params& params,
+    int height,
     const SaplingEncCiphertext &ciphertext,
     const uint256 &ivk,
-    const uint256 &epk
+    const uint256 &epk,
+    const uint256 &cmu,
+    const uint256 &dhsecret
 )
 {
-    auto encPlaintext = AttemptSaplingEncDecryption(ciphertext, ivk, epk);
+    auto ret = DeserializeSaplingEncPlaintext(
+        AttemptSaplingEncDecryptionWithSharedSecret(ciphertext, dhsecret, epk));
 
-    if (!encPlaintext) {
+    if (!ret) {
         return std::nullopt;
+    } else {
+        const SaplingNotePlaintext plaintext = *ret;
+
+        // Check leadbyte is allowed at block height
+        if (!plaintext_version_is_valid(params, height, plaintext.get_leadbyte())) {
+            LogPrint("receiveunsafe", "Received note plaintext with invalid lead byte %d at height %d",
+                     plaintext.get_leadbyte(), height);
+            return std::nullopt;
+        }
+
+        return plaintext_checks_without_height(plaintext, ivk, epk, cmu);
     }
+}
 
-    // Deserialize from the plaintext
-    SaplingNotePlaintext ret;
-    try {
-        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-        ss << encPlaintext.value();
-        ss >> ret;
-        assert(ss.size() == 0);
-        return ret;
-    } catch (const boost::thread_interrupted&) {
-        throw;
-    } catch (...) {
+std::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt_compact_with_shared_secret(
+    const Consensus::Params& params,
+    int height,
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk,
+    const uint256 &cmu,
+    const uint256 &dhsecret
+)
+{
+    auto ret = DeserializeSaplingEncPlaintext(
+        DecryptSaplingCompactCiphertextWithSharedSecret(ciphertext, dhsecret, epk));
+
+    if (!ret) {
         return std::nullopt;
+    } else {
+        const SaplingNotePlaintext plaintext = *ret;
+
+        // Check leadbyte is allowed at block height
+        if (!plaintext_version_is_valid(params, height, plaintext.get_leadbyte())) {
+            LogPrint("receiveunsafe", "Received note plaintext with invalid lead byte %d at height %d",
+                     plaintext.get_leadbyte(), height);
+            return std::nullopt;
+        }
+
+        return plaintext_checks_without_height(plaintext, ivk, epk, cmu);
     }
 }
 
+std::optional<SaplingNotePlaintext> SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk
+)
+{
+    return DeserializeSaplingEncPlaintext(AttemptSaplingEncDecryption(ciphertext, ivk, epk));
+}
+
 std::optional<SaplingNotePlaintext> SaplingNotePlaintext::plaintext_checks_without_height(
     const SaplingNotePlaintext &plaintext,
     const uint256 &ivk,
@@ -169,6 +169,31 @@ public:
         const uint256 &cmu
     );
 
+    // Decrypts using dhsecret, the key agreement of ivk and epk, which lets
+    // trial decryption compute the key agreements in a batch.
+    static std::optional<SaplingNotePlaintext> decrypt_with_shared_secret(
+        const Consensus::Params& params,
+        int height,
+        const SaplingEncCiphertext &ciphertext,
+        const uint256 &ivk,
+        const uint256 &epk,
+        const uint256 &cmu,
+        const uint256 &dhsecret
+    );
+
+    // Decrypts the leading bytes of a note ciphertext, as kept by the shielded
+    // index, using dhsecret. The note commitment is checked, but the memo of
+    // the result is empty.
+    static std::optional<SaplingNotePlaintext> decrypt_compact_with_shared_secret(
+        const Consensus::Params& params,
+        int height,
+        const SaplingCompactCiphertext &ciphertext,
+        const uint256 &ivk,
+        const uint256 &epk,
+        const uint256 &cmu,
+        const uint256 &dhsecret
+    );
+
     static std::optional<SaplingNotePlaintext> plaintext_checks_without_height(
         const SaplingNotePlaintext &plaintext,
         const uint256 &ivk,
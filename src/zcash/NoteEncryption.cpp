@@ -2,6 +2,7 @@
 
 #include "random.h"
 
+#include <memory>
 #include <stdexcept>
 #include "sodium.h"
 #include "prf.h"
@@ -153,6 +154,51 @@ std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
         return std::nullopt;
     }
 
+    return AttemptSaplingEncDecryptionWithSharedSecret(ciphertext, dhsecret, epk);
+}
+
+std::vector<std::optional<uint256>> SaplingKeyAgreementBatch(
+    const std::vector<uint256> &epks,
+    const std::vector<uint256> &ivks
+)
+{
+    std::vector<std::optional<uint256>> ret(epks.size() * ivks.size());
+    if (ret.empty()) {
+        return ret;
+    }
+
+    std::vector<unsigned char> epkBytes(32 * epks.size());
+    for (size_t i = 0; i < epks.size(); i++) {
+        memcpy(epkBytes.data() + 32 * i, epks[i].begin(), 32);
+    }
+    std::vector<unsigned char> ivkBytes(32 * ivks.size());
+    for (size_t j = 0; j < ivks.size(); j++) {
+        memcpy(ivkBytes.data() + 32 * j, ivks[j].begin(), 32);
+    }
+    std::vector<unsigned char> results(32 * ret.size());
+    std::unique_ptr<bool[]> valid(new bool[ret.size()]);
+
+    librustzcash_sapling_ka_agree_batch(
+        epkBytes.data(), epks.size(),
+        ivkBytes.data(), ivks.size(),
+        results.data(), valid.get());
+
+    for (size_t k = 0; k < ret.size(); k++) {
+        if (valid[k]) {
+            uint256 dhsecret;
+            memcpy(dhsecret.begin(), results.data() + 32 * k, 32);
+            ret[k] = dhsecret;
+        }
+    }
+    return ret;
+}
+
+std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryptionWithSharedSecret(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &dhsecret,
+    const uint256 &epk
+)
+{
     // Construct the symmetric key
     unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
     KDF_Sapling(K, dhsecret, epk);
@@ -176,6 +222,30 @@ std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     return plaintext;
 }
 
+SaplingEncPlaintext DecryptSaplingCompactCiphertextWithSharedSecret(
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &dhsecret,
+    const uint256 &epk
+)
+{
+    // Construct the symmetric key
+    unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
+    KDF_Sapling(K, dhsecret, epk);
+
+    // The nonce is zero because we never reuse keys
+    unsigned char cipher_nonce[crypto_stream_chacha20_ietf_NONCEBYTES] = {};
+
+    // The AEAD encrypts the plaintext with the ChaCha20 keystream from its
+    // second block onwards, as the first block is used for the Poly1305 key.
+    SaplingEncPlaintext plaintext = {};
+    crypto_stream_chacha20_ietf_xor_ic(
+        plaintext.begin(),
+        ciphertext.begin(), ZC_SAPLING_COMPACT_CIPHERTEXT_SIZE,
+        cipher_nonce, 1, K);
+
+    return plaintext;
+}
+
 std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
     const SaplingEncCiphertext &ciphertext,
     const uint256 &epk,
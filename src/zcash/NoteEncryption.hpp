@@ -14,12 +14,14 @@ https://github.com/zcash/zips/blob/master/protocol/protocol.pdf
 
 #include <array>
 #include <optional>
+#include <vector>
 
 namespace libzcash {
 
 // Ciphertext for the recipient to decrypt
 typedef std::array<unsigned char, ZC_SAPLING_ENCCIPHERTEXT_SIZE> SaplingEncCiphertext;
 typedef std::array<unsigned char, ZC_SAPLING_ENCPLAINTEXT_SIZE> SaplingEncPlaintext;
+typedef std::array<unsigned char, ZC_SAPLING_COMPACT_CIPHERTEXT_SIZE> SaplingCompactCiphertext;
 
 // Ciphertext for outgoing viewing key to decrypt
 typedef std::array<unsigned char, ZC_SAPLING_OUTCIPHERTEXT_SIZE> SaplingOutCiphertext;
@@ -74,6 +76,35 @@ std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     const uint256 &epk
 );
 
+// Computes the Sapling key agreement [ivk] [8] epk for every pair of epks[i]
+// and ivks[j], returned at index i * ivks.size() + j. This is much faster than
+// separate key agreements when trial-decrypting with many keys. An entry is
+// empty if its epk or ivk is not a valid encoding.
+std::vector<std::optional<uint256>> SaplingKeyAgreementBatch(
+    const std::vector<uint256> &epks,
+    const std::vector<uint256> &ivks
+);
+
+// Attempts to decrypt a Sapling note with a shared secret that was already
+// computed for its ivk and epk. This will not check that the contents of the
+// ciphertext are correct.
+std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryptionWithSharedSecret(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &dhsecret,
+    const uint256 &epk
+);
+
+// Decrypts the leading bytes of a Sapling note ciphertext, which hold
+// everything but the memo, with a shared secret that was already computed for
+// its ivk and epk. The memo bytes of the result are left as zeroes. These
+// bytes are not authenticated on their own, so the caller must check the note
+// commitment.
+SaplingEncPlaintext DecryptSaplingCompactCiphertextWithSharedSecret(
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &dhsecret,
+    const uint256 &epk
+);
+
 // Attempts to decrypt a Sapling note using outgoing plaintext.
 // This will not check that the contents of the ciphertext are correct.
 std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
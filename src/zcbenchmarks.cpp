@@ -26,6 +26,7 @@
 #include "transaction_builder.h"
 #include "txdb.h"
 #include "utiltest.h"
+#include "wallet/trialdecryption.h"
 #include "wallet/wallet.h"
 
 #include "zcbenchmarks.h"
@@ -313,6 +314,40 @@ double benchmark_try_decrypt_sapling_notes(size_t nKeys)
     return timer_stop(tv_start);
 }
 
+// Times the trial decryption of a Sapling output against nKeys keys with each
+// of 1 to nMaxThreads trial decryption threads, to show how it scales.
+std::vector<double> benchmark_try_decrypt_sapling_notes_threaded(size_t nKeys, int nMaxThreads)
+{
+    // Set params
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    auto masterKey = GetTestMasterSaplingSpendingKey();
+
+    CWallet wallet;
+
+    for (size_t i = 0; i < nKeys; i++) {
+        auto sk = masterKey.Derive(i);
+        wallet.AddSaplingSpendingKey(sk);
+    }
+
+    // Generate a key that has not been added to the wallet
+    auto sk = masterKey.Derive(nKeys);
+    auto tx = GetValidSaplingReceive(consensusParams, wallet, sk, 10);
+
+    int nPrevThreads = GetTrialDecryptionThreads();
+    std::vector<double> ret;
+    for (int nThreads = 1; nThreads <= nMaxThreads; nThreads++) {
+        StartTrialDecryptionThreads(nThreads);
+        struct timeval tv_start;
+        timer_start(tv_start);
+        auto noteDataMapAndAddressesToAdd = wallet.FindMySaplingNotes(tx, 1);
+        assert(noteDataMapAndAddressesToAdd.first.empty());
+        ret.push_back(timer_stop(tv_start));
+    }
+    StartTrialDecryptionThreads(nPrevThreads);
+    return ret;
+}
+
 CWalletTx CreateSproutTxWithNoteData(const libzcash::SproutSpendingKey& sk) {
     auto wtx = GetValidSproutReceive(sk, 10, true);
     auto note = GetSproutNote(sk, wtx, 0, 1);
@@ -435,8 +470,10 @@ double benchmark_increment_sapling_note_witnesses(size_t nTxs)
 
 // Fake the input of a given block
 // This class is based on the class CCoinsViewDB, but with limited functionality.
-// The constructor and the functions `GetCoins` and `HaveCoins` come directly from
-// CCoinsViewDB, but the rest are either mocks and/or don't really do anything.
+// The constructor and the functions `GetCoins` and `HaveCoins` come from
+// CCoinsViewDB as it was when the benchmark databases were created, with one
+// record per transaction; the rest are either mocks and/or don't really do
+// anything.
 
 // The following constant is a duplicate of the one found in txdb.cpp
 static const char DB_COINS = 'c';